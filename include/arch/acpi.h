@@ -0,0 +1,53 @@
+/**
+ * @file acpi.h
+ * @brief ACPI Table Lookup Interface
+ *
+ * Declares the layouts of the ACPI tables the kernel reads and the lookup of a
+ * table by signature. The firmware hands over the RSDP before boot services
+ * exit, the tables it points at stay in memory the kernel never allocates.
+ */
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <kint.h>
+
+/**
+ * @struct Root system description pointer, the revision 2 fields are only valid from ACPI 2.0
+ */
+typedef struct acpi_rsdp_t
+{
+    char signature[8]; /* "RSD PTR " */
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision; /* 0 for ACPI 1.0, only the RSDT is there */
+    uint32_t rsdt_address;
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+/**
+ * @struct Header every system description table starts with
+ */
+typedef struct acpi_header_t
+{
+    char signature[4];
+    uint32_t length; /* Bytes of the table, header included */
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_header_t;
+
+/**
+ * @brief Finds a system description table
+ * @param signature 4 character signature, "APIC" for the MADT
+ * @return table, NULL if the firmware has none or gave no RSDP
+ */
+acpi_header_t* acpi_find_table(const char* signature);
+
+#endif /* ACPI_H */
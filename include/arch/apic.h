@@ -0,0 +1,97 @@
+/**
+ * @file apic.h
+ * @brief Local APIC Interface
+ *
+ * Declares access to the local APIC of every CPU: end of interrupt, the
+ * one shot timer that drives scheduling, inter processor interrupts and the
+ * INIT and startup messages that start the application processors. The timer
+ * is armed with a TSC deadline, written straight to the deadline MSR when the
+ * CPU has TSC deadline mode and converted to a count down otherwise.
+ * Works with the memory mapped registers of xAPIC mode and with the MSRs of
+ * x2APIC mode when the firmware left it enabled. Legacy PIC interrupts keep
+ * arriving on the bootstrap processor through LINT0.
+ */
+#ifndef APIC_H
+#define APIC_H
+
+#include <kint.h>
+
+#define APIC_TIMER_VECTOR 0x30    /* Timer of every CPU */
+#define APIC_SPURIOUS_VECTOR 0xFF /* Spurious interrupts, never acknowledged */
+#define APIC_CALIBRATE_MS 10      /* Length of the TSC window the count down timer is measured against */
+
+/**
+ * @struct Local APIC state shared by every CPU
+ */
+typedef struct apic_state_t
+{
+    uint64_t base;      /* Physical address of the registers */
+    bool x2apic;        /* Registers are MSRs, the mapping is unused */
+    bool tsc_deadline;  /* Timer fires when the TSC reaches the deadline MSR */
+    uint64_t timer_hz;  /* Count down rate at divide by 16, unused in TSC deadline mode */
+    uint64_t timer_max; /* Longest count down in TSC cycles, longer deadlines fire early and are armed again */
+} apic_state_t;
+
+/**
+ * @brief Maps the registers, enables the APIC of the bootstrap processor and sets up its timer
+ *
+ * Measures the count down rate against the TSC when there is no TSC deadline mode.
+ */
+void apic_init();
+
+/**
+ * @brief Enables the APIC of an application processor and sets up its timer
+ */
+void apic_init_ap();
+
+/**
+ * @brief Arms the timer of the calling CPU
+ * @param deadline TSC value to fire at, one in the past fires right away
+ *
+ * Replaces the deadline armed before. The interrupt may come early when the
+ * count down cannot reach the deadline, the handler checks the TSC.
+ */
+void apic_timer_arm(uint64_t deadline);
+
+/**
+ * @brief Disarms the timer of the calling CPU
+ */
+void apic_timer_stop();
+
+/**
+ * @brief Lists the enabled local APICs of the MADT
+ * @param apic_ids filled with the APIC id of every CPU
+ * @param max entries apic_ids holds
+ * @return number of CPUs found, 0 if there is no MADT
+ */
+uint64_t apic_enumerate(uint32_t* apic_ids, uint64_t max);
+
+/**
+ * @brief Gets the APIC id of the calling CPU
+ */
+uint32_t apic_id();
+
+/**
+ * @brief Acknowledges the interrupt being handled
+ */
+void apic_eoi();
+
+/**
+ * @brief Sends an interrupt to another CPU
+ * @param apic_id target CPU
+ * @param vector vector raised on the target
+ */
+void apic_send_ipi(uint32_t apic_id, uint8_t vector);
+
+/**
+ * @brief Sends INIT to a CPU, it waits for a startup message afterwards
+ */
+void apic_send_init(uint32_t apic_id);
+
+/**
+ * @brief Sends a startup message, the CPU starts in real mode at page:0
+ * @param page physical page number of the startup code, below 1 Mb
+ */
+void apic_send_startup(uint32_t apic_id, uint8_t page);
+
+#endif /* APIC_H */
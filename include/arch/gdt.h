@@ -10,6 +10,8 @@
 #include <kint.h>
 #include <memory/kmemory.h>
 
+#define GDT_ENTRIES 7 /* Null, kernel code and data, user code and data, the TSS taking two */
+
 typedef struct __attribute__((packed))
 {
     uint32_t reserved0;
@@ -45,6 +47,13 @@ typedef struct
     uint64_t base;
 } __attribute__((packed)) GDTPtr;
 
-void KERNEL_InitGDT();
+/**
+ * @brief Builds and loads the GDT and TSS of the calling CPU
+ * @param gdt GDT_ENTRIES entries, they stay in use
+ * @param tss task state of the CPU, its ist1 stack already set
+ *
+ * Loading the segment registers clears the GS base.
+ */
+void KERNEL_InitGDT(GDTEntry* gdt, TSS64* tss);
 
 #endif
\ No newline at end of file
@@ -7,6 +7,7 @@
 #ifndef IDT_H
 #define IDT_H
 
+#include <kernel/process.h>
 #include <kint.h>
 #include <memory/kmemory.h>
 
@@ -35,19 +36,41 @@ typedef struct
     IDTr idtr;
 } IDTData;
 
-typedef struct interrupt_info_t
+/**
+ * @struct Frame the interrupt stubs push on the kernel stack
+ *
+ * Entries from user mode put it at the top of the kernel stack of the process,
+ * its regs are the process_t regs.
+ */
+typedef struct interrupt_frame_t
 {
     uint64_t irq_number;
-    uint64_t error_code;
-    uint64_t cr3;
-    uint64_t rsp;
-} __attribute__((packed)) interrupt_info_t;
-
-#define INTERRUPT_INFO ((interrupt_info_t*)INTERRUPT_INFO_START)
+    uint64_t cr3;                /* Page table loaded again on return */
+    process_stack_layout_t regs; /* Registers of the interrupted code */
+} __attribute__((packed)) interrupt_frame_t;
 
 void KERNEL_InitIDT();
 
-void exception_handler();
-void interrupt_handler();
+/**
+ * @brief Loads the IDT built by KERNEL_InitIDT on the calling CPU
+ */
+void KERNEL_LoadIDT();
+
+/**
+ * @brief Takes the kernel lock and starts charging system time
+ * @param frame frame just pushed by the interrupt stub
+ *
+ * Called by the interrupt stubs before anything else.
+ */
+void interrupt_enter(interrupt_frame_t* frame);
+
+void exception_handler(interrupt_frame_t* frame);
+void interrupt_handler(interrupt_frame_t* frame);
+
+/**
+ * @brief Delivers pending signals and restores the user state of the process on the way out of an interrupt
+ * @param frame frame being returned through
+ */
+void check_signal(interrupt_frame_t* frame);
 
 #endif /* IDT_H */
\ No newline at end of file
@@ -18,4 +18,20 @@ uint16_t inw(uint16_t port);
 
 void outw(uint16_t port, uint16_t value);
 
+/**
+ * @brief Reads the time stamp counter
+ * @return cycles since reset
+ */
+uint64_t rdtsc();
+
+/**
+ * @brief Reads a model specific register
+ */
+uint64_t rdmsr(uint32_t msr);
+
+/**
+ * @brief Writes a model specific register
+ */
+void wrmsr(uint32_t msr, uint64_t value);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,160 @@
+/**
+ * @file smp.h
+ * @brief Multiprocessor Interface
+ *
+ * Declares the per CPU state, the start of the application processors and the
+ * kernel lock. Every CPU has its own GDT, TSS, double fault stack, run queue,
+ * current process and idle process, the IDT is shared. The GS base of a CPU
+ * points at its cpu_t while it runs kernel code, the interrupt stubs swap it
+ * in on entry from user mode.
+ *
+ * Kernel code runs under one lock taken on every entry and dropped on the way
+ * back to user mode or into the idle halt, so user code runs in parallel and
+ * the kernel stays single threaded. Threads of a process stay on the CPU of
+ * their leader, an address space is only ever loaded on one CPU and changing
+ * it needs no other TLB flushed. Kernel mappings are the exception, their
+ * removal is shot down on every CPU.
+ */
+#ifndef SMP_H
+#define SMP_H
+
+#include <arch/gdt.h>
+#include <kernel/process.h>
+#include <kernel/scheduler.h>
+#include <kernel/softirq.h>
+#include <kint.h>
+
+#define SMP_MAX_CPUS 16            /* CPUs brought up, the MADT may list more */
+#define SMP_VECTOR_RESCHEDULE 0x31 /* Makes a CPU pick again, when idle or asked to by need_resched */
+#define SMP_VECTOR_TLB 0x32        /* Makes a CPU flush its TLB before it takes the kernel lock */
+#define SMP_VECTOR_TIMER 0x33      /* Makes TIMER_CPU arm its APIC timer for a timer added elsewhere */
+#define SMP_START_TIMEOUT_MS 100   /* Wait for an application processor to come online */
+
+/**
+ * @struct State of a CPU, reached through the GS base
+ */
+typedef struct cpu_t
+{
+    struct cpu_t* self;            /* First field, read by smp_cpu */
+    volatile bool tlb_pending;     /* Flush asked for by a shootdown, done when the kernel lock is taken */
+    volatile bool lock_waiting;    /* Spinning for the kernel lock, a shootdown does not wait for it */
+    volatile bool online;          /* Running the scheduler */
+    bool kernel_locked;            /* Holds the kernel lock */
+    uint64_t id;                   /* Index in CPUS, 0 is the bootstrap processor */
+    uint32_t apic_id;              /* Target of inter processor interrupts */
+    process_t* current;            /* Running process, the idle process if there is none */
+    krbtree_t run_queue;           /* Runnable processes waiting for the CPU, ordered by vruntime */
+    uint64_t queued;               /* Processes in the run queue */
+    uint64_t queued_weight;        /* Sum of their weights */
+    uint64_t min_vruntime;         /* Never decreasing floor of the vruntimes, where waking processes are placed */
+    bool need_resched;             /* A woken process should preempt the current one */
+    process_t* rt_queue[SCHEDULER_RT_PRIORITY_MAX + 1]; /* Queued real time processes by priority, loops through rt_next and rt_last from the next to run */
+    uint64_t rt_bitmap[2];         /* Bit per priority with queued processes */
+    uint64_t rt_queued;            /* Real time processes in the run queue */
+    uint64_t rt_period_start;      /* TSC when the current throttling period began */
+    uint64_t rt_runtime;           /* Cycles real time processes ran in the period */
+    process_t idle;                /* Runs the idle loop on the stack the CPU started on, in no run queue */
+    uint64_t fs_base;              /* FS base currently loaded */
+    uint64_t usage_stamp;          /* TSC when time was last charged */
+    uint64_t ticks;                /* Timer ticks taken */
+    uint64_t tick_deadline;        /* TSC value of the next tick, 0 while it is stopped */
+    uint64_t timer_deadline;       /* TSC value the APIC timer is armed for, 0 while it is stopped */
+    volatile bool halted;          /* In HLT or MWAIT, the time until the next interrupt is idle time */
+    uint64_t idle_wakeups;         /* Times the CPU left HLT or MWAIT */
+    uint64_t softirq_pending;      /* Bit per softirq raised on the CPU that did not run yet */
+    tasklet_t* tasklets;           /* Tasklets scheduled on the CPU, oldest first */
+    tasklet_t* tasklets_last;
+    wait_queue_t softirq_waiters;  /* Softirq thread of the CPU while nothing is pending */
+    TSS64 tss;                     /* rsp0 is the kernel stack of the current process */
+    GDTEntry gdt[GDT_ENTRIES];
+} cpu_t;
+
+/**
+ * @struct Multiprocessor state
+ */
+typedef struct smp_state_t
+{
+    uint64_t cpu_count;            /* Entries of CPUS in use, online or not */
+    volatile uint64_t online;      /* CPUs running the scheduler */
+    volatile uint64_t kernel_lock; /* 1 while a CPU runs kernel code */
+    bool mwait;                    /* Idle CPUs wait in MWAIT instead of HLT */
+    uint32_t mwait_hint;           /* C-state asked for by MWAIT, the deepest one that keeps the APIC timer running */
+} smp_state_t;
+
+/**
+ * @brief Gets the state of the calling CPU
+ *
+ * Read again on every call, a process switched out in the kernel may resume
+ * on another CPU.
+ */
+static inline cpu_t* smp_cpu()
+{
+    cpu_t* cpu;
+    __asm__ volatile("mov %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+/**
+ * @brief Sets up the bootstrap processor as CPU 0 and takes the kernel lock
+ *
+ * First thing done after the jump to the kernel half, the current process
+ * lives in the per CPU state.
+ */
+void smp_init();
+
+/**
+ * @brief Starts every enabled CPU of the MADT
+ *
+ * Needs the IDT and the TSC rate. The application processors wait for the
+ * kernel lock until the bootstrap processor goes idle.
+ */
+void smp_start();
+
+/**
+ * @brief Runs the processes of the calling CPU, halting while none is runnable
+ *
+ * The idle process. Waits in MWAIT with a C-state hint when the CPU has it,
+ * in HLT otherwise, with the tick stopped and the kernel lock dropped. Only an
+ * interrupt wakes it, the time until then is charged as idle time. Never
+ * returns. Entered on the stack the CPU started on.
+ */
+void smp_idle();
+
+/**
+ * @brief Takes the kernel lock unless the calling CPU holds it
+ *
+ * Called on every entry to the kernel. Flushes the TLB when a shootdown asked
+ * for it while the CPU was outside the kernel.
+ */
+void smp_lock();
+
+/**
+ * @brief Drops the kernel lock
+ *
+ * Called on the way back to user mode and before the idle halt.
+ */
+void smp_unlock();
+
+/**
+ * @brief Makes another CPU enter the kernel and pick its next process
+ */
+void smp_kick(cpu_t* cpu);
+
+/**
+ * @brief Flushes the TLB of every other CPU that runs a process
+ *
+ * Needed after a kernel mapping is removed. Returns once every such CPU has
+ * flushed or is waiting for the kernel lock, which flushes before it is taken.
+ */
+void smp_tlb_shootdown();
+
+/**
+ * @brief Checks whether a process has its address space loaded on another CPU
+ *
+ * Its page table may only be changed by that CPU, and it cannot be torn down
+ * from here.
+ * @return the CPU it is loaded on, 0 if it is on no other CPU
+ */
+cpu_t* smp_running_elsewhere(process_t* process);
+
+#endif /* SMP_H */
@@ -24,6 +24,10 @@ typedef struct preboot_info_t
     UINTN DescriptorSize;
     UINT32 DescriptorVersion;
     uint64_t framebuffer_size;
+
+    /* Platform Tables */
+    void* acpi_rsdp;         /* RSDP from the EFI configuration table, NULL if there is none */
+    uint64_t smp_trampoline; /* Page below 1 Mb the application processors start in, 0 if none was free */
 } preboot_info_t;
 
 EFI_STATUS exit_boot_services(preboot_info_t* preboot_info,
@@ -10,6 +10,8 @@
 #include <kernel/process.h>
 #include <memory/pageTable.h>
 
+#define ELF_INTERP_MAX 256 /* Longest PT_INTERP path */
+
 typedef struct file_descriptor_t file_descriptor_t;
 
 int elfLoader_systemd(file_descriptor_t* file);
@@ -8,11 +8,15 @@
 #define VCON_H
 
 #include <kernel/process.h>
+#include <kernel/softirq.h>
 #include <kint.h>
 
 #define VCON_COUNT 128
 #define CHRDEV_SETGRP 4
 #define CHRDEV_GETGRP 5
+#define CHRDEV_POLL 6 /* Readiness for poll, queues the wait entry it is given while not ready */
+
+#define VCON_PREEMPT_INTERVAL 64 /* Characters written between preemption points */
 
 typedef struct vcon_t
 {
@@ -23,10 +27,9 @@ typedef struct vcon_t
     uint64_t grp;
 
     uint64_t input_buffer_pointer;
-    process_t* input_block_process;
+    bool input_ready;           /* A finished line waits in input_buffer */
+    wait_queue_t input_waiters; /* Readers and pollers sleeping until a line is finished */
     char input_buffer[512];
-    char* process_input_buffer;
-    void* process_pml4;
 } vcon_t;
 
 void vcon_init();
@@ -37,9 +40,25 @@ size_t vcon_write(uint64_t open_file, uint64_t str, size_t size);
 
 size_t vcon_input(uint64_t open_file, uint64_t str, size_t size);
 
-void vcon_handle_user_input();
+/**
+ * @brief Hands the keys queued by the keyboard interrupt to the first console
+ *
+ * Tasklet scheduled by the keyboard interrupt, echoing and rendering run in
+ * the softirq thread.
+ */
+void vcon_handle_user_input(tasklet_t* tasklet);
 
 size_t vcon_setgrp(uint64_t open_file, uint64_t pgid, uint64_t _1);
 size_t vcon_getgrp(uint64_t open_file, uint64_t _0, uint64_t _1);
 
+/**
+ * @brief Reports whether a line can be read
+ * @param open_file console file descriptor
+ * @param entry wait entry queued until a line is finished, 0 to only check
+ * @return POLLIN once a line is finished, with POLLOUT, writes never block
+ *
+ * Starts line editing like a read does, the line stays for the next read.
+ */
+size_t vcon_poll(uint64_t open_file, uint64_t entry, uint64_t _1);
+
 #endif
\ No newline at end of file
@@ -73,6 +73,14 @@ int fdm_set(file_descriptor_entry_t* entry, size_t index, file_descriptor_t* fd)
  */
 file_descriptor_t* fdm_get(file_descriptor_entry_t* entry, size_t index);
 
+/**
+ * @brief Puts a file descriptor in the lowest free slot of a table
+ * @param entry top level of file descriptor table
+ * @param fd file descriptor
+ * @return index of the slot, -1 if the table is full
+ */
+int fdm_alloc(file_descriptor_entry_t* entry, file_descriptor_t* fd);
+
 /**
  * @brief Copies the entries in a file descriptor table
  * @param src top of source file descriptor table
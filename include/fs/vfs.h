@@ -46,6 +46,8 @@ typedef struct vfs_entry_t
     entry_type_t type;          ///< Entry type (file, dir, etc.)
     uint32_t name_hash;         ///< Precomputed name hash
     uint8_t children_loaded;    ///< Flag indicating children were loaded
+    uint8_t referenced;         ///< Looked up since the last shrinker pass
+    uint8_t pinned;             ///< Opened, a working directory or created by the kernel, never dropped
     file_ops_t* ops;            ///< File operations table
     void* private_data;         ///< Private data for special files
 } vfs_entry_t;
@@ -86,6 +88,12 @@ vfs_entry_t* vfs_create_entry(vfs_entry_t* dir, const char* name, entry_type_t t
  */
 file_descriptor_t* vfs_open_file(vfs_entry_t* entry);
 
+/**
+ * @brief Close file opened with vfs_open_file
+ * @param file Open file handle, not installed in any descriptor table
+ */
+void vfs_close_file(file_descriptor_t* file);
+
 /**
  * @brief Initialize VFS subsystem
  */
@@ -99,6 +107,23 @@ void vfs_init();
  */
 void vfs_path(vfs_entry_t* dir, char* buffer, uint64_t* offset);
 
+/**
+ * @brief Counts the cached entries the VFS shrinker could drop
+ * @return number of entries loaded from disk
+ */
+uint64_t vfs_cache_count();
+
+/**
+ * @brief Drops the children of directories not looked up recently
+ * @param target number of entries wanted
+ * @return number of entries dropped
+ *
+ * Directories get a second chance like swapped pages, one pass clears their
+ * referenced flag and the next drops their children unless something below is
+ * pinned. Dropped directories are read from disk again on the next lookup.
+ */
+uint64_t vfs_cache_shrink(uint64_t target);
+
 size_t vfs_write_reg_file(uint64_t open_file, uint64_t buf, size_t size);
 
 size_t vfs_read_reg_file(uint64_t open_file, uint64_t buf, size_t size);
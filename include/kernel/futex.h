@@ -0,0 +1,58 @@
+/**
+ * @file futex.h
+ * @brief Futex Interface
+ *
+ * Declares the wait queues behind the futex syscall. Threads sleep on a user
+ * address of their process until another thread wakes that address. Waiters
+ * are kept in buckets hashed by process and address, so a wake only walks the
+ * threads that could match.
+ */
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include <kint.h>
+
+#define FUTEX_BUCKETS 64
+
+/* Futex operations, Linux values */
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+#define FUTEX_PRIVATE_FLAG 128 /* Every futex is private to its process, the flag is ignored */
+
+typedef struct process_t process_t;
+
+/**
+ * @struct Futex wait queues
+ */
+typedef struct futex_table_t
+{
+    process_t* buckets[FUTEX_BUCKETS]; /* Waiters chained through futex_next, oldest first */
+} futex_table_t;
+
+/**
+ * @brief Empties every bucket
+ */
+void futex_init();
+
+/**
+ * @brief Queues a thread on an address and blocks it
+ * @param process thread going to sleep, the caller switches away from it
+ * @param addr user address waited on
+ */
+void futex_wait(process_t* process, uint64_t addr);
+
+/**
+ * @brief Wakes threads waiting on an address
+ * @param leader thread leader of the process the address belongs to
+ * @param addr user address
+ * @param count maximum number of threads woken
+ * @return number of threads woken
+ */
+uint64_t futex_wake(process_t* leader, uint64_t addr, uint64_t count);
+
+/**
+ * @brief Takes a thread off the queue it waits on, if any
+ */
+void futex_cancel(process_t* process);
+
+#endif /* FUTEX_H */
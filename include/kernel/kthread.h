@@ -0,0 +1,32 @@
+/**
+ * @file kthread.h
+ * @brief Kernel Thread Interface
+ *
+ * Declares the kernel threads, processes that only ever run kernel code. A
+ * kernel thread has a kernel stack and scheduling state like any process but
+ * no address space, file descriptors or process id: it runs on the kernel
+ * page table, is in no process map and cannot be signaled or waited for. It
+ * is scheduled like the others and stays on the CPU it was created for.
+ *
+ * Work an interrupt handler queues runs in kernel threads, where it may
+ * sleep and the scheduler decides when it runs.
+ */
+#ifndef KTHREAD_H
+#define KTHREAD_H
+
+#include <kint.h>
+
+typedef struct process_t process_t;
+typedef struct cpu_t cpu_t;
+
+/**
+ * @brief Starts a kernel thread
+ * @param function code of the thread, called with data, the thread ends when it returns
+ * @param data passed to the function
+ * @param cpu CPU the thread runs on for its whole life
+ * @param priority real time priority of the FIFO class, 0 to run in the normal class
+ * @return the thread, 0 if no kernel stack was left
+ */
+process_t* kthread_create(void (*function)(uint64_t), uint64_t data, cpu_t* cpu, uint64_t priority);
+
+#endif /* KTHREAD_H */
@@ -0,0 +1,86 @@
+/**
+ * @file pidMap.h
+ * @brief Process ID Map Interface
+ *
+ * Declares the radix tree mapping ids to processes, process groups and
+ * sessions. Every level resolves 6 bits of the id, so a lookup is always 4
+ * steps no matter how many ids are in use. Nodes keep a bitmap of the slots
+ * with no free id left below them, which finds the lowest free id without
+ * scanning the ids in use.
+ */
+#ifndef PID_MAP_H
+#define PID_MAP_H
+
+#include <kint.h>
+
+#define PID_MAP_BITS 6                                       /* Bits of the id resolved per level */
+#define PID_MAP_FANOUT (1 << PID_MAP_BITS)                   /* Slots per node */
+#define PID_MAP_LEVELS 4                                     /* Levels of the tree, the last one holds the entries */
+#define PID_MAX (1 << (PID_MAP_BITS * PID_MAP_LEVELS))       /* Ids the map can hold, 0 is never handed out */
+
+typedef struct kernel_memory_pool_t kernel_memory_pool_t;
+
+/**
+ * @struct Node of the id tree
+ */
+typedef struct pid_map_node_t
+{
+    void* slots[PID_MAP_FANOUT]; /* Child nodes, entries in the last level */
+    uint64_t used;               /* Slots holding a child node, ids in use in the last level */
+    uint64_t full;               /* Slots with no free id left below them */
+} pid_map_node_t;
+
+/**
+ * @struct Id map
+ */
+typedef struct pid_map_t
+{
+    pid_map_node_t* root;       /* Always allocated */
+    kernel_memory_pool_t* pool; /* Memory pool for nodes */
+    uint64_t count;             /* Ids in use */
+} pid_map_t;
+
+/**
+ * @brief Sets up an empty map
+ */
+void pidMap_init(pid_map_t* map);
+
+/**
+ * @brief Finds the lowest id not in use
+ * @param min lowest id wanted
+ * @return free id, 0 if every id from min up is in use
+ *
+ * The id is not taken, insert it to do so.
+ */
+uint32_t pidMap_find_free(pid_map_t* map, uint32_t min);
+
+/**
+ * @brief Takes an id and sets its entry
+ * @param id id, may already be in use
+ * @param entry entry, NULL keeps the id reserved without an entry
+ * @return 1 on success, 0 if the id is out of range or out of memory
+ */
+bool pidMap_insert(pid_map_t* map, uint32_t id, void* entry);
+
+/**
+ * @brief Gets the entry of an id
+ * @return entry, NULL if the id is free or only reserved
+ */
+void* pidMap_lookup(pid_map_t* map, uint32_t id);
+
+/**
+ * @brief Frees an id, it can be handed out again
+ */
+void pidMap_remove(pid_map_t* map, uint32_t id);
+
+/**
+ * @brief Finds the entry with the lowest id from a starting id
+ * @param id first id looked at, set to the id of the entry found
+ * @return entry, NULL if there is none from id up
+ *
+ * Iteration goes by id, not by node, so entries can be added and removed
+ * between calls. Reserved ids are skipped.
+ */
+void* pidMap_next(pid_map_t* map, uint32_t* id);
+
+#endif /* PID_MAP_H */
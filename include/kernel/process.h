@@ -8,14 +8,56 @@
 #ifndef PROCESS_H
 #define PROCESS_H
 
+#include <kernel/timer.h>
+#include <kernel/usage.h>
+#include <kernel/wait.h>
+#include <krbtree.h>
 #include <memory/pageTable.h>
 
 #define DECLARE_PROCESS process_t* process = (*CURRENT_PROCESS)
 
 #define PROCESS_BLOCKING 1
 #define PROCESS_ZOMBIE 2
+#define PROCESS_OOM_EXEMPT 4 /* Never picked by the out of memory killer (init) */
+#define PROCESS_VFORK 8      /* Address space is shared between a vfork child and its suspended parent */
+#define PROCESS_THREAD 16    /* Thread created by clone, runs in the address space of its leader */
+#define PROCESS_EXITING 32   /* Another thread exited the process, exits with status when it runs next */
+#define PROCESS_SLEEPING 64  /* Asleep in wait_schedule_timeout, a signal wakes it */
+#define PROCESS_KTHREAD 128  /* Kernel thread, runs kernel code only and stays on its CPU */
+
+#define PROCESS_HEAP_START 0x40000000 /* 1 gb, anonymous mappings grow up from here */
+#define PROCESS_THP 1                 /* Back aligned anonymous ranges written first with huge pages without MADV_HUGEPAGE */
+#define PROCESS_COW_SPLIT 1           /* Split shared 2mb copy on write pages instead of copying them whole */
+
+#define PROCESS_STACK_TOP 0x7FFFFFFFF000 /* Stack grows down from the top of the user half */
+#define PROCESS_STACK_INITIAL 0x4000     /* 16kb, stack area reserved at exec */
+#define PROCESS_STACK_LIMIT 0x800000     /* 8mb, default limit the stack can grow to */
+#define PROCESS_ARG_MAX 0x20000          /* 128kb of argument and environment strings */
+
+/* File actions applied to a spawned child, in order */
+#define PROCESS_SPAWN_OPEN 0      /* Open path on fd */
+#define PROCESS_SPAWN_CLOSE 1     /* Close fd */
+#define PROCESS_SPAWN_DUP2 2      /* Duplicate fd onto newfd */
+#define PROCESS_SPAWN_TCSETPGRP 3 /* Make the child group the foreground group of the terminal on fd */
+#define PROCESS_SPAWN_MAX_ACTIONS 64
+
+/* Spawn attribute flags */
+#define PROCESS_SPAWN_SETPGROUP 1 /* Put the child in process group pgroup, 0 for a new group */
+
+/* Clone flags, Linux values */
+#define CLONE_VM 0x100                /* Share the address space */
+#define CLONE_FS 0x200                /* Share the working directory */
+#define CLONE_FILES 0x400             /* Share the file descriptor table */
+#define CLONE_SIGHAND 0x800           /* Share signal handlers */
+#define CLONE_THREAD 0x10000          /* Same process as the caller */
+#define CLONE_SYSVSEM 0x40000         /* Share semaphore undo lists */
+#define CLONE_SETTLS 0x80000          /* Set the FS base of the thread */
+#define CLONE_PARENT_SETTID 0x100000  /* Store the thread id at parent_tid */
+#define CLONE_CHILD_CLEARTID 0x200000 /* Clear child_tid and wake it with a futex when the thread exits */
+#define PROCESS_CLONE_THREAD (CLONE_VM | CLONE_FILES | CLONE_THREAD) /* Flags every clone has to pass, only threads are created */
 
 typedef struct vfs_entry_t vfs_entry_t;
+typedef struct cpu_t cpu_t;
 typedef struct file_descriptor_t file_descriptor_t;
 typedef struct file_descriptor_t file_descriptor_t;
 
@@ -39,6 +81,7 @@ typedef struct
     uint64_t rcx;
     uint64_t rbx;
     uint64_t rax;
+    uint64_t error_code; /* Pushed by the CPU for some exceptions, 0 otherwise */
     uint64_t rip;
     uint64_t cs;
     uint64_t rflags;
@@ -49,18 +92,16 @@ typedef struct
 
 typedef struct process_group_t
 {
-    uint64_t pgid; /* pid of group leader */
-    struct process_t** processes;
+    uint64_t pgid;                /* pid of group leader */
+    struct process_t* processes;  /* Members, a loop through group_next and group_last */
     uint64_t process_count;
-    uint64_t process_capacity;
 } process_group_t;
 
 typedef struct process_session_t
 {
-    uint64_t sid; /* pid of group leader */
-    struct process_t** processes;
+    uint64_t sid;                 /* pid of session leader */
+    struct process_t* processes;  /* Members, a loop through session_next and session_last */
     uint64_t process_count;
-    uint64_t process_capacity;
 } process_session_t;
 
 typedef enum sig_t
@@ -104,14 +145,24 @@ typedef enum sig_t
  */
 typedef struct process_t
 {
-    process_stack_layout_t process_stack_signature; /* Stack Signature for switching contexts*/
+    process_stack_layout_t* regs;                   /* User registers, saved in the frame at the top of the kernel stack */
     page_table_t page_table;                        /* Page table for process context, also used for kernel index */
     uint64_t pid;                                   /* Process ID */
     uint64_t ppid;                                  /* Parent Process ID*/
     uint64_t pgid;                                  /* Process Group ID */
     uint64_t sid;                                   /* Session ID */
-    struct process_t* next;                         /* next process context to switch to */
-    struct process_t* last;                         /* last process contexgt */
+    krbtree_node_t run_node;                        /* Node in the run queue of its CPU while waiting to run */
+    struct cpu_t* cpu;                              /* CPU whose run queue holds the process */
+    uint64_t vruntime;                              /* Run time scaled by the weight, in TSC cycles of a nice 0 process */
+    uint64_t exec_start;                            /* TSC when run time was last charged */
+    uint64_t slice_start;                           /* TSC when the process was last picked */
+    int64_t nice;                                   /* -20 to 19, inherited by children and threads */
+    uint64_t weight;                                /* Share of the CPU given by nice, 1024 at nice 0 */
+    bool queued;                                    /* In the run queue, the running process is not */
+    uint64_t policy;                                /* SCHEDULER_NORMAL, SCHEDULER_FIFO or SCHEDULER_RR, inherited */
+    uint64_t rt_priority;                           /* 1 to 99 in the real time classes, higher runs first, 0 otherwise */
+    struct process_t* rt_next;                      /* Next queued real time process of the same priority */
+    struct process_t* rt_last;
     uint64_t entry;                                 /* entry into process */
     uint64_t stackPointer;                          /* saved stack pointer */
     uint64_t process_heap_ptr;                      /* points to end of heap */
@@ -120,11 +171,49 @@ typedef struct process_t
     uint64_t flags;
     vfs_entry_t* cwd;
     void* heap_end;
-    uint64_t waiting_parent_pid;
     uint64_t status;
     uint64_t signal;
+    krbtree_t vmas; /* Virtual memory areas of the process */
+    uint64_t stack_limit; /* Maximum size of the stack area */
+    uint64_t vfork_parent_pid; /* Parent suspended until this vfork child execs or exits */
+    uint64_t program_headers;      /* Address of the program headers, AT_PHDR for the dynamic loader */
+    uint64_t program_header_count; /* AT_PHNUM */
+    uint64_t interp_base;          /* Lowest address of the dynamic loader, 0 for static programs (AT_BASE) */
+    struct process_t* thread_leader; /* Owner of the areas and heap of the address space, itself unless PROCESS_THREAD */
+    uint64_t thread_count;           /* Threads created by clone that are still running, kept by the leader */
+    uint64_t fs_base;                /* FS base of the thread, points at its TLS */
+    uint64_t clear_child_tid;        /* Cleared and woken when the thread exits, 0 if not asked for */
+    uint64_t futex_addr;             /* User address waited on, 0 if not waiting */
+    struct process_t* futex_next;    /* Next waiter in the same futex bucket */
+    wait_entry_t* wait_entries;      /* Entries of the process in wait queues, on its kernel stack */
+    timer_event_t sleep_timer;       /* Ends a sleep with a timeout */
+    timer_event_t alarm_timer;       /* Sends SIGALRM for alarm and setitimer, kept by the leader */
+    uint64_t alarm_interval;         /* Milliseconds the alarm repeats at, 0 for a single one */
+    wait_queue_t exit_waiters;       /* Parents sleeping in waitpid until it exits */
+    void* kernel_stack;              /* Top of the kernel stack, loaded into the TSS while the process runs */
+    uint64_t kernel_rsp;             /* Kernel stack pointer saved while the process is switched out */
+    struct process_t* group_next;    /* Next member of the process group, NULL if not a member */
+    struct process_t* group_last;
+    struct process_t* session_next;  /* Next member of the session, NULL if not a member */
+    struct process_t* session_last;
+    process_usage_t usage;           /* Counters of this thread */
+    process_usage_t thread_usage;    /* Counters of threads that exited, kept by the leader */
+    process_usage_t child_usage;     /* Totals of reaped children and their reaped children, kept by the leader */
 } __attribute__((packed)) process_t;
 
+/**
+ * @struct File action applied to a spawned child, laid out like the user side
+ */
+typedef struct process_spawn_action_t
+{
+    uint64_t type;    /* PROCESS_SPAWN_OPEN, CLOSE, DUP2 or TCSETPGRP */
+    uint64_t fd;      /* Descriptor acted on */
+    uint64_t newfd;   /* Target of DUP2 */
+    const char* path; /* File opened by OPEN */
+    uint64_t oflag;   /* Access mode OPEN opens the file with, as open */
+    uint64_t mode;    /* Permissions of a created file, unused as OPEN never creates one */
+} process_spawn_action_t;
+
 /**
  * @enum Different types of pages that can be added to a process
  */
@@ -136,7 +225,7 @@ typedef enum process_page_use
 
 /**
  * @brief Generates a new process id
- * @return Newly generated unique process id
+ * @return Lowest id not used by a process, group or session, reserved until the process is scheduled
  */
 uint64_t process_genPID();
 
@@ -167,10 +256,105 @@ uint64_t process_add_page(uint64_t page_number, uint64_t page_count, uint64_t pa
  */
 bool process_validate_address(void* vaddr, size_t size);
 
+/**
+ * @brief Services a page fault the process is allowed to take
+ * @param process process the fault happened in
+ * @param vaddr faulting virtual address
+ * @param write 1 if the faulting access was a write
+ * @return 1 if the fault was serviced, 0 if the process should be signalled
+ *
+ * Looks up the area containing vaddr, then breaks copy on write pages and
+ * populates anonymous and stack memory with zeroed pages. Must be called with
+ * the kernel page table loaded.
+ */
+bool process_resolve_fault(process_t* process, uint64_t vaddr, bool write);
+
+/**
+ * @brief Makes a user memory region of the current process present
+ * @param vaddr start of the region
+ * @param size size of the region in bytes
+ * @param write 1 if the kernel is going to write the region
+ *
+ * The kernel cannot take page faults while servicing a syscall, so syscalls
+ * fault in user buffers before touching them.
+ */
+void process_fault_in(uint64_t vaddr, size_t size, bool write);
+
 int process_fork();
 
+/**
+ * @brief Creates a child borrowing the address space of the current process
+ *
+ * Nothing is copied, the child runs on the same page table and areas while
+ * the parent stays suspended. The parent resumes with everything the child
+ * changed once the child execs or exits.
+ */
+void process_vfork();
+
+/**
+ * @brief Creates a child running a new program, without copying the caller
+ * @param file executable the child runs
+ * @param argc number of arguments
+ * @param argv user pointers to the arguments
+ * @param envc number of environment strings
+ * @param env user pointers to the environment strings
+ * @param actions file actions applied to the child, in order
+ * @param action_count number of file actions
+ * @param flags PROCESS_SPAWN_SETPGROUP or 0
+ * @param pgroup process group used with PROCESS_SPAWN_SETPGROUP
+ * @return pid of the child, -1 if the executable could not be loaded
+ *
+ * Equivalent to fork followed by exec, but the child page table is built from
+ * the executable directly. Runs in the address space of the caller.
+ */
+int64_t process_spawn(file_descriptor_t* file, int argc, char** argv, int envc, char** env, process_spawn_action_t* actions, uint64_t action_count,
+                      uint64_t flags, uint64_t pgroup);
+
 void process_execvp(file_descriptor_t* file, int argc, char** kernel_argv, int envc, char** env);
 
+/**
+ * @brief Creates a thread of the current process
+ * @param flags CLONE_ flags, PROCESS_CLONE_THREAD must be set
+ * @param stack stack pointer the thread starts with
+ * @param parent_tid where the thread id is stored with CLONE_PARENT_SETTID
+ * @param child_tid address cleared on exit with CLONE_CHILD_CLEARTID
+ * @param tls FS base with CLONE_SETTLS
+ * @return thread id, -1 if the flags ask for something else than a thread
+ *
+ * The thread shares the page table, areas and file descriptors of the caller
+ * and starts right after the syscall with rax 0 on the given stack.
+ */
+int64_t process_clone(uint64_t flags, uint64_t stack, uint64_t parent_tid, uint64_t child_tid, uint64_t tls);
+
+/**
+ * @brief Ends the current thread only
+ * @param process current process
+ * @param status exit status, used if this was the last thread
+ *
+ * The main thread cannot leave the others running, it exits the process.
+ */
+void process_exit_thread(process_t* process, uint64_t status);
+
+/**
+ * @brief Loads the FS base of a process into the CPU if it is not loaded already
+ */
+void process_load_fs(process_t* process);
+
+/**
+ * @brief Creates the initial stack of a process
+ * @param process process being set up, its page table must already exist
+ * @param argc number of arguments
+ * @param strings argument strings followed by the environment strings, each NUL terminated
+ * @param size size of strings in bytes
+ * @param envc number of environment strings
+ * @return initial stack pointer, 0 if a page of the stack could not be allocated
+ *
+ * Packs argc, argv, envp and the auxiliary vector System V style below the
+ * strings at the top of the stack, only the pages holding them are backed.
+ * Must be called with the kernel page table loaded.
+ */
+uint64_t process_setup_stack(process_t* process, int argc, const char* strings, uint64_t size, int envc);
+
 process_group_t* process_create_group(uint64_t pgid);
 process_session_t* process_create_session(uint64_t pgid);
 void process_add_to_group(process_t* process, uint64_t pgid);
@@ -179,6 +363,24 @@ void process_remove_from_group(process_t* process);
 void process_remove_from_session(process_t* process);
 uint64_t process_cleanup(process_t* process);
 
+/**
+ * @brief Gives a new process its kernel stack and first kernel context
+ * @param process process being created
+ * @param parent process whose user registers are copied, NULL to start with zeroed registers
+ * @return 0 on success, 1 if no stack could be allocated
+ *
+ * Points regs at the user frame at the top of the stack.
+ */
+int process_init_kernel_stack(process_t* process, process_t* parent);
+
+/**
+ * @brief Frees a process that is off the run queue along with its kernel stack
+ *
+ * The current process is still running on its stack, it is freed on the next
+ * release once it was switched away from.
+ */
+void process_release(process_t* process);
+
 void process_signal(process_t* process, sig_t signal);
 void process_group_signal(process_group_t* group, sig_t signal);
 void process_signal_all(sig_t signal);
@@ -0,0 +1,85 @@
+/**
+ * @file processTemplate.h
+ * @brief Process Template Cache Interface
+ *
+ * Declares the cache of loaded program images. The first exec of a binary
+ * loads it into a template, an address space that never runs, with every whole
+ * page of its file areas already mapped from the page cache. Later execs of the
+ * same inode clone the template copy on write instead of reading the ELF
+ * headers and taking a fault for every page again.
+ */
+#ifndef PROCESS_TEMPLATE_H
+#define PROCESS_TEMPLATE_H
+
+#include <kint.h>
+#include <krbtree.h>
+#include <memory/pageTable.h>
+
+#define PROCESS_TEMPLATE_MAX 8 /* Binaries kept loaded, the least recently executed one is replaced */
+
+typedef struct file_descriptor_t file_descriptor_t;
+typedef struct process_t process_t;
+
+/**
+ * @struct Loaded image of a binary
+ */
+typedef struct process_template_t
+{
+    uint32_t inode_num;      /* Executable, 0 if the slot is free */
+    uint64_t last_used;      /* Exec count when it was last cloned */
+    page_table_t page_table; /* Address space of the image */
+    krbtree_t vmas;          /* Areas of the image, including the dynamic loader */
+    uint64_t entry;
+    uint64_t rip; /* Program entry, or the dynamic loader entry */
+    uint64_t program_headers;
+    uint64_t program_header_count;
+    uint64_t interp_base;
+} process_template_t;
+
+/**
+ * @struct Template cache state
+ */
+typedef struct process_templates_t
+{
+    process_template_t templates[PROCESS_TEMPLATE_MAX];
+    uint64_t execs;  /* Execs served, orders templates by use */
+    uint64_t hits;   /* Execs cloned from a template */
+    uint64_t misses; /* Execs that loaded the binary */
+} process_templates_t;
+
+/**
+ * @brief Sets up the cache and registers its shrinker
+ */
+void processTemplate_init();
+
+/**
+ * @brief Loads a binary into a process through its template
+ * @param page_table_ptr page table being filled in, must be empty
+ * @param file executable
+ * @param process process being loaded, its areas must be empty
+ * @return 0 on success, 1 if the binary cannot be loaded
+ *
+ * Same contract as elfLoader_load. Must be called with the kernel page table
+ * loaded.
+ */
+int processTemplate_load(page_table_t* page_table_ptr, file_descriptor_t* file, process_t* process);
+
+/**
+ * @brief Drops the templates mapping a file (it was written to)
+ * @param inode_num inode of the file, the executable or its dynamic loader
+ */
+void processTemplate_invalidate(uint32_t inode_num);
+
+/**
+ * @brief Counts the templates the shrinker could free
+ */
+uint64_t processTemplate_count();
+
+/**
+ * @brief Frees the least recently executed templates
+ * @param target number of templates wanted
+ * @return number of templates freed
+ */
+uint64_t processTemplate_shrink(uint64_t target);
+
+#endif /* PROCESS_TEMPLATE_H */
@@ -9,11 +9,151 @@
 
 #include <kernel/process.h>
 
+#define SCHEDULER_NICE_MIN -20
+#define SCHEDULER_NICE_MAX 19
+#define SCHEDULER_NICE_0_WEIGHT 1024          /* Weight of nice 0, vruntime runs at the speed of the TSC */
+#define SCHEDULER_LATENCY_MS 24               /* Period in which every runnable process of a CPU gets a turn */
+#define SCHEDULER_MIN_GRANULARITY_MS 4        /* Shortest slice, one tick */
+#define SCHEDULER_WAKEUP_GRANULARITY_MS 1     /* Lead a woken process needs over the running one to preempt it */
+#define SCHEDULER_PRIO_PROCESS 0              /* Only target of setpriority and getpriority, a single process */
+
+/* Scheduling classes, Linux values */
+#define SCHEDULER_NORMAL 0                    /* Fair share by nice value (SCHED_OTHER) */
+#define SCHEDULER_FIFO 1                      /* Runs until it blocks or a higher priority comes */
+#define SCHEDULER_RR 2                        /* Like FIFO, sharing a priority in slices */
+#define SCHEDULER_RT_PRIORITY_MAX 99          /* Real time priorities go from 1 to this */
+#define SCHEDULER_RR_SLICE_MS 100             /* Slice of a round robin process */
+#define SCHEDULER_RT_PERIOD_MS 1000           /* Throttling period of the real time classes */
+#define SCHEDULER_RT_RUNTIME_MS 950           /* Time they may take of it while normal processes wait */
+
+/**
+ * @struct Kernel context saved by a switch, the callee saved registers of the ms abi
+ *
+ * Sits on the kernel stack of a process that is switched out, its saved
+ * kernel_rsp points at it.
+ */
+typedef struct scheduler_context_t
+{
+    uint64_t cr3;
+    uint8_t xmm[10][16]; /* xmm6 to xmm15 */
+    uint64_t r15;
+    uint64_t r14;
+    uint64_t r13;
+    uint64_t r12;
+    uint64_t rsi;
+    uint64_t rdi;
+    uint64_t rbx;
+    uint64_t rbp;
+    uint64_t rip; /* Where the switch returns to */
+} __attribute__((packed)) scheduler_context_t;
+
+/**
+ * @brief Picks the next runnable process of the calling CPU
+ *
+ * Keeps the current process until its slice is used up or a woken process
+ * asked to preempt it, then takes the one with the smallest vruntime. Takes
+ * one from the busiest CPU when its own run queue has none.
+ * @return the process, the idle process of the CPU if nothing is runnable
+ */
 process_t* scheduler_nextProcess();
+
+/**
+ * @brief Adds a process to the run queue of the least loaded CPU
+ *
+ * Threads join the run queue of their leader. The weight comes from the nice
+ * value, the rest of the scheduling state is reset. An idle target CPU is
+ * woken.
+ */
 process_t* scheduler_schedule(process_t* process);
+
+/**
+ * @brief Adds a kernel thread to the run queue of a CPU
+ *
+ * The thread is not in the process map and never moves to another CPU.
+ */
+void scheduler_schedule_on(process_t* process, cpu_t* cpu);
+
+/**
+ * @brief Takes a process out of its run queue
+ * @return the process to switch to when it is running on the calling CPU, 0 otherwise
+ */
 process_t* schedule_end(process_t* process);
+
 process_t* scheduler_currentProcess();
 void schedule_block(process_t* process);
+
+/**
+ * @brief Puts a blocked process back in the run queue of its CPU
+ *
+ * Its vruntime is raised to half a period behind the others at most. When it
+ * is far enough behind the running process, that one is preempted on its way
+ * back to user mode.
+ */
 void schedule_unblock(process_t* process);
 
+/**
+ * @brief Changes the nice value of a process, clamped to the valid range
+ */
+void scheduler_set_nice(process_t* process, int64_t nice);
+
+/**
+ * @brief Moves a process to another scheduling class
+ * @param policy SCHEDULER_NORMAL, SCHEDULER_FIFO or SCHEDULER_RR
+ * @param priority 1 to SCHEDULER_RT_PRIORITY_MAX for the real time classes, 0 for the normal one
+ * @return 0 on success, 1 if the priority does not fit the class
+ *
+ * The CPU of the process picks again, it may be preempted or preempt.
+ */
+int scheduler_set_policy(process_t* process, uint64_t policy, uint64_t priority);
+
+/**
+ * @brief Decides on the tick whether the current process gives up the calling CPU
+ *
+ * Only sets need_resched, the switch happens on the way back to user mode or
+ * out of scheduler_preempt, never inside the interrupt handler.
+ */
+void scheduler_tick();
+
+/**
+ * @brief Moves a process from the busiest to the idlest CPU when they differ by two
+ *
+ * Called on the housekeeping pass of the tick.
+ */
+void scheduler_balance();
+
+/**
+ * @brief Builds the first context of a new process
+ * @param process process with its kernel stack and user registers set up
+ *
+ * The first switch to the process returns to user mode through the frame at
+ * the top of its kernel stack.
+ */
+void scheduler_init_context(process_t* process);
+
+/**
+ * @brief Switches to another process
+ * @param next process to run
+ *
+ * The kernel context of the current process stays on its kernel stack, it
+ * returns from here when a later switch picks it again, possibly on another
+ * CPU. Must be called with interrupts disabled and the kernel lock held.
+ */
+void scheduler_switch(process_t* next);
+
+/**
+ * @brief Switches to the next runnable process
+ *
+ * Used by syscalls that blocked the current process, they continue from here
+ * once it is unblocked and picked again.
+ */
+void scheduler_yield();
+
+/**
+ * @brief Lets a pending interrupt run in the middle of a long syscall
+ *
+ * Switches to another process when a timer tick or a wake up taken here
+ * asked for it, so it is only called where no kernel state is half updated.
+ */
+void scheduler_preempt();
+
 #endif
\ No newline at end of file
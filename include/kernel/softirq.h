@@ -0,0 +1,66 @@
+/**
+ * @file softirq.h
+ * @brief Softirq and Tasklet Interface
+ *
+ * Declares the deferred halves of interrupt handlers. An interrupt handler
+ * only acknowledges its device, saves what it has to and raises a softirq,
+ * the rest runs in the softirq thread of its CPU: a kernel thread of the
+ * FIFO class that preempts every normal process and most real time ones, so
+ * it runs on the way out of the interrupt unless the CPU is busy with
+ * something more urgent.
+ *
+ * Softirqs are a fixed set of vectors, each with one handler. Tasklets are
+ * queued on the SOFTIRQ_TASKLET vector and let a driver defer a function of
+ * its own. A tasklet scheduled again before it ran runs once.
+ */
+#ifndef SOFTIRQ_H
+#define SOFTIRQ_H
+
+#include <kint.h>
+
+/* Softirq vectors, handled lowest first */
+#define SOFTIRQ_TIMER 0   /* Runs expired timers of the wheel, raised on TIMER_CPU */
+#define SOFTIRQ_TASKLET 1 /* Runs the tasklets scheduled on the CPU */
+#define SOFTIRQ_COUNT 2
+
+#define SOFTIRQ_PRIORITY 50 /* FIFO priority of the softirq threads, the default of threaded interrupt handlers */
+
+/**
+ * @struct Deferred function of a driver, embedded in whatever it works on
+ */
+typedef struct tasklet_t
+{
+    void (*function)(struct tasklet_t*); /* Called from the softirq thread */
+    uint64_t data;                       /* Left to the owner */
+    struct tasklet_t* next;              /* Next tasklet scheduled on the same CPU */
+    bool scheduled;                      /* Queued and not run yet, cleared before it runs */
+} tasklet_t;
+
+/**
+ * @brief Starts the softirq thread of every CPU
+ *
+ * Needs the CPUs and kernel stacks. Softirqs raised before run once the
+ * threads start.
+ */
+void softirq_init();
+
+/**
+ * @brief Marks a softirq pending on the calling CPU and wakes its softirq thread
+ * @param nr SOFTIRQ_TIMER or SOFTIRQ_TASKLET
+ */
+void softirq_raise(uint64_t nr);
+
+/**
+ * @brief Checks whether a softirq is raised on the calling CPU and did not run yet
+ */
+bool softirq_pending(uint64_t nr);
+
+/**
+ * @brief Queues a tasklet on the calling CPU
+ * @param tasklet tasklet with its function set
+ *
+ * Does nothing if it is already queued.
+ */
+void tasklet_schedule(tasklet_t* tasklet);
+
+#endif /* SOFTIRQ_H */
@@ -16,17 +16,12 @@
 #define IA32_LSTAR 0xC0000082
 #define IA32_FMASK 0xC0000084
 
-#define SYS_ARG_1(process) (process)->process_stack_signature.rdi
-#define SYS_ARG_2(process) (process)->process_stack_signature.rsi
-#define SYS_ARG_3(process) (process)->process_stack_signature.rdx
-#define SYS_ARG_4(process) (process)->process_stack_signature.r10
-#define SYS_ARG_5(process) (process)->process_stack_signature.r8
-#define SYS_ARG_6(process) (process)->process_stack_signature.r9
-
-/**
- * @brief Inline asm helpers for MSR read/write
- */
-static inline void wrmsr(uint32_t msr, uint64_t value);
+#define SYS_ARG_1(process) (process)->regs->rdi
+#define SYS_ARG_2(process) (process)->regs->rsi
+#define SYS_ARG_3(process) (process)->regs->rdx
+#define SYS_ARG_4(process) (process)->regs->r10
+#define SYS_ARG_5(process) (process)->regs->r8
+#define SYS_ARG_6(process) (process)->regs->r9
 
 /* Read CR4 register */
 static inline uint64_t read_cr4();
@@ -0,0 +1,85 @@
+/**
+ * @file tick.h
+ * @brief Scheduler Tick Interface
+ *
+ * Declares the timer tick of every CPU. The tick is a one shot deadline on
+ * the local APIC timer, armed again each time it fires, and only runs while
+ * the CPU has a process to run: a CPU going idle stops it and halts until an
+ * interrupt or a wake up arrives. Memory housekeeping and load balancing keep
+ * a fixed slower rate, started by whichever CPU ticks once they are due. The
+ * PIT is left masked.
+ *
+ * The APIC timer of TIMER_CPU also fires for the timer wheel, at whichever of
+ * its next tick and the next pending timer comes first, idle or not.
+ *
+ * The handler itself only decides: expired timers run in the timer softirq,
+ * housekeeping in the worker thread, and a process whose slice is used up is
+ * switched away from on the way out of the interrupt.
+ */
+#ifndef TICK_H
+#define TICK_H
+
+#include <kernel/workqueue.h>
+#include <kint.h>
+
+#define TICK_HZ 250             /* Scheduler ticks per second of a busy CPU, the timeslice */
+#define TICK_HOUSEKEEPING_HZ 20 /* Page merging, pressure and balancing passes per second */
+
+/**
+ * @struct Tick state shared by every CPU
+ */
+typedef struct tick_state_t
+{
+    uint64_t period;                /* TSC cycles between ticks */
+    uint64_t housekeeping_period;   /* TSC cycles between housekeeping passes */
+    uint64_t housekeeping_deadline; /* TSC value the next pass is due at */
+    work_t housekeeping;            /* Page merging and pressure pass, queued when it is due */
+} tick_state_t;
+
+/**
+ * @brief Sets the tick rates and masks the PIT
+ *
+ * Needs the APIC and the TSC rate. CPUs start ticking once they run a process.
+ */
+void tick_init();
+
+/**
+ * @brief Starts the tick of the calling CPU unless it runs
+ *
+ * Called when the CPU leaves its idle process.
+ */
+void tick_start();
+
+/**
+ * @brief Stops the tick of the calling CPU
+ *
+ * Called before the idle halt.
+ */
+void tick_stop();
+
+/**
+ * @brief Handles the timer interrupt of the calling CPU
+ *
+ * Raises the timer softirq on TIMER_CPU when timers expired. Once the tick is
+ * due, arms the next one, queues housekeeping and balances when they are due
+ * and sets need_resched if another process should run.
+ */
+void tick_handler();
+
+/**
+ * @brief Arms the APIC timer of the calling CPU again
+ *
+ * Called on TIMER_CPU when another CPU added a timer before its deadline, and
+ * by the timer softirq once the expired timers ran.
+ */
+void tick_rearm();
+
+/**
+ * @brief Makes TIMER_CPU fire in time for a timer just added
+ *
+ * Rearms it directly when it is the calling CPU, sends it SMP_VECTOR_TIMER
+ * otherwise.
+ */
+void tick_timer_added();
+
+#endif /* TICK_H */
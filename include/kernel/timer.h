@@ -0,0 +1,126 @@
+/**
+ * @file timer.h
+ * @brief Kernel Timer Interface
+ *
+ * Declares the timer wheel behind sleeps, alarms and timeouts. Timers expire
+ * on a millisecond clock counted from boot and are kept in a hierarchical
+ * wheel: four levels of 64 slots, a level covering 64 times the range of the
+ * one below. A timer goes into the slot of the lowest level that reaches its
+ * expiry and moves down a level each time the wheel passes the start of its
+ * slot, so adding, removing and expiring a timer are constant time.
+ *
+ * The wheel runs on the tick of one CPU, which keeps its APIC timer armed for
+ * the next slot holding a timer even while it is idle. Timers are added and
+ * removed under the kernel lock from any CPU, their functions run in the
+ * timer softirq of that CPU.
+ */
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <kernel/usage.h>
+#include <kint.h>
+
+#define TIMER_LEVELS 4                         /* Levels of the wheel, the last one covers 2^24 ms, about 4.6 hours */
+#define TIMER_LEVEL_BITS 6                     /* Bits of the expiry each level indexes */
+#define TIMER_SLOTS (1 << TIMER_LEVEL_BITS)    /* Slots per level */
+#define TIMER_CPU 0                            /* CPU whose tick runs the wheel */
+
+/* Interval timers, Linux values */
+#define ITIMER_REAL 0 /* Counts wall clock time and sends SIGALRM, the only one there is */
+
+/**
+ * @struct Timer, embedded in whatever it times
+ */
+typedef struct timer_event_t
+{
+    uint64_t expires;                          /* Millisecond it runs at, counted from boot */
+    void (*function)(struct timer_event_t*);   /* Called once it expires, after it is removed from the wheel */
+    uint64_t data;                             /* Left to the owner, usually what the timer belongs to */
+    struct timer_event_t* next;                /* Next timer in the same slot */
+    struct timer_event_t* last;
+    struct timer_event_t** slot;               /* Slot holding the timer, 0 while it is not pending */
+} timer_event_t;
+
+/**
+ * @struct Time as struct timespec
+ */
+typedef struct timer_timespec_t
+{
+    int64_t sec;
+    int64_t nsec;
+} timer_timespec_t;
+
+/**
+ * @struct Interval timer as struct itimerval
+ */
+typedef struct timer_itimerval_t
+{
+    usage_timeval_t interval; /* Period it repeats at, zero for a single expiry */
+    usage_timeval_t value;    /* Time until it expires next, zero while stopped */
+} timer_itimerval_t;
+
+/**
+ * @struct Timer wheel
+ */
+typedef struct timer_state_t
+{
+    uint64_t cycles_per_ms;                             /* TSC cycles in a millisecond */
+    uint64_t now;                                       /* Next millisecond the wheel processes */
+    uint64_t bitmap[TIMER_LEVELS];                      /* Bit per slot holding timers */
+    timer_event_t* slots[TIMER_LEVELS][TIMER_SLOTS];    /* Timers by level and slot, newest first */
+} timer_state_t;
+
+/**
+ * @brief Empties the wheel and starts its clock
+ *
+ * Needs the TSC rate.
+ */
+void timer_init();
+
+/**
+ * @brief Gets the milliseconds since boot
+ */
+uint64_t timer_now();
+
+/**
+ * @brief Gets the first expiry at least a number of milliseconds from now
+ *
+ * The clock only counts whole milliseconds, the current one is partly gone.
+ */
+uint64_t timer_deadline(uint64_t ms);
+
+/**
+ * @brief Starts a timer, stopping it first if it is pending
+ * @param timer timer with its function and data set
+ * @param expires millisecond it runs at, one already past runs on the next tick of the wheel
+ */
+void timer_add(timer_event_t* timer, uint64_t expires);
+
+/**
+ * @brief Stops a timer
+ * @return 1 if it was pending, 0 if it already ran or was never started
+ */
+bool timer_cancel(timer_event_t* timer);
+
+/**
+ * @brief Checks whether a timer is waiting to run
+ */
+static inline bool timer_pending(timer_event_t* timer)
+{
+    return timer->slot != 0;
+}
+
+/**
+ * @brief Runs every timer that expired
+ *
+ * Called by the timer softirq of TIMER_CPU, raised by its tick.
+ */
+void timer_run();
+
+/**
+ * @brief Gets when the wheel next has work
+ * @return TSC value the next timer expires or moves down a level at, 0 if no timer is pending
+ */
+uint64_t timer_next();
+
+#endif /* TIMER_H */
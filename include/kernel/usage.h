@@ -0,0 +1,214 @@
+/**
+ * @file usage.h
+ * @brief Process Resource Accounting Interface
+ *
+ * Declares the per-process counters behind getrusage, times and /dev/procstat.
+ * Time is measured with the TSC: the interrupt stubs charge the cycles since
+ * the last charge to the running process as user time on entry from user
+ * mode, the way back to user mode and every context switch charge them as
+ * system time. Faults, switches and I/O are counted where they happen, the
+ * resident size is sampled from the page table.
+ */
+#ifndef USAGE_H
+#define USAGE_H
+
+#include <kint.h>
+
+#define USAGE_CLOCK_TICKS 100   /* Clock ticks per second reported by times, _SC_CLK_TCK */
+#define USAGE_RSS_INTERVAL 125  /* Timer ticks between resident size samples of the running process */
+#define USAGE_CALIBRATE_MS 10   /* Length of the PIT window the TSC is measured against */
+#define USAGE_DEVICE "procstat" /* Name of the stats device in /dev */
+
+/* getrusage targets, Linux values */
+#define RUSAGE_SELF 0
+#define RUSAGE_CHILDREN -1
+#define RUSAGE_THREAD 1
+
+typedef struct process_t process_t;
+typedef struct interrupt_frame_t interrupt_frame_t;
+
+/**
+ * @struct Counters of a thread, or totals of a group of them
+ */
+typedef struct process_usage_t
+{
+    uint64_t user_cycles;          /* TSC cycles spent in user mode */
+    uint64_t system_cycles;        /* TSC cycles spent in the kernel while current */
+    uint64_t minor_faults;         /* Faults served without I/O */
+    uint64_t major_faults;         /* Faults that read the page cache from disk or swapped in */
+    uint64_t voluntary_switches;   /* Switched away from while blocked or exiting */
+    uint64_t involuntary_switches; /* Switched away from while runnable */
+    uint64_t read_bytes;           /* Bytes returned by reads */
+    uint64_t write_bytes;          /* Bytes taken by writes */
+    uint64_t rss;                  /* Resident pages at the last sample, kept by the leader */
+    uint64_t rss_peak;             /* Most resident pages ever sampled, kept by the leader */
+    uint64_t idle_cycles;          /* TSC cycles halted waiting for work, idle processes only */
+} process_usage_t;
+
+/**
+ * @struct Accounting state
+ */
+typedef struct usage_state_t
+{
+    uint64_t tsc_hz;   /* TSC frequency, measured against the PIT at boot */
+    uint64_t boot_tsc; /* TSC when accounting started, the charge stamps and ticks are per CPU */
+} usage_state_t;
+
+/**
+ * @struct Time as struct timeval
+ */
+typedef struct usage_timeval_t
+{
+    int64_t sec;
+    int64_t usec;
+} usage_timeval_t;
+
+/**
+ * @struct Result of getrusage, laid out like the Linux struct rusage
+ */
+typedef struct usage_rusage_t
+{
+    usage_timeval_t utime;
+    usage_timeval_t stime;
+    int64_t maxrss; /* Kb */
+    int64_t ixrss;
+    int64_t idrss;
+    int64_t isrss;
+    int64_t minflt;
+    int64_t majflt;
+    int64_t nswap;
+    int64_t inblock; /* 512 byte blocks */
+    int64_t oublock;
+    int64_t msgsnd;
+    int64_t msgrcv;
+    int64_t nsignals;
+    int64_t nvcsw;
+    int64_t nivcsw;
+} usage_rusage_t;
+
+/**
+ * @struct Result of times, laid out like the Linux struct tms
+ */
+typedef struct usage_tms_t
+{
+    int64_t utime; /* Clock ticks */
+    int64_t stime;
+    int64_t cutime;
+    int64_t cstime;
+} usage_tms_t;
+
+/**
+ * @struct Record of /dev/procstat, one per thread followed by one per CPU for its idle process with pid 0
+ */
+typedef struct usage_record_t
+{
+    uint64_t pid;          /* Thread id */
+    uint64_t tgid;         /* Process id, the pid of the thread leader */
+    uint64_t ppid;
+    uint64_t pgid;
+    uint64_t flags;        /* PROCESS_ flags */
+    uint64_t tsc_hz;       /* Converts the cycle counts */
+    process_usage_t usage; /* Counters of the thread, the resident size of the process */
+} usage_record_t;
+
+/**
+ * @brief Measures the TSC and starts charging time
+ */
+void usage_init();
+
+/**
+ * @brief Creates /dev/procstat
+ */
+void usage_init_device();
+
+/**
+ * @brief Zeroes the counters of a new process or thread
+ */
+void usage_start(process_t* process);
+
+/**
+ * @brief Charges user time when a frame entered the kernel from user mode
+ *
+ * Called on every entry to the kernel, once the kernel lock is held.
+ */
+void usage_enter(interrupt_frame_t* frame);
+
+/**
+ * @brief Charges system time to the current process on its way back to user mode
+ */
+void usage_leave();
+
+/**
+ * @brief Charges system time to the idle process before its CPU halts
+ *
+ * The time from here to the next interrupt is idle time.
+ */
+void usage_idle_enter();
+
+/**
+ * @brief Charges the time the CPU was halted as idle time
+ *
+ * Done by the first entry to the kernel after the halt, later calls do
+ * nothing.
+ */
+void usage_idle_leave();
+
+/**
+ * @brief Charges system time to the process switched away from and counts the switch
+ * @param prev process switched away from, the idle process of the CPU when it had nothing to run
+ */
+void usage_switch(process_t* prev);
+
+/**
+ * @brief Counts a serviced page fault
+ * @param major 1 if the fault waited for I/O
+ */
+void usage_fault(process_t* process, bool major);
+
+/**
+ * @brief Samples the resident size of the running process every few ticks
+ *
+ * Called on every timer tick.
+ */
+void usage_tick();
+
+/**
+ * @brief Samples the resident size of a process and updates its peak
+ * @param process any thread of the process
+ */
+void usage_sample_rss(process_t* process);
+
+/**
+ * @brief Settles the counters of an exiting thread or process
+ *
+ * Charges the time of the current process up to now and samples the resident
+ * size before the address space goes away. The counters of a thread are
+ * added to its leader.
+ */
+void usage_exit(process_t* process);
+
+/**
+ * @brief Adds the totals of a reaped child to the children totals of its parent
+ */
+void usage_reap(process_t* parent, process_t* child);
+
+/**
+ * @brief Sums the counters of a getrusage target
+ * @param process calling thread
+ * @param who RUSAGE_SELF, RUSAGE_CHILDREN or RUSAGE_THREAD
+ * @param total filled with the sum
+ * @return 0 on success, 1 if who is not known
+ */
+int usage_collect(process_t* process, int64_t who, process_usage_t* total);
+
+/**
+ * @brief Converts TSC cycles to a timeval
+ */
+usage_timeval_t usage_timeval(uint64_t cycles);
+
+/**
+ * @brief Converts TSC cycles to clock ticks
+ */
+uint64_t usage_clock_ticks(uint64_t cycles);
+
+#endif /* USAGE_H */
@@ -0,0 +1,139 @@
+/**
+ * @file wait.h
+ * @brief Wait Queue Interface
+ *
+ * Declares the wait queues processes sleep on in the kernel until an event
+ * or a timeout. A sleeper puts an entry on its own kernel stack into each
+ * queue it waits on, the side raising the event wakes the entries of a queue,
+ * which takes them out of it. Entries stay listed on their process as well,
+ * so a process that exits or gets a signal leaves every queue at once.
+ *
+ * Everything runs under the kernel lock: a condition checked before going to
+ * sleep cannot change until the process has switched away.
+ */
+#ifndef WAIT_H
+#define WAIT_H
+
+#include <kint.h>
+
+#define WAIT_FOREVER ((uint64_t)-1) /* Timeout of a sleep only an event or a signal ends */
+#define WAIT_POLL_MAX 32            /* Descriptors a poll waits on, their entries are on the kernel stack */
+
+/* Poll events, Linux values */
+#define POLLIN 0x1
+#define POLLOUT 0x4
+#define POLLNVAL 0x20
+
+typedef struct process_t process_t;
+
+/**
+ * @struct Entry of a sleeping process in a wait queue
+ */
+typedef struct wait_entry_t
+{
+    process_t* process;                /* Process woken */
+    struct wait_queue_t* queue;        /* Queue the entry is in, 0 once woken or removed */
+    struct wait_entry_t* next;         /* Next entry of the queue */
+    struct wait_entry_t* last;
+    struct wait_entry_t* process_next; /* Next entry of the same process */
+} wait_entry_t;
+
+/**
+ * @struct Wait queue, oldest entry first
+ */
+typedef struct wait_queue_t
+{
+    wait_entry_t* first;
+    wait_entry_t* last;
+} wait_queue_t;
+
+/**
+ * @struct Descriptor polled, laid out like the user side struct pollfd
+ */
+typedef struct wait_pollfd_t
+{
+    int32_t fd;
+    int16_t events;  /* Events asked for */
+    int16_t revents; /* Events that happened, set by poll */
+} wait_pollfd_t;
+
+/**
+ * @brief Empties a queue
+ */
+void wait_init(wait_queue_t* queue);
+
+/**
+ * @brief Resets the wait state of a new process copied from another
+ *
+ * The copy is in no queue and has no timer running.
+ */
+void wait_start(process_t* process);
+
+/**
+ * @brief Puts the entry of the current process into a queue, without sleeping
+ *
+ * Lets a process wait on several queues at once, with wait_schedule_timeout
+ * afterwards. Does nothing if the entry is in the queue already.
+ */
+void wait_add(wait_queue_t* queue, wait_entry_t* entry);
+
+/**
+ * @brief Takes an entry out of its queue, if it is still in one, and off its process
+ */
+void wait_remove(wait_entry_t* entry);
+
+/**
+ * @brief Checks whether the current process has to leave the kernel instead of sleeping
+ *
+ * True with a signal pending, or once another thread exited the process.
+ */
+bool wait_interrupted();
+
+/**
+ * @brief Sleeps until woken, a signal arrives or the timeout passes
+ * @param ms milliseconds to sleep at most, WAIT_FOREVER for no timeout
+ * @return milliseconds left of the timeout, 0 once it passed, WAIT_FOREVER without one
+ *
+ * Returns right away if wait_interrupted.
+ */
+uint64_t wait_schedule_timeout(uint64_t ms);
+
+/**
+ * @brief Sleeps on a queue until woken or a signal arrives
+ *
+ * Callers check their condition again in a loop, a wake only means it may
+ * have changed.
+ */
+void wait_sleep(wait_queue_t* queue);
+
+/**
+ * @brief Sleeps on a queue until woken, a signal arrives or the timeout passes
+ * @return milliseconds left of the timeout, as wait_schedule_timeout
+ */
+uint64_t wait_sleep_timeout(wait_queue_t* queue, uint64_t ms);
+
+/**
+ * @brief Wakes the oldest entry of a queue
+ * @return 1 if an entry was woken, 0 if the queue was empty
+ */
+bool wait_wake_one(wait_queue_t* queue);
+
+/**
+ * @brief Wakes every entry of a queue
+ * @return number of entries woken
+ */
+uint64_t wait_wake_all(wait_queue_t* queue);
+
+/**
+ * @brief Wakes a process sleeping in wait_schedule_timeout, so it can act on a signal
+ */
+void wait_interrupt(process_t* process);
+
+/**
+ * @brief Takes a process out of every queue and stops its sleep timer
+ *
+ * Called when the process ends, its entries are on its kernel stack.
+ */
+void wait_cancel(process_t* process);
+
+#endif /* WAIT_H */
@@ -0,0 +1,54 @@
+/**
+ * @file workqueue.h
+ * @brief Work Queue Interface
+ *
+ * Declares the system work queue, run by a kernel worker thread of the
+ * normal class. Work too long or too unimportant for a softirq goes there:
+ * it takes its turn with the processes, may sleep, and queueing it again
+ * before it ran has no effect.
+ */
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include <kernel/wait.h>
+#include <kint.h>
+
+#define WORKQUEUE_CPU 0 /* CPU the worker thread runs on */
+
+/**
+ * @struct Deferred work, embedded in whatever it works on
+ */
+typedef struct work_t
+{
+    void (*function)(struct work_t*); /* Called from the worker thread */
+    uint64_t data;                    /* Left to the owner */
+    struct work_t* next;              /* Next work in the queue */
+    bool pending;                     /* Queued and not run yet, cleared before it runs */
+} work_t;
+
+/**
+ * @struct Work queue, oldest work first
+ */
+typedef struct workqueue_t
+{
+    work_t* first;
+    work_t* last;
+    wait_queue_t waiters; /* Worker thread while the queue is empty */
+    process_t* worker;
+} workqueue_t;
+
+/**
+ * @brief Empties the system work queue and starts its worker thread
+ *
+ * Needs the CPUs and kernel stacks.
+ */
+void workqueue_init();
+
+/**
+ * @brief Queues work on the system work queue
+ * @param work work with its function set
+ * @return 1 if it was queued, 0 if it was pending already
+ */
+bool work_queue(work_t* work);
+
+#endif /* WORKQUEUE_H */
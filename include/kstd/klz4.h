@@ -0,0 +1,39 @@
+/**
+ * @file klz4.h
+ * @brief Kernel LZ4 Block Compression Interface
+ *
+ * Declares a small LZ4 block format compressor and decompressor, fast enough
+ * to compress pages on the reclaim path.
+ */
+#ifndef K_LZ4_H
+#define K_LZ4_H
+
+#include <kint.h>
+
+#define KLZ4_HASH_BITS 12    /* Entries in the match finder table (log2) */
+#define KLZ4_MIN_MATCH 4     /* Shortest match the format can encode */
+#define KLZ4_LAST_LITERALS 5 /* Bytes at the end of a block that are always literals */
+#define KLZ4_MF_LIMIT 12     /* Matches must start this far before the end of a block */
+#define KLZ4_MAX_OFFSET 0xFFFF
+
+/**
+ * @brief Compresses a block
+ * @param source data being compressed
+ * @param size size of source in bytes
+ * @param dest buffer receiving the compressed block
+ * @param capacity size of dest in bytes
+ * @return size of the compressed block, 0 if it does not fit in capacity
+ */
+size_t klz4_compress(const void* source, size_t size, void* dest, size_t capacity);
+
+/**
+ * @brief Decompresses a block
+ * @param source compressed block
+ * @param size size of the compressed block in bytes
+ * @param dest buffer receiving the data
+ * @param capacity size of dest in bytes
+ * @return size of the decompressed data, -1 if the block is malformed
+ */
+int64_t klz4_decompress(const void* source, size_t size, void* dest, size_t capacity);
+
+#endif /* K_LZ4_H */
@@ -0,0 +1,81 @@
+/**
+ * @file krbtree.h
+ * @brief Kernel Red-Black Tree Interface
+ *
+ * Declares an intrusive red-black tree. Nodes are embedded in the structures
+ * they order, the caller walks the tree to find the insertion point and the
+ * tree keeps itself balanced.
+ */
+#ifndef K_RBTREE_H
+#define K_RBTREE_H
+
+#include <kint.h>
+
+#define KRBTREE_RED 0
+#define KRBTREE_BLACK 1
+
+/**
+ * @brief Gets the structure a tree node is embedded in
+ * @param node pointer to the embedded node
+ * @param type type of the containing structure
+ * @param member name of the node member in the containing structure
+ */
+#define krbtree_entry(node, type, member) ((type*)((uint8_t*)(node) - __builtin_offsetof(type, member)))
+
+/**
+ * @struct Node embedded in every element of a tree
+ */
+typedef struct krbtree_node_t
+{
+    struct krbtree_node_t* parent;
+    struct krbtree_node_t* left;
+    struct krbtree_node_t* right;
+    uint64_t color;
+} krbtree_node_t;
+
+/**
+ * @struct Root of a tree
+ */
+typedef struct krbtree_t
+{
+    krbtree_node_t* root;
+} krbtree_t;
+
+/**
+ * @brief Links a node into the tree and rebalances it
+ * @param tree tree the node is inserted into
+ * @param node node being inserted
+ * @param parent parent found while walking the tree, NULL for an empty tree
+ * @param link child pointer of parent (or tree root) the node goes into
+ */
+void krbtree_insert(krbtree_t* tree, krbtree_node_t* node, krbtree_node_t* parent, krbtree_node_t** link);
+
+/**
+ * @brief Removes a node from the tree and rebalances it
+ * @param tree tree the node is in
+ * @param node node being removed
+ */
+void krbtree_remove(krbtree_t* tree, krbtree_node_t* node);
+
+/**
+ * @brief Gets the left most (smallest) node of a tree
+ * @param tree tree being searched
+ * @return smallest node, NULL if the tree is empty
+ */
+krbtree_node_t* krbtree_first(krbtree_t* tree);
+
+/**
+ * @brief Gets the in order successor of a node
+ * @param node current node
+ * @return next node, NULL if node is the last one
+ */
+krbtree_node_t* krbtree_next(krbtree_node_t* node);
+
+/**
+ * @brief Gets the in order predecessor of a node
+ * @param node current node
+ * @return previous node, NULL if node is the first one
+ */
+krbtree_node_t* krbtree_prev(krbtree_node_t* node);
+
+#endif /* K_RBTREE_H */
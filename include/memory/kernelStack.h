@@ -0,0 +1,60 @@
+/**
+ * @file kernelStack.h
+ * @brief Process Kernel Stack Interface
+ *
+ * Declares the allocator of the kernel stacks of processes. Every process gets
+ * its own stack in the kernel half, mapped in every address space, with an
+ * unmapped guard below it so an overflow faults instead of running into the
+ * next stack. Interrupts and syscalls from user mode land on it and a process
+ * switched out in the kernel keeps its state there. Freed stacks stay mapped
+ * for the next process until memory runs low.
+ */
+#ifndef KERNEL_STACK_H
+#define KERNEL_STACK_H
+
+#include <kint.h>
+
+/**
+ * @struct Kernel stack allocator state
+ */
+typedef struct kernel_stacks_t
+{
+    uint8_t* mapped;       /* 1 for every slot whose stack is mapped, in use or cached */
+    void* cached;          /* Freed stacks still mapped, linked through their lowest word */
+    uint64_t cached_count; /* Stacks on the cached list */
+    uint64_t used;         /* Stacks owned by processes */
+    uint64_t next_slot;    /* Where the search for an unmapped slot starts */
+} kernel_stacks_t;
+
+/**
+ * @brief Sets up the allocator and registers its shrinker
+ */
+void kernelStack_init();
+
+/**
+ * @brief Gets a kernel stack
+ * @return top of the stack, 16 byte aligned, NULL if out of memory
+ */
+void* kernelStack_allocate();
+
+/**
+ * @brief Gives a kernel stack back
+ * @param top top of the stack, as returned by kernelStack_allocate
+ *
+ * The stack must not be in use anymore.
+ */
+void kernelStack_free(void* top);
+
+/**
+ * @brief Counts the cached stacks the shrinker could free
+ */
+uint64_t kernelStack_count();
+
+/**
+ * @brief Unmaps cached stacks
+ * @param target number of stacks wanted
+ * @return number of stacks freed
+ */
+uint64_t kernelStack_shrink(uint64_t target);
+
+#endif /* KERNEL_STACK_H */
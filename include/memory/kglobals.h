@@ -8,8 +8,10 @@
 #ifndef K_GLOBALS_H
 #define K_GLOBALS_H
 
+#include <arch/apic.h>
 #include <arch/gdt.h>
 #include <arch/idt.h>
+#include <arch/smp.h>
 #include <boot/bootServices.h>
 #include <drivers/fbcon.h>
 #include <drivers/graphics.h>
@@ -20,12 +22,26 @@
 #include <fs/fontLoader.h>
 #include <fs/vfs.h>
 #include <kernel/device.h>
-#include <kernel/pidHashTable.h>
+#include <kernel/futex.h>
+#include <kernel/pidMap.h>
 #include <kernel/process.h>
+#include <kernel/processTemplate.h>
+#include <kernel/softirq.h>
+#include <kernel/tick.h>
+#include <kernel/timer.h>
+#include <kernel/usage.h>
+#include <kernel/workqueue.h>
+#include <memory/kernelStack.h>
 #include <memory/kmemory.h>
 #include <memory/kpool.h>
 #include <memory/memoryMap.h>
+#include <memory/pageCache.h>
+#include <memory/pageMerge.h>
 #include <memory/pageTable.h>
+#include <memory/pressure.h>
+#include <memory/swap.h>
+#include <memory/vma.h>
+#include <memory/zram.h>
 
 /* Constants */
 #define GLOBAL_VARS_END 0xFFFF860000200000 ///< End address for global variables allocation
@@ -83,14 +99,10 @@
 #define FD_ENTRY_POOL createGlobal(kernel_memory_pool_t*, SESSION_POOL)        ///< Memory pool for file descriptor entries
 
 /* Process Management */
-#define PID createGlobal(uint64_t, FD_ENTRY_POOL)           ///< Process ID counter
-#define CURRENT_PROCESS createGlobal(process_t*, PID)       ///< Pointer to the current process context
-#define PROCESSES createGlobal(process_t*, CURRENT_PROCESS) ///< Process Context Loop
-#define PROCESS_COUNT createGlobal(uint64_t, PROCESSES)     ///< Number of processes running
-#define TSS createGlobal(TSS64, PROCESS_COUNT)              ///< TSS which contains the stack that is switched to when interrupts happen
-#define PID_MAP createGlobal(pid_hash_table_t, TSS)         ///< Hash table for process lookup with PID
-#define PGID_MAP createGlobal(pid_hash_table_t, PID_MAP)    ///< Hash table for process group lookup
-#define SID_MAP createGlobal(pid_hash_table_t, PGID_MAP)    ///< Hash table for session lookup
+#define CURRENT_PROCESS (&smp_cpu()->current)          ///< Pointer to the current process context of the calling CPU
+#define PID_MAP createGlobal(pid_map_t, FD_ENTRY_POOL) ///< Process ids, allocated lowest free first
+#define PGID_MAP createGlobal(pid_map_t, PID_MAP)      ///< Process groups by id
+#define SID_MAP createGlobal(pid_map_t, PGID_MAP)      ///< Sessions by id
 
 /* Graphics System */
 #define FBCON createGlobal(fbcon_t, SID_MAP)                            ///< The frambuffer console object
@@ -116,10 +128,46 @@
 typedef void (*syscall_fn)();
 #define SYSCALLS createGlobalArray(syscall_fn, 512, VCONS) ///< List of all syscall function pointers
 
-#define LAST_GLOBAL SYSCALLS
+/* Globals below are chained after SYSCALLS, the syscall stub hardcodes its address */
+
+/* Virtual Memory */
+#define VMA_POOL createGlobal(kernel_memory_pool_t*, SYSCALLS)   ///< Memory pool for virtual memory areas
+#define PAGE_SHARE_COUNTS createGlobal(uint16_t*, VMA_POOL)      ///< Extra mappings of every 4 Kb frame (indexed by frame)
+#define ZERO_PAGE createGlobal(void*, PAGE_SHARE_COUNTS)         ///< Zeroed frame mapped read only for untouched anonymous memory
+#define ZERO_PAGE_REFS createGlobal(uint64_t, ZERO_PAGE)         ///< Number of mappings of the zero frame
+#define PAGE_MERGE createGlobal(page_merge_t, ZERO_PAGE_REFS)    ///< Same page merging scanner state
+#define SWAP createGlobal(swap_t, PAGE_MERGE)                    ///< Swap file, slots and LRU lists
+#define ZRAM createGlobal(zram_t, SWAP)                          ///< Compressed RAM swap device
+#define VFS_CACHED createGlobal(uint64_t, ZRAM)                  ///< VFS entries loaded from disk, the part shrinkers can drop
+#define PRESSURE createGlobal(pressure_t, VFS_CACHED)            ///< Pressure level, shrinkers and out of memory killer
+#define PAGE_CACHE createGlobal(page_cache_t, PRESSURE)          ///< Cached file pages backing file mappings
+#define PROCESS_TEMPLATES createGlobal(process_templates_t, PAGE_CACHE) ///< Loaded images of recently executed binaries
+
+/* Threads */
+#define FUTEX_TABLE createGlobal(futex_table_t, PROCESS_TEMPLATES) ///< Threads waiting on futexes, hashed by address
+
+/* Scheduling */
+#define KERNEL_STACKS createGlobal(kernel_stacks_t, FUTEX_TABLE) ///< Kernel stacks of processes, mapped and cached
+#define PROCESS_REAP createGlobal(process_t*, KERNEL_STACKS)     ///< Process that freed itself while running on its kernel stack, released later
+
+/* Accounting */
+#define USAGE createGlobal(usage_state_t, PROCESS_REAP) ///< TSC rate and the stamp time is charged from
+
+/* Multiprocessor */
+#define APIC createGlobal(apic_state_t, USAGE)            ///< Local APIC registers and timer rate
+#define CPUS createGlobalArray(cpu_t, SMP_MAX_CPUS, APIC) ///< State of every CPU, 0 is the bootstrap processor
+#define SMP createGlobal(smp_state_t, CPUS)               ///< CPU count and the kernel lock
+#define TICK createGlobal(tick_state_t, SMP)              ///< Tick and housekeeping rates
+#define TIMERS createGlobal(timer_state_t, TICK)          ///< Timer wheel
+
+/* Deferred Work */
+#define WORKQUEUE createGlobal(workqueue_t, TIMERS)     ///< System work queue and its worker thread
+#define VCON_TASKLET createGlobal(tasklet_t, WORKQUEUE) ///< Console input handling deferred by the keyboard interrupt
+
+#define LAST_GLOBAL VCON_TASKLET
 
 #define GLOBALS_SIZE (char*)(GLOBAL_VARS_END) - (char*)(LAST_GLOBAL)
 
-#define TEMP createGlobal(uint64_t, SYSCALLS)
+#define TEMP createGlobal(uint64_t, LAST_GLOBAL)
 
 #endif /* K_GLOBALS_H */
\ No newline at end of file
@@ -23,11 +23,15 @@
 
 #define KERNEL_STACK_START 0xFFFF810000000000 /* 129tb */
 
-#define INTERRUPT_STACK_START 0xFFFF810000FFFF00
-#define INTERRUPT_INFO_START 0xFFFF810000FFFEE0
+#define INTERRUPT_STACK_START 0xFFFF810000FFFF00 /* Stack of double faults, a process kernel stack may be the fault */
 
 #define KERNEL_STACK_SIZE 0x1000000
 
+#define PROCESS_KERNEL_STACKS_START 0xFFFF810001000000 /* Kernel stacks of processes, right after the kernel stack */
+#define PROCESS_KERNEL_STACK_SIZE 0x4000               /* 16kb mapped per process */
+#define PROCESS_KERNEL_STACK_SLOT 0x8000               /* Stride between stacks, the unmapped part below each stack is its guard */
+#define PROCESS_KERNEL_STACKS_MAX 0x4000               /* 512mb of address space */
+
 #define KERNEL_HEAP_START 0xFFFF820000000000 /* 130tb */ // 0x00000FFEBF000000
 #define KERNEL_HEAP_SIZE 0x40000000
 
@@ -46,6 +50,9 @@
 #define FRAMEBUFFER_START 0xFFFF870000000000 /* 135tb */
 #define FRAMEBUFFER_SIZE 0x10000000
 
+#define APIC_START 0xFFFF880000000000 /* 136tb */
+#define APIC_SIZE 0x1000 /* Registers of the local APIC, mapped uncached */
+
 /* Process code starts at the third section. from now on each process has 128 gb sections which
  * allows 2045 concurrent running processes at once */
 
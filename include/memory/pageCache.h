@@ -0,0 +1,89 @@
+/**
+ * @file pageCache.h
+ * @brief File Page Cache Interface
+ *
+ * Declares the cache of file contents mapped into processes. Every regular file
+ * mapped by the ELF loader gets one cache entry holding a frame per 4kb page of
+ * the file, read from disk on first use. Processes running the same binary map
+ * the same frames, private writes go through copy on write.
+ */
+#ifndef PAGE_CACHE_H
+#define PAGE_CACHE_H
+
+#include <kint.h>
+
+#define PAGE_CACHE_BUCKETS 64      /* Hash buckets of cached files, indexed by inode */
+#define PAGE_CACHE_FAULT_AROUND 16 /* Pages mapped per file fault, the aligned window around the faulting page */
+
+typedef struct file_descriptor_t file_descriptor_t;
+typedef struct kernel_memory_pool_t kernel_memory_pool_t;
+
+/**
+ * @struct Cached contents of a file
+ */
+typedef struct page_cache_file_t
+{
+    struct page_cache_file_t* next; /* Next file in the same bucket */
+    file_descriptor_t* file;        /* Descriptor owned by the cache, mappings point at it */
+    uint64_t page_count;            /* Pages of the file when frames was allocated, 0 if it was not */
+    void** frames;                  /* Frame of every page, NULL if not read yet */
+} page_cache_file_t;
+
+/**
+ * @struct Page cache state
+ */
+typedef struct page_cache_t
+{
+    page_cache_file_t* buckets[PAGE_CACHE_BUCKETS];
+    kernel_memory_pool_t* pool; /* Memory pool for cached files */
+    uint64_t pages;             /* Frames held by the cache */
+    uint64_t reads;             /* Pages read from disk */
+    uint64_t shrink_bucket;     /* Where the next shrinker pass starts */
+} page_cache_t;
+
+/**
+ * @brief Sets up the cache and registers its shrinker
+ */
+void pageCache_init();
+
+/**
+ * @brief Gets the cache entry of a file, creating it on first use
+ * @param file open regular file
+ * @return cache entry, entries live as long as the kernel
+ */
+page_cache_file_t* pageCache_open(file_descriptor_t* file);
+
+/**
+ * @brief Gets the frame holding a page of a file
+ * @param file descriptor of a cache entry (page_cache_file_t.file)
+ * @param index page of the file
+ * @return frame owned by the cache, NULL past the end of the file or out of memory
+ *
+ * Missing pages are read from disk, the part past the end of the file is zero.
+ * The cache keeps its own reference, mappings take one with pages_share. Must
+ * be called with the kernel page table loaded.
+ */
+void* pageCache_get(file_descriptor_t* file, uint64_t index);
+
+/**
+ * @brief Drops every cached page of a file (it was written to)
+ * @param inode_num inode of the file
+ *
+ * Frames still mapped stay with their mappings.
+ */
+void pageCache_invalidate(uint32_t inode_num);
+
+/**
+ * @brief Counts the cached frames the shrinker could free
+ * @return number of frames not mapped by any process
+ */
+uint64_t pageCache_count();
+
+/**
+ * @brief Frees cached frames not mapped by any process
+ * @param target number of frames wanted
+ * @return number of frames freed
+ */
+uint64_t pageCache_shrink(uint64_t target);
+
+#endif /* PAGE_CACHE_H */
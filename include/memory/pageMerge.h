@@ -0,0 +1,78 @@
+/**
+ * @file pageMerge.h
+ * @brief Same Page Merging Interface
+ *
+ * Declares the background scanner that finds identical private anonymous pages
+ * across processes and maps them to a single copy on write frame. Zero filled
+ * pages are folded into the shared zero frame.
+ */
+#ifndef PAGE_MERGE_H
+#define PAGE_MERGE_H
+
+#include <kint.h>
+
+#define PAGE_MERGE_BUDGET 16         /* Pages scanned per housekeeping pass */
+#define PAGE_MERGE_TABLE_SIZE 4096   /* Candidate pages remembered by content hash */
+#define PAGE_MERGE_MAX_SHARES 0x1000 /* Frames with this many mappings take no more merges */
+
+#define PAGE_MERGE_QUERY 0   /* Only report */
+#define PAGE_MERGE_ENABLE 1  /* Start the scanner */
+#define PAGE_MERGE_DISABLE 2 /* Stop the scanner */
+
+/**
+ * @struct Page seen by the scanner, kept as a merge target for later pages
+ */
+typedef struct page_merge_candidate_t
+{
+    uint64_t hash;  /* Content hash, 0 for an empty slot */
+    uint64_t frame; /* Physical frame holding the content */
+    uint64_t pid;   /* Process mapping the frame */
+    uint64_t vaddr; /* Address the frame is mapped at in that process */
+} page_merge_candidate_t;
+
+/**
+ * @struct Statistics reported to user space
+ */
+typedef struct page_merge_stats_t
+{
+    uint64_t scanned;     /* Pages looked at by the scanner */
+    uint64_t merged;      /* Pages merged into another frame with equal content */
+    uint64_t zero_merged; /* Zero filled pages folded into the zero frame by the scanner */
+    uint64_t zero_mapped; /* Current mappings of the zero frame */
+    uint64_t saved;       /* Bytes saved right now, zero frame mappings plus extra mappings of shared frames, page cache references left out */
+} page_merge_stats_t;
+
+/**
+ * @struct Scanner state
+ */
+typedef struct page_merge_t
+{
+    bool enabled;
+    uint64_t zero_hash;    /* Content hash of the zero frame */
+    uint64_t cursor_pid;   /* Process being scanned */
+    uint64_t cursor_vaddr; /* Next address to scan in that process */
+    page_merge_candidate_t* candidates;
+    page_merge_stats_t stats;
+} page_merge_t;
+
+/**
+ * @brief Allocates the candidate table, the scanner starts disabled
+ */
+void pageMerge_init();
+
+/**
+ * @brief Scans the next few pages and merges duplicates
+ * @param budget number of pages to look at
+ *
+ * Called from the timer interrupt while enabled. Picks up where the previous
+ * call stopped, walking every process in turn.
+ */
+void pageMerge_scan(uint64_t budget);
+
+/**
+ * @brief Gets the current statistics
+ * @param stats filled in with the statistics
+ */
+void pageMerge_stats(page_merge_stats_t* stats);
+
+#endif /* PAGE_MERGE_H */
@@ -23,9 +23,13 @@
 #define PAGE_PRESENT 0x001        /* Bit 0: Present in memory */
 #define PAGE_WRITABLE 0x002       /* Bit 1: Read/Write permissions */
 #define PAGE_USER 0x004           /* Bit 2: User/Supervisor level */
+#define PAGE_PWT 0x008            /* Bit 3: Write through */
+#define PAGE_PCD 0x010            /* Bit 4: Cache disabled */
+#define PAGE_ACCESSED 0x020       /* Bit 5: Set by the CPU when the page is used */
 #define PAGE_PS 0x080             /* Bit 7: Page Size (0=4KB, 1=2MB/1GB) */
 #define PAGE_NO_EXEC (1ULL << 63) /* Bit 63: Execute-disable */
 #define PAGE_COW (1ULL << 52)     /* Bit 52: Copy On Write */
+#define PAGE_SWAPPED (1ULL << 53) /* Bit 53: Not present, the address bits hold a swap slot */
 
 /* Virtual address bitfield extraction (Intel Vol. 3A 4-12) */
 #define PML4_INDEX(x) (((x) >> 39) & 0x1FF) /* Bits 39-47: PML4 index */
@@ -58,8 +62,21 @@ typedef struct
 {
     uint64_t entry;
     uint64_t size;
+    uint64_t* entry_ptr; /* Location of the entry in its table */
 } page_lookup_result_t;
 
+#define TLB_BATCH_SIZE 32 /* Invalidations collected before flushing the whole TLB */
+
+/**
+ * @struct tlb_batch_t
+ * @brief Pages whose TLB entries must be invalidated once an edit is done
+ */
+typedef struct tlb_batch_t
+{
+    uint64_t addresses[TLB_BATCH_SIZE];
+    uint64_t count;
+} tlb_batch_t;
+
 /* ==================== Constants ==================== */
 
 #define PAGE_SIZE_4KB 0x1000     /* 4kb */
@@ -122,4 +139,112 @@ page_table_t pageTable_fork(page_table_t* ref);
 
 page_lookup_result_t pageTable_find_entry(page_table_t* pageTable, uint64_t cr2);
 
+/**
+ * @brief Queues a page for TLB invalidation
+ * @param batch batch collecting the invalidations of one operation
+ * @param vaddr virtual address of the page
+ */
+void pageTable_tlb_add(tlb_batch_t* batch, uint64_t vaddr);
+
+/**
+ * @brief Invalidates every queued page
+ * @param batch batch being flushed
+ *
+ * Uses invlpg for small batches and a single CR3 reload once the batch
+ * overflows, then resets the batch.
+ */
+void pageTable_tlb_flush(tlb_batch_t* batch);
+
+/**
+ * @brief Checks if a 2mb slot has nothing mapped in it
+ * @param pageTable page table being checked
+ * @param vaddr address inside the slot
+ * @return 1 if a huge page can be mapped at the slot
+ *
+ * Must be called with the kernel page table loaded.
+ */
+bool pageTable_huge_slot_free(page_table_t* pageTable, uint64_t vaddr);
+
+/**
+ * @brief Splits a 2mb leaf into 512 4kb leaves with the same flags
+ * @param pageTable page table being edited
+ * @param vaddr address inside the huge page
+ * @return 0 on success, -1 on failure
+ *
+ * The frame is split in place, copy on write flags are kept and the share
+ * count of the frame carries over to every 4kb piece. Must be called with the
+ * kernel page table loaded.
+ */
+int pageTable_split(page_table_t* pageTable, uint64_t vaddr);
+
+/**
+ * @brief Unmaps a range and releases the frames behind it
+ * @param pageTable page table being edited
+ * @param start first address (page aligned)
+ * @param end address after the range (page aligned)
+ * @param batch collects the pages that need invalidating
+ *
+ * Huge leaves partially covered by the range are split first. Must be called
+ * with the kernel page table loaded.
+ */
+void pageTable_unmap(page_table_t* pageTable, uint64_t start, uint64_t end, tlb_batch_t* batch);
+
+/**
+ * @brief Changes the access of every present page in a range
+ * @param pageTable page table being edited
+ * @param start first address (page aligned)
+ * @param end address after the range (page aligned)
+ * @param writable 1 to allow writes (copy on write pages stay read only)
+ * @param user 1 to allow user access at all
+ * @param batch collects the pages that need invalidating
+ *
+ * Must be called with the kernel page table loaded.
+ */
+void pageTable_protect(page_table_t* pageTable, uint64_t start, uint64_t end, bool writable, bool user, tlb_batch_t* batch);
+
+/**
+ * @brief Moves the pages of a range to another virtual address
+ * @param pageTable page table being edited
+ * @param old_start first address of the source range
+ * @param new_start first address of the destination range
+ * @param size size of the range in bytes
+ * @param batch collects the pages that need invalidating
+ *
+ * Entries are moved as they are, frames are neither copied nor released. Both
+ * ranges must have the same offset into a 2mb page so huge leaves stay huge,
+ * huge leaves sticking out of the range are split. Must be called with the
+ * kernel page table loaded.
+ */
+void pageTable_move(page_table_t* pageTable, uint64_t old_start, uint64_t new_start, uint64_t size, tlb_batch_t* batch);
+
+/**
+ * @brief Tears down the user half of a page table
+ * @param pageTable page table being released, cleared afterwards
+ *
+ * Releases every frame and swap slot mapped in the user half, then frees the
+ * tables and the PML4 itself. Must be called with the kernel page table loaded
+ * and not with pageTable loaded.
+ */
+void pageTable_release_user(page_table_t* pageTable);
+
+/**
+ * @brief Empties the user half of a page table but keeps the PML4
+ * @param pageTable page table being emptied
+ *
+ * Same as pageTable_release_user, except the page table stays valid and can be
+ * released again later. Must be called with the kernel page table loaded and
+ * not with pageTable loaded.
+ */
+void pageTable_clear_user(page_table_t* pageTable);
+
+/**
+ * @brief Counts the pages mapped in the user half of a page table
+ * @param pageTable page table being counted
+ * @param swapped set to the number of pages out in swap, may be NULL
+ * @return number of resident 4kb pages, zero frame mappings left out
+ *
+ * Must be called with the kernel page table loaded.
+ */
+uint64_t pageTable_count_user(page_table_t* pageTable, uint64_t* swapped);
+
 #endif
\ No newline at end of file
@@ -62,4 +62,61 @@ void pages_reservePage(uint64_t page_start, uint64_t page_count, uint64_t page_s
  */
 void pages_generateFreeStack();
 
+/**
+ * @brief Turns an allocated 2mb frame into 512 allocated 4kb frames
+ * @param address physical address of the 2mb frame
+ *
+ * Every 4kb frame inherits the share count of the 2mb frame and can be
+ * released on its own afterwards.
+ */
+void pages_split(void* address);
+
+/**
+ * @brief Allocates the frame share counts
+ *
+ * Every frame starts out owned by a single mapping. Needs the kernel heap.
+ */
+void pages_initShareCounts();
+
+/**
+ * @brief Allocates the shared zero frame
+ *
+ * The zero frame is never freed, mappings of it are counted in ZERO_PAGE_REFS
+ * instead of the share counts.
+ */
+void pages_initZeroPage();
+
+/**
+ * @brief Records another mapping of a frame
+ * @param address physical address of the frame
+ * @param page_size size of the mapping
+ *
+ * A 2mb frame is counted as a unit until it is split, afterwards a 2mb mapping
+ * of it counts once on every 4kb frame.
+ */
+void pages_share(void* address, uint64_t page_size);
+
+/**
+ * @brief Drops one mapping of a frame, freeing it when it was the last one
+ * @param address physical address of the frame
+ * @param page_size size of the mapping
+ * @return 1 if the frame was freed
+ */
+bool pages_release(void* address, uint64_t page_size);
+
+/**
+ * @brief Gets how many mappings of a frame exist besides the first one
+ * @param address physical address of the frame
+ * @param page_size size of the mapping
+ * @return number of extra mappings, 0 if the frame has a single owner
+ */
+uint64_t pages_shareCount(void* address, uint64_t page_size);
+
+/**
+ * @brief Counts the 4kb pages that extra mappings of shared frames save right now
+ *
+ * Mappings of the zero frame are not included. Walks every frame.
+ */
+uint64_t pages_sharedPages();
+
 #endif /* K_PAGING_H */
\ No newline at end of file
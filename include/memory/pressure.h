@@ -0,0 +1,111 @@
+/**
+ * @file pressure.h
+ * @brief Memory Pressure Interface
+ *
+ * Declares the memory pressure levels derived from free memory watermarks, the
+ * shrinkers kernel caches register to give memory back under pressure and the
+ * out of memory killer used once reclaim has nothing left to give. The current
+ * state is readable by user space from /dev/pressure.
+ */
+#ifndef PRESSURE_H
+#define PRESSURE_H
+
+#include <kint.h>
+
+#define PRESSURE_LOW_PAGES 4096      /* 16mb, free 4kb frames below which pressure is low */
+#define PRESSURE_MEDIUM_PAGES 1024   /* 4mb, free 4kb frames below which pressure is medium */
+#define PRESSURE_CRITICAL_PAGES 256  /* 1mb, free 4kb frames below which pressure is critical */
+#define PRESSURE_SHRINK_INTERVAL 16  /* Housekeeping passes between shrinker passes while under pressure */
+#define PRESSURE_MAX_SHRINKERS 8
+
+#define PRESSURE_DEVICE "pressure" /* Device file in /dev */
+
+/**
+ * @enum Memory pressure levels, from least to most severe
+ */
+typedef enum pressure_level_t
+{
+    PRESSURE_NONE,
+    PRESSURE_LOW,      /* Caches are trimmed a little */
+    PRESSURE_MEDIUM,   /* Caches are trimmed harder */
+    PRESSURE_CRITICAL, /* Caches are emptied, allocations reclaim to swap */
+    PRESSURE_LEVELS,
+} pressure_level_t;
+
+/**
+ * @struct Cache giving memory back under pressure
+ */
+typedef struct pressure_shrinker_t
+{
+    const char* name;
+    uint64_t (*count)();               /* Objects that could be freed right now */
+    uint64_t (*scan)(uint64_t target); /* Frees up to target cold objects, returns the number freed */
+} pressure_shrinker_t;
+
+/**
+ * @struct Pressure state reported to user space
+ */
+typedef struct pressure_stats_t
+{
+    uint64_t level;                   /* Current pressure_level_t */
+    uint64_t sequence;                /* Bumped on every level change, readers poll it */
+    uint64_t free_pages;              /* Free 4kb frames */
+    uint64_t total_pages;             /* 4kb frames of physical memory */
+    uint64_t events[PRESSURE_LEVELS]; /* Times every level was entered */
+    uint64_t shrunk;                  /* Objects freed by shrinkers */
+    uint64_t oom_kills;               /* Processes killed by the out of memory killer */
+    uint64_t oom_last_pid;            /* Last process killed */
+    uint64_t oom_last_score;          /* Score of the last process killed */
+} pressure_stats_t;
+
+/**
+ * @struct Memory pressure state
+ */
+typedef struct pressure_t
+{
+    pressure_shrinker_t shrinkers[PRESSURE_MAX_SHRINKERS];
+    uint64_t shrinker_count;
+    uint64_t ticks; /* Housekeeping passes since the last shrinker pass */
+    bool killing;   /* Stops the killer from running inside itself */
+    pressure_stats_t stats;
+} pressure_t;
+
+/**
+ * @brief Resets the pressure state, before any cache registers a shrinker
+ */
+void pressure_init();
+
+/**
+ * @brief Creates /dev/pressure, needs the file system
+ */
+void pressure_init_device();
+
+/**
+ * @brief Registers a cache shrinker
+ * @param name name of the cache
+ * @param count returns the number of objects the cache could free
+ * @param scan frees up to the given number of cold objects
+ */
+void pressure_register_shrinker(const char* name, uint64_t (*count)(), uint64_t (*scan)(uint64_t));
+
+/**
+ * @brief Updates the pressure level and runs shrinkers while under pressure
+ *
+ * Called on the housekeeping pass of the tick. Shrinkers are asked for a share of their
+ * objects growing with the level, from 1/16 when low to all when critical.
+ */
+void pressure_tick();
+
+/**
+ * @brief Kills a process to get memory back
+ * @return 1 if memory was freed, 0 if the allocation has to fail
+ *
+ * Zombies are emptied first, they never run again but keep their memory until
+ * they are waited for. Otherwise the process with the highest score, resident
+ * plus swapped out pages, is sent SIGKILL with ties going to the newest. Its
+ * memory is released right away unless it is the current process, which dies
+ * on its way back to user space instead.
+ */
+bool pressure_oom();
+
+#endif /* PRESSURE_H */
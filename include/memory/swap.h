@@ -0,0 +1,166 @@
+/**
+ * @file swap.h
+ * @brief Swap Interface
+ *
+ * Declares the swap subsystem that pushes idle anonymous pages out to swap
+ * devices once physical memory runs low. Devices are the compressed RAM device
+ * and a preallocated file on the ext2 partition, filled in that order. Reclaim
+ * picks pages from active/inactive LRU lists, swapped out pages are left in the
+ * page table as swap entries resolved by the page fault handler.
+ */
+#ifndef SWAP_H
+#define SWAP_H
+
+#include <kint.h>
+#include <memory/pageTable.h>
+
+#define SWAP_FILE "swap"  /* Swap file in the root directory, swap stays off without it */
+#define SWAP_CLUSTER 8    /* Pages written back together, also the reclaim batch */
+#define SWAP_READAHEAD 8  /* Pages read per swap fault, the faulting page and the ones after it */
+#define SWAP_SCAN_RATIO 8 /* LRU pages looked at per page reclaimed before giving up */
+#define SWAP_MAX_DEVICES 2
+#define SWAP_LOW_WATERMARK 256 /* Free 4kb frames below which allocations start reclaim */
+
+/* A not present 4kb entry holding a swap slot */
+#define SWAP_ENTRY(slot) (((uint64_t)(slot) << 12) | PAGE_SWAPPED)
+#define SWAP_SLOT(entry) (((entry)&PAGE_MASK) >> 12)
+#define SWAP_IS_ENTRY(entry) (!((entry)&PAGE_PRESENT) && ((entry)&PAGE_SWAPPED))
+
+typedef struct process_t process_t;
+typedef struct vma_t vma_t;
+typedef struct file_descriptor_t file_descriptor_t;
+typedef struct kernel_memory_pool_t kernel_memory_pool_t;
+
+/**
+ * @struct Backend holding swapped out pages
+ *
+ * Slots passed to the operations are relative to the device.
+ */
+typedef struct swap_device_t
+{
+    uint64_t base;                                   /* First swap slot of the device */
+    uint64_t slots;                                  /* Number of slots */
+    uint64_t next_slot;                              /* Where the next free slot search starts */
+    bool (*write)(uint64_t slot, const void* frame); /* Stores a 4kb frame, 0 on failure */
+    bool (*read)(uint64_t slot, void* frame);        /* Loads a 4kb frame, 0 on failure */
+    void (*discard)(uint64_t slot);                  /* Slot is not referenced anymore, may be NULL */
+} swap_device_t;
+
+/**
+ * @struct Anonymous page on one of the LRU lists
+ */
+typedef struct swap_lru_page_t
+{
+    struct swap_lru_page_t* prev; /* Towards the head (most recently used) */
+    struct swap_lru_page_t* next; /* Towards the tail (least recently used) */
+    uint64_t pid;                 /* Process mapping the page */
+    uint64_t vaddr;               /* Address of the page in that process */
+    uint64_t frame;               /* Frame backing the page */
+    bool active;                  /* On the active list */
+} swap_lru_page_t;
+
+/**
+ * @struct LRU list of anonymous pages
+ */
+typedef struct swap_lru_t
+{
+    swap_lru_page_t* head;
+    swap_lru_page_t* tail;
+    uint64_t count;
+} swap_lru_t;
+
+/**
+ * @struct Swap statistics
+ */
+typedef struct swap_stats_t
+{
+    uint64_t swapped_out; /* Pages written to swap */
+    uint64_t swapped_in;  /* Pages read back on a fault */
+    uint64_t readahead;   /* Pages read back ahead of a fault */
+    uint64_t free_slots;  /* Slots not holding a page */
+} swap_stats_t;
+
+/**
+ * @struct Swap state
+ */
+typedef struct swap_t
+{
+    swap_device_t devices[SWAP_MAX_DEVICES]; /* In the order they are filled */
+    uint64_t device_count;
+    file_descriptor_t* file; /* Swap file, NULL if there is none */
+    uint64_t slots;          /* Number of 4kb slots over all devices, 0 while swap is off */
+    uint16_t* slot_counts;   /* Entries referring to every slot, 0 for a free slot */
+    swap_lru_page_t** frame_pages;  /* LRU page of every frame (indexed by frame) */
+    kernel_memory_pool_t* lru_pool; /* Memory pool for LRU pages */
+    swap_lru_t active;              /* Recently used pages */
+    swap_lru_t inactive;            /* Reclaim candidates */
+    bool reclaiming;                /* Stops reclaim from running inside itself */
+    swap_stats_t stats;
+} swap_t;
+
+/**
+ * @brief Sets up the swap devices, the slot and the LRU tables
+ *
+ * Needs the file system, swap stays off if there is no device.
+ */
+void swap_init();
+
+/**
+ * @brief Adds a swap device, only during swap_init
+ * @param slots number of 4kb slots the device holds
+ * @param write stores a frame in a slot
+ * @param read loads a frame from a slot
+ * @param discard called when a slot is freed, may be NULL
+ */
+void swap_add_device(uint64_t slots, bool (*write)(uint64_t, const void*), bool (*read)(uint64_t, void*), void (*discard)(uint64_t));
+
+/**
+ * @brief Puts a private anonymous page on the inactive list
+ * @param process process mapping the page
+ * @param vaddr address of the page
+ * @param frame frame backing the page
+ */
+void swap_track(process_t* process, uint64_t vaddr, void* frame);
+
+/**
+ * @brief Takes a frame off the LRU lists
+ * @param frame frame being freed
+ */
+void swap_untrack(void* frame);
+
+/**
+ * @brief Writes idle pages out to swap and frees their frames
+ * @param target number of frames wanted
+ * @return number of frames freed
+ *
+ * Pages leave the tail of the inactive list, pages used since they were last
+ * looked at get a second chance on the active list. Victims are written in
+ * clusters of consecutive slots.
+ */
+uint64_t swap_reclaim(uint64_t target);
+
+/**
+ * @brief Reads a swapped out page back in
+ * @param process process that faulted
+ * @param vma area containing the page
+ * @param vaddr faulting address
+ * @return 1 if the page is mapped again, 0 if it could not be read
+ *
+ * Swapped out pages following the faulting one in the same area are read
+ * ahead. Must be called with the kernel page table loaded.
+ */
+bool swap_fault(process_t* process, vma_t* vma, uint64_t vaddr);
+
+/**
+ * @brief Records another entry referring to a swap slot (fork)
+ * @param entry swap entry being copied
+ */
+void swap_dup(uint64_t entry);
+
+/**
+ * @brief Drops an entry referring to a swap slot, freeing the slot with the last one
+ * @param entry swap entry being removed
+ */
+void swap_free(uint64_t entry);
+
+#endif /* SWAP_H */
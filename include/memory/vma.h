@@ -0,0 +1,141 @@
+/**
+ * @file vma.h
+ * @brief Virtual Memory Area Interface
+ *
+ * Declares the per-process virtual memory areas. Every valid user range of a
+ * process is described by one area, kept in a red-black tree ordered by address
+ * so faults and user pointers can be checked in O(log n).
+ */
+#ifndef VMA_H
+#define VMA_H
+
+#include <kint.h>
+#include <krbtree.h>
+
+#define PROT_NONE 0  /* Pages cannot be accessed */
+#define PROT_EXEC 1  /* Pages can be executed */
+#define PROT_WRITE 2 /* Pages can be written */
+#define PROT_READ 4  /* Pages can be read */
+
+#define VMA_HUGEPAGE 1 /* Area asked to be backed by huge pages (MADV_HUGEPAGE) */
+
+typedef struct file_descriptor_t file_descriptor_t;
+
+/**
+ * @enum What backs the pages of an area
+ */
+typedef enum vma_backing_t
+{
+    VMA_ANON,   /* Zero filled private memory */
+    VMA_FILE,   /* Loaded from a file */
+    VMA_SHARED, /* Shared between processes */
+    VMA_STACK,  /* Zero filled stack memory */
+} vma_backing_t;
+
+/**
+ * @struct Virtual memory area
+ */
+typedef struct vma_t
+{
+    krbtree_node_t node;   /* Node in the process area tree */
+    uint64_t start;        /* First address of the area (page aligned) */
+    uint64_t end;          /* Address after the area (page aligned) */
+    uint64_t prot;         /* PROT_ flags */
+    vma_backing_t backing; /* What backs the pages */
+    uint64_t flags;        /* VMA_ flags */
+    file_descriptor_t* file;
+    uint64_t offset;   /* Offset into file of start */
+    uint64_t file_end; /* Address where the file contents end, the rest of a file area reads as zero */
+} vma_t;
+
+/**
+ * @brief Finds the area containing an address
+ * @param tree area tree of the process
+ * @param addr address being looked up
+ * @return area containing addr, NULL if addr is not mapped
+ */
+vma_t* vma_find(krbtree_t* tree, uint64_t addr);
+
+/**
+ * @brief Finds the first area ending after an address
+ * @param tree area tree of the process
+ * @param addr address being looked up
+ * @return area containing addr or the first one above it, NULL if there is none
+ */
+vma_t* vma_find_next(krbtree_t* tree, uint64_t addr);
+
+/**
+ * @brief Creates an area and adds it to the tree
+ * @param tree area tree of the process
+ * @param start first address (rounded down to a page)
+ * @param end address after the area (rounded up to a page)
+ * @param prot PROT_ flags
+ * @param backing what backs the pages
+ * @param flags VMA_ flags
+ * @return the new area, NULL if the range overlaps another area
+ *
+ * Anonymous areas directly following an area with the same protection and
+ * flags are merged into it so a growing heap stays a single node.
+ */
+vma_t* vma_create(krbtree_t* tree, uint64_t start, uint64_t end, uint64_t prot, vma_backing_t backing, uint64_t flags);
+
+/**
+ * @brief Removes an area from the tree and frees it
+ * @param tree area tree of the process
+ * @param vma area being removed
+ */
+void vma_destroy(krbtree_t* tree, vma_t* vma);
+
+/**
+ * @brief Splits an area in two
+ * @param tree area tree of the process
+ * @param vma area being split
+ * @param addr page aligned address inside the area where the second half starts
+ * @return the second half
+ */
+vma_t* vma_split(krbtree_t* tree, vma_t* vma, uint64_t addr);
+
+/**
+ * @brief Removes a range from the tree, splitting areas sticking out of it
+ * @param tree area tree of the process
+ * @param start first address (page aligned)
+ * @param end address after the range (page aligned)
+ */
+void vma_remove_range(krbtree_t* tree, uint64_t start, uint64_t end);
+
+/**
+ * @brief Isolates a range into its own areas
+ * @param tree area tree of the process
+ * @param start first address (page aligned)
+ * @param end address after the range (page aligned)
+ * @return 1 if the range is fully covered by areas, 0 (and nothing split) if not
+ *
+ * Afterwards every area between start and end lies completely inside the range
+ * so its protection or flags can be changed on its own.
+ */
+bool vma_isolate_range(krbtree_t* tree, uint64_t start, uint64_t end);
+
+/**
+ * @brief Removes and frees every area in a tree
+ * @param tree area tree being cleared
+ */
+void vma_destroy_all(krbtree_t* tree);
+
+/**
+ * @brief Copies every area of a tree into an empty tree
+ * @param dest tree being filled
+ * @param src tree being copied
+ */
+void vma_copy(krbtree_t* dest, krbtree_t* src);
+
+/**
+ * @brief Checks a range is fully covered by areas allowing an access
+ * @param tree area tree of the process
+ * @param start first address of the range
+ * @param size size of the range in bytes
+ * @param prot PROT_ flags every area in the range must allow
+ * @return 1 if the whole range is valid, 0 otherwise
+ */
+bool vma_check(krbtree_t* tree, uint64_t start, uint64_t size, uint64_t prot);
+
+#endif /* VMA_H */
@@ -0,0 +1,79 @@
+/**
+ * @file zram.h
+ * @brief Compressed RAM Swap Device Interface
+ *
+ * Declares the in-memory swap device. Swapped out pages are compressed with
+ * LZ4 and packed into frames by a size class allocator, pages filled with a
+ * single repeated word are only stored as that word.
+ */
+#ifndef ZRAM_H
+#define ZRAM_H
+
+#include <kint.h>
+
+#define ZRAM_ENABLED 1           /* Register the device with swap */
+#define ZRAM_SIZE_RATIO 4        /* Slots are 1/ZRAM_SIZE_RATIO of physical memory in 4kb pages */
+#define ZRAM_CLASS_SIZE 64       /* Granularity of the size classes */
+#define ZRAM_MAX_COMPRESSED 3072 /* Pages compressing worse than this are stored as they are */
+#define ZRAM_CLASS_COUNT (ZRAM_MAX_COMPRESSED / ZRAM_CLASS_SIZE)
+#define ZRAM_HEADER_SIZE ZRAM_CLASS_SIZE /* Space taken by zram_page_t at the start of a pool frame */
+
+#define ZRAM_SAME 0     /* Slot holds a repeated word instead of an object */
+#define ZRAM_RAW 0x1000 /* Slot holds an uncompressed frame */
+
+/**
+ * @struct Pool frame carved into objects of one size class
+ */
+typedef struct zram_page_t
+{
+    struct zram_page_t* prev; /* Frames of the class with free objects */
+    struct zram_page_t* next;
+    uint32_t free; /* Offset of the first free object, 0 when the frame is full */
+    uint32_t used; /* Objects handed out */
+    uint32_t size; /* Object size of the class */
+} zram_page_t;
+
+/**
+ * @struct Statistics reported to user space
+ */
+typedef struct zram_stats_t
+{
+    uint64_t stored_pages;      /* Pages held by the device */
+    uint64_t same_pages;        /* Pages stored as a repeated word */
+    uint64_t raw_pages;         /* Pages that did not compress */
+    uint64_t original_size;     /* Bytes of the stored pages */
+    uint64_t compressed_size;   /* Bytes of the objects holding them */
+    uint64_t memory_used;       /* Bytes of frames used by the device */
+    uint64_t compress_count;    /* Pages compressed */
+    uint64_t compress_cycles;   /* TSC cycles spent compressing */
+    uint64_t decompress_count;  /* Pages decompressed */
+    uint64_t decompress_cycles; /* TSC cycles spent decompressing */
+} zram_stats_t;
+
+/**
+ * @struct Device state
+ */
+typedef struct zram_t
+{
+    uint64_t slots;
+    uint64_t* handles;                      /* Object address, or the repeated word, of every slot */
+    uint16_t* sizes;                        /* Object size of every slot, ZRAM_SAME or ZRAM_RAW */
+    zram_page_t* classes[ZRAM_CLASS_COUNT]; /* Frames with free objects per size class */
+    uint8_t* buffer;                        /* Compression output */
+    zram_stats_t stats;
+} zram_t;
+
+/**
+ * @brief Sets up the device and registers it with swap
+ *
+ * Called by swap_init before any other device is added.
+ */
+void zram_init();
+
+/**
+ * @brief Gets the current statistics
+ * @param stats filled in with the statistics
+ */
+void zram_stats(zram_stats_t* stats);
+
+#endif /* ZRAM_H */
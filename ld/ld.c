@@ -0,0 +1,519 @@
+/**
+ * @file ld.c
+ * @brief Dynamic Loader
+ *
+ * Started by the kernel instead of dynamically linked programs (PT_INTERP). It
+ * maps the shared libraries a program needs from /lib, applies their RELA
+ * relocations and those of the program, then jumps to the program entry.
+ * Function calls through the PLT are bound lazily on first use.
+ *
+ * The loader is a static executable linked at LD_BASE and must not depend on
+ * std, which is one of the libraries it loads.
+ */
+#include <elf.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LD_BASE 0x30000000         /* Where the loader itself is linked (see makefile) */
+#define LD_LIBRARY_BASE 0x20000000 /* Libraries are mapped up from here, below the loader and the std heap */
+#define LD_LIBRARY_PATH "/lib/"
+#define LD_MAX_OBJECTS 8
+#define LD_MAX_PHDRS 16
+#define LD_PAGE_SIZE 4096
+
+#define LD_ALIGN_DOWN(addr) ((addr) & ~(uint64_t)(LD_PAGE_SIZE - 1))
+#define LD_ALIGN_UP(addr) LD_ALIGN_DOWN((addr) + LD_PAGE_SIZE - 1)
+
+/* Kernel syscalls and flags */
+#define SYS_EXIT 1
+#define SYS_WRITE 4
+#define SYS_MMAP 7
+#define SYS_OPEN 12
+#define SYS_CLOSE 14
+#define SYS_MUNMAP 22
+
+#define K_PROT_EXEC 1
+#define K_PROT_WRITE 2
+#define K_PROT_READ 4
+
+#define K_MAP_ANONYMOUS 2
+#define K_MAP_FIXED 4
+#define K_MAP_FIXED_NOREPLACE 8
+
+/**
+ * @struct Loaded program or library
+ */
+typedef struct ld_object_t
+{
+    const char* name;
+    uint64_t base; /* Added to every address of the object, 0 for the program */
+    Elf64_Dyn* dynamic;
+    const char* strtab;
+    Elf64_Sym* symtab;
+    Elf64_Word* hash; /* DT_HASH table, nbucket, nchain, buckets, chains */
+    Elf64_Rela* rela;
+    uint64_t rela_size;
+    Elf64_Rela* jmprel; /* PLT relocations */
+    uint64_t jmprel_size;
+    uint64_t* pltgot;
+    void (**init_array)();
+    uint64_t init_array_size;
+    int bind_now; /* Linked with -z now, PLT slots are bound before the program starts */
+} ld_object_t;
+
+static ld_object_t ld_objects[LD_MAX_OBJECTS];
+static uint64_t ld_object_count;
+static uint64_t ld_next_base = LD_LIBRARY_BASE;
+
+/* PLT0 jumps here with the object and relocation index pushed */
+void ld_resolve();
+uint64_t ld_fixup(ld_object_t* object, uint64_t index);
+
+static long ld_syscall(long number, long a, long b, long c, long d, long e, long f)
+{
+    register long r10 __asm__("r10") = d;
+    register long r8 __asm__("r8") = e;
+    register long r9 __asm__("r9") = f;
+
+    long ret;
+    __asm__ volatile("int $0x80" : "=a"(ret) : "a"(number), "D"(a), "S"(b), "d"(c), "r"(r10), "r"(r8), "r"(r9) : "rcx", "r11", "memory");
+    return ret;
+}
+
+static uint64_t ld_strlen(const char* str)
+{
+    uint64_t length = 0;
+    while (str[length])
+        length++;
+    return length;
+}
+
+static int ld_strcmp(const char* a, const char* b)
+{
+    while (*a && *a == *b)
+    {
+        a++;
+        b++;
+    }
+    return (unsigned char)*a - (unsigned char)*b;
+}
+
+static void ld_memcpy(void* dest, const void* src, uint64_t size)
+{
+    for (uint64_t i = 0; i < size; i++)
+        ((uint8_t*)dest)[i] = ((const uint8_t*)src)[i];
+}
+
+static void ld_memset(void* dest, int value, uint64_t size)
+{
+    for (uint64_t i = 0; i < size; i++)
+        ((uint8_t*)dest)[i] = value;
+}
+
+/**
+ * @brief Prints an error on stderr and exits like a failed exec
+ */
+static void ld_fail(const char* message, const char* name)
+{
+    ld_syscall(SYS_WRITE, 2, (long)"ld.so: ", 7, 0, 0, 0);
+    ld_syscall(SYS_WRITE, 2, (long)message, ld_strlen(message), 0, 0, 0);
+    if (name)
+        ld_syscall(SYS_WRITE, 2, (long)name, ld_strlen(name), 0, 0, 0);
+    ld_syscall(SYS_WRITE, 2, (long)"\n", 1, 0, 0, 0);
+    ld_syscall(SYS_EXIT, 127, 0, 0, 0, 0, 0);
+    __builtin_unreachable();
+}
+
+static uint32_t ld_hash(const char* name)
+{
+    uint32_t hash = 0;
+    while (*name)
+    {
+        hash = (hash << 4) + (uint8_t)*name++;
+        uint32_t high = hash & 0xF0000000;
+        if (high)
+            hash ^= high >> 24;
+        hash &= ~high;
+    }
+    return hash;
+}
+
+/**
+ * @brief Reads the dynamic section of an object
+ */
+static void ld_parse_dynamic(ld_object_t* object)
+{
+    for (Elf64_Dyn* dyn = object->dynamic; dyn->d_tag != DT_NULL; dyn++)
+    {
+        uint64_t addr = object->base + dyn->d_un.d_ptr;
+        switch (dyn->d_tag)
+        {
+        case DT_STRTAB:
+            object->strtab = (const char*)addr;
+            break;
+        case DT_SYMTAB:
+            object->symtab = (Elf64_Sym*)addr;
+            break;
+        case DT_HASH:
+            object->hash = (Elf64_Word*)addr;
+            break;
+        case DT_RELA:
+            object->rela = (Elf64_Rela*)addr;
+            break;
+        case DT_RELASZ:
+            object->rela_size = dyn->d_un.d_val;
+            break;
+        case DT_JMPREL:
+            object->jmprel = (Elf64_Rela*)addr;
+            break;
+        case DT_PLTRELSZ:
+            object->jmprel_size = dyn->d_un.d_val;
+            break;
+        case DT_PLTGOT:
+            object->pltgot = (uint64_t*)addr;
+            break;
+        case DT_INIT_ARRAY:
+            object->init_array = (void (**)())addr;
+            break;
+        case DT_INIT_ARRAYSZ:
+            object->init_array_size = dyn->d_un.d_val;
+            break;
+        case DT_BIND_NOW:
+            object->bind_now = 1;
+            break;
+        case DT_FLAGS:
+            object->bind_now |= (dyn->d_un.d_val & DF_BIND_NOW) != 0;
+            break;
+        case DT_TEXTREL:
+            ld_fail("text relocations are not supported in ", object->name);
+        }
+    }
+}
+
+/**
+ * @brief Finds a symbol defined by an object
+ * @return symbol, NULL if the object does not define it
+ */
+static Elf64_Sym* ld_lookup_in(ld_object_t* object, const char* name, uint32_t hash)
+{
+    if (!object->hash)
+        return 0;
+
+    Elf64_Word nbucket = object->hash[0];
+    Elf64_Word* buckets = &object->hash[2];
+    Elf64_Word* chains = &buckets[nbucket];
+
+    for (Elf64_Word index = buckets[hash % nbucket]; index != STN_UNDEF; index = chains[index])
+    {
+        Elf64_Sym* sym = &object->symtab[index];
+        uint8_t bind = ELF64_ST_BIND(sym->st_info);
+        if (sym->st_shndx != SHN_UNDEF && (bind == STB_GLOBAL || bind == STB_WEAK) && ld_strcmp(object->strtab + sym->st_name, name) == 0)
+            return sym;
+    }
+    return 0;
+}
+
+/**
+ * @brief Finds the address of a symbol, the program first then libraries in load order
+ * @param skip object not searched (copy relocations)
+ * @return address, 0 for a missing weak symbol
+ */
+static uint64_t ld_lookup(const char* name, ld_object_t* skip, int weak)
+{
+    uint32_t hash = ld_hash(name);
+    for (uint64_t i = 0; i < ld_object_count; i++)
+    {
+        if (&ld_objects[i] == skip)
+            continue;
+        Elf64_Sym* sym = ld_lookup_in(&ld_objects[i], name, hash);
+        if (sym)
+            return ld_objects[i].base + sym->st_value;
+    }
+
+    if (!weak)
+        ld_fail("undefined symbol ", name);
+    return 0;
+}
+
+/**
+ * @brief Gets the symbol size for a copy relocation
+ */
+static uint64_t ld_lookup_size(const char* name, ld_object_t* skip)
+{
+    uint32_t hash = ld_hash(name);
+    for (uint64_t i = 0; i < ld_object_count; i++)
+    {
+        Elf64_Sym* sym = &ld_objects[i] != skip ? ld_lookup_in(&ld_objects[i], name, hash) : 0;
+        if (sym)
+            return sym->st_size;
+    }
+    return 0;
+}
+
+/**
+ * @brief Applies the RELA relocations of an object
+ */
+static void ld_relocate(ld_object_t* object)
+{
+    for (uint64_t i = 0; i < object->rela_size / sizeof(Elf64_Rela); i++)
+    {
+        Elf64_Rela* rela = &object->rela[i];
+        uint64_t* target = (uint64_t*)(object->base + rela->r_offset);
+        Elf64_Sym* sym = &object->symtab[ELF64_R_SYM(rela->r_info)];
+        const char* name = object->strtab + sym->st_name;
+        int weak = ELF64_ST_BIND(sym->st_info) == STB_WEAK;
+
+        /* Relocations without a symbol use 0 */
+        uint64_t type = ELF64_R_TYPE(rela->r_info);
+        uint64_t symbol = 0;
+        if (ELF64_R_SYM(rela->r_info) && (type == R_X86_64_64 || type == R_X86_64_GLOB_DAT || type == R_X86_64_JUMP_SLOT))
+            symbol = ld_lookup(name, 0, weak);
+
+        switch (type)
+        {
+        case R_X86_64_NONE:
+            break;
+        case R_X86_64_RELATIVE:
+            *target = object->base + rela->r_addend;
+            break;
+        case R_X86_64_64:
+            *target = symbol + rela->r_addend;
+            break;
+        case R_X86_64_GLOB_DAT:
+        case R_X86_64_JUMP_SLOT:
+            *target = symbol;
+            break;
+        case R_X86_64_COPY:
+            /* Data the program uses directly, the library GOT entries then point at the copy */
+            ld_memcpy(target, (void*)ld_lookup(name, object, 0), ld_lookup_size(name, object));
+            break;
+        default:
+            ld_fail("unsupported relocation in ", object->name);
+        }
+    }
+
+    if (!object->jmprel)
+        return;
+
+    if (object->bind_now || !object->pltgot)
+    {
+        for (uint64_t i = 0; i < object->jmprel_size / sizeof(Elf64_Rela); i++)
+            ld_fixup(object, i);
+        return;
+    }
+
+    /* PLT slots start out pointing back into the PLT, which calls ld_resolve */
+    for (uint64_t i = 0; i < object->jmprel_size / sizeof(Elf64_Rela); i++)
+        *(uint64_t*)(object->base + object->jmprel[i].r_offset) += object->base;
+    object->pltgot[1] = (uint64_t)object;
+    object->pltgot[2] = (uint64_t)ld_resolve;
+}
+
+/**
+ * @brief Binds a PLT slot on its first call
+ * @param object object the call came from
+ * @param index relocation index pushed by the PLT entry
+ * @return address of the function, stored in the slot for later calls
+ */
+uint64_t ld_fixup(ld_object_t* object, uint64_t index)
+{
+    Elf64_Rela* rela = &object->jmprel[index];
+    Elf64_Sym* sym = &object->symtab[ELF64_R_SYM(rela->r_info)];
+
+    uint64_t addr = ld_lookup(object->strtab + sym->st_name, 0, 0);
+    *(uint64_t*)(object->base + rela->r_offset) = addr;
+    return addr;
+}
+
+/**
+ * @brief Maps a shared library from /lib
+ * @param name DT_NEEDED name
+ */
+static void ld_load_library(const char* name)
+{
+    for (uint64_t i = 0; i < ld_object_count; i++)
+    {
+        if (ld_strcmp(ld_objects[i].name, name) == 0)
+            return;
+    }
+    if (ld_object_count == LD_MAX_OBJECTS)
+        ld_fail("too many libraries loading ", name);
+
+    char path[256];
+    uint64_t prefix = ld_strlen(LD_LIBRARY_PATH);
+    uint64_t length = ld_strlen(name);
+    if (prefix + length >= sizeof(path))
+        ld_fail("library name too long ", name);
+    ld_memcpy(path, LD_LIBRARY_PATH, prefix);
+    ld_memcpy(path + prefix, name, length + 1);
+
+    long fd = ld_syscall(SYS_OPEN, (long)path, 0, 0, 0, 0, 0);
+    if (fd < 0)
+        ld_fail("cannot open ", path);
+
+    /* Headers are read through a mapping of the first page, where the library goes next */
+    uint64_t base = ld_next_base;
+    Elf64_Ehdr* header = (Elf64_Ehdr*)ld_syscall(SYS_MMAP, base, LD_PAGE_SIZE, K_PROT_READ, K_MAP_FIXED_NOREPLACE, fd, 0);
+    if ((long)header == -1 || header->e_ident[EI_MAG0] != ELFMAG0 || header->e_ident[EI_MAG1] != ELFMAG1 || header->e_ident[EI_MAG2] != ELFMAG2 ||
+        header->e_ident[EI_MAG3] != ELFMAG3 || header->e_type != ET_DYN || header->e_phnum > LD_MAX_PHDRS ||
+        header->e_phoff + header->e_phnum * sizeof(Elf64_Phdr) > LD_PAGE_SIZE)
+        ld_fail("not a shared library ", path);
+
+    Elf64_Phdr phdrs[LD_MAX_PHDRS];
+    uint16_t phnum = header->e_phnum;
+    ld_memcpy(phdrs, (uint8_t*)header + header->e_phoff, phnum * sizeof(Elf64_Phdr));
+    ld_syscall(SYS_MUNMAP, (long)header, LD_PAGE_SIZE, 0, 0, 0, 0);
+
+    uint64_t span = 0;
+    for (uint16_t i = 0; i < phnum; i++)
+    {
+        if (phdrs[i].p_type == PT_LOAD && phdrs[i].p_vaddr + phdrs[i].p_memsz > span)
+            span = phdrs[i].p_vaddr + phdrs[i].p_memsz;
+    }
+
+    if (base + LD_ALIGN_UP(span) > LD_BASE)
+        ld_fail("out of library address space loading ", path);
+    ld_next_base = LD_ALIGN_UP(base + span);
+
+    ld_object_t* object = &ld_objects[ld_object_count++];
+    object->name = name;
+    object->base = base;
+
+    for (uint16_t i = 0; i < phnum; i++)
+    {
+        Elf64_Phdr* ph = &phdrs[i];
+        if (ph->p_type == PT_DYNAMIC)
+            object->dynamic = (Elf64_Dyn*)(base + ph->p_vaddr);
+        if (ph->p_type != PT_LOAD)
+            continue;
+
+        long prot = ((ph->p_flags & PF_R) ? K_PROT_READ : 0) | ((ph->p_flags & PF_W) ? K_PROT_WRITE : 0) | ((ph->p_flags & PF_X) ? K_PROT_EXEC : 0);
+        uint64_t start = base + LD_ALIGN_DOWN(ph->p_vaddr);
+        uint64_t file_end = base + LD_ALIGN_UP(ph->p_vaddr + ph->p_filesz);
+        uint64_t end = base + LD_ALIGN_UP(ph->p_vaddr + ph->p_memsz);
+
+        /* Text and read only data stay shared with every other process through the page cache */
+        if (file_end > start &&
+            ld_syscall(SYS_MMAP, start, file_end - start, prot, K_MAP_FIXED, fd, LD_ALIGN_DOWN(ph->p_offset)) == -1)
+            ld_fail("cannot map ", path);
+
+        /* The file continues after the data, bss starts zeroed */
+        if (ph->p_memsz > ph->p_filesz)
+        {
+            uint64_t bss = base + ph->p_vaddr + ph->p_filesz;
+            ld_memset((void*)bss, 0, (file_end < end ? file_end : end) - bss);
+            if (end > file_end &&
+                ld_syscall(SYS_MMAP, file_end, end - file_end, prot, K_MAP_ANONYMOUS | K_MAP_FIXED, -1, 0) == -1)
+                ld_fail("cannot map ", path);
+        }
+    }
+
+    ld_syscall(SYS_CLOSE, fd, 0, 0, 0, 0, 0);
+
+    if (!object->dynamic)
+        ld_fail("no dynamic section in ", path);
+    ld_parse_dynamic(object);
+}
+
+/**
+ * @brief Loads the program's libraries and relocates everything
+ * @param sp initial stack pointer (argc, argv, envp, auxv)
+ * @return program entry point
+ */
+uint64_t ld_main(uint64_t* sp)
+{
+    uint64_t argc = sp[0];
+    uint64_t* envp = sp + 1 + argc + 1;
+    while (*envp)
+        envp++;
+
+    Elf64_Phdr* phdrs = 0;
+    uint64_t phnum = 0;
+    uint64_t entry = 0;
+    for (Elf64_auxv_t* auxv = (Elf64_auxv_t*)(envp + 1); auxv->a_type != AT_NULL; auxv++)
+    {
+        if (auxv->a_type == AT_PHDR)
+            phdrs = (Elf64_Phdr*)auxv->a_un.a_val;
+        else if (auxv->a_type == AT_PHNUM)
+            phnum = auxv->a_un.a_val;
+        else if (auxv->a_type == AT_ENTRY)
+            entry = auxv->a_un.a_val;
+    }
+    if (!phdrs)
+        ld_fail("started without program headers", 0);
+
+    /* The program is not position independent, its addresses are used as they are */
+    ld_object_t* program = &ld_objects[ld_object_count++];
+    program->name = "";
+    for (uint64_t i = 0; i < phnum; i++)
+    {
+        if (phdrs[i].p_type == PT_DYNAMIC)
+            program->dynamic = (Elf64_Dyn*)phdrs[i].p_vaddr;
+    }
+    if (!program->dynamic)
+        return entry;
+    ld_parse_dynamic(program);
+
+    for (Elf64_Dyn* dyn = program->dynamic; dyn->d_tag != DT_NULL; dyn++)
+    {
+        if (dyn->d_tag == DT_NEEDED)
+            ld_load_library(program->strtab + dyn->d_un.d_val);
+    }
+
+    /* Libraries first, copy relocations in the program read their initialized data */
+    for (uint64_t i = 1; i < ld_object_count; i++)
+        ld_relocate(&ld_objects[i]);
+    ld_relocate(program);
+
+    for (uint64_t i = ld_object_count - 1; i > 0; i--)
+    {
+        for (uint64_t j = 0; j < ld_objects[i].init_array_size / sizeof(void*); j++)
+            ld_objects[i].init_array[j]();
+    }
+
+    return entry;
+}
+
+/**
+ * @brief Entry point, the program gets the untouched initial stack
+ */
+__attribute__((naked)) void _start()
+{
+    __asm__ volatile("mov %rsp, %rbx\n\t"
+                     "mov %rsp, %rdi\n\t"
+                     "and $-16, %rsp\n\t"
+                     "call ld_main\n\t"
+                     "mov %rbx, %rsp\n\t"
+                     "xor %edx, %edx\n\t"
+                     "jmp *%rax\n\t");
+}
+
+/**
+ * @brief Lazy binding trampoline, argument registers are kept for the real call
+ *
+ * Entered from PLT0 with the object and the relocation index on the stack.
+ * The loader is built without SSE so vector argument registers stay intact.
+ */
+__attribute__((naked)) void ld_resolve()
+{
+    __asm__ volatile("push %rax\n\t"
+                     "push %rcx\n\t"
+                     "push %rdx\n\t"
+                     "push %rsi\n\t"
+                     "push %rdi\n\t"
+                     "push %r8\n\t"
+                     "push %r9\n\t"
+                     "mov 56(%rsp), %rdi\n\t"
+                     "mov 64(%rsp), %rsi\n\t"
+                     "call ld_fixup\n\t"
+                     "mov %rax, %r11\n\t"
+                     "pop %r9\n\t"
+                     "pop %r8\n\t"
+                     "pop %rdi\n\t"
+                     "pop %rsi\n\t"
+                     "pop %rdx\n\t"
+                     "pop %rcx\n\t"
+                     "pop %rax\n\t"
+                     "add $16, %rsp\n\t"
+                     "jmp *%r11\n\t");
+}
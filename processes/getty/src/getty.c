@@ -1,5 +1,6 @@
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <wait.h>
@@ -38,13 +39,15 @@ int main()
 
         printf("Login successfull. Welcome %s!\n", username);
 
-        uint64_t pid = fork();
+        /* Shell replaces the child right away, no need to copy the address space */
+        uint64_t pid = vfork();
 
         if (pid == 0)
         {
             setpgid(0, 0);
             tcsetpgrp(0, 0);
             execve("shell", 0, 0);
+            exit(1);
         }
         int status;
         waitpid(pid, &status, 0);
@@ -1,5 +1,7 @@
+#define _GNU_SOURCE /* posix_spawn_file_actions_addtcsetpgrp_np */
 #include <ctype.h>
 #include <memory.h>
+#include <spawn.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -595,13 +597,30 @@ void execute(arg_list_t args)
             }
         }
 
-        uint64_t pid = fork();
+        /* Child gets its own process group owning the terminal, same as setpgid and tcsetpgrp after fork */
+        posix_spawnattr_t attr;
+        posix_spawnattr_init(&attr);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+        posix_spawnattr_setpgroup(&attr, 0);
 
-        if (pid == 0)
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_addtcsetpgrp_np(&actions, 0);
+
+        char** argv = malloc((args.count + 1) * sizeof(char*));
+        memcpy(argv, args.args, args.count * sizeof(char*));
+        argv[args.count] = 0;
+
+        pid_t pid;
+        int error = posix_spawn(&pid, args.args[0], &actions, &attr, argv, 0);
+        free(argv);
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attr);
+
+        if (error)
         {
-            setpgid(0, 0);
-            tcsetpgrp(0, 0);
-            execve(args.args[0], 0, 0);
+            printf("%s: command not found\n", args.args[0]);
+            return;
         }
         int status;
         waitpid(pid, &status, 0);
@@ -1,27 +1,34 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <wait.h>
 
 int main()
 {
-    int pid = fork();
-    if (pid)
+    /* Keeps a getty on the console, waiting in the kernel instead of spinning so idle CPUs can halt */
+    while (1)
     {
-        FILE* tty = fopen("/dev/vcon0", 0);
+        int pid = fork();
+        if (pid == 0)
+        {
+            FILE* tty = fopen("/dev/vcon0", 0);
 
-        dup2((int)tty, 0);
-        dup2((int)tty, 1);
-        dup2((int)tty, 2);
+            dup2((int)tty, 0);
+            dup2((int)tty, 1);
+            dup2((int)tty, 2);
 
-        // fclose(tty);
+            // fclose(tty);
 
-        // setsid(0, 0);
-        setpgid(0, 0);
-        tcsetpgrp(0, 0);
+            // setsid(0, 0);
+            setpgid(0, 0);
+            tcsetpgrp(0, 0);
 
-        execve("getty", 0, 0);
-    }
+            execve("getty", 0, 0);
+            exit(1);
+        }
 
-    while (1)
-        ;
-}
\ No newline at end of file
+        /* Started again once it exits */
+        int status;
+        waitpid(pid, &status, 0);
+    }
+}
@@ -0,0 +1,46 @@
+/**
+ * @file acpi.c
+ * @brief ACPI Table Lookup Implementation
+ *
+ * Walks the XSDT, or the RSDT of ACPI 1.0 firmware, for a table by signature.
+ * Tables are read through the identity mapping of the kernel page table.
+ */
+#include <arch/acpi.h>
+#include <memory/kglobals.h>
+#include <memory/kmemory.h>
+
+/**
+ * @brief Checks that the bytes of a table add up to 0
+ */
+static bool acpi_checksum(void* table, uint64_t length)
+{
+    uint8_t sum = 0;
+    for (uint64_t i = 0; i < length; i++)
+        sum += ((uint8_t*)table)[i];
+    return sum == 0;
+}
+
+acpi_header_t* acpi_find_table(const char* signature)
+{
+    acpi_rsdp_t* rsdp = PREBOOT_INFO->acpi_rsdp;
+    if (!rsdp || kmemcmp(rsdp->signature, "RSD PTR ", 8) != 0 || !acpi_checksum(rsdp, 20))
+        return 0;
+
+    /* The XSDT holds 64 bit pointers, the RSDT 32 bit ones */
+    bool extended = rsdp->revision >= 2 && rsdp->xsdt_address;
+    acpi_header_t* root = extended ? (acpi_header_t*)rsdp->xsdt_address : (acpi_header_t*)(uint64_t)rsdp->rsdt_address;
+    if (!root || !acpi_checksum(root, root->length))
+        return 0;
+
+    uint64_t entry_size = extended ? sizeof(uint64_t) : sizeof(uint32_t);
+    uint64_t count = (root->length - sizeof(acpi_header_t)) / entry_size;
+    uint8_t* entries = (uint8_t*)(root + 1);
+    for (uint64_t i = 0; i < count; i++)
+    {
+        uint64_t address = extended ? *(uint64_t*)(entries + i * entry_size) : *(uint32_t*)(entries + i * entry_size);
+        acpi_header_t* table = (acpi_header_t*)address;
+        if (table && kmemcmp(table->signature, signature, 4) == 0 && acpi_checksum(table, table->length))
+            return table;
+    }
+    return 0;
+}
@@ -0,0 +1,270 @@
+/**
+ * @file apic.c
+ * @brief Local APIC Implementation
+ *
+ * Implements register access in xAPIC and x2APIC mode, the CPU list of the
+ * MADT, the one shot timer and the interrupt command register.
+ */
+#include <arch/acpi.h>
+#include <arch/apic.h>
+#include <arch/io.h>
+#include <kmath.h>
+#include <memory/kglobals.h>
+#include <memory/memoryMap.h>
+#include <memory/pageTable.h>
+
+#define IA32_APIC_BASE 0x1B
+#define APIC_BASE_X2APIC (1 << 10) /* Registers are MSRs */
+#define APIC_BASE_ENABLE (1 << 11)
+#define X2APIC_MSR 0x800 /* MSR of register 0, one MSR per 16 bytes of the memory mapped layout */
+#define IA32_TSC_DEADLINE 0x6E0
+#define CPUID_TSC_DEADLINE (1 << 24) /* Leaf 1, ecx */
+
+/* Register offsets of the memory mapped layout */
+#define APIC_ID 0x20
+#define APIC_TPR 0x80
+#define APIC_EOI 0xB0
+#define APIC_SVR 0xF0
+#define APIC_ICR_LOW 0x300
+#define APIC_ICR_HIGH 0x310
+#define APIC_LVT_TIMER 0x320
+#define APIC_LVT_LINT0 0x350
+#define APIC_LVT_LINT1 0x360
+#define APIC_TIMER_INITIAL 0x380
+#define APIC_TIMER_CURRENT 0x390
+#define APIC_TIMER_DIVIDE 0x3E0
+
+#define APIC_SVR_ENABLE 0x100
+#define APIC_LVT_MASKED 0x10000
+#define APIC_LVT_TSC_DEADLINE 0x40000 /* One shot mode is 0 */
+#define APIC_DELIVERY_NMI 0x400
+#define APIC_DELIVERY_EXTINT 0x700
+#define APIC_ICR_INIT 0x4500    /* INIT, level asserted */
+#define APIC_ICR_STARTUP 0x4600 /* Startup, the vector is the page of the startup code */
+#define APIC_ICR_PENDING 0x1000 /* Set until the message is accepted, xAPIC only */
+#define APIC_DIVIDE_16 0x3
+
+#define MADT_LAPIC 0     /* Processor local APIC entry */
+#define MADT_X2APIC 9    /* Processor local x2APIC entry, ids above 254 */
+#define MADT_ENABLED 0x1 /* Usable now, the other CPUs can only be hot added */
+
+/**
+ * @struct Multiple APIC description table, the entries follow
+ */
+typedef struct apic_madt_t
+{
+    acpi_header_t header;
+    uint32_t lapic_address;
+    uint32_t flags;
+    uint8_t entries[];
+} __attribute__((packed)) apic_madt_t;
+
+/**
+ * @struct Header of a MADT entry
+ */
+typedef struct apic_madt_entry_t
+{
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed)) apic_madt_entry_t;
+
+/**
+ * @struct MADT_LAPIC entry
+ */
+typedef struct apic_madt_lapic_t
+{
+    apic_madt_entry_t header;
+    uint8_t processor_id;
+    uint8_t apic_id;
+    uint32_t flags;
+} __attribute__((packed)) apic_madt_lapic_t;
+
+/**
+ * @struct MADT_X2APIC entry
+ */
+typedef struct apic_madt_x2apic_t
+{
+    apic_madt_entry_t header;
+    uint16_t reserved;
+    uint32_t apic_id;
+    uint32_t flags;
+    uint32_t processor_uid;
+} __attribute__((packed)) apic_madt_x2apic_t;
+
+static uint32_t apic_read(uint32_t reg)
+{
+    if (APIC->x2apic)
+        return (uint32_t)rdmsr(X2APIC_MSR + reg / 16);
+    return *(volatile uint32_t*)(APIC_START + reg);
+}
+
+static void apic_write(uint32_t reg, uint32_t value)
+{
+    if (APIC->x2apic)
+        wrmsr(X2APIC_MSR + reg / 16, value);
+    else
+        *(volatile uint32_t*)(APIC_START + reg) = value;
+}
+
+/**
+ * @brief Writes the interrupt command register and waits until the message is accepted
+ * @param low delivery mode and vector
+ */
+static void apic_send_icr(uint32_t apic_id, uint32_t low)
+{
+    /* x2APIC takes both halves in a single write and never reports pending */
+    if (APIC->x2apic)
+    {
+        wrmsr(X2APIC_MSR + APIC_ICR_LOW / 16, ((uint64_t)apic_id << 32) | low);
+        return;
+    }
+
+    apic_write(APIC_ICR_HIGH, apic_id << 24);
+    apic_write(APIC_ICR_LOW, low);
+    while (apic_read(APIC_ICR_LOW) & APIC_ICR_PENDING)
+        __asm__ volatile("pause");
+}
+
+/**
+ * @brief Turns on the APIC of the calling CPU in the mode of the bootstrap processor
+ */
+static void apic_enable()
+{
+    wrmsr(IA32_APIC_BASE, rdmsr(IA32_APIC_BASE) | APIC_BASE_ENABLE | (APIC->x2apic ? APIC_BASE_X2APIC : 0));
+    apic_write(APIC_TPR, 0);
+    apic_write(APIC_SVR, APIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+    apic_write(APIC_LVT_LINT1, APIC_DELIVERY_NMI);
+}
+
+/**
+ * @brief Points the timer of the calling CPU at the timer vector, disarmed
+ */
+static void apic_timer_init()
+{
+    if (APIC->tsc_deadline)
+    {
+        apic_write(APIC_LVT_TIMER, APIC_TIMER_VECTOR | APIC_LVT_TSC_DEADLINE);
+        return;
+    }
+
+    apic_write(APIC_TIMER_DIVIDE, APIC_DIVIDE_16);
+    apic_write(APIC_LVT_TIMER, APIC_TIMER_VECTOR);
+    apic_write(APIC_TIMER_INITIAL, 0);
+}
+
+void apic_init()
+{
+    uint64_t base = rdmsr(IA32_APIC_BASE);
+    APIC->x2apic = (base & APIC_BASE_X2APIC) != 0;
+    APIC->base = base & PAGE_MASK;
+
+    uint32_t eax, ebx, ecx, edx;
+    __asm__ volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1), "c"(0));
+    APIC->tsc_deadline = (ecx & CPUID_TSC_DEADLINE) != 0;
+
+    /* Every address space shares the kernel half, one mapping serves every CPU */
+    if (!APIC->x2apic)
+    {
+        pageTable_addPage(KERNEL_PAGE_TABLE, (void*)APIC_START, APIC->base / PAGE_SIZE_4KB, 1, PAGE_SIZE_4KB, 0);
+        *pageTable_find_entry(KERNEL_PAGE_TABLE, APIC_START).entry_ptr |= PAGE_PCD | PAGE_PWT;
+        __asm__ volatile("invlpg (%0)" ::"r"(APIC_START) : "memory");
+    }
+
+    apic_enable();
+    apic_write(APIC_LVT_LINT0, APIC_DELIVERY_EXTINT); /* The PIC */
+
+    if (!APIC->tsc_deadline)
+    {
+        /* Counts down from the top over a TSC window */
+        apic_write(APIC_TIMER_DIVIDE, APIC_DIVIDE_16);
+        apic_write(APIC_LVT_TIMER, APIC_LVT_MASKED);
+        apic_write(APIC_TIMER_INITIAL, 0xFFFFFFFF);
+        uint64_t end = rdtsc() + USAGE->tsc_hz * APIC_CALIBRATE_MS / 1000;
+        while (rdtsc() < end)
+            ;
+        uint64_t counted = 0xFFFFFFFF - apic_read(APIC_TIMER_CURRENT);
+        apic_write(APIC_TIMER_INITIAL, 0);
+
+        APIC->timer_hz = MAX(counted * 1000 / APIC_CALIBRATE_MS, 1);
+        APIC->timer_max = USAGE->tsc_hz; /* A second, well inside 32 bits of count */
+    }
+    apic_timer_init();
+}
+
+void apic_init_ap()
+{
+    apic_enable();
+    apic_write(APIC_LVT_LINT0, APIC_LVT_MASKED);
+    apic_timer_init();
+}
+
+void apic_timer_arm(uint64_t deadline)
+{
+    if (APIC->tsc_deadline)
+    {
+        /* Orders the LVT write of the memory mapped layout before the MSR */
+        __asm__ volatile("mfence" ::: "memory");
+        wrmsr(IA32_TSC_DEADLINE, MAX(deadline, 1));
+        return;
+    }
+
+    uint64_t now = rdtsc();
+    uint64_t cycles = deadline > now ? MIN(deadline - now, APIC->timer_max) : 0;
+    apic_write(APIC_TIMER_INITIAL, MAX(cycles * APIC->timer_hz / USAGE->tsc_hz, 1));
+}
+
+void apic_timer_stop()
+{
+    if (APIC->tsc_deadline)
+        wrmsr(IA32_TSC_DEADLINE, 0);
+    else
+        apic_write(APIC_TIMER_INITIAL, 0);
+}
+
+uint64_t apic_enumerate(uint32_t* apic_ids, uint64_t max)
+{
+    apic_madt_t* madt = (apic_madt_t*)acpi_find_table("APIC");
+    if (!madt)
+        return 0;
+
+    uint64_t count = 0;
+    uint8_t* end = (uint8_t*)madt + madt->header.length;
+    for (uint8_t* entry = madt->entries; entry + sizeof(apic_madt_entry_t) <= end && count < max; entry += ((apic_madt_entry_t*)entry)->length)
+    {
+        apic_madt_entry_t* header = (apic_madt_entry_t*)entry;
+        if (header->length < sizeof(apic_madt_entry_t))
+            break;
+
+        if (header->type == MADT_LAPIC && (((apic_madt_lapic_t*)entry)->flags & MADT_ENABLED))
+            apic_ids[count++] = ((apic_madt_lapic_t*)entry)->apic_id;
+        else if (header->type == MADT_X2APIC && (((apic_madt_x2apic_t*)entry)->flags & MADT_ENABLED))
+            apic_ids[count++] = ((apic_madt_x2apic_t*)entry)->apic_id;
+    }
+    return count;
+}
+
+uint32_t apic_id()
+{
+    uint32_t id = apic_read(APIC_ID);
+    return APIC->x2apic ? id : id >> 24;
+}
+
+void apic_eoi()
+{
+    apic_write(APIC_EOI, 0);
+}
+
+void apic_send_ipi(uint32_t apic_id, uint8_t vector)
+{
+    apic_send_icr(apic_id, vector);
+}
+
+void apic_send_init(uint32_t apic_id)
+{
+    apic_send_icr(apic_id, APIC_ICR_INIT);
+}
+
+void apic_send_startup(uint32_t apic_id, uint8_t page)
+{
+    apic_send_icr(apic_id, APIC_ICR_STARTUP | page);
+}
@@ -6,24 +6,14 @@
  */
 #include <arch/gdt.h>
 
-#include <memory/kglobals.h>
 #include <memory/kmemory.h>
-#include <memory/memoryMap.h>
 
-#define GDT_ENTRIES 7
-
-void KERNEL_InitGDT()
+void KERNEL_InitGDT(GDTEntry* gdt, TSS64* tss)
 {
-    GDTEntry* gdt = (GDTEntry*)kmalloc(sizeof(GDTEntry) * GDT_ENTRIES);
     kmemset(gdt, 0, sizeof(GDTEntry) * GDT_ENTRIES);
-    TSS64* tss = TSS;
-    kmemset(tss, 0, sizeof(TSS64));
-
-    // Setup kernel stack (must be mapped in user space page tables with supervisor-only permission)
-    tss->rsp0 = 0x00000037ffff0000; //(uint64_t)KERNEL_STACK_START + (uint64_t)KERNEL_STACK_SIZE;
 
-    // Optionally set IST[0] if you use it (like for #DF or NMI)
-    // tss->ist1 = (uint64_t)some_emergency_stack;
+    // rsp0 is the kernel stack of the running process, set on every switch
+    tss->rsp0 = 0;
 
     // GDT Entries
     gdt[0] = (GDTEntry){0}; // Null descriptor
@@ -6,15 +6,19 @@
  */
 
 #include "efibind.h"
+#include <arch/apic.h>
 #include <arch/idt.h>
 #include <arch/pic.h>
+#include <arch/smp.h>
 #include <drivers/fbcon.h>
 #include <drivers/keyboard.h>
 #include <drivers/mouse.h>
 #include <efi.h>
 #include <efilib.h>
 #include <kernel/scheduler.h>
+#include <kernel/softirq.h>
 #include <kernel/syscalls.h>
+#include <kernel/tick.h>
 #include <memory/kglobals.h>
 #include <memory/kmemory.h>
 #include <memory/memoryMap.h>
@@ -82,18 +86,30 @@ void KERNEL_InitIDT()
     data.idtr.base = (uintptr_t)&data.idt[0];
     data.idtr.limit = (uint16_t)sizeof(IDTEntry) * (IDT_MAX_DESCRIPTORS - 1);
     void** virtual_isr = EXTERN(void*, isr_stub_table);
+    /* Entries from user mode land on the kernel stack of the process (TSS rsp0), entries in the kernel stay on the current stack */
     for (int vector = 0; vector < 256; vector++)
     {
-        idt_set_descriptor(vector, EXTERN(void*, virtual_isr[vector]), 0, 1);
+        idt_set_descriptor(vector, EXTERN(void*, virtual_isr[vector]), 0, 0);
     }
-    idt_set_descriptor(0x20, EXTERN(void*, virtual_isr[0x20]), 0, 1);
-    idt_set_descriptor(0x80, EXTERN(void*, virtual_isr[0x80]), 3, 1);
+    idt_set_descriptor(0x8, EXTERN(void*, virtual_isr[0x8]), 0, 1); /* A stack overflow double faults, it needs a stack of its own */
+    idt_set_descriptor(0x80, EXTERN(void*, virtual_isr[0x80]), 3, 0);
     __asm__ volatile("lidt %0" : : "m"(data.idtr)); /* load the new IDT */
 }
 
-void exception_handler()
+void KERNEL_LoadIDT()
 {
-    switch (INTERRUPT_INFO->irq_number)
+    __asm__ volatile("lidt %0" : : "m"(data.idtr));
+}
+
+void interrupt_enter(interrupt_frame_t* frame)
+{
+    smp_lock();
+    usage_enter(frame);
+}
+
+void exception_handler(interrupt_frame_t* frame)
+{
+    switch (frame->irq_number)
     {
     case 0x0: /* Divide Error (#DE) */
         process_signal(*CURRENT_PROCESS, SIGFPE);
@@ -135,10 +151,10 @@ void exception_handler()
         break;
     case 0xD: /* General Protection Fault (#GP) */
     {
-        uint16_t selector = ((INTERRUPT_INFO->error_code) & 0xFFFF);
-        bool is_external = (((INTERRUPT_INFO->error_code) >> 17) & 1);
-        bool is_ldt_or_idt = (((INTERRUPT_INFO->error_code) >> 16) & 1);
-        if (INTERRUPT_INFO->error_code == 0)
+        uint16_t selector = ((frame->regs.error_code) & 0xFFFF);
+        bool is_external = (((frame->regs.error_code) >> 17) & 1);
+        bool is_ldt_or_idt = (((frame->regs.error_code) >> 16) & 1);
+        if (frame->regs.error_code == 0)
         {
             process_signal(*CURRENT_PROCESS, SIGILL);
         }
@@ -161,20 +177,15 @@ void exception_handler()
         __asm__ volatile("mov %%cr3, %0\n\t" : "=r"(current_cr3) : :);
         __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(*KERNEL_PAGE_TABLE) :);
 
-        if (INTERRUPT_INFO->error_code & 2) /* Write Fault */
+        /* Copy on write and demand zero pages */
+        if (process_resolve_fault(*CURRENT_PROCESS, cr2, (frame->regs.error_code & 2) != 0))
         {
-            page_lookup_result_t entry_results = pageTable_find_entry(&(*CURRENT_PROCESS)->page_table, cr2);
-            if (entry_results.size && entry_results.entry & PAGE_COW)
-            {
-                uint64_t page = (uint64_t)pages_allocatePage(entry_results.size);
-                kmemcpy((void*)page, (void*)(entry_results.entry & PAGE_MASK), entry_results.size);
-                pageTable_addPage(&(*CURRENT_PROCESS)->page_table, (void*)cr2, page / entry_results.size, 1, entry_results.size, 4);
-                __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(current_cr3) :);
-                return;
-            }
+            __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(current_cr3) :);
+            return;
         }
 
-        bool present = (INTERRUPT_INFO->error_code & 0x1) != 0;
+        __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(current_cr3) :);
+        bool present = (frame->regs.error_code & 0x1) != 0;
 
         if (!present)
         {
@@ -201,25 +212,8 @@ void exception_handler()
         process_signal(*CURRENT_PROCESS, SIGFPE);
         break;
     default:
-        __asm__ volatile("mov %0, %%rsp\n\t" : : "r"(INTERRUPT_INFO->rsp) :);
-        __asm__ volatile("pop %%r15\n\t"
-                         "pop %%r14\n\t"
-                         "pop %%r13\n\t"
-                         "pop %%r12\n\t"
-                         "pop %%r11\n\t"
-                         "pop %%r10\n\t"
-                         "pop %%r9\n\t"
-                         "pop %%r8\n\t"
-                         "pop %%rbp\n\t"
-                         "pop %%rdi\n\t"
-                         "pop %%rsi\n\t"
-                         "pop %%rdx\n\t"
-                         "pop %%rcx\n\t"
-                         "pop %%rbx\n\t"
-                         "pop %%rax\n\t"
-                         :
-                         :
-                         :);
+        /* Unhandled, stop with the registers of the faulting code loaded and r12 at its frame */
+        __asm__ volatile("mov %0, %%rsp\n\t" : : "r"(&frame->regs) :);
         __asm__ volatile("pop %%r15\n\t"
                          "pop %%r14\n\t"
                          "pop %%r13\n\t"
@@ -238,47 +232,48 @@ void exception_handler()
                          :
                          :
                          :);
-        __asm__ volatile("mov %0, %%rsp\n\t" : : "r"(INTERRUPT_INFO) :);
-        __asm__ volatile("pop %%rdx\n\t"
-                         "pop %%rcx\n\t"
-                         "pop %%rbx\n\t"
-                         "pop %%rax\n\t"
-                         :
-                         :
-                         :);
+        __asm__ volatile("lea -136(%%rsp), %%r12\n\t" : : :);
         __asm__ volatile("hlt\n\t");
     }
 }
 
-void interrupt_handler()
+void interrupt_handler(interrupt_frame_t* frame)
 {
+    /* Acknowledged first, the rest of the work is deferred to threads */
+    if (frame->irq_number >= 0x28 && frame->irq_number < 0x30)
+        outb(PIC2_CMD, PIC_EOI);
+    if (frame->irq_number < 0x30)
+        outb(PIC1_CMD, PIC_EOI);
+    else if (frame->irq_number != APIC_SPURIOUS_VECTOR)
+        apic_eoi();
+
     {
-        switch (INTERRUPT_INFO->irq_number)
+        switch (frame->irq_number)
         {
         case 0x2C:
             mouse_isr();
             break;
         case 0x21:
             keyboard_isr();
-            vcon_handle_user_input();
+            tasklet_schedule(VCON_TASKLET);
+            break;
+        case 0x20: /* PIT, masked once the APIC timer ticks */
+            break;
+        case APIC_TIMER_VECTOR:
+            tick_handler();
+            break;
+        case SMP_VECTOR_RESCHEDULE: /* Picked again by the idle loop, or on the way out when need_resched is set */
+            break;
+        case SMP_VECTOR_TIMER:
+            tick_rearm();
+            break;
+        case SMP_VECTOR_TLB: /* Flushed when the kernel lock was taken */
+        case APIC_SPURIOUS_VECTOR:
             break;
-        case 0x20:
-        {
-            process_t* next = scheduler_nextProcess();
-            
-            (*CURRENT_PROCESS) = next;
-            INTERRUPT_INFO->cr3 = (uint64_t)(*CURRENT_PROCESS)->page_table;
-            INTERRUPT_INFO->rsp = (uint64_t)(&(*CURRENT_PROCESS)->process_stack_signature);
-            TSS->ist1 = (uint64_t)(*CURRENT_PROCESS) + sizeof(process_stack_layout_t);
-
-   
-         
-        }
-        break;
         default:
         // will handle later
-        __asm__ volatile("mov %0, %%r12\n\t" : : "r"(INTERRUPT_INFO->rsp));
-        __asm__ volatile("mov %0, %%r15\n\t" : : "r"(INTERRUPT_INFO->irq_number));
+        __asm__ volatile("mov %0, %%r12\n\t" : : "r"(frame));
+        __asm__ volatile("mov %0, %%r15\n\t" : : "r"(frame->irq_number));
 
             __asm__ volatile("hlt\n");
 
@@ -287,10 +282,45 @@ void interrupt_handler()
     }
 }
 
-void check_signal()
+/**
+ * @brief Loads the address space and fs base of the current process into a frame returning to user mode
+ *
+ * Frames returning into the kernel keep the page table they were taken with
+ * and the kernel lock, user mode runs without it.
+ */
+static void check_signal_resume(interrupt_frame_t* frame, bool user)
 {
+    if (!user)
+        return;
+    usage_leave();
+    process_load_fs(*CURRENT_PROCESS);
+    frame->cr3 = (uint64_t)(*CURRENT_PROCESS)->page_table;
+    smp_unlock();
+}
+
+void check_signal(interrupt_frame_t* frame)
+{
+    /* Signals are taken on the way back to user mode, faults act right away */
+    bool user = (frame->regs.cs & 3) != 0;
+    if (!user && frame->irq_number >= 32)
+        return;
+
+    /* The tick or a woken process asked for the CPU, the switch happens here before returning to user mode */
+    if (user && smp_cpu()->need_resched)
+        scheduler_yield();
+
+    /* Another thread exited the process */
+    if ((*CURRENT_PROCESS)->flags & PROCESS_EXITING)
+    {
+        (*CURRENT_PROCESS)->flags &= ~PROCESS_EXITING;
+        process_exit((*CURRENT_PROCESS), (*CURRENT_PROCESS)->status);
+    }
+
     if ((*CURRENT_PROCESS)->signal == SIGNONE)
+    {
+        check_signal_resume(frame, user);
         return;
+    }
 
     switch ((*CURRENT_PROCESS)->signal)
     {
@@ -307,6 +337,7 @@ void check_signal()
         /* Terminate and Core Dump */
         process_exit((*CURRENT_PROCESS), (*CURRENT_PROCESS)->signal | (1 << 7));
         break;
+    case SIGKILL:
     case SIGTERM:
     case SIGHUP:
     case SIGINT:
@@ -332,4 +363,5 @@ void check_signal()
     }
 
     (*CURRENT_PROCESS)->signal = SIGNONE;
+    check_signal_resume(frame, user);
 }
\ No newline at end of file
@@ -9,76 +9,34 @@ section .text
 extern exception_handler
 extern interrupt_handler
 extern check_signal
+extern interrupt_enter
+global interrupt_return
+
+; Every entry builds an interrupt_frame_t on the current stack: the CPU pushes
+; ss, rsp, rflags, cs and rip (and an error code for some exceptions), the stub
+; pushes the registers, cr3 and the vector. From user mode the CPU loads rsp0,
+; the top of the kernel stack of the process, and swapgs loads the GS base of
+; the kernel, the cpu_t of the CPU. The way back to user mode swaps it out.
 
 ; Macro for exceptions WITHOUT error code
 %macro isr_no_err 1
 isr_stub_%+%1:
-
-    push rax
-    push rbx
-    push rcx
-    push rdx
-    push rsi
-    push rdi
-    push rbp
-    push r8
-    push r9
-    push r10
-    push r11
-    push r12
-    push r13
-    push r14
-    push r15
-
-    mov r14, rsp
-    mov rsp, 0xFFFF810000FFFF00 ; TODO - get these actual values somehow
-    push r14
-    mov r12, cr3
-    push r12
     push 0
-    push %1
-
-    ; Set irq number and run exception handler
-    call interrupt_handler
-    call check_signal
-
-    ; mov back to original stack and page table
-    pop r13
-    pop r13
-    pop r13
-    mov cr3, r13
-    pop rsp
-
-    mov al, 0x20
-    out 0x20, al  ; Master PIC EOI
-
-    pop r15
-    pop r14
-    pop r13
-    pop r12
-    pop r11
-    pop r10
-    pop r9
-    pop r8
-    pop rbp
-    pop rdi
-    pop rsi
-    pop rdx
-    pop rcx
-    pop rbx
-    pop rax
-
-    iretq                ; Return from interrupt (64-bit)
-
+    push rax
+    mov rax, %1
+    jmp isr_common
 %endmacro
 
-
-
 ; Macro for exceptions WITH error code
 %macro isr_err 1
 isr_stub_%+%1:
-    pop r15 ; Error code
     push rax
+    mov rax, %1
+    jmp isr_common
+%endmacro
+
+; Pushes the rest of the frame, rax holds the vector
+%macro push_frame 0
     push rbx
     push rcx
     push rdx
@@ -93,29 +51,70 @@ isr_stub_%+%1:
     push r13
     push r14
     push r15
+    mov rbx, cr3
+    push rbx
+    push rax
+%endmacro
 
-    mov r14, rsp
-    mov rsp, 0xFFFF810000FFFF00 ; TODO - get these actual values somehow
-    push r14
-    mov r12, cr3
-    push r12
-    push r15
-    push %1
+; Loads the GS base of the kernel when the frame came from user mode
+%macro swapgs_from_user 0
+    test qword [rsp + 152], 3 ; Saved cs
+    jz %%kernel
+    swapgs
+%%kernel:
+%endmacro
 
-    ; Set irq number and run exception handler
+isr_common:
+    push_frame
+    swapgs_from_user
+
+    ; Frame is the first argument, 32 bytes of shadow space keep the stack aligned
+    mov rcx, rsp
+    sub rsp, 40
+    call interrupt_enter
+    lea rcx, [rsp + 40]
+    mov rax, [rcx] ; Vector
+    cmp rax, 32
+    jae .interrupt
     call exception_handler
-    call check_signal
-
-    ; mov back to original stack and page table
-    pop r13
-    pop r13
-    pop r13
-    mov cr3, r13
-    pop rsp
+    jmp .done
+.interrupt:
+    call interrupt_handler
+.done:
+    add rsp, 40
+    jmp interrupt_return
 
-    mov al, 0x20
-    out 0x20, al  ; Master PIC EOI
+syscall_stub:
+    push 0
+    push rax
+    mov rax, 0x80
+    push_frame
+    swapgs_from_user
+
+    mov rcx, rsp
+    sub rsp, 40
+    call interrupt_enter
+    mov rbx, 0xffff8600001aac60 ; TODO - get these actual values somehow
+    mov rax, [rsp + 40 + 8 * 16] ; Syscall number, the saved rax
+    shl rax, 3
+    add rbx, rax
+    call [rbx]
+    add rsp, 40
+
+; Also where a new process starts, its first switch returns here
+interrupt_return:
+    mov rcx, rsp
+    sub rsp, 40
+    call check_signal
+    add rsp, 40
 
+    add rsp, 8 ; Vector
+    pop rax
+    mov rbx, cr3
+    cmp rax, rbx
+    je .same_cr3
+    mov cr3, rax
+.same_cr3:
     pop r15
     pop r14
     pop r13
@@ -131,8 +130,12 @@ isr_stub_%+%1:
     pop rcx
     pop rbx
     pop rax
-    iretq                ; Return from interrupt (64-bit)
-%endmacro
+    add rsp, 8 ; Error code
+    test qword [rsp + 8], 3 ; Saved cs
+    jz .kernel
+    swapgs
+.kernel:
+    iretq
 
 ; Generate all exception stubs (0-31)
 isr_no_err 0    ; Divide-by-zero
@@ -168,131 +171,9 @@ isr_no_err 29   ; Reserved
 isr_err   30    ; Security Exception
 isr_no_err 31   ; Reserved
 
-syscall_stub:
-
-    push rax
-    push rbx
-    push rcx
-    push rdx
-    push rsi
-    push rdi
-    push rbp
-    push r8
-    push r9
-    push r10
-    push r11
-    push r12
-    push r13
-    push r14
-    push r15
-    
-    mov r14, rsp
-    mov rsp, 0xFFFF810000FFFF00 ; TODO - get these actual values somehow
-    push r14
-    mov r12, cr3
-    push r12
-    push 0
-    push 0x80
-    
-    mov rcx, 0xffff8600001a4be8
-    mov rbx, rax
-
-    shl rbx, 3
-    add rcx, rbx
-
-    mov rax, [rcx]
-
-    call rax
-    call check_signal
-
-    ; mov back to original stack and page table
-    pop r13
-    pop r13
-    pop r13
-    mov cr3, r13
-    pop rsp
-
-    mov al, 0x20
-    out 0x20, al  ; Master PIC EOI
-
-    pop r15
-    pop r14
-    pop r13
-    pop r12
-    pop r11
-    pop r10
-    pop r9
-    pop r8
-    pop rbp
-    pop rdi
-    pop rsi
-    pop rdx
-    pop rcx
-    pop rbx
-    pop rax
-    iretq
-
-
-; Macro for Tick
-isr_stub_32:
-    push rax
-    push rbx
-    push rcx
-    push rdx
-    push rsi
-    push rdi
-    push rbp
-    push r8
-    push r9
-    push r10
-    push r11
-    push r12
-    push r13
-    push r14
-    push r15
-
-    mov r14, rsp
-    mov rsp, 0xFFFF810000FFFF00 ; TODO - get these actual values somehow
-    push r14
-    mov r12, cr3
-    push r12
-    push 0
-    push 32
-
-    ; Set irq number and run exception handler
-    call interrupt_handler
-    call check_signal
-    ; mov back to original stack and page table
-    pop r13
-    pop r13
-    pop r13
-    mov cr3, r13
-    pop rsp
-
-
-    mov al, 0x20
-    out 0x20, al  ; Master PIC EOI
-
-    pop r15
-    pop r14
-    pop r13
-    pop r12
-    pop r11
-    pop r10
-    pop r9
-    pop r8
-    pop rbp
-    pop rdi
-    pop rsi
-    pop rdx
-    pop rcx
-    pop rbx
-    pop rax
-    iretq                ; Return from interrupt (64-bit)
-
-; Generate stubs for remaining interrupts (33-255) (32 is tick and is defined above)
-%assign i 33
-%rep (256 - 33)
+; Generate stubs for the interrupts (32-255), 32 is the tick
+%assign i 32
+%rep (256 - 32)
     isr_no_err i
 %assign i i+1
 %endrep
@@ -0,0 +1,95 @@
+;**
+; @file smp.asm
+; @brief Application Processor Startup Code
+;
+; Copied to a page below 1 Mb, a startup message starts an application
+; processor there in real mode. It goes straight to long mode on a temporary
+; GDT and the kernel page table, then loads the control registers of the
+; bootstrap processor and calls smp_ap_main with its cpu_t on its own stack.
+; The code only uses relative addresses, the bootstrap processor fills in the
+; data at the end (smp_trampoline_t).
+;**
+bits 16
+section .text
+global smp_trampoline
+global smp_trampoline_data
+global smp_trampoline_end
+
+smp_trampoline:
+    cli
+    cld
+    mov ax, cs
+    mov ds, ax
+    o32 lgdt [smp_gdt_ptr - smp_trampoline]
+
+    ; PAE, a page table below 4 Gb and long mode with the EFER of the bootstrap processor
+    mov eax, cr4
+    or eax, 1 << 5
+    mov cr4, eax
+    mov eax, [smp_boot_cr3 - smp_trampoline]
+    mov cr3, eax
+    mov ecx, 0xC0000080
+    mov eax, [smp_efer - smp_trampoline]
+    xor edx, edx
+    wrmsr
+
+    ; Protection and paging at once enter long mode, the far jump loads the 64 bit code segment
+    mov eax, cr0
+    or eax, 0x80000001
+    mov cr0, eax
+    o32 jmp far [smp_long_jump - smp_trampoline]
+
+bits 64
+smp_trampoline_long:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+
+    mov rax, [rel smp_cr4]
+    mov cr4, rax
+    mov rax, [rel smp_cr0]
+    mov cr0, rax
+    mov rax, [rel smp_cr3]
+    mov cr3, rax
+
+    ; cpu_t is the first argument, 32 bytes of shadow space keep the stack aligned
+    mov rsp, [rel smp_stack]
+    mov rcx, [rel smp_cpu_state]
+    mov rax, [rel smp_entry]
+    sub rsp, 32
+    call rax
+.halt:
+    cli
+    hlt
+    jmp .halt
+
+align 16
+smp_trampoline_data:
+smp_gdt_ptr:
+    dw 3 * 8 - 1
+    dd smp_gdt - smp_trampoline                  ; Offset, the base is added
+smp_long_jump:
+    dd smp_trampoline_long - smp_trampoline      ; Offset, the base is added
+    dw 0x08
+smp_boot_cr3:
+    dd 0
+smp_efer:
+    dd 0
+smp_cr0:
+    dq 0
+smp_cr3:
+    dq 0
+smp_cr4:
+    dq 0
+smp_stack:
+    dq 0
+smp_cpu_state:
+    dq 0
+smp_entry:
+    dq 0
+smp_gdt:
+    dq 0
+    dq 0x00209A0000000000 ; 64 bit code
+    dq 0x0000920000000000 ; Data
+smp_trampoline_end:
@@ -0,0 +1,354 @@
+/**
+ * @file smp.c
+ * @brief Multiprocessor Implementation
+ *
+ * Implements the per CPU state, the INIT and startup sequence of the
+ * application processors, the kernel lock, the idle loop and TLB shootdowns.
+ */
+#include <arch/apic.h>
+#include <arch/idt.h>
+#include <arch/io.h>
+#include <arch/smp.h>
+#include <kernel/scheduler.h>
+#include <kernel/tick.h>
+#include <memory/kernelStack.h>
+#include <memory/kglobals.h>
+#include <memory/kmemory.h>
+#include <memory/memoryMap.h>
+#include <memory/pageTable.h>
+
+#define IA32_EFER 0xC0000080
+#define IA32_EFER_LMA (1 << 10) /* Set by the CPU once paging is on, not written */
+#define IA32_FS_BASE 0xC0000100
+#define IA32_GS_BASE 0xC0000101
+#define IA32_KERNEL_GS_BASE 0xC0000102 /* Swapped with the GS base by swapgs */
+
+#define CPUID_MWAIT (1 << 3)            /* Leaf 1 ECX, MONITOR and MWAIT */
+#define CPUID_MWAIT_LEAF 5              /* ECX bit 0 says EDX lists the sub C-states, 4 bits per C-state */
+#define CPUID_MWAIT_EXTENSIONS (1 << 0)
+#define CPUID_POWER_LEAF 6
+#define CPUID_ARAT (1 << 2)             /* Leaf 6 EAX, the APIC timer runs in every C-state */
+#define SMP_MWAIT_CSTATES 8             /* C0 to C7 in the sub C-state list */
+
+/* Startup code in smp.asm, copied below 1 Mb */
+extern uint8_t smp_trampoline[];
+extern uint8_t smp_trampoline_data[];
+extern uint8_t smp_trampoline_end[];
+
+/**
+ * @struct Data at the end of the startup code, filled in before a startup message
+ */
+typedef struct smp_trampoline_t
+{
+    uint16_t gdt_limit;
+    uint32_t gdt_base;      /* Offset of the temporary GDT, the base of the copy is added */
+    uint32_t jump_offset;   /* Offset of the long mode code, the base of the copy is added */
+    uint16_t jump_selector;
+    uint32_t boot_cr3;      /* Kernel page table, loaded in real mode so below 4 Gb */
+    uint32_t efer;          /* EFER of the bootstrap processor, long mode and no execute */
+    uint64_t cr0;           /* Control registers of the bootstrap processor, loaded in long mode */
+    uint64_t cr3;
+    uint64_t cr4;
+    uint64_t stack;         /* Top of the stack of the processor being started */
+    uint64_t cpu;           /* Its cpu_t */
+    uint64_t entry;         /* smp_ap_main */
+    uint64_t gdt[3];
+} __attribute__((packed)) smp_trampoline_t;
+
+/**
+ * @brief Busy waits using the TSC
+ */
+static void smp_delay(uint64_t us)
+{
+    uint64_t end = rdtsc() + USAGE->tsc_hz * us / 1000000;
+    while (rdtsc() < end)
+        __asm__ volatile("pause");
+}
+
+/**
+ * @brief Runs CPUID
+ */
+static void smp_cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx)
+{
+    __asm__ volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(0));
+}
+
+/**
+ * @brief Picks how idle CPUs wait, every CPU is assumed to be the same
+ *
+ * MWAIT asks for the deepest C-state the CPU lists. Without an APIC timer
+ * that keeps running in deep C-states the timer could not wake the CPU, it
+ * stays in C1 then.
+ */
+static void smp_detect_mwait()
+{
+    uint32_t eax, ebx, ecx, edx;
+    smp_cpuid(0, &eax, &ebx, &ecx, &edx);
+    uint32_t max_leaf = eax;
+    if (max_leaf < CPUID_MWAIT_LEAF)
+        return;
+
+    smp_cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(ecx & CPUID_MWAIT))
+        return;
+    SMP->mwait = 1;
+    SMP->mwait_hint = 0; /* C1 */
+
+    smp_cpuid(CPUID_MWAIT_LEAF, &eax, &ebx, &ecx, &edx);
+    uint32_t substates = edx;
+    if (!(ecx & CPUID_MWAIT_EXTENSIONS) || max_leaf < CPUID_POWER_LEAF)
+        return;
+    smp_cpuid(CPUID_POWER_LEAF, &eax, &ebx, &ecx, &edx);
+    if (!(eax & CPUID_ARAT))
+        return;
+
+    /* Bits 7:4 of the hint are the C-state minus one */
+    for (uint32_t cstate = SMP_MWAIT_CSTATES - 1; cstate > 1; cstate--)
+    {
+        if ((substates >> (cstate * 4)) & 0xF)
+        {
+            SMP->mwait_hint = (cstate - 1) << 4;
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Sets up the state of a CPU that is not running yet
+ * @param stack top of the stack its idle loop runs on
+ * @param fault_stack top of its double fault stack
+ */
+static void smp_prepare_cpu(cpu_t* cpu, uint64_t id, void* stack, void* fault_stack)
+{
+    kmemset(cpu, 0, sizeof(cpu_t));
+    cpu->self = cpu;
+    cpu->id = id;
+
+    cpu->idle.thread_leader = &cpu->idle;
+    cpu->idle.kernel_stack = stack;
+    cpu->idle.signal = SIGNONE;
+    cpu->idle.cpu = cpu;
+    cpu->current = &cpu->idle;
+
+    /* Double faults get a stack of their own, the kernel stack may be what faulted */
+    cpu->tss.ist1 = (uint64_t)fault_stack;
+}
+
+/**
+ * @brief Loads the GDT and TSS of the calling CPU and points its GS base at its state
+ */
+static void smp_load_cpu(cpu_t* cpu)
+{
+    KERNEL_InitGDT(cpu->gdt, &cpu->tss);
+    wrmsr(IA32_GS_BASE, (uint64_t)cpu);
+    wrmsr(IA32_KERNEL_GS_BASE, 0);
+    wrmsr(IA32_FS_BASE, 0);
+}
+
+/**
+ * @brief First C code of an application processor, on its own stack
+ */
+static void smp_ap_main(cpu_t* cpu)
+{
+    smp_load_cpu(cpu);
+    KERNEL_LoadIDT();
+    apic_init_ap();
+    cpu->usage_stamp = rdtsc();
+
+    __atomic_add_fetch(&SMP->online, 1, __ATOMIC_SEQ_CST);
+    cpu->online = 1;
+
+    smp_lock();
+    smp_idle();
+}
+
+void smp_init()
+{
+    kmemset(SMP, 0, sizeof(smp_state_t));
+
+    cpu_t* cpu = &CPUS[0];
+    smp_prepare_cpu(cpu, 0, (void*)(KERNEL_STACK_START + KERNEL_STACK_SIZE - 4096), (void*)INTERRUPT_STACK_START);
+    smp_load_cpu(cpu);
+    cpu->online = 1;
+    SMP->cpu_count = 1;
+    SMP->online = 1;
+    smp_detect_mwait();
+
+    /* Boot runs in the kernel like any entry, the idle loop drops the lock */
+    SMP->kernel_lock = 1;
+    cpu->kernel_locked = 1;
+}
+
+void smp_start()
+{
+    apic_init();
+    CPUS[0].apic_id = apic_id();
+
+    uint32_t apic_ids[SMP_MAX_CPUS];
+    uint64_t count = apic_enumerate(apic_ids, SMP_MAX_CPUS);
+
+    /* Real mode needs the code below 1 Mb and the page table below 4 Gb */
+    uint64_t page = PREBOOT_INFO->smp_trampoline;
+    if (!page || (uint64_t)*KERNEL_PAGE_TABLE >= 0x100000000ULL)
+        return;
+
+    kmemcpy((void*)page, EXTERN(uint8_t, smp_trampoline), smp_trampoline_end - smp_trampoline);
+    smp_trampoline_t* trampoline = (smp_trampoline_t*)(page + (smp_trampoline_data - smp_trampoline));
+    trampoline->gdt_base += page;
+    trampoline->jump_offset += page;
+    trampoline->boot_cr3 = (uint32_t)(uint64_t)*KERNEL_PAGE_TABLE;
+    trampoline->efer = (uint32_t)(rdmsr(IA32_EFER) & ~IA32_EFER_LMA);
+    __asm__ volatile("mov %%cr0, %0" : "=r"(trampoline->cr0));
+    __asm__ volatile("mov %%cr4, %0" : "=r"(trampoline->cr4));
+    trampoline->cr3 = (uint64_t)*KERNEL_PAGE_TABLE;
+    trampoline->entry = (uint64_t)smp_ap_main;
+
+    /* One at a time, they share the data of the startup code */
+    for (uint64_t i = 0; i < count && SMP->cpu_count < SMP_MAX_CPUS; i++)
+    {
+        if (apic_ids[i] == CPUS[0].apic_id)
+            continue;
+
+        void* stack = kernelStack_allocate();
+        void* fault_stack = kernelStack_allocate();
+        if (!stack || !fault_stack)
+            break;
+
+        cpu_t* cpu = &CPUS[SMP->cpu_count];
+        smp_prepare_cpu(cpu, SMP->cpu_count, stack, fault_stack);
+        cpu->apic_id = apic_ids[i];
+        trampoline->stack = (uint64_t)stack;
+        trampoline->cpu = (uint64_t)cpu;
+
+        apic_send_init(cpu->apic_id);
+        smp_delay(10000);
+        for (uint64_t attempt = 0; attempt < 2 && !cpu->online; attempt++)
+        {
+            apic_send_startup(cpu->apic_id, page / PAGE_SIZE_4KB);
+            smp_delay(200);
+        }
+
+        /* A processor that is late keeps its slot, it is used once it comes online */
+        uint64_t end = rdtsc() + USAGE->tsc_hz * SMP_START_TIMEOUT_MS / 1000;
+        while (!cpu->online && rdtsc() < end)
+            __asm__ volatile("pause");
+        SMP->cpu_count++;
+    }
+}
+
+void smp_idle()
+{
+    /* The idle process never moves, its CPU stays the same */
+    cpu_t* cpu = smp_cpu();
+    while (1)
+    {
+        process_t* next = scheduler_nextProcess();
+        if (next != &cpu->idle)
+        {
+            scheduler_switch(next);
+            continue;
+        }
+
+        /* sti holds interrupts off until hlt or mwait, a wake up sent after the check is not lost */
+        tick_stop();
+        usage_idle_enter();
+        smp_unlock();
+        if (SMP->mwait)
+        {
+            /* Armed on need_resched, an interrupt wakes it all the same */
+            __asm__ volatile("monitor\n\t" ::"a"(&cpu->need_resched), "c"(0), "d"(0) : "memory");
+            __asm__ volatile("sti\n\t"
+                             "mwait\n\t"
+                             "cli\n\t" ::"a"(SMP->mwait_hint),
+                             "c"(0)
+                             : "memory");
+        }
+        else
+        {
+            __asm__ volatile("sti\n\t"
+                             "hlt\n\t"
+                             "cli\n\t" ::
+                                 : "memory");
+        }
+        smp_lock();
+        usage_idle_leave();
+    }
+}
+
+void smp_lock()
+{
+    cpu_t* cpu = smp_cpu();
+    if (cpu->kernel_locked)
+        return;
+
+    cpu->lock_waiting = 1;
+    while (__atomic_exchange_n(&SMP->kernel_lock, 1, __ATOMIC_ACQUIRE))
+    {
+        while (SMP->kernel_lock)
+            __asm__ volatile("pause");
+    }
+    cpu->lock_waiting = 0;
+    cpu->kernel_locked = 1;
+
+    if (cpu->tlb_pending)
+    {
+        cpu->tlb_pending = 0;
+        uint64_t cr3;
+        __asm__ volatile("mov %%cr3, %0\n\t"
+                         "mov %0, %%cr3\n\t"
+                         : "=r"(cr3)
+                         :
+                         : "memory");
+    }
+}
+
+void smp_unlock()
+{
+    smp_cpu()->kernel_locked = 0;
+    __atomic_store_n(&SMP->kernel_lock, 0, __ATOMIC_RELEASE);
+}
+
+void smp_kick(cpu_t* cpu)
+{
+    if (cpu != smp_cpu() && cpu->online)
+        apic_send_ipi(cpu->apic_id, SMP_VECTOR_RESCHEDULE);
+}
+
+void smp_tlb_shootdown()
+{
+    cpu_t* self = smp_cpu();
+
+    /* Idle CPUs loaded the kernel page table when they went idle, that flushed them already */
+    for (uint64_t i = 0; i < SMP->cpu_count; i++)
+    {
+        cpu_t* cpu = &CPUS[i];
+        if (cpu == self || !cpu->online || cpu->current == &cpu->idle)
+            continue;
+        cpu->tlb_pending = 1;
+        apic_send_ipi(cpu->apic_id, SMP_VECTOR_TLB);
+    }
+
+    /* A CPU spinning for the kernel lock flushes before it gets it */
+    for (uint64_t i = 0; i < SMP->cpu_count; i++)
+    {
+        cpu_t* cpu = &CPUS[i];
+        while (cpu->tlb_pending && !cpu->lock_waiting)
+            __asm__ volatile("pause");
+    }
+}
+
+cpu_t* smp_running_elsewhere(process_t* process)
+{
+    /* Threads and vfork children share the page table they run on */
+    if (!process->page_table)
+        return 0;
+
+    cpu_t* self = smp_cpu();
+    for (uint64_t i = 0; i < SMP->cpu_count; i++)
+    {
+        cpu_t* cpu = &CPUS[i];
+        if (cpu != self && cpu->current->page_table == process->page_table)
+            return cpu;
+    }
+    return 0;
+}
@@ -14,6 +14,7 @@
 #include <memory/kglobals.h>
 #include <memory/kmemory.h>
 #include <memory/memoryMap.h>
+#include <memory/pageCache.h>
 #include <memory/pageTable.h>
 #include <memory/paging.h>
 #include <misc/debug.h>
@@ -26,8 +27,6 @@
 #define PT_SHLIB 5
 #define PT_PHDR 6
 
-#define MIN(x, y) (x) < (y) ? (x) : (y)
-
 typedef struct elf_header_t
 {
     /* e_ident */
@@ -73,139 +72,333 @@ typedef struct elf_program_header_t
 
 void elfLoader_loadSegment(elf_program_header_t* ph, file_descriptor_t* file_data);
 
+/**
+ * @brief Loads a page shared by two segments right away
+ * @param page_table_ptr page table of the process
+ * @param open_file executable
+ * @param phdrs program headers
+ * @param phnum number of program headers
+ * @param vaddr page aligned address of the page
+ * @param prot PROT_ flags of the page
+ *
+ * The areas of both segments would read the page at different file offsets,
+ * so it is assembled from every segment touching it instead.
+ */
+static void elfLoader_loadPage(page_table_t* page_table_ptr, file_descriptor_t* open_file, elf_program_header_t* phdrs, uint16_t phnum, uint64_t vaddr, uint64_t prot)
+{
+    if (pageTable_find_entry(page_table_ptr, vaddr).size)
+        return;
+
+    void* page = pages_allocatePage(PAGE_SIZE_4KB);
+    kmemset(page, 0, PAGE_SIZE_4KB);
+
+    for (uint16_t i = 0; i < phnum; i++)
+    {
+        elf_program_header_t* ph = &phdrs[i];
+        uint64_t start = MAX(ph->p_vaddr, vaddr);
+        uint64_t end = MIN(ph->p_vaddr + ph->p_filesz, vaddr + PAGE_SIZE_4KB);
+        if (ph->p_type != PT_LOAD || start >= end)
+            continue;
+
+        ext2_file_seek(open_file, ph->p_offset + (start - ph->p_vaddr), SEEK_SET);
+        ext2_file_read(FILESYSTEM, open_file, (uint8_t*)page + (start - vaddr), end - start);
+    }
+
+    pageTable_addPage(page_table_ptr, (void*)vaddr, (uint64_t)page / PAGE_SIZE_4KB, 1, PAGE_SIZE_4KB, 4);
+    if (!(prot & PROT_WRITE))
+    {
+        /* pageTable_addPage always maps writable */
+        *pageTable_find_entry(page_table_ptr, vaddr).entry_ptr &= ~PAGE_WRITABLE;
+    }
+}
+
 int elfLoader_systemd(file_descriptor_t* file)
 {
     page_table_t page_table = 0;
     process_t* process = pool_allocate(*PROCESS_POOL);
+    process->vmas.root = 0;
+    if (process_init_kernel_stack(process, 0) != 0)
+    {
+        pool_free(process);
+        return 1;
+    }
     elfLoader_load(&page_table, file, process);
-    void* stackPage = pages_allocatePage(PAGE_SIZE_2MB);
 
     uint64_t pid = process_genPID();
 
     process->page_table = page_table;
     process->pid = pid;
-    process->stackPointer = 0x7FFF00;           /* 5mb + 1kb */
-    process->process_heap_ptr = 0x40000000;     /* 1 gb */
+    process->stackPointer = process_setup_stack(process, 0, 0, 0, 0);
+    if (!process->stackPointer)
+    {
+        vma_destroy_all(&process->vmas);
+        pageTable_release_user(&process->page_table);
+        pidMap_remove(PID_MAP, pid);
+        process_release(process);
+        return 1;
+    }
+    process->process_heap_ptr = PROCESS_HEAP_START;
     process->process_shared_ptr = 0x2000000000; /* 128gb */
 
-    process->process_stack_signature.r15 = 0;
-    process->process_stack_signature.r14 = 0;
-    process->process_stack_signature.r13 = 0;
-    process->process_stack_signature.r12 = 0;
-    process->process_stack_signature.r11 = 0;
-    process->process_stack_signature.r10 = 0;
-    process->process_stack_signature.r9 = 0;
-    process->process_stack_signature.r8 = 0;
-    process->process_stack_signature.rbp = 0;
-    process->process_stack_signature.rdi = 0;
-    process->process_stack_signature.rsi = 0;
-    process->process_stack_signature.rdx = 0;
-    process->process_stack_signature.rcx = 0;
-    process->process_stack_signature.rbx = 0;
-    process->process_stack_signature.rax = 0;
-    process->process_stack_signature.cs = 0x1B; /* kernel - 0x08, user - 0x1B*/
-    process->process_stack_signature.rflags = (1 << 9) | (1 << 1);
-    process->process_stack_signature.rsp = 0x7FFF00; /* 5mb + 1kb */
-    process->process_stack_signature.ss = 0x23;      /* kernel - 0x10, user - 0x23 */
-    process->flags = 0;
+    process->regs->r15 = 0;
+    process->regs->r14 = 0;
+    process->regs->r13 = 0;
+    process->regs->r12 = 0;
+    process->regs->r11 = 0;
+    process->regs->r10 = 0;
+    process->regs->r9 = 0;
+    process->regs->r8 = 0;
+    process->regs->rbp = 0;
+    process->regs->rdi = 0;
+    process->regs->rsi = 0;
+    process->regs->rdx = 0;
+    process->regs->rcx = 0;
+    process->regs->rbx = 0;
+    process->regs->rax = 0;
+    process->regs->cs = 0x1B; /* kernel - 0x08, user - 0x1B*/
+    process->regs->rflags = (1 << 9) | (1 << 1);
+    process->regs->rsp = process->stackPointer;
+    process->regs->ss = 0x23; /* kernel - 0x10, user - 0x23 */
+    process->flags = PROCESS_OOM_EXEMPT;
     process->cwd = ROOT;
-    process->heap_end = (void*)0x40000000; /* 1gb */
-    process->waiting_parent_pid = 0;
+    process->heap_end = (void*)PROCESS_HEAP_START;
     process->file_descriptor_table = pool_allocate(*FD_ENTRY_POOL);
     process->signal = SIGNONE;
+    process->thread_leader = process;
+    process->thread_count = 0;
+    process->fs_base = 0;
+    process->nice = 0;
+    process->policy = SCHEDULER_NORMAL;
+    process->rt_priority = 0;
+    usage_start(process);
+    wait_start(process);
+    process->clear_child_tid = 0;
+    process->futex_addr = 0;
+    process->futex_next = 0;
+    process->pgid = 0;
+    process->sid = 0;
+    process->group_next = 0;
+    process->group_last = 0;
+    process->session_next = 0;
+    process->session_last = 0;
 
-    pageTable_addPage(&process->page_table, (void*)0x600000, (uint64_t)stackPage / PAGE_SIZE_2MB, 1, PAGE_SIZE_2MB, 4);
-
-    /* Configure arguments */
-    void* args_page = pages_allocatePage(PAGE_SIZE_2MB);
-    pageTable_addPage(&process->page_table, (void*)0x200000, (uint64_t)args_page / PAGE_SIZE_2MB, 1, PAGE_SIZE_2MB, 4);
     scheduler_schedule(process);
     return 0;
 }
 
-int elfLoader_load(page_table_t* page_table_ptr, file_descriptor_t* open_file, process_t* process)
+/**
+ * @brief Reads and checks the ELF and program headers of an executable
+ * @param open_file executable
+ * @param header filled in with the ELF header
+ * @return program headers (kmalloc), NULL if the file cannot be run
+ */
+static elf_program_header_t* elfLoader_readHeaders(file_descriptor_t* open_file, elf_header_t* header)
 {
-    pageTable_addKernel(page_table_ptr);
-
     ext2_file_seek(open_file, 0, SEEK_SET);
-    elf_header_t header;
 
-    if (ext2_file_read(FILESYSTEM, open_file, &header, sizeof(elf_header_t)) != sizeof(elf_header_t))
+    if (ext2_file_read(FILESYSTEM, open_file, header, sizeof(elf_header_t)) != sizeof(elf_header_t))
     {
         /* Failed to read ELF header */
-        return 1;
+        return 0;
     }
 
-    if (header.EI_MAG0 != 0x7F || header.EI_MAG3[0] != 'E' || header.EI_MAG3[1] != 'L' || header.EI_MAG3[2] != 'F')
+    if (header->EI_MAG0 != 0x7F || header->EI_MAG3[0] != 'E' || header->EI_MAG3[1] != 'L' || header->EI_MAG3[2] != 'F')
     {
         /* Not valid elf file */
-        return 1;
+        return 0;
     }
 
-    if (header.EI_DATA != 1)
+    if (header->EI_DATA != 1)
     {
         /* Big endian ELF not supported */
-        return 1;
+        return 0;
     }
-    if (header.e_machine != 0x3E)
+    if (header->e_machine != 0x3E)
     {
         /* Architecture not supported */
-        return 1;
+        return 0;
     }
-    if (header.e_type != 2)
+    if (header->e_type != 2)
     {
         /* not an executable */
-        return 1;
+        return 0;
     }
 
-    ext2_file_seek(open_file, header.e_phoff, SEEK_SET);
+    ext2_file_seek(open_file, header->e_phoff, SEEK_SET);
 
-    elf_program_header_t* phdrs = kmalloc(sizeof(elf_program_header_t) * header.e_phnum);
+    elf_program_header_t* phdrs = kmalloc(sizeof(elf_program_header_t) * header->e_phnum);
 
-    if (ext2_file_read(FILESYSTEM, open_file, phdrs, sizeof(elf_program_header_t) * header.e_phnum) != sizeof(elf_program_header_t) * header.e_phnum)
+    if (ext2_file_read(FILESYSTEM, open_file, phdrs, sizeof(elf_program_header_t) * header->e_phnum) != sizeof(elf_program_header_t) * header->e_phnum)
     {
         /* failed to read program header(s) */
+        kfree(phdrs);
+        return 0;
+    }
+    return phdrs;
+}
+
+/**
+ * @brief Creates the areas of every loadable segment
+ * @param page_table_ptr page table of the process
+ * @param open_file executable
+ * @param process process being loaded
+ * @param phdrs program headers
+ * @param phnum number of program headers
+ * @return 0 on success, 1 if segments overlap
+ */
+static int elfLoader_mapSegments(page_table_t* page_table_ptr, file_descriptor_t* open_file, process_t* process, elf_program_header_t* phdrs, uint16_t phnum)
+{
+    /* Segments map the file through the page cache, processes running it share the frames */
+    page_cache_file_t* cache = pageCache_open(open_file);
+
+    for (int i = 0; i < phnum; i++)
+    {
+        elf_program_header_t* ph = &phdrs[i];
+
+        if (ph->p_type != PT_LOAD) /* Only loadable segments */
+            continue;
+
+        uint64_t start = ALIGN_DOWN(ph->p_vaddr, PAGE_SIZE_4KB);
+        uint64_t file_end = ALIGN_UP(ph->p_vaddr + ph->p_filesz, PAGE_SIZE_4KB);
+        uint64_t end = ALIGN_UP(ph->p_vaddr + ph->p_memsz, PAGE_SIZE_4KB);
+
+        /* Segment flags (PF_X 1, PF_W 2, PF_R 4) match the PROT_ flags */
+        uint64_t prot = ph->p_flags & 7;
+
+        vma_t* vma = vma_find(&process->vmas, start);
+        if (vma)
+        {
+            /* Segment shares its first page with the previous one */
+            vma->prot |= prot;
+            elfLoader_loadPage(page_table_ptr, open_file, phdrs, phnum, start, vma->prot);
+            start = vma->end;
+        }
+
+        /* Pages holding file contents are read from the page cache on first touch */
+        if (start < file_end)
+        {
+            vma = vma_create(&process->vmas, start, file_end, prot, VMA_FILE, 0);
+            if (!vma)
+                return 1;
+            vma->file = cache->file;
+            vma->offset = ph->p_offset - ph->p_vaddr + start;
+
+            /* Text may map the whole last page, data has to zero what follows its contents */
+            vma->file_end = ph->p_memsz > ph->p_filesz ? ph->p_vaddr + ph->p_filesz : file_end;
+            start = file_end;
+        }
+
+        /* Rest of the bss is zero filled on demand */
+        if (start < end)
+            vma_create(&process->vmas, start, end, prot, VMA_ANON, 0);
+    }
+    return 0;
+}
+
+/**
+ * @brief Loads the dynamic loader named by a PT_INTERP segment
+ * @param page_table_ptr page table of the process
+ * @param open_file executable
+ * @param process process being loaded
+ * @param interp PT_INTERP program header
+ * @return 0 on success, 1 if the loader cannot be loaded
+ *
+ * The loader is a static executable linked away from programs, it gets
+ * control first and maps the shared libraries the program needs.
+ */
+static int elfLoader_loadInterp(page_table_t* page_table_ptr, file_descriptor_t* open_file, process_t* process, elf_program_header_t* interp)
+{
+    char path[ELF_INTERP_MAX];
+    if (interp->p_filesz == 0 || interp->p_filesz > ELF_INTERP_MAX)
+        return 1;
+
+    ext2_file_seek(open_file, interp->p_offset, SEEK_SET);
+    if (ext2_file_read(FILESYSTEM, open_file, path, interp->p_filesz) != interp->p_filesz)
+        return 1;
+    path[interp->p_filesz - 1] = 0;
+
+    vfs_entry_t* entry;
+    if (vfs_find_entry(ROOT, &entry, path) != 0 || entry->type != EXT2_FT_REG_FILE)
+        return 1;
+    file_descriptor_t* interp_file = vfs_open_file(entry);
+
+    elf_header_t header;
+    elf_program_header_t* phdrs = elfLoader_readHeaders(interp_file, &header);
+    if (!phdrs)
+    {
+        vfs_close_file(interp_file);
+        return 1;
+    }
+
+    uint64_t base = (uint64_t)-1;
+    for (int i = 0; i < header.e_phnum; i++)
+    {
+        if (phdrs[i].p_type == PT_INTERP)
+        {
+            /* The loader has to be static */
+            kfree(phdrs);
+            vfs_close_file(interp_file);
+            return 1;
+        }
+        if (phdrs[i].p_type == PT_LOAD)
+            base = MIN(base, ALIGN_DOWN(phdrs[i].p_vaddr, PAGE_SIZE_4KB));
+    }
+
+    /* File mappings go through the page cache, it keeps a descriptor of its own */
+    int result = elfLoader_mapSegments(page_table_ptr, interp_file, process, phdrs, header.e_phnum);
+    kfree(phdrs);
+    vfs_close_file(interp_file);
+    if (result)
+        return 1;
+
+    process->interp_base = base;
+    process->regs->rip = header.e_entry;
+    return 0;
+}
+
+int elfLoader_load(page_table_t* page_table_ptr, file_descriptor_t* open_file, process_t* process)
+{
+    pageTable_addKernel(page_table_ptr);
+
+    elf_header_t header;
+    elf_program_header_t* phdrs = elfLoader_readHeaders(open_file, &header);
+    if (!phdrs)
+        return 1;
+
+    if (elfLoader_mapSegments(page_table_ptr, open_file, process, phdrs, header.e_phnum))
+    {
+        kfree(phdrs);
         return 1;
     }
 
+    process->entry = header.e_entry;
+    process->regs->rip = header.e_entry;
+    process->program_headers = 0;
+    process->program_header_count = header.e_phnum;
+    process->interp_base = 0;
+
+    elf_program_header_t* interp = 0;
     for (int i = 0; i < header.e_phnum; i++)
     {
         elf_program_header_t* ph = &phdrs[i];
 
-        if (ph->p_type == PT_LOAD) /* Loadable Segment */
+        if (ph->p_type == PT_PHDR)
+        {
+            process->program_headers = ph->p_vaddr;
+        }
+        else if (ph->p_type == PT_LOAD && !process->program_headers && header.e_phoff >= ph->p_offset && header.e_phoff < ph->p_offset + ph->p_filesz)
         {
-            /* Seek to start of section */
-            ext2_file_seek(open_file, ph->p_offset, SEEK_SET);
-
-            /* find size of section in pages */
-            uint64_t virtual_mem_end = ALIGN_UP(ph->p_vaddr + ph->p_memsz, 4096);
-            uint64_t virtual_mem_start = ALIGN_DOWN(ph->p_vaddr, 4096);
-            uint64_t page_count = (virtual_mem_end - virtual_mem_start) / 4096;
-
-            int data_left = ph->p_filesz;
-            for (uint64_t i = 0; i < page_count; i++)
-            {
-                void* page = pages_allocatePage(PAGE_SIZE_4KB);
-                kmemset(page, 0, 4096);
-                if (data_left > 0)
-                {
-                    int data_moved = MIN(4096, data_left);
-                    long idk = ext2_file_read(FILESYSTEM, open_file, page, data_moved);
-
-                    data_left -= MIN(4096, data_left);
-                }
-                pageTable_addPage(page_table_ptr, (void*)(ph->p_vaddr + PAGE_SIZE_4KB * i), (uint64_t)page / PAGE_SIZE_4KB, 1, PAGE_SIZE_4KB, 4);
-            }
-
-            /* Zero out remaining pages */
+            /* Without PT_PHDR the headers are found in the segment loading them */
+            process->program_headers = ph->p_vaddr + (header.e_phoff - ph->p_offset);
         }
         else if (ph->p_type == PT_INTERP) /* Dynamic Linker */
         {
-            /* Dynamically linked is not supported */
-            return 1;
+            interp = ph;
         }
     }
 
-    process->entry = header.e_entry;
-    process->process_stack_signature.rip = header.e_entry;
-}
\ No newline at end of file
+    /* Dynamically linked programs start in the loader instead */
+    int result = interp ? elfLoader_loadInterp(page_table_ptr, open_file, process, interp) : 0;
+    kfree(phdrs);
+    return result;
+}
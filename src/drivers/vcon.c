@@ -11,6 +11,9 @@
 #include <fs/vfs.h>
 #include <kernel/device.h>
 #include <kernel/scheduler.h>
+#include <kernel/softirq.h>
+#include <kernel/wait.h>
+#include <kmath.h>
 #include <kstring.h>
 #include <memory/kglobals.h>
 #include <misc/debug.h>
@@ -86,6 +89,8 @@ void vcon_init()
     {
         /* Initializes vcon structure */
         VCONS[i].cononical = false;
+        VCONS[i].input_ready = false;
+        wait_init(&VCONS[i].input_waiters);
         VCONS[i].vcon_line = 0;
         VCONS[i].vcon_column = 0;
 
@@ -98,8 +103,13 @@ void vcon_init()
         device_file->ops[DEV_READ] = vcon_input;
         device_file->ops[CHRDEV_SETGRP] = vcon_setgrp;
         device_file->ops[CHRDEV_GETGRP] = vcon_getgrp;
+        device_file->ops[CHRDEV_POLL] = vcon_poll;
         device_file->private_data = &VCONS[i];
     }
+
+    VCON_TASKLET->function = vcon_handle_user_input;
+    VCON_TASKLET->next = 0;
+    VCON_TASKLET->scheduled = 0;
 }
 
 void vcon_keyboard_handle(vcon_t* vcon, key_event_t key)
@@ -116,7 +126,7 @@ void vcon_keyboard_handle(vcon_t* vcon, key_event_t key)
             FBCON->fbcon->ops[4]((uint64_t)FBCON->fbcon, 'C', ((uint64_t)vcon->vcon_column++ << 32) | vcon->vcon_line);
             vcon->input_buffer[vcon->input_buffer_pointer++] = key.keycode;
             vcon_handle_cursor(vcon);
-            process_group_signal((process_group_t*)vcon->grp, SIGINT);
+            process_group_signal((process_group_t*)pidMap_lookup(PGID_MAP, vcon->grp), SIGINT);
             break;
         case '/':
             FBCON->fbcon->ops[4]((uint64_t)FBCON->fbcon, '^', ((uint64_t)vcon->vcon_column++ << 32) | vcon->vcon_line);
@@ -125,7 +135,7 @@ void vcon_keyboard_handle(vcon_t* vcon, key_event_t key)
             FBCON->fbcon->ops[4]((uint64_t)FBCON->fbcon, '/', ((uint64_t)vcon->vcon_column++ << 32) | vcon->vcon_line);
             vcon->input_buffer[vcon->input_buffer_pointer++] = key.keycode;
             vcon_handle_cursor(vcon);
-            process_group_signal((process_group_t*)vcon->grp, SIGQUIT);
+            process_group_signal((process_group_t*)pidMap_lookup(PGID_MAP, vcon->grp), SIGQUIT);
             break;
         case 'z':
             FBCON->fbcon->ops[4]((uint64_t)FBCON->fbcon, '^', ((uint64_t)vcon->vcon_column++ << 32) | vcon->vcon_line);
@@ -134,7 +144,7 @@ void vcon_keyboard_handle(vcon_t* vcon, key_event_t key)
             FBCON->fbcon->ops[4]((uint64_t)FBCON->fbcon, 'Z', ((uint64_t)vcon->vcon_column++ << 32) | vcon->vcon_line);
             vcon->input_buffer[vcon->input_buffer_pointer++] = key.keycode;
             vcon_handle_cursor(vcon);
-            process_group_signal((process_group_t*)vcon->grp, SIGTSTP);
+            process_group_signal((process_group_t*)pidMap_lookup(PGID_MAP, vcon->grp), SIGTSTP);
             break;
 
         default:
@@ -153,12 +163,8 @@ void vcon_keyboard_handle(vcon_t* vcon, key_event_t key)
         case '\n': /* Handles new line */
             vcon->cononical = false;
             vcon->input_buffer[vcon->input_buffer_pointer++] = 0;
-            uint64_t current_cr3;
-            __asm__ volatile("mov %%cr3, %0\n\t" : "=r"(current_cr3) : :);
-            __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(vcon->process_pml4) :);
-            kmemcpy(vcon->process_input_buffer, vcon->input_buffer, vcon->input_buffer_pointer);
-            __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(current_cr3) :);
-            schedule_unblock(vcon->input_block_process);
+            vcon->input_ready = true;
+            wait_wake_all(&vcon->input_waiters); /* The reader copies the line out itself */
             vcon_putc(vcon, '\n');
             break;
         case '\b': /* Handles backspace */
@@ -186,7 +192,7 @@ void vcon_keyboard_handle(vcon_t* vcon, key_event_t key)
     }
 }
 
-void vcon_handle_user_input()
+void vcon_handle_user_input(tasklet_t* tasklet)
 {
     while (keyboard_has_input())
     {
@@ -239,31 +245,59 @@ size_t vcon_write(uint64_t open_file, uint64_t str, size_t size)
     {
         if (!((const char*)str)[i])
             return i;
+        /* Long writes let the timer in between lines of output */
+        if (i && i % VCON_PREEMPT_INTERVAL == 0)
+            scheduler_preempt();
         vcon_putc(((file_descriptor_t* )open_file)->private_data, ((const char*)str)[i]);
     }
     return size;
 }
 
+/**
+ * @brief Lets a line be typed into the console unless one is typed or waits to be read already
+ */
+static void vcon_start_line(vcon_t* vcon)
+{
+    if (vcon->cononical || vcon->input_ready)
+        return;
+    vcon->cononical = true;
+    vcon->input_buffer_pointer = 0;
+}
+
 size_t vcon_input(uint64_t open_file, uint64_t str, size_t size)
 {
     vcon_t* vcon = ((file_descriptor_t* )open_file)->private_data;
 
     /* Allows writing in the terminal */
-    vcon->cononical = true;
-    vcon->input_buffer_pointer = 0;
-    vcon->input_block_process = (*CURRENT_PROCESS);
-    vcon->process_input_buffer = (const char*)str;
-    vcon->process_pml4 = (*CURRENT_PROCESS)->page_table;
+    vcon_start_line(vcon);
+
+    /* Sleeps here until a line is entered */
+    while (!vcon->input_ready)
+    {
+        if (wait_interrupted())
+        {
+            /* Editing stops unless someone else still waits for the line */
+            if (!vcon->input_waiters.first)
+                vcon->cononical = false;
+            return 0;
+        }
+        wait_sleep(&vcon->input_waiters);
+    }
 
-    schedule_block(*CURRENT_PROCESS);
-    (*CURRENT_PROCESS) = scheduler_nextProcess();
+    vcon->input_ready = false;
+    size_t count = MIN(size, vcon->input_buffer_pointer);
+    kmemcpy((void*)str, vcon->input_buffer, count);
+    return count;
+}
 
-    /* Prepare for context switch:
-     * R12 = new process's page table root (CR3)
-     * R11 = new process's stack pointer */
-    INTERRUPT_INFO->cr3 = (uint64_t)(*CURRENT_PROCESS)->page_table;
-    INTERRUPT_INFO->rsp = (uint64_t)&(*CURRENT_PROCESS)->process_stack_signature;
-    TSS->ist1 = (uint64_t)(*CURRENT_PROCESS) + sizeof(process_stack_layout_t);
+size_t vcon_poll(uint64_t open_file, uint64_t entry, uint64_t _1)
+{
+    vcon_t* vcon = ((file_descriptor_t* )open_file)->private_data;
+    if (vcon->input_ready)
+        return POLLIN | POLLOUT;
 
-    return 0;
-}
\ No newline at end of file
+    vcon_start_line(vcon);
+    if (entry)
+        wait_add(&vcon->input_waiters, (wait_entry_t*)entry);
+    return POLLOUT;
+}
@@ -24,6 +24,9 @@
  */
 file_descriptor_t* fdm_open_file(vfs_entry_t* current)
 {
+    /* Open files share the inode of the entry, it can never be dropped */
+    current->pinned = 1;
+
     /* Allocate memory for the open file structure */
     file_descriptor_t* open_file = pool_allocate(*OPEN_FILE_POOL);
 
@@ -98,6 +101,25 @@ file_descriptor_t* fdm_get(file_descriptor_entry_t* entry, size_t index)
     return ((file_descriptor_t***)entry->file_descriptors)[first_index][second_index];
 }
 
+/**
+ * @brief Puts a file descriptor in the lowest free slot of a table
+ * @param entry top level of file descriptor table
+ * @param fd file descriptor
+ * @return index of the slot, -1 if the table is full
+ */
+int fdm_alloc(file_descriptor_entry_t* entry, file_descriptor_t* fd)
+{
+    for (size_t index = 0; index < FD_ENTRY_COUNT * FD_ENTRY_COUNT; index++)
+    {
+        if (!fdm_get(entry, index))
+        {
+            fdm_set(entry, index, fd);
+            return index;
+        }
+    }
+    return -1;
+}
+
 /**
  * @brief Copies the entries in a file descriptor table
  * @param src top of source file descriptor table
@@ -8,8 +8,11 @@
 
 #include "kstring.h"
 #include <fs/vfs.h>
+#include <kernel/processTemplate.h>
 #include <memory/kglobals.h>
 #include <memory/kmemory.h>
+#include <memory/kpool.h>
+#include <memory/pageCache.h>
 #include <misc/debug.h>
 #include <stdint.h>
 
@@ -269,6 +272,7 @@ static vfs_entry_t* vfs_find_child(vfs_entry_t* parent, const char* name)
         vfs_entry_t* child = container_of(pos, vfs_entry_t, sibling);
         if (kernel_strcmp(child->name, name) == 0)
         {
+            child->referenced = 1;
             return child;
         }
     }
@@ -310,6 +314,8 @@ void vfs_entry_init(vfs_entry_t* entry, const char* name)
     entry->inode_num = 0;
     entry->parent = 0;
     entry->children_loaded = 0;
+    entry->referenced = 0;
+    entry->pinned = 0;
     entry->type = EXT2_FT_DIR;
     entry->name_hash = fnv1a_hash(name);
     init_list_head(&entry->children);
@@ -349,10 +355,16 @@ void vfs_init()
     /* Create /dev directory */
     *DEV = vfs_create_entry(ROOT, "dev", EXT2_FT_DIR);
     (*DEV)->children_loaded = 1;
+
+    *VFS_CACHED = 0;
+    pressure_register_shrinker("vfs", vfs_cache_count, vfs_cache_shrink);
 }
 
 size_t vfs_write_reg_file(uint64_t open_file, uint64_t buf, size_t size)
 {
+    /* Running programs keep the pages they mapped, new mappings read the new contents */
+    pageCache_invalidate(((file_descriptor_t*)open_file)->inode_num);
+    processTemplate_invalidate(((file_descriptor_t*)open_file)->inode_num);
     return ext2_file_write(FILESYSTEM, (file_descriptor_t*)open_file, (uint8_t*)buf, size);
 }
 
@@ -385,7 +397,9 @@ void vfs_populate_directory(vfs_entry_t* dir)
         entry->inode = pool_allocate(*INODE_POOL);
         // TODO: Make a better way for dynamicall setting callbacks, fornow there are 8
         entry->ops = kmalloc(sizeof(void*) * 8);
+        kmemset(entry->ops, 0, sizeof(void*) * 8);
         vfs_add_child(dir, entry);
+        (*VFS_CACHED)++;
 
         if (entry->type == EXT2_FT_REG_FILE)
         {
@@ -483,6 +497,15 @@ file_descriptor_t* vfs_open_file(vfs_entry_t* entry)
     return fdm_open_file(entry);
 }
 
+/**
+ * @brief Close file opened through VFS
+ * @param file Open file handle, not installed in any descriptor table
+ */
+void vfs_close_file(file_descriptor_t* file)
+{
+    pool_free(file);
+}
+
 /**
  * @brief Create new VFS entry
  * @param dir Parent directory
@@ -497,10 +520,12 @@ vfs_entry_t* vfs_create_entry(vfs_entry_t* dir, const char* name, entry_type_t t
     vfs_entry_init(entry, name);
     entry->type = type;
     entry->inode_num = -1;
+    entry->pinned = 1;
     entry->parent = dir;
     entry->inode = pool_allocate(*INODE_POOL);
     // TODO: Make a better way for dynamicall setting callbacks, fornow there are 8
     entry->ops = kmalloc(sizeof(void*) * 8);
+    kmemset(entry->ops, 0, sizeof(void*) * 8); /* Operations a file does not have stay null */
     vfs_add_child(dir, entry);
     return entry;
 }
@@ -524,4 +549,70 @@ void vfs_path(vfs_entry_t* dir, char* buffer, uint64_t* offset)
     kernel_strcat(&buffer[*offset], "/");
     *offset += 1;
     buffer[*offset] = '\0';
-}
\ No newline at end of file
+}
+
+uint64_t vfs_cache_count()
+{
+    return *VFS_CACHED;
+}
+
+/**
+ * @brief Frees an entry loaded from disk
+ * @param entry entry being freed, its own children are already gone
+ */
+static void vfs_entry_free(vfs_entry_t* entry)
+{
+    kfree(entry->name);
+    kfree(entry->ops);
+    pool_free(entry->inode);
+    pool_free(entry);
+    (*VFS_CACHED)--;
+}
+
+/**
+ * @brief Shrinks the cache below a directory
+ * @param dir directory being shrunk
+ * @param target number of entries wanted
+ * @param freed number of entries dropped so far
+ */
+static void vfs_shrink_dir(vfs_entry_t* dir, uint64_t target, uint64_t* freed)
+{
+    /* Deepest directories go first, a directory keeps its children if one of them has to stay */
+    bool keep = 0;
+    list_head_t* pos;
+    for (pos = dir->children.next; pos != &dir->children; pos = pos->next)
+    {
+        vfs_entry_t* child = container_of(pos, vfs_entry_t, sibling);
+        if (child->children_loaded && *freed < target)
+            vfs_shrink_dir(child, target, freed);
+        if (child->pinned || child->children_loaded)
+            keep = 1;
+    }
+
+    if (keep || *freed >= target || !vfs_entry_has_children(dir))
+        return;
+
+    if (dir->referenced)
+    {
+        dir->referenced = 0;
+        return;
+    }
+
+    pos = dir->children.next;
+    while (pos != &dir->children)
+    {
+        vfs_entry_t* child = container_of(pos, vfs_entry_t, sibling);
+        pos = pos->next;
+        vfs_entry_free(child);
+        (*freed)++;
+    }
+    init_list_head(&dir->children);
+    dir->children_loaded = 0;
+}
+
+uint64_t vfs_cache_shrink(uint64_t target)
+{
+    uint64_t freed = 0;
+    vfs_shrink_dir(ROOT, target, &freed);
+    return freed;
+}
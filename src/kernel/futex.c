@@ -0,0 +1,77 @@
+/**
+ * @file futex.c
+ * @brief Futex Implementation
+ *
+ * Implements the hashed futex wait queues.
+ */
+#include <kernel/futex.h>
+#include <kernel/process.h>
+#include <kernel/scheduler.h>
+#include <memory/kglobals.h>
+#include <memory/kmemory.h>
+
+/**
+ * @brief Gets the bucket of an address of a process
+ */
+static process_t** futex_bucket(process_t* leader, uint64_t addr)
+{
+    uint64_t hash = (addr >> 2) ^ ((uint64_t)leader >> 6);
+    return &FUTEX_TABLE->buckets[hash % FUTEX_BUCKETS];
+}
+
+void futex_init()
+{
+    kmemset(FUTEX_TABLE, 0, sizeof(futex_table_t));
+}
+
+void futex_wait(process_t* process, uint64_t addr)
+{
+    process->futex_addr = addr;
+    process->futex_next = 0;
+
+    /* Appended so wakes go oldest first */
+    process_t** link = futex_bucket(process->thread_leader, addr);
+    while (*link)
+        link = &(*link)->futex_next;
+    *link = process;
+
+    schedule_block(process);
+}
+
+uint64_t futex_wake(process_t* leader, uint64_t addr, uint64_t count)
+{
+    uint64_t woken = 0;
+    process_t** link = futex_bucket(leader, addr);
+
+    while (*link && woken < count)
+    {
+        process_t* waiter = *link;
+        if (waiter->thread_leader != leader || waiter->futex_addr != addr)
+        {
+            link = &waiter->futex_next;
+            continue;
+        }
+
+        *link = waiter->futex_next;
+        waiter->futex_addr = 0;
+        waiter->futex_next = 0;
+        schedule_unblock(waiter);
+        woken++;
+    }
+    return woken;
+}
+
+void futex_cancel(process_t* process)
+{
+    if (!process->futex_addr)
+        return;
+
+    process_t** link = futex_bucket(process->thread_leader, process->futex_addr);
+    while (*link && *link != process)
+        link = &(*link)->futex_next;
+    if (*link)
+        *link = process->futex_next;
+
+    process->futex_addr = 0;
+    process->futex_next = 0;
+}
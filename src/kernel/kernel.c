@@ -10,6 +10,7 @@
 #include <arch/gdt.h>
 #include <arch/idt.h>
 #include <arch/io.h>
+#include <arch/smp.h>
 #include <boot/bootServices.h>
 #include <boot/elfLoader.h>
 #include <drivers/fbcon.h>
@@ -19,8 +20,9 @@
 #include <fs/fontLoader.h>
 #include <fs/vfs.h>
 #include <kernel/device.h>
-#include <kernel/pidHashTable.h>
+#include <kernel/pidMap.h>
 #include <kernel/scheduler.h>
+#include <kernel/usage.h>
 #include <kmath.h>
 #include <memory/kglobals.h>
 #include <memory/kmemory.h>
@@ -29,15 +31,20 @@
 #include <memory/paging.h>
 #include <misc/debug.h>
 #include <kernel/syscalls.h>
+#include <kernel/tick.h>
+#include <kernel/timer.h>
+#include <kernel/softirq.h>
+#include <kernel/workqueue.h>
 #include <stdint.h>
 
 /* ==================== Forward Declarations ==================== */
 
 static EFI_STATUS init_framebuffer(preboot_info_t* preboot_info, EFI_HANDLE image_handle, EFI_SYSTEM_TABLE* system_table);
 static uint64_t calculate_total_system_memory(preboot_info_t* preboot_info);
-static void init_clock(void);
 static void setup_kernel_mappings(page_table_t* kernel_pt, uint64_t* early_allocations);
 static void find_kernel_memory(void);
+static void find_acpi_rsdp(EFI_SYSTEM_TABLE* system_table);
+static void find_smp_trampoline(void);
 static void reserve_kernel_memory(uint64_t total_memory_size);
 static void init_subsystems(void);
 static void launch_system_processes(void);
@@ -90,6 +97,9 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE* SystemTable
     /* Load terminal font before exiting boot services */
     font_init(&TEMPFONT, u"UbuntuMono-Regular.ttf", 20, ImageHandle);
 
+    /* The configuration table lives in boot services memory */
+    find_acpi_rsdp(SystemTable);
+
     /* Step 2: Exit UEFI environment */
     if (EFI_ERROR(exit_boot_services(&preboot_info, ImageHandle, SystemTable)))
     {
@@ -98,6 +108,7 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE* SystemTable
     }
 
     /* =============== MEMORY MANAGEMENT SETUP =============== */
+    find_smp_trampoline();
     find_kernel_memory();
 
     /* Early allocations to catch allocations made before allocation table */
@@ -195,6 +206,60 @@ static void find_kernel_memory()
     }
 }
 
+/**
+ * @brief Finds the ACPI RSDP in the EFI configuration table, ACPI 2.0 preferred
+ */
+static void find_acpi_rsdp(EFI_SYSTEM_TABLE* system_table)
+{
+    preboot_info.acpi_rsdp = 0;
+    for (UINTN i = 0; i < system_table->NumberOfTableEntries; i++)
+    {
+        EFI_CONFIGURATION_TABLE* table = &system_table->ConfigurationTable[i];
+        if (CompareGuid(&table->VendorGuid, &Acpi20TableGuid) == 0)
+        {
+            preboot_info.acpi_rsdp = table->VendorTable;
+            return;
+        }
+        if (CompareGuid(&table->VendorGuid, &AcpiTableGuid) == 0)
+            preboot_info.acpi_rsdp = table->VendorTable;
+    }
+}
+
+/**
+ * @brief Takes a page below 1 Mb for the startup code of the application processors
+ *
+ * Startup messages can only point at a page in real mode reach, page 0 is left alone.
+ */
+static void find_smp_trampoline()
+{
+    UINTN numRegions = preboot_info.MemoryMapSize / preboot_info.DescriptorSize;
+    EFI_MEMORY_DESCRIPTOR* entry = preboot_info.MemoryMap;
+    preboot_info.smp_trampoline = 0;
+    for (UINTN i = 0; i < numRegions; i++)
+    {
+        if (entry->Type == EfiConventionalMemory && entry->NumberOfPages > 0)
+        {
+            uint64_t start = entry->PhysicalStart;
+            uint64_t end = start + entry->NumberOfPages * PAGE_SIZE_4KB;
+            if (end <= 0x100000 && end - PAGE_SIZE_4KB >= 0x1000)
+            {
+                /* The top page, the region keeps its start */
+                preboot_info.smp_trampoline = end - PAGE_SIZE_4KB;
+                entry->NumberOfPages--;
+                return;
+            }
+            if (start >= 0x1000 && start < 0x100000)
+            {
+                preboot_info.smp_trampoline = start;
+                entry->PhysicalStart += PAGE_SIZE_4KB;
+                entry->NumberOfPages--;
+                return;
+            }
+        }
+        entry = (EFI_MEMORY_DESCRIPTOR*)((UINT8*)entry + preboot_info.DescriptorSize);
+    }
+}
+
 static void* alloc_kernel_memory(size_t page_count)
 {
     UINTN numRegions = preboot_info.MemoryMapSize / preboot_info.DescriptorSize;
@@ -241,18 +306,6 @@ static EFI_STATUS init_framebuffer(preboot_info_t* preboot_info, EFI_HANDLE imag
     return status;
 }
 
-/**
- * @brief Configure PIT for system timing
- */
-static void init_clock(void)
-{
-    /* Configure PIT channel 0 for 50Hz interrupts */
-    uint16_t divisor = 1193 * 50; /* 1.193 MHz / 1000 = 1ms */
-    outb(0x43, 0x36);             /* Command port: Channel 0, mode 3 */
-    outb(0x40, divisor & 0xFF);   /* Low Byte */
-    outb(0x40, divisor >> 8);     /* High Byte */
-}
-
 /**
  * @brief Setup virtual memory mappings for kernel
  * @param kernel_pt Kernel page table to populate
@@ -469,6 +522,10 @@ static void reserve_kernel_memory(uint64_t total_memory_size)
 
     /* Framebuffer */
     pages_reservePage(MEMORY_REGIONS[5].base / PAGE_SIZE_4KB, FRAMEBUFFER_SIZE / PAGE_SIZE_4KB, PAGE_SIZE_4KB);
+
+    /* Startup code of the application processors */
+    if (preboot_info.smp_trampoline)
+        pages_reservePage(preboot_info.smp_trampoline / PAGE_SIZE_4KB, 1, PAGE_SIZE_4KB);
 }
 
 /**
@@ -476,6 +533,9 @@ static void reserve_kernel_memory(uint64_t total_memory_size)
  */
 static void init_subsystems(void)
 {
+    /* The current process and the GDT are per CPU */
+    smp_init();
+
     void* page = pages_allocatePage(PAGE_SIZE_2MB);
     *TEMP_MEMORY = (void*)0xFFFFB40000000000; /* 180tb */
     pageTable_addPage(KERNEL_PAGE_TABLE, (void*)0xFFFFB40000000000, (uint64_t)page / PAGE_SIZE_2MB, 1, PAGE_SIZE_2MB, 0);
@@ -487,15 +547,31 @@ static void init_subsystems(void)
     *PROCESS_GROUP_POOL = pool_create(sizeof(process_group_t), 8);
     *SESSION_POOL = pool_create(sizeof(process_session_t), 8);
     *FD_ENTRY_POOL = pool_create(sizeof(file_descriptor_entry_t), 8);
-
-    init_clock();
+    *VMA_POOL = pool_create(sizeof(vma_t), 8);
+    pages_initShareCounts();
+    pages_initZeroPage();
+    pageMerge_init();
+
+    usage_init();
+    pressure_init();
+    pageCache_init();
+    processTemplate_init();
+    futex_init();
+    kernelStack_init();
     vfs_init();
+    swap_init();
+    pressure_init_device();
+    usage_init_device();
     keyboard_init();
     mouse_init();
 
-    KERNEL_InitGDT();
     KERNEL_InitIDT();
     syscall_init();
+    smp_start();
+    tick_init();
+    timer_init();
+    softirq_init();
+    workqueue_init();
 
     /* Graphics initialization */
     GRAPHICS_InitGraphics(kmalloc(sizeof(uint32_t) * 1920 * 1080));
@@ -504,9 +580,9 @@ static void init_subsystems(void)
     vcon_init();
     fbcon_init();
 
-    pid_hash_init(PID_MAP, (void*)0xFFFF8D0000000000);
-    pid_hash_init(PGID_MAP, (void*)0xFFFF8E0000000000);
-    pid_hash_init(SID_MAP, (void*)0xFFFF8F0000000000);
+    pidMap_init(PID_MAP);
+    pidMap_init(PGID_MAP);
+    pidMap_init(SID_MAP);
 }
 
 /**
@@ -523,36 +599,13 @@ static void launch_system_processes(void)
         file_descriptor_t* open_file = fdm_open_file(entry);
         elfLoader_systemd(open_file);
     }
-    (*CURRENT_PROCESS) = scheduler_nextProcess();
-    /* Switch page table to process */
-    __asm__ volatile("mov %0, %%cr3\n\t" : : "r"((*CURRENT_PROCESS)->page_table) :);
-
-    /* Switch to process stack signature */
-    __asm__ volatile("mov %0, %%rsp\n\t" : : "r"(&(*CURRENT_PROCESS)->process_stack_signature) :);
-
-    TSS->ist1 = (uint64_t)(*CURRENT_PROCESS) + sizeof(process_stack_layout_t);
-
-    /* pop all registers */
     __asm__ volatile("mov $0x23, %%ax\n\t"
                      "mov %%ax, %%ds\n\t"
                      "mov %%ax, %%es\n\t"
-                     "pop %%r15\n\t"
-                     "pop %%r14\n\t"
-                     "pop %%r13\n\t"
-                     "pop %%r12\n\t"
-                     "pop %%r11\n\t"
-                     "pop %%r10\n\t"
-                     "pop %%r9\n\t"
-                     "pop %%r8\n\t"
-                     "pop %%rbp\n\t"
-                     "pop %%rdi\n\t"
-                     "pop %%rsi\n\t"
-                     "pop %%rdx\n\t"
-                     "pop %%rcx\n\t"
-                     "pop %%rbx\n\t"
-                     "pop %%rax\n\t"
                      :
                      :
-                     :);
-    __asm__ volatile("iretq\n\t" : ::);
+                     : "rax");
+
+    /* The boot stack becomes the idle process of the bootstrap processor */
+    smp_idle();
 }
\ No newline at end of file
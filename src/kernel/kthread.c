@@ -0,0 +1,64 @@
+/**
+ * @file kthread.c
+ * @brief Kernel Thread Implementation
+ *
+ * Implements the creation and end of kernel threads.
+ */
+#include <arch/idt.h>
+#include <arch/smp.h>
+#include <kernel/kthread.h>
+#include <kernel/process.h>
+#include <kernel/scheduler.h>
+#include <kernel/wait.h>
+#include <memory/kglobals.h>
+#include <memory/kmemory.h>
+#include <memory/kpool.h>
+
+/**
+ * @brief First code of a kernel thread, entered from its interrupt frame with the function and its data in rcx and rdx
+ *
+ * Ends the thread once the function returns, it is switched away from for good.
+ */
+static void kthread_main(void (*function)(uint64_t), uint64_t data)
+{
+    function(data);
+
+    process_t* self = *CURRENT_PROCESS;
+    wait_cancel(self);
+    process_t* next = schedule_end(self);
+    process_release(self);
+    scheduler_switch(next);
+}
+
+process_t* kthread_create(void (*function)(uint64_t), uint64_t data, cpu_t* cpu, uint64_t priority)
+{
+    process_t* thread = pool_allocate(*PROCESS_POOL);
+    kmemset(thread, 0, sizeof(process_t));
+    if (process_init_kernel_stack(thread, 0) != 0)
+    {
+        pool_free(thread);
+        return 0;
+    }
+    wait_start(thread);
+    thread->thread_leader = thread;
+    thread->signal = SIGNONE;
+    thread->flags = PROCESS_KTHREAD;
+    thread->policy = priority ? SCHEDULER_FIFO : SCHEDULER_NORMAL;
+    thread->rt_priority = priority;
+
+    /* The first switch returns into kthread_main in kernel mode, interrupts stay off like in any kernel code */
+    interrupt_frame_t* frame = (interrupt_frame_t*)thread->kernel_stack - 1;
+    frame->irq_number = 32; /* Not a fault, the way out leaves a kernel frame alone */
+    thread->regs->rip = (uint64_t)kthread_main;
+    thread->regs->cs = 0x08; /* kernel - 0x08, user - 0x1B*/
+    thread->regs->ss = 0x10; /* kernel - 0x10, user - 0x23 */
+    thread->regs->rflags = 0x2;
+    thread->regs->rcx = (uint64_t)function;
+    thread->regs->rdx = data;
+
+    /* As if called: the return address slot below 16 byte alignment and the shadow space above it */
+    thread->regs->rsp = (uint64_t)thread->kernel_stack - 56;
+
+    scheduler_schedule_on(thread, cpu);
+    return thread;
+}
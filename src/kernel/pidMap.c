@@ -0,0 +1,198 @@
+/**
+ * @file pidMap.c
+ * @brief Process ID Map Implementation
+ *
+ * Implements the radix tree behind process, group and session ids, the lowest
+ * free id search and iteration by id.
+ */
+#include <kernel/pidMap.h>
+#include <kmath.h>
+#include <memory/kmemory.h>
+#include <memory/kpool.h>
+
+/**
+ * @brief Slot of an id in a node of a level
+ */
+static inline uint32_t pidMap_index(uint32_t id, uint32_t level)
+{
+    return (id >> (PID_MAP_BITS * (PID_MAP_LEVELS - 1 - level))) & (PID_MAP_FANOUT - 1);
+}
+
+/**
+ * @brief Finds the lowest free id below a node
+ * @param base lowest id below the node
+ * @param min lowest id wanted, inside or below the range of the node
+ * @return free id, 0 if there is none
+ */
+static uint32_t pidMap_find_free_node(pid_map_node_t* node, uint32_t level, uint32_t base, uint32_t min)
+{
+    uint32_t shift = PID_MAP_BITS * (PID_MAP_LEVELS - 1 - level);
+    uint32_t first = min > base ? (min - base) >> shift : 0;
+
+    uint64_t candidates = ~node->full & (~0ull << first);
+    while (candidates)
+    {
+        uint32_t slot = __builtin_ctzll(candidates);
+        candidates &= candidates - 1;
+
+        /* An id of the last level or a missing child is free as it is */
+        uint32_t slot_base = base + (slot << shift);
+        if (level == PID_MAP_LEVELS - 1 || !(node->used & (1ull << slot)))
+            return MAX(slot_base, min);
+
+        uint32_t id = pidMap_find_free_node(node->slots[slot], level + 1, slot_base, min);
+        if (id)
+            return id;
+    }
+    return 0;
+}
+
+/**
+ * @brief Finds the entry with the lowest id from *id below a node
+ * @param base lowest id below the node
+ * @return entry, NULL if there is none
+ */
+static void* pidMap_next_node(pid_map_node_t* node, uint32_t level, uint32_t base, uint32_t* id)
+{
+    uint32_t shift = PID_MAP_BITS * (PID_MAP_LEVELS - 1 - level);
+    uint32_t first = *id > base ? (*id - base) >> shift : 0;
+
+    uint64_t candidates = node->used & (~0ull << first);
+    while (candidates)
+    {
+        uint32_t slot = __builtin_ctzll(candidates);
+        candidates &= candidates - 1;
+
+        uint32_t slot_base = base + (slot << shift);
+        if (level == PID_MAP_LEVELS - 1)
+        {
+            if (!node->slots[slot])
+                continue; /* Reserved */
+            *id = slot_base;
+            return node->slots[slot];
+        }
+
+        void* entry = pidMap_next_node(node->slots[slot], level + 1, slot_base, id);
+        if (entry)
+            return entry;
+    }
+    return 0;
+}
+
+void pidMap_init(pid_map_t* map)
+{
+    map->pool = pool_create(sizeof(pid_map_node_t), 8);
+    map->root = pool_allocate(map->pool);
+    kmemset(map->root, 0, sizeof(pid_map_node_t));
+    map->count = 0;
+}
+
+uint32_t pidMap_find_free(pid_map_t* map, uint32_t min)
+{
+    if (!min)
+        min = 1;
+    if (min >= PID_MAX)
+        return 0;
+    return pidMap_find_free_node(map->root, 0, 0, min);
+}
+
+bool pidMap_insert(pid_map_t* map, uint32_t id, void* entry)
+{
+    if (!id || id >= PID_MAX)
+        return 0;
+
+    pid_map_node_t* path[PID_MAP_LEVELS];
+    pid_map_node_t* node = map->root;
+    for (uint32_t level = 0; level < PID_MAP_LEVELS - 1; level++)
+    {
+        path[level] = node;
+        uint64_t bit = 1ull << pidMap_index(id, level);
+        if (!(node->used & bit))
+        {
+            pid_map_node_t* child = pool_allocate(map->pool);
+            if (!child)
+                return 0;
+            kmemset(child, 0, sizeof(pid_map_node_t));
+            node->slots[pidMap_index(id, level)] = child;
+            node->used |= bit;
+        }
+        node = node->slots[pidMap_index(id, level)];
+    }
+
+    uint64_t bit = 1ull << pidMap_index(id, PID_MAP_LEVELS - 1);
+    node->slots[pidMap_index(id, PID_MAP_LEVELS - 1)] = entry;
+    if (node->used & bit)
+        return 1;
+    node->used |= bit;
+    node->full |= bit;
+    map->count++;
+
+    /* Every node the id filled up is full in its parent */
+    for (int32_t level = PID_MAP_LEVELS - 2; level >= 0 && node->full == ~0ull; level--)
+    {
+        path[level]->full |= 1ull << pidMap_index(id, level);
+        node = path[level];
+    }
+    return 1;
+}
+
+void* pidMap_lookup(pid_map_t* map, uint32_t id)
+{
+    if (id >= PID_MAX)
+        return 0;
+
+    pid_map_node_t* node = map->root;
+    for (uint32_t level = 0; level < PID_MAP_LEVELS - 1; level++)
+    {
+        if (!(node->used & (1ull << pidMap_index(id, level))))
+            return 0;
+        node = node->slots[pidMap_index(id, level)];
+    }
+    return node->slots[pidMap_index(id, PID_MAP_LEVELS - 1)];
+}
+
+void pidMap_remove(pid_map_t* map, uint32_t id)
+{
+    if (!id || id >= PID_MAX)
+        return;
+
+    pid_map_node_t* path[PID_MAP_LEVELS];
+    pid_map_node_t* node = map->root;
+    for (uint32_t level = 0; level < PID_MAP_LEVELS - 1; level++)
+    {
+        if (!(node->used & (1ull << pidMap_index(id, level))))
+            return;
+        path[level] = node;
+        node = node->slots[pidMap_index(id, level)];
+    }
+
+    uint64_t bit = 1ull << pidMap_index(id, PID_MAP_LEVELS - 1);
+    if (!(node->used & bit))
+        return;
+    node->slots[pidMap_index(id, PID_MAP_LEVELS - 1)] = 0;
+    node->used &= ~bit;
+    node->full &= ~bit;
+    map->count--;
+
+    /* The path has a free id again, nodes left empty go back to the pool */
+    for (int32_t level = PID_MAP_LEVELS - 2; level >= 0; level--)
+    {
+        pid_map_node_t* parent = path[level];
+        uint64_t slot_bit = 1ull << pidMap_index(id, level);
+        parent->full &= ~slot_bit;
+        if (!node->used)
+        {
+            pool_free(node);
+            parent->slots[pidMap_index(id, level)] = 0;
+            parent->used &= ~slot_bit;
+        }
+        node = parent;
+    }
+}
+
+void* pidMap_next(pid_map_t* map, uint32_t* id)
+{
+    if (*id >= PID_MAX)
+        return 0;
+    return pidMap_next_node(map->root, 0, 0, id);
+}
@@ -6,16 +6,24 @@
  * and process lifecycle operations for the kernel multitasking system.
  */
 
+#include <arch/idt.h>
+#include <arch/smp.h>
 #include <boot/elfLoader.h>
+#include <drivers/vcon.h>
 
 #include <fs/vfs.h>
+#include <kernel/futex.h>
 #include <kernel/process.h>
+#include <kernel/processTemplate.h>
 #include <kernel/scheduler.h>
 #include <kernel/syscalls.h>
+#include <kernel/wait.h>
 #include <kmath.h>
+#include <kstring.h>
 #include <memory/kglobals.h>
 #include <memory/kmemory.h>
 #include <memory/memoryMap.h>
+#include <memory/pageCache.h>
 #include <memory/paging.h>
 #include <misc/debug.h>
 #include <stdint.h>
@@ -26,7 +34,13 @@
  */
 uint64_t process_genPID()
 {
-    return (*PID)++;
+    /* An id still naming a group or session is skipped, its members would be mixed up with the new process */
+    uint32_t pid = pidMap_find_free(PID_MAP, 1);
+    while (pid && (pidMap_lookup(PGID_MAP, pid) || pidMap_lookup(SID_MAP, pid)))
+        pid = pidMap_find_free(PID_MAP, pid + 1);
+
+    pidMap_insert(PID_MAP, pid, 0);
+    return pid;
 }
 
 /**
@@ -41,7 +55,7 @@ uint64_t process_genPID()
  */
 uint64_t process_add_page(uint64_t page_number, uint64_t page_count, uint64_t page_size, process_page_use use)
 {
-    DECLARE_PROCESS;
+    process_t* process = (*CURRENT_PROCESS)->thread_leader;
 
     /* userspace address */
     uint64_t user_addr = 0;
@@ -68,6 +82,29 @@ uint64_t process_add_page(uint64_t page_number, uint64_t page_count, uint64_t pa
     return user_addr;
 }
 
+/**
+ * @brief Grows the stack area of a process down to an address
+ * @param process process whose stack grows
+ * @param vaddr address below the stack
+ * @return the stack area, NULL if the address cannot be part of the stack
+ */
+static vma_t* process_grow_stack(process_t* process, uint64_t vaddr)
+{
+    uint64_t start = ALIGN_DOWN(vaddr, PAGE_SIZE_4KB);
+
+    vma_t* stack = vma_find_next(&process->vmas, vaddr);
+    if (!stack || stack->backing != VMA_STACK || stack->end - start > process->stack_limit)
+        return 0;
+
+    /* Keep an unmapped guard page between the stack and the area below it */
+    krbtree_node_t* below = krbtree_prev(&stack->node);
+    if (below && krbtree_entry(below, vma_t, node)->end + PAGE_SIZE_4KB > start)
+        return 0;
+
+    stack->start = start;
+    return stack;
+}
+
 /**
  * @brief Validates a memory region in a process
  * @param vaddr virtual address checking
@@ -76,44 +113,292 @@ uint64_t process_add_page(uint64_t page_number, uint64_t page_count, uint64_t pa
  */
 bool process_validate_address(void* vaddr, size_t size)
 {
-    DECLARE_PROCESS;
+    process_t* process = (*CURRENT_PROCESS)->thread_leader;
+
+    /* Buffers on the stack may lie below what has been touched so far */
+    if (!vma_find(&process->vmas, (uint64_t)vaddr))
+        process_grow_stack(process, (uint64_t)vaddr);
+
+    return vma_check(&process->vmas, (uint64_t)vaddr, size, PROT_NONE);
+}
+
+/**
+ * @brief Maps a page of a file area
+ * @param process process the page is mapped in
+ * @param vma file area containing the page
+ * @param vaddr page aligned address
+ * @param write 1 if the page is about to be written
+ * @return 1 if the page was mapped
+ *
+ * The cached frame of the file is mapped copy on write. Writes and the page
+ * holding the end of the file contents get a private copy instead.
+ */
+static bool process_map_file_page(process_t* process, vma_t* vma, uint64_t vaddr, bool write)
+{
+    /* Past the file contents is bss, areas grown by mremap have no contents at all */
+    uint64_t size = vaddr < vma->file_end ? MIN(PAGE_SIZE_4KB, vma->file_end - vaddr) : 0;
+
+    void* frame = 0;
+    if (size)
+    {
+        frame = pageCache_get(vma->file, (vma->offset + (vaddr - vma->start)) / PAGE_SIZE_4KB);
+        if (!frame)
+            return 0;
+    }
+
+    if (write || size < PAGE_SIZE_4KB)
+    {
+        void* page = pages_allocatePage(PAGE_SIZE_4KB);
+        if (!page)
+            return 0;
 
-    size_t start = (size_t)vaddr;
-    size_t end = start + size;
+        kmemcpy(page, frame, size);
+        kmemset((uint8_t*)page + size, 0, PAGE_SIZE_4KB - size);
 
-    // TODO: implement this somehow
+        pageTable_addPage(&process->page_table, (void*)vaddr, (uint64_t)page / PAGE_SIZE_4KB, 1, PAGE_SIZE_4KB, 4);
+        if (!(vma->prot & PROT_WRITE))
+        {
+            /* pageTable_addPage always maps writable */
+            *pageTable_find_entry(&process->page_table, vaddr).entry_ptr &= ~PAGE_WRITABLE;
+        }
+        swap_track(process, vaddr, page);
+        return 1;
+    }
 
+    /* Read only text stays copy on write too, mprotect must not make the cached frame writable */
+    pageTable_addPage(&process->page_table, (void*)vaddr, (uint64_t)frame / PAGE_SIZE_4KB, 1, PAGE_SIZE_4KB, 4);
+    uint64_t* file_entry = pageTable_find_entry(&process->page_table, vaddr).entry_ptr;
+    *file_entry = (*file_entry & ~PAGE_WRITABLE) | PAGE_COW;
+    pages_share(frame, PAGE_SIZE_4KB);
     return 1;
 }
 
-void process_remove_from_group(process_t* process)
+/**
+ * @brief Services a page fault the process is allowed to take
+ * @param process process the fault happened in
+ * @param vaddr faulting virtual address
+ * @param write 1 if the faulting access was a write
+ * @return 1 if the fault was serviced, 0 if the process should be signalled
+ */
+static bool process_resolve_fault_page(process_t* process, uint64_t vaddr, bool write)
 {
-    if (process->pgid == 0)
-        return;
-    process_group_t* group = (process_group_t*)pid_hash_lookup(PGID_MAP, process->pgid);
-    for (int i = 0; i < group->process_count; i++)
+    /* Threads fault on the areas of their leader */
+    process = process->thread_leader;
+
+    vma_t* vma = vma_find(&process->vmas, vaddr);
+    if (!vma)
+        vma = process_grow_stack(process, vaddr);
+    if (!vma || vma->prot == PROT_NONE || (write && !(vma->prot & PROT_WRITE)))
+        return 0;
+
+    page_lookup_result_t entry = pageTable_find_entry(&process->page_table, vaddr);
+
+    /* Page was pushed out to swap */
+    if (!entry.size && SWAP_IS_ENTRY(entry.entry))
+        return swap_fault(process, vma, vaddr);
+
+    /* Copy on write */
+    if (write && entry.size && (entry.entry & PAGE_COW))
     {
-        if (group->processes[i]->pid == process->pid)
+        void* frame = (void*)(entry.entry & PAGE_MASK);
+
+        if (frame != *ZERO_PAGE && entry.size == PAGE_SIZE_2MB && PROCESS_COW_SPLIT && pages_shareCount(frame, entry.size))
+        {
+            /* Only the touched 4kb piece gets copied, the rest stays shared */
+            if (pageTable_split(&process->page_table, vaddr) == 0)
+            {
+                entry = pageTable_find_entry(&process->page_table, vaddr);
+                frame = (void*)(entry.entry & PAGE_MASK);
+            }
+        }
+
+        if (frame != *ZERO_PAGE && !pages_shareCount(frame, entry.size))
         {
-            group->processes[i] = group->processes[--group->process_count];
-            process->pgid = 0;
+            /* Every other mapping is gone, take the frame over in place */
+            *entry.entry_ptr = (entry.entry & ~PAGE_COW) | PAGE_WRITABLE;
+            __asm__ volatile("invlpg (%0)" ::"r"(vaddr) : "memory");
+            return 1;
         }
+
+        uint64_t page = (uint64_t)pages_allocatePage(entry.size);
+        if (!page)
+            return 0;
+
+        if (frame == *ZERO_PAGE)
+        {
+            /* First write to untouched memory, nothing to copy */
+            kmemset((void*)page, 0, entry.size);
+        }
+        else
+        {
+            kmemcpy((void*)page, frame, entry.size);
+        }
+        pageTable_addPage(&process->page_table, (void*)ALIGN_DOWN(vaddr, entry.size), page / entry.size, 1, entry.size, 4);
+        pages_release(frame, entry.size);
+        if (entry.size == PAGE_SIZE_4KB)
+            swap_track(process, vaddr, (void*)page);
+        return 1;
     }
+
+    /* File pages come from the page cache, reads map the neighbouring pages too */
+    if (!entry.size && vma->backing == VMA_FILE)
+    {
+        uint64_t page = ALIGN_DOWN(vaddr, PAGE_SIZE_4KB);
+        if (!process_map_file_page(process, vma, page, write))
+            return 0;
+
+        if (!write)
+        {
+            /* Only whole pages of the file, the last one would need a private copy */
+            uint64_t window = ALIGN_DOWN(vaddr, PAGE_CACHE_FAULT_AROUND * PAGE_SIZE_4KB);
+            uint64_t start = MAX(window, vma->start);
+            uint64_t end = MIN(MIN(window + PAGE_CACHE_FAULT_AROUND * PAGE_SIZE_4KB, vma->end), ALIGN_DOWN(vma->file_end, PAGE_SIZE_4KB));
+
+            for (uint64_t around = start; around < end; around += PAGE_SIZE_4KB)
+            {
+                page_lookup_result_t neighbour = pageTable_find_entry(&process->page_table, around);
+                if (around == page || neighbour.size || SWAP_IS_ENTRY(neighbour.entry))
+                    continue;
+                if (!process_map_file_page(process, vma, around, 0))
+                    break;
+            }
+        }
+        return 1;
+    }
+
+    /* Anonymous and stack memory is only backed on first touch, without MADV_HUGEPAGE reads take the zero frame below */
+    if (!entry.size && vma->backing != VMA_FILE && ((PROCESS_THP && write) || (vma->flags & VMA_HUGEPAGE)))
+    {
+        /* Use a huge page when the whole 2mb slot belongs to the area and is empty */
+        uint64_t slot = ALIGN_DOWN(vaddr, PAGE_SIZE_2MB);
+        if (slot >= vma->start && slot + PAGE_SIZE_2MB <= vma->end && pageTable_huge_slot_free(&process->page_table, slot))
+        {
+            void* page = pages_allocatePage(PAGE_SIZE_2MB);
+            if (page)
+            {
+                kmemset(page, 0, PAGE_SIZE_2MB);
+                pageTable_addPage(&process->page_table, (void*)slot, (uint64_t)page / PAGE_SIZE_2MB, 1, PAGE_SIZE_2MB, 4);
+                if (!(vma->prot & PROT_WRITE))
+                {
+                    /* pageTable_addPage always maps writable */
+                    *pageTable_find_entry(&process->page_table, vaddr).entry_ptr &= ~PAGE_WRITABLE;
+                }
+                return 1;
+            }
+        }
+    }
+
+    /* Reads of untouched memory share the zero frame until the first write */
+    if (!entry.size && !write && vma->backing != VMA_FILE)
+    {
+        pageTable_addPage(&process->page_table, (void*)ALIGN_DOWN(vaddr, PAGE_SIZE_4KB), (uint64_t)*ZERO_PAGE / PAGE_SIZE_4KB, 1, PAGE_SIZE_4KB, 4);
+        uint64_t* zero_entry = pageTable_find_entry(&process->page_table, vaddr).entry_ptr;
+        *zero_entry = (*zero_entry & ~PAGE_WRITABLE) | PAGE_COW;
+        pages_share(*ZERO_PAGE, PAGE_SIZE_4KB);
+        return 1;
+    }
+
+    if (!entry.size && vma->backing != VMA_FILE)
+    {
+        void* page = pages_allocatePage(PAGE_SIZE_4KB);
+        if (!page)
+            return 0;
+        kmemset(page, 0, PAGE_SIZE_4KB);
+        pageTable_addPage(&process->page_table, (void*)ALIGN_DOWN(vaddr, PAGE_SIZE_4KB), (uint64_t)page / PAGE_SIZE_4KB, 1, PAGE_SIZE_4KB, 4);
+        if (!(vma->prot & PROT_WRITE))
+        {
+            /* pageTable_addPage always maps writable */
+            *pageTable_find_entry(&process->page_table, vaddr).entry_ptr &= ~PAGE_WRITABLE;
+        }
+        swap_track(process, vaddr, page);
+        return 1;
+    }
+
+    return 0;
 }
 
-void process_remove_from_session(process_t* process)
+bool process_resolve_fault(process_t* process, uint64_t vaddr, bool write)
+{
+    /* Reading the page cache from disk or swapping in makes the fault major */
+    uint64_t io = PAGE_CACHE->reads + SWAP->stats.swapped_in;
+    if (!process_resolve_fault_page(process, vaddr, write))
+        return 0;
+
+    usage_fault(process, PAGE_CACHE->reads + SWAP->stats.swapped_in != io);
+    return 1;
+}
+
+/**
+ * @brief Makes a user memory region of the current process present
+ * @param vaddr start of the region
+ * @param size size of the region in bytes
+ * @param write 1 if the kernel is going to write the region
+ */
+void process_fault_in(uint64_t vaddr, size_t size, bool write)
 {
-    if (process->sid == 0)
+    DECLARE_PROCESS;
+
+    if (!size)
         return;
-    process_session_t* session = (process_session_t*)pid_hash_lookup(SID_MAP, process->sid);
-    for (int i = 0; i < session->process_count; i++)
+
+    uint64_t current_cr3;
+    __asm__ volatile("mov %%cr3, %0\n\t" : "=r"(current_cr3) : :);
+    __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(*KERNEL_PAGE_TABLE) :);
+
+    for (uint64_t page = ALIGN_DOWN(vaddr, PAGE_SIZE_4KB); page < vaddr + size; page += PAGE_SIZE_4KB)
     {
-        if (session->processes[i]->sid == process->sid)
+        page_lookup_result_t entry = pageTable_find_entry(&process->page_table, page);
+        if (!entry.size || (write && (entry.entry & PAGE_COW)))
         {
-            session->processes[i] = session->processes[--session->process_count];
-            process->sid = 0;
+            /* Best effort, invalid addresses are left to fault as before */
+            process_resolve_fault(process, page, write);
         }
     }
+
+    __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(current_cr3) :);
+}
+
+void process_remove_from_group(process_t* process)
+{
+    if (process->pgid == 0 || !process->group_next)
+        return;
+    process_group_t* group = (process_group_t*)pidMap_lookup(PGID_MAP, process->pgid);
+
+    process->group_last->group_next = process->group_next;
+    process->group_next->group_last = process->group_last;
+    if (group->processes == process)
+        group->processes = process->group_next == process ? 0 : process->group_next;
+    process->group_next = 0;
+    process->group_last = 0;
+    process->pgid = 0;
+
+    /* The group goes away with its last member, its id can be handed out again */
+    if (--group->process_count == 0)
+    {
+        pidMap_remove(PGID_MAP, group->pgid);
+        pool_free(group);
+    }
+}
+
+void process_remove_from_session(process_t* process)
+{
+    if (process->sid == 0 || !process->session_next)
+        return;
+    process_session_t* session = (process_session_t*)pidMap_lookup(SID_MAP, process->sid);
+
+    process->session_last->session_next = process->session_next;
+    process->session_next->session_last = process->session_last;
+    if (session->processes == process)
+        session->processes = process->session_next == process ? 0 : process->session_next;
+    process->session_next = 0;
+    process->session_last = 0;
+    process->sid = 0;
+
+    if (--session->process_count == 0)
+    {
+        pidMap_remove(SID_MAP, session->sid);
+        pool_free(session);
+    }
 }
 
 process_group_t* process_create_group(uint64_t pgid)
@@ -121,10 +406,9 @@ process_group_t* process_create_group(uint64_t pgid)
     process_group_t* group = pool_allocate(*PROCESS_GROUP_POOL);
 
     group->pgid = pgid;
-    group->process_capacity = 1;
+    group->processes = 0;
     group->process_count = 0;
-    group->processes = kmalloc(sizeof(process_t*) * group->process_capacity);
-    pid_hash_insert(PGID_MAP, pgid, (uint64_t)group);
+    pidMap_insert(PGID_MAP, pgid, group);
 
     return group;
 }
@@ -134,48 +418,145 @@ process_session_t* process_create_session(uint64_t sid)
     process_session_t* session = pool_allocate(*SESSION_POOL);
 
     session->sid = sid;
-    session->process_capacity = 1;
+    session->processes = 0;
     session->process_count = 0;
-    session->processes = kmalloc(sizeof(process_t*) * session->process_capacity);
-    pid_hash_insert(SID_MAP, sid, (uint64_t)session);
+    pidMap_insert(SID_MAP, sid, session);
 
     return session;
 }
 
 void process_add_to_group(process_t* process, uint64_t pgid)
 {
-    process_group_t* group = (process_group_t*)pid_hash_lookup(PGID_MAP, pgid);
+    process_group_t* group = (process_group_t*)pidMap_lookup(PGID_MAP, pgid);
 
     if (!group)
     {
         group = process_create_group(pgid);
     }
 
-    if (group->process_count == group->process_capacity)
+    /* Added at the end of the loop, signals reach members in the order they joined */
+    process_t* first = group->processes;
+    if (!first)
+    {
+        process->group_next = process;
+        process->group_last = process;
+        group->processes = process;
+    }
+    else
     {
-        group->process_capacity *= 2;
-        group->processes = krealloc(group->processes, group->process_capacity * sizeof(process_t*));
+        process->group_next = first;
+        process->group_last = first->group_last;
+        first->group_last->group_next = process;
+        first->group_last = process;
     }
-    group->processes[group->process_count++] = process;
+    group->process_count++;
     process->pgid = group->pgid;
 }
 
 void process_add_to_session(process_t* process, uint64_t sid)
 {
-    process_session_t* session = (process_session_t*)pid_hash_lookup(SID_MAP, sid);
+    process_session_t* session = (process_session_t*)pidMap_lookup(SID_MAP, sid);
 
     if (!session)
     {
         session = process_create_session(sid);
     }
 
-    if (session->process_count == session->process_capacity)
+    process_t* first = session->processes;
+    if (!first)
     {
-        session->process_capacity *= 2;
-        session->processes = krealloc(session->processes, session->process_capacity * sizeof(process_t*));
+        process->session_next = process;
+        process->session_last = process;
+        session->processes = process;
     }
-    session->processes[session->process_count++] = process;
-    process->pgid = session->sid;
+    else
+    {
+        process->session_next = first;
+        process->session_last = first->session_last;
+        first->session_last->session_next = process;
+        first->session_last = process;
+    }
+    session->process_count++;
+    process->sid = session->sid;
+}
+
+/**
+ * @brief Puts a copied process in the group and session of the process it was copied from
+ * @param process process whose pgid and sid were copied along with the links of the original
+ */
+static void process_join_groups(process_t* process)
+{
+    uint64_t pgid = process->pgid;
+    uint64_t sid = process->sid;
+    process->pgid = 0;
+    process->sid = 0;
+    process->group_next = 0;
+    process->group_last = 0;
+    process->session_next = 0;
+    process->session_last = 0;
+
+    if (pgid)
+        process_add_to_group(process, pgid);
+    if (sid)
+        process_add_to_session(process, sid);
+}
+
+/**
+ * @brief Makes a copied process the only thread of its own process
+ * @param process process copied from another one
+ * @param parent process it was copied from, the areas and heap of its leader are taken
+ */
+static void process_init_threads(process_t* process, process_t* parent)
+{
+    process_t* leader = parent->thread_leader;
+    process->vmas = leader->vmas;
+    process->stack_limit = leader->stack_limit;
+    process->heap_end = leader->heap_end;
+    process->process_heap_ptr = leader->process_heap_ptr;
+    process->process_shared_ptr = leader->process_shared_ptr;
+
+    process->thread_leader = process;
+    process->thread_count = 0;
+    process->clear_child_tid = 0;
+    process->futex_addr = 0;
+    process->futex_next = 0;
+}
+
+int process_init_kernel_stack(process_t* process, process_t* parent)
+{
+    process->kernel_stack = kernelStack_allocate();
+    if (!process->kernel_stack)
+        return 1;
+
+    process->regs = &((interrupt_frame_t*)process->kernel_stack - 1)->regs;
+    if (parent)
+        kmemcpy(process->regs, parent->regs, sizeof(process_stack_layout_t));
+    else
+        kmemset(process->regs, 0, sizeof(process_stack_layout_t));
+
+    scheduler_init_context(process);
+    return 0;
+}
+
+void process_release(process_t* process)
+{
+    /* The previous one was switched away from for good, its stack is free now */
+    process_t* reaped = *PROCESS_REAP;
+    if (reaped && reaped != *CURRENT_PROCESS)
+    {
+        *PROCESS_REAP = 0;
+        kernelStack_free(reaped->kernel_stack);
+        pool_free(reaped);
+    }
+
+    if (process == *CURRENT_PROCESS)
+    {
+        *PROCESS_REAP = process;
+        return;
+    }
+
+    kernelStack_free(process->kernel_stack);
+    pool_free(process);
 }
 
 int process_fork()
@@ -183,96 +564,498 @@ int process_fork()
     process_t* forked_process = (*CURRENT_PROCESS);
     process_t* process = pool_allocate(*PROCESS_POOL);
     kmemcpy(process, forked_process, sizeof(process_t));
+    if (process_init_kernel_stack(process, forked_process) != 0)
+    {
+        pool_free(process);
+        forked_process->regs->rax = (uint64_t)-1;
+        return -1;
+    }
+    process_init_threads(process, forked_process);
+    usage_start(process);
+    wait_start(process);
     process->file_descriptor_table = pool_allocate(*FD_ENTRY_POOL);
     fdm_copy((file_descriptor_entry_t*)forked_process->file_descriptor_table, (file_descriptor_entry_t*)process->file_descriptor_table);
     process->page_table = pageTable_fork(&forked_process->page_table);
+    process->vmas.root = 0;
+    vma_copy(&process->vmas, &forked_process->thread_leader->vmas);
     process->pid = process_genPID();
-    process->process_stack_signature.rax = 0;
-    forked_process->process_stack_signature.rax = process->pid;
-    process->waiting_parent_pid = 0;
+    process->regs->rax = 0;
+    forked_process->regs->rax = process->pid;
     process->flags = 0;
     process->signal = SIGNONE;
+    process_join_groups(process);
     pageTable_addKernel(&process->page_table);
-    (*CURRENT_PROCESS) = scheduler_schedule(process);
-    /* Prepare for context switch:
-     * R12 = new process's page table root (CR3)
-     * R11 = new process's stack pointer */
-    INTERRUPT_INFO->cr3 = (uint64_t)(*CURRENT_PROCESS)->page_table;
-    INTERRUPT_INFO->rsp = (uint64_t)&(*CURRENT_PROCESS)->process_stack_signature;
-    TSS->ist1 = (uint64_t)(*CURRENT_PROCESS) + sizeof(process_stack_layout_t);
+
+    /* Placed on this CPU the child runs first, the parent returns from here when it is picked again */
+    scheduler_schedule(process);
+    if (process->cpu == smp_cpu())
+        scheduler_switch(process);
+    return process->pid;
+}
+
+void process_vfork()
+{
+    process_t* parent = (*CURRENT_PROCESS);
+    process_t* process = pool_allocate(*PROCESS_POOL);
+    kmemcpy(process, parent, sizeof(process_t));
+    if (process_init_kernel_stack(process, parent) != 0)
+    {
+        pool_free(process);
+        parent->regs->rax = (uint64_t)-1;
+        return;
+    }
+    process_init_threads(process, parent);
+    usage_start(process);
+    wait_start(process);
+    process->file_descriptor_table = pool_allocate(*FD_ENTRY_POOL);
+    fdm_copy((file_descriptor_entry_t*)parent->file_descriptor_table, (file_descriptor_entry_t*)process->file_descriptor_table);
+
+    /* Page table and areas are borrowed, not copied */
+    process->pid = process_genPID();
+    process->ppid = parent->pid;
+    process->regs->rax = 0;
+    parent->regs->rax = process->pid;
+    process->vfork_parent_pid = parent->pid;
+    process->flags = PROCESS_VFORK;
+    process->signal = SIGNONE;
+    process_join_groups(process);
+
+    parent->flags |= PROCESS_VFORK;
+    scheduler_schedule(process);
+    scheduler_switch(process);
+
+    /* Sleeps here until the child execs or exits */
+    while (parent->flags & PROCESS_VFORK)
+    {
+        schedule_block(parent);
+        scheduler_yield();
+    }
+}
+
+/**
+ * @brief Copies user strings into a single kernel buffer
+ * @param count number of strings, lowered if they do not fit the buffer
+ * @param strings user pointers to the strings
+ * @param buffer buffer being appended to
+ * @param capacity bytes the buffer holds, nothing is written past it
+ * @param size bytes used in buffer
+ *
+ * Runs in the address space the strings belong to. Every page is checked and
+ * faulted in before it is read.
+ */
+static void process_copy_strings(int* count, char** strings, char* buffer, uint64_t capacity, uint64_t* size)
+{
+    for (int i = 0; i < *count; i++)
+    {
+        const char* string = strings[i];
+        uint64_t start = *size;
+
+        for (uint64_t j = 0;; j++)
+        {
+            if (j == 0 || ((uint64_t)(string + j) & (PAGE_SIZE_4KB - 1)) == 0)
+            {
+                if (!process_validate_address((void*)(string + j), 1))
+                    break;
+                process_fault_in((uint64_t)(string + j), 1, 0);
+            }
+
+            if (*size == capacity)
+                break;
+
+            buffer[(*size)++] = string[j];
+            if (!string[j])
+                break;
+        }
+
+        if (*size == start || buffer[*size - 1])
+        {
+            /* Unreadable or does not fit, drop it and everything after it */
+            *size = start;
+            *count = i;
+            return;
+        }
+    }
+}
+
+/* Auxiliary vector types */
+#define AT_NULL 0
+#define AT_PHDR 3
+#define AT_PHENT 4
+#define AT_PHNUM 5
+#define AT_PAGESZ 6
+#define AT_BASE 7
+#define AT_ENTRY 9
+
+#define ELF_PHENT_SIZE 56 /* Size of a 64 bit program header */
+
+uint64_t process_setup_stack(process_t* process, int argc, const char* strings, uint64_t size, int envc)
+{
+    /* The dynamic loader finds the program through these */
+    uint64_t auxv[] = {AT_PHDR,   process->program_headers, AT_PHENT, ELF_PHENT_SIZE,        AT_PHNUM, process->program_header_count,
+                       AT_PAGESZ, PAGE_SIZE_4KB,            AT_BASE,  process->interp_base, AT_ENTRY, process->entry,
+                       AT_NULL,   0};
+
+    /* argc, argv and envp with their terminators, then the auxiliary vector */
+    uint64_t strings_start = PROCESS_STACK_TOP - ALIGN_UP(size, 16);
+    uint64_t words = 1 + (argc + 1) + (envc + 1) + sizeof(auxv) / sizeof(uint64_t);
+    uint64_t rsp = ALIGN_DOWN(strings_start - words * sizeof(uint64_t), 16);
+
+    uint64_t image_size = PROCESS_STACK_TOP - rsp;
+    uint8_t* image = kmalloc(image_size);
+    kmemset(image, 0, image_size);
+    kmemcpy(image + (strings_start - rsp), strings, size);
+
+    uint64_t* vector = (uint64_t*)image;
+    uint64_t string = strings_start;
+    *vector++ = argc;
+    for (int i = 0; i < argc + envc + 1; i++)
+    {
+        if (i == argc)
+        {
+            *vector++ = 0; /* End of argv */
+            continue;
+        }
+        *vector++ = string;
+        string += kernel_strlen((const uint8_t*)strings + (string - strings_start)) + 1;
+    }
+    *vector++ = 0; /* End of envp */
+    kmemcpy(vector, auxv, sizeof(auxv));
+
+    /* Back only the pages the image lands on */
+    for (uint64_t page = ALIGN_DOWN(rsp, PAGE_SIZE_4KB); page < PROCESS_STACK_TOP; page += PAGE_SIZE_4KB)
+    {
+        uint8_t* frame = pages_allocatePage(PAGE_SIZE_4KB);
+        if (!frame)
+        {
+            /* Pages mapped so far go with the address space the caller releases */
+            kfree(image);
+            return 0;
+        }
+        kmemset(frame, 0, PAGE_SIZE_4KB);
+
+        uint64_t from = MAX(page, rsp);
+        kmemcpy(frame + (from - page), image + (from - rsp), page + PAGE_SIZE_4KB - from);
+        pageTable_addPage(&process->page_table, (void*)page, (uint64_t)frame / PAGE_SIZE_4KB, 1, PAGE_SIZE_4KB, 4);
+    }
+    kfree(image);
+
+    process->stack_limit = PROCESS_STACK_LIMIT;
+    vma_create(&process->vmas, MIN(ALIGN_DOWN(rsp, PAGE_SIZE_4KB), PROCESS_STACK_TOP - PROCESS_STACK_INITIAL), PROCESS_STACK_TOP, PROT_READ | PROT_WRITE, VMA_STACK, 0);
+
+    return rsp;
+}
+
+/**
+ * @brief Sets the registers and heap of a freshly loaded program
+ * @param process process being set up
+ * @param rsp initial stack pointer
+ */
+static void process_init_context(process_t* process, uint64_t rsp)
+{
+    process->stackPointer = rsp;
+    process->process_heap_ptr = PROCESS_HEAP_START;
+    process->process_shared_ptr = 0x2000000000; /* 128gb */
+
+    process->regs->r15 = 0;
+    process->regs->r14 = 0;
+    process->regs->r13 = 0;
+    process->regs->r12 = 0;
+    process->regs->r11 = 0;
+    process->regs->r10 = 0;
+    process->regs->r9 = 0;
+    process->regs->r8 = 0;
+    process->regs->rbp = 0;
+    process->regs->rdi = 0;
+    process->regs->rsi = 0;
+    process->regs->rdx = 0;
+    process->regs->rcx = 0;
+    process->regs->rbx = 0;
+    process->regs->rax = 0;
+    process->regs->cs = 0x1B; /* kernel - 0x08, user - 0x1B*/
+    process->regs->rflags = (1 << 9) | (1 << 1);
+    process->regs->rsp = rsp;
+    process->regs->ss = 0x23; /* kernel - 0x10, user - 0x23 */
+    process->heap_end = (void*)PROCESS_HEAP_START;
+    process->signal = SIGNONE;
+    process->fs_base = 0;
+}
+
+/**
+ * @brief Hands a borrowed address space back to the suspended vfork parent
+ * @param process vfork child that is about to exec or exit
+ */
+static void process_vfork_release(process_t* process)
+{
+    if (!(process->flags & PROCESS_VFORK))
+        return;
+
+    process_t* parent = (process_t*)pidMap_lookup(PID_MAP, process->vfork_parent_pid);
+    if (parent)
+    {
+        /* Areas and heap the child changed belong to the shared address space */
+        process_t* leader = parent->thread_leader;
+        leader->vmas = process->vmas;
+        leader->stack_limit = process->stack_limit;
+        leader->heap_end = process->heap_end;
+        leader->process_heap_ptr = process->process_heap_ptr;
+        leader->process_shared_ptr = process->process_shared_ptr;
+        parent->flags &= ~PROCESS_VFORK;
+        schedule_unblock(parent);
+    }
+
+    process->vmas.root = 0;
+    process->page_table = 0;
+    process->flags &= ~PROCESS_VFORK;
+    process->vfork_parent_pid = 0;
+}
+
+/**
+ * @brief Frees a thread that is off the run queue
+ * @param thread thread created by clone
+ */
+static void process_free_thread(process_t* thread)
+{
+    usage_exit(thread);
+    futex_cancel(thread);
+    wait_cancel(thread);
+    pidMap_remove(PID_MAP, thread->pid);
+    thread->thread_leader->thread_count--;
+    process_release(thread);
+}
+
+/**
+ * @brief Ends every thread of a process except the caller and the leader
+ * @param process current process
+ *
+ * The threads are not running, they are dropped wherever they stopped.
+ */
+static void process_kill_threads(process_t* process)
+{
+    process_t* leader = process->thread_leader;
+
+    process_t* thread;
+    for (uint32_t pid = 0; leader->thread_count > (process != leader) && (thread = pidMap_next(PID_MAP, &pid)); pid++)
+    {
+        if (thread == process || thread == leader || thread->thread_leader != leader)
+            continue;
+        schedule_end(thread);
+        process_free_thread(thread);
+    }
 }
 
 void process_execvp(file_descriptor_t* file, int argc, char** kernel_argv, int envc, char** env)
 {
+    process_t* process = *CURRENT_PROCESS;
+
+    /* The other threads go away with the old program */
+    if (process->thread_count)
+        process_kill_threads(process);
+
+    /* Arguments live in the old address space, copy them out before it goes away */
+    char* strings = kmalloc(PROCESS_ARG_MAX);
+    uint64_t size = 0;
+    process_copy_strings(&argc, kernel_argv, strings, PROCESS_ARG_MAX, &size);
+    process_copy_strings(&envc, env, strings, PROCESS_ARG_MAX, &size);
+
+    /* A vfork child leaves the borrowed address space to the parent */
+    process_vfork_release(process);
+
     uint64_t current_cr3;
     __asm__ volatile("mov %%cr3, %0\n\t" : "=r"(current_cr3) : :);
     __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(*KERNEL_PAGE_TABLE) :);
 
     page_table_t page_table = 0;
 
-    process_t* process = *CURRENT_PROCESS;
-    elfLoader_load(&page_table, file, process);
-    void* stackPage = pages_allocatePage(PAGE_SIZE_2MB);
+    vma_destroy_all(&process->vmas);
+    bool loaded = processTemplate_load(&page_table, file, process) == 0;
 
+    /* The old address space is not needed anymore */
+    pageTable_release_user(&process->page_table);
     process->page_table = page_table;
-    process->stackPointer = 0x7FFF00;           /* 5mb + 1kb */
-    process->process_heap_ptr = 0x40000000;     /* 1 gb */
-    process->process_shared_ptr = 0x2000000000; /* 128gb */
+    uint64_t rsp = loaded ? process_setup_stack(process, argc, strings, size, envc) : 0;
+    kfree(strings);
 
-    process->process_stack_signature.r15 = 0;
-    process->process_stack_signature.r14 = 0;
-    process->process_stack_signature.r13 = 0;
-    process->process_stack_signature.r12 = 0;
-    process->process_stack_signature.r11 = 0;
-    process->process_stack_signature.r10 = 0;
-    process->process_stack_signature.r9 = 0;
-    process->process_stack_signature.r8 = 0;
-    process->process_stack_signature.rbp = 0;
-    process->process_stack_signature.rdi = 0;
-    process->process_stack_signature.rsi = 0;
-    process->process_stack_signature.rdx = 0;
-    process->process_stack_signature.rcx = 0;
-    process->process_stack_signature.rbx = 0;
-    process->process_stack_signature.rax = 0;
-    process->process_stack_signature.cs = 0x1B; /* kernel - 0x08, user - 0x1B*/
-    process->process_stack_signature.rflags = (1 << 9) | (1 << 1);
-    process->process_stack_signature.rsp = 0x7FFF00; /* 5mb + 1kb */
-    process->process_stack_signature.ss = 0x23;      /* kernel - 0x10, user - 0x23 */
-    process->heap_end = (void*)0x40000000;                  /* 1gb */
-    process->signal = SIGNONE;
+    /* The old program is gone, without a new one the process dies on its way back to user mode */
+    if (rsp)
+    {
+        process_init_context(process, rsp);
+        current_cr3 = (uint64_t)page_table;
+    }
+    else
+    {
+        vma_destroy_all(&process->vmas);
+        process->signal = SIGKILL;
+        current_cr3 = (uint64_t)*KERNEL_PAGE_TABLE;
+    }
+
+    __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(current_cr3) :);
+}
+
+/**
+ * @brief Applies the file actions of a spawn to the child
+ * @param process child being spawned
+ * @param actions file actions, already faulted in
+ * @param action_count number of file actions
+ *
+ * Runs in the address space of the caller, paths are read from there.
+ */
+static void process_spawn_actions(process_t* process, process_spawn_action_t* actions, uint64_t action_count)
+{
+    file_descriptor_entry_t* table = (file_descriptor_entry_t*)process->file_descriptor_table;
+
+    for (uint64_t i = 0; i < action_count; i++)
+    {
+        process_spawn_action_t* action = &actions[i];
+
+        switch (action->type)
+        {
+        case PROCESS_SPAWN_OPEN:
+        {
+            char path[256];
+            char* paths[] = {(char*)action->path};
+            int count = 1;
+            uint64_t size = 0;
+            process_copy_strings(&count, paths, path, sizeof(path), &size);
+
+            /* A path longer than the buffer is dropped by the copy, the action fails */
+            vfs_entry_t* entry;
+            if (count && vfs_find_entry(process->cwd, &entry, path) == 0)
+            {
+                file_descriptor_t* descriptor = fdm_open_file(entry);
+                descriptor->mode = action->oflag;
+                fdm_set(table, action->fd, descriptor);
+            }
+            break;
+        }
+        case PROCESS_SPAWN_CLOSE:
+            fdm_set(table, action->fd, 0);
+            break;
+        case PROCESS_SPAWN_DUP2:
+            fdm_set(table, action->newfd, fdm_get(table, action->fd));
+            break;
+        case PROCESS_SPAWN_TCSETPGRP:
+        {
+            file_descriptor_t* descriptor = fdm_get(table, action->fd);
+            if (descriptor && descriptor->type == EXT2_FT_CHRDEV)
+                descriptor->ops[CHRDEV_SETGRP]((uint64_t)descriptor, process->pgid, 0);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+}
 
-    pageTable_addPage(&process->page_table, (void*)0x600000, (uint64_t)stackPage / PAGE_SIZE_2MB, 1, PAGE_SIZE_2MB, 4);
+int64_t process_spawn(file_descriptor_t* file, int argc, char** argv, int envc, char** env, process_spawn_action_t* actions, uint64_t action_count,
+                      uint64_t flags, uint64_t pgroup)
+{
+    process_t* parent = (*CURRENT_PROCESS);
 
-    /* Configure arguments */
-    void* args_page = pages_allocatePage(PAGE_SIZE_2MB);
-    pageTable_addPage(&process->page_table, (void*)0x200000, (uint64_t)args_page / PAGE_SIZE_2MB, 1, PAGE_SIZE_2MB, 4);
+    char* strings = kmalloc(PROCESS_ARG_MAX);
+    uint64_t size = 0;
+    process_copy_strings(&argc, argv, strings, PROCESS_ARG_MAX, &size);
+    process_copy_strings(&envc, env, strings, PROCESS_ARG_MAX, &size);
 
-    *((uint64_t*)(0x7FFF00)) = argc;
-    int current_offset = 0x200000;
-    for (int i = 0; i < argc; i++)
+    process_t* process = pool_allocate(*PROCESS_POOL);
+    kmemcpy(process, parent, sizeof(process_t));
+    if (process_init_kernel_stack(process, 0) != 0)
     {
-        kmemcpy((void*)current_offset, kernel_argv[i], kernel_strlen(kernel_argv[i]) + 1);
-        *((uint64_t*)(0x7FFF08 + i * 8)) = current_offset;
-        current_offset += kernel_strlen(kernel_argv[i]) + 1;
+        pool_free(process);
+        kfree(strings);
+        return -1;
     }
+    process_init_threads(process, parent);
+    usage_start(process);
+    wait_start(process);
+    process->page_table = 0;
+    process->vmas.root = 0;
+    process->pid = process_genPID();
+    process->ppid = parent->pid;
+    process->vfork_parent_pid = 0;
+    process->flags = 0;
+    process_join_groups(process);
+    process->file_descriptor_table = pool_allocate(*FD_ENTRY_POOL);
+    fdm_copy((file_descriptor_entry_t*)parent->file_descriptor_table, (file_descriptor_entry_t*)process->file_descriptor_table);
+
+    uint64_t current_cr3;
+    __asm__ volatile("mov %%cr3, %0\n\t" : "=r"(current_cr3) : :);
+    __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(*KERNEL_PAGE_TABLE) :);
+
+    uint64_t rsp = 0;
+    if (processTemplate_load(&process->page_table, file, process) == 0)
+        rsp = process_setup_stack(process, argc, strings, size, envc);
+    kfree(strings);
+
+    if (!rsp)
+    {
+        vma_destroy_all(&process->vmas);
+        pageTable_release_user(&process->page_table);
+        __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(current_cr3) :);
+        fdm_free((file_descriptor_entry_t*)process->file_descriptor_table);
+        process_remove_from_group(process);
+        process_remove_from_session(process);
+        pidMap_remove(PID_MAP, process->pid);
+        process_release(process);
+        return -1;
+    }
+
+    process_init_context(process, rsp);
 
     __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(current_cr3) :);
+
+    /* Same order as the child running setpgid before its file actions */
+    scheduler_schedule(process);
+    if (flags & PROCESS_SPAWN_SETPGROUP)
+    {
+        if (process->pgid != 0)
+            process_remove_from_group(process);
+        process_add_to_group(process, pgroup ? pgroup : process->pid);
+    }
+    process_spawn_actions(process, actions, action_count);
+
+    return process->pid;
 }
 
 uint64_t process_cleanup(process_t* process)
 {
     uint64_t status = process->status;
-    pool_free(process);
+    vma_destroy_all(&process->vmas);
+
+    uint64_t current_cr3;
+    __asm__ volatile("mov %%cr3, %0\n\t" : "=r"(current_cr3) : :);
+    __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(*KERNEL_PAGE_TABLE) :);
+    if (current_cr3 == (uint64_t)process->page_table)
+        current_cr3 = (uint64_t)*KERNEL_PAGE_TABLE; /* Exiting from its own address space */
+    pageTable_release_user(&process->page_table);
+    __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(current_cr3) :);
+
+    process_remove_from_group(process);
+    process_remove_from_session(process);
+    pidMap_remove(PID_MAP, process->pid);
+    process_release(process);
     return status;
 }
 
 void process_signal(process_t* process, sig_t signal)
 {
+    /* Nothing runs anymore, it only waits to be reaped */
+    if (process->flags & PROCESS_ZOMBIE)
+        return;
+
+    /* A process running on another CPU acts on the signal once it is kicked into the kernel */
+    cpu_t* cpu = smp_running_elsewhere(process);
+
     switch (signal)
     {
     case SIGKILL:
+        if (cpu)
+        {
+            process->signal = SIGKILL;
+            schedule_unblock(process);
+            break;
+        }
         process_exit(process, SIGKILL);
-        break;
+        return;
     case SIGCONT:
         schedule_unblock(process);
         break;
@@ -283,61 +1066,176 @@ void process_signal(process_t* process, sig_t signal)
         schedule_block(process);
         break;
     default:
-        (*CURRENT_PROCESS)->signal = signal;
+        /* A sleep in the kernel ends early, the signal is taken on the way back to user mode */
+        process->signal = signal;
+        wait_interrupt(process);
         break;
     }
+
+    if (cpu)
+        smp_kick(cpu);
 }
 
 void process_group_signal(process_group_t* group, sig_t signal)
 {
-    for (int i = 0; i < group->process_count; i++)
+    if (!group)
+        return;
+
+    /* The current process goes last, a signal that ends it does not return */
+    process_t* current = 0;
+    process_t* process = group->processes;
+    for (uint64_t i = group->process_count; i > 0; i--)
     {
-        process_signal(group->processes[i], signal);
+        process_t* next = process->group_next;
+        if (process == *CURRENT_PROCESS)
+            current = process;
+        else
+            process_signal(process, signal);
+        process = next;
     }
+
+    if (current)
+        process_signal(current, signal);
 }
 
 void process_signal_all(sig_t signal)
 {
-    for (int i = 0; i < PID_HASH_SIZE; i++)
+    /* Threads are reached through their leader */
+    process_t* process;
+    for (uint32_t pid = 0; (process = pidMap_next(PID_MAP, &pid)); pid++)
     {
-        pid_hash_node_t* current = PID_MAP->buckets[i];
-
-        while (current)
-        {
-            process_signal((process_t*)current->proc, signal);
-        }
+        if (process != *CURRENT_PROCESS && !(process->flags & PROCESS_THREAD))
+            process_signal(process, signal);
     }
+
+    process_signal((*CURRENT_PROCESS)->thread_leader, signal);
 }
 
-void process_exit(process_t* process, uint64_t status)
+int64_t process_clone(uint64_t flags, uint64_t stack, uint64_t parent_tid, uint64_t child_tid, uint64_t tls)
 {
-    process->status = status;
+    process_t* parent = (*CURRENT_PROCESS);
+    process_t* leader = parent->thread_leader;
+
+    /* fork and vfork cover the other uses of clone */
+    if ((flags & PROCESS_CLONE_THREAD) != PROCESS_CLONE_THREAD || (parent->flags & PROCESS_VFORK))
+        return -1;
+    if ((flags & CLONE_PARENT_SETTID) && !process_validate_address((void*)parent_tid, sizeof(uint32_t)))
+        return -1;
 
-    /* Schedule next process and get new current */
-    (*CURRENT_PROCESS) = schedule_end((*CURRENT_PROCESS));
+    process_t* thread = pool_allocate(*PROCESS_POOL);
+    kmemcpy(thread, parent, sizeof(process_t));
+    if (process_init_kernel_stack(thread, parent) != 0)
+    {
+        pool_free(thread);
+        return -1;
+    }
+    thread->vmas.root = 0; /* Areas belong to the leader */
+    usage_start(thread);
+    wait_start(thread);
+    thread->pid = process_genPID();
+    thread->flags = PROCESS_THREAD;
+    thread->signal = SIGNONE;
+    thread->vfork_parent_pid = 0;
+    thread->thread_count = 0;
+    thread->futex_addr = 0;
+    thread->futex_next = 0;
+    thread->group_next = 0; /* Groups and sessions list the leader only */
+    thread->group_last = 0;
+    thread->session_next = 0;
+    thread->session_last = 0;
+    thread->clear_child_tid = (flags & CLONE_CHILD_CLEARTID) ? child_tid : 0;
+    if (flags & CLONE_SETTLS)
+        thread->fs_base = tls;
 
-    /* Prepare for context switch:
-     * R12 = new process's page table root (CR3)
-     * R11 = new process's stack pointer
-     */
-    INTERRUPT_INFO->cr3 = (uint64_t)(*CURRENT_PROCESS)->page_table;
-    INTERRUPT_INFO->rsp = (uint64_t)&(*CURRENT_PROCESS)->process_stack_signature;
-    TSS->ist1 = (uint64_t)(*CURRENT_PROCESS) + sizeof(process_stack_layout_t);
+    /* Same registers as the caller, returning 0 on the new stack */
+    thread->regs->rax = 0;
+    thread->regs->rsp = stack;
+    leader->thread_count++;
+
+    if (flags & CLONE_PARENT_SETTID)
+    {
+        process_fault_in(parent_tid, sizeof(uint32_t), 1);
+        *(uint32_t*)parent_tid = thread->pid;
+    }
+
+    scheduler_schedule(thread);
+    return thread->pid;
+}
+
+void process_exit_thread(process_t* process, uint64_t status)
+{
+    if (!(process->flags & PROCESS_THREAD))
+    {
+        process_exit(process, status);
+        return;
+    }
 
-    if (process->waiting_parent_pid != 0)
+    process_t* leader = process->thread_leader;
+    if (process->clear_child_tid && process_validate_address((void*)process->clear_child_tid, sizeof(uint32_t)))
     {
-        process_t* waiting_parent = (process_t*)pid_hash_lookup(PID_MAP, process->waiting_parent_pid);
+        /* pthread_join sleeps on the thread id */
+        process_fault_in(process->clear_child_tid, sizeof(uint32_t), 1);
+
         uint64_t current_cr3;
         __asm__ volatile("mov %%cr3, %0\n\t" : "=r"(current_cr3) : :);
-        __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(waiting_parent->page_table) :);
-        *((uint64_t*)SYS_ARG_2(waiting_parent)) = process->status;
-        waiting_parent->process_stack_signature.rax = process->pid;
+        __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(process->page_table) :);
+        *(uint32_t*)process->clear_child_tid = 0;
         __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(current_cr3) :);
-        process_cleanup(process);
-        schedule_unblock(waiting_parent);
+
+        futex_wake(leader, process->clear_child_tid, (uint64_t)-1);
     }
-    else
+
+    /* The stack of the thread is freed once it is switched away from */
+    process_t* next = schedule_end(process);
+    process_free_thread(process);
+    if (process == *CURRENT_PROCESS)
+        scheduler_switch(next);
+}
+
+#define IA32_FS_BASE 0xC0000100
+
+void process_load_fs(process_t* process)
+{
+    cpu_t* cpu = smp_cpu();
+    if (cpu->fs_base == process->fs_base)
+        return;
+
+    cpu->fs_base = process->fs_base;
+    __asm__ volatile("wrmsr" : : "c"(IA32_FS_BASE), "a"((uint32_t)process->fs_base), "d"((uint32_t)(process->fs_base >> 32)) : "memory");
+}
+
+void process_exit(process_t* process, uint64_t status)
+{
+    /* Exiting ends every thread, the leader is the one reporting to the parent */
+    process_t* leader = process->thread_leader;
+    if (leader->thread_count)
+        process_kill_threads(process);
+    if (process != leader)
     {
-        process->flags |= PROCESS_ZOMBIE;
+        leader->status = status;
+        leader->flags |= PROCESS_EXITING;
+        futex_cancel(leader);
+        wait_cancel(leader);
+        schedule_unblock(leader);
+        process_exit_thread(process, status);
+        return;
     }
+
+    process->status = status;
+    process->flags |= PROCESS_ZOMBIE;
+    futex_cancel(process);
+    wait_cancel(process);
+    timer_cancel(&process->alarm_timer);
+    usage_exit(process);
+
+    /* The suspended parent has to be runnable before the next process is picked */
+    process_vfork_release(process);
+    process_t* next = schedule_end(process);
+
+    /* A waiting parent reaps the zombie in waitpid */
+    wait_wake_all(&process->exit_waiters);
+
+    /* Never returns, the kernel stack stays until the zombie is reaped */
+    if (process == *CURRENT_PROCESS)
+        scheduler_switch(next);
 }
\ No newline at end of file
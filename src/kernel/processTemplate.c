@@ -0,0 +1,221 @@
+/**
+ * @file processTemplate.c
+ * @brief Process Template Cache Implementation
+ *
+ * Implements loading binaries into templates, cloning them into processes and
+ * dropping them when their files change or memory runs low.
+ */
+#include <boot/elfLoader.h>
+#include <fs/fdm.h>
+#include <kernel/process.h>
+#include <kernel/processTemplate.h>
+#include <kstd/kmath.h>
+#include <memory/kglobals.h>
+#include <memory/kmemory.h>
+#include <memory/pageCache.h>
+#include <memory/pageTable.h>
+#include <memory/paging.h>
+#include <memory/pressure.h>
+#include <memory/vma.h>
+
+/**
+ * @brief Finds the template of an inode
+ * @return template, NULL if the binary has none
+ */
+static process_template_t* processTemplate_lookup(uint32_t inode_num)
+{
+    for (uint64_t i = 0; i < PROCESS_TEMPLATE_MAX; i++)
+    {
+        if (PROCESS_TEMPLATES->templates[i].inode_num == inode_num)
+            return &PROCESS_TEMPLATES->templates[i];
+    }
+    return 0;
+}
+
+/**
+ * @brief Frees the image of a template and empties its slot
+ */
+static void processTemplate_release(process_template_t* template)
+{
+    vma_destroy_all(&template->vmas);
+
+    uint64_t current_cr3;
+    __asm__ volatile("mov %%cr3, %0\n\t" : "=r"(current_cr3) : :);
+    __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(*KERNEL_PAGE_TABLE) :);
+    pageTable_release_user(&template->page_table);
+    __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(current_cr3) :);
+
+    template->inode_num = 0;
+}
+
+/**
+ * @brief Picks the slot for a new template, the least recently executed one if all are used
+ */
+static process_template_t* processTemplate_slot()
+{
+    process_template_t* oldest = &PROCESS_TEMPLATES->templates[0];
+    for (uint64_t i = 0; i < PROCESS_TEMPLATE_MAX; i++)
+    {
+        process_template_t* template = &PROCESS_TEMPLATES->templates[i];
+        if (!template->inode_num)
+            return template;
+        if (template->last_used < oldest->last_used)
+            oldest = template;
+    }
+
+    processTemplate_release(oldest);
+    return oldest;
+}
+
+/**
+ * @brief Maps every whole page of the file areas of a template
+ *
+ * Same mappings the fault handler makes, done once here so clones start with
+ * them. The page holding the end of a segment gets a private copy on fault and
+ * is left out.
+ */
+static void processTemplate_populate(process_template_t* template)
+{
+    for (vma_t* vma = vma_find_next(&template->vmas, 0); vma; vma = vma_find_next(&template->vmas, vma->end))
+    {
+        if (vma->backing != VMA_FILE)
+            continue;
+
+        uint64_t end = MIN(vma->end, ALIGN_DOWN(vma->file_end, PAGE_SIZE_4KB));
+        for (uint64_t page = vma->start; page < end; page += PAGE_SIZE_4KB)
+        {
+            if (pageTable_find_entry(&template->page_table, page).size)
+                continue;
+
+            void* frame = pageCache_get(vma->file, (vma->offset + (page - vma->start)) / PAGE_SIZE_4KB);
+            if (!frame)
+                return;
+
+            pageTable_addPage(&template->page_table, (void*)page, (uint64_t)frame / PAGE_SIZE_4KB, 1, PAGE_SIZE_4KB, 4);
+            uint64_t* entry = pageTable_find_entry(&template->page_table, page).entry_ptr;
+            *entry = (*entry & ~PAGE_WRITABLE) | PAGE_COW;
+            pages_share(frame, PAGE_SIZE_4KB);
+        }
+    }
+}
+
+/**
+ * @brief Loads a binary into a new template
+ * @return template, NULL if the binary cannot be loaded
+ *
+ * The process is used to run the ELF loader and gives its areas and entry
+ * point to the template.
+ */
+static process_template_t* processTemplate_create(file_descriptor_t* file, process_t* process)
+{
+    process_template_t* template = processTemplate_slot();
+    template->page_table = 0;
+    template->vmas.root = 0;
+
+    if (elfLoader_load(&template->page_table, file, process) != 0)
+    {
+        pageTable_release_user(&template->page_table);
+        return 0;
+    }
+
+    template->vmas = process->vmas;
+    process->vmas.root = 0;
+    template->entry = process->entry;
+    template->rip = process->regs->rip;
+    template->program_headers = process->program_headers;
+    template->program_header_count = process->program_header_count;
+    template->interp_base = process->interp_base;
+    template->inode_num = file->inode_num;
+
+    processTemplate_populate(template);
+    return template;
+}
+
+void processTemplate_init()
+{
+    kmemset(PROCESS_TEMPLATES, 0, sizeof(process_templates_t));
+    pressure_register_shrinker("process templates", processTemplate_count, processTemplate_shrink);
+}
+
+int processTemplate_load(page_table_t* page_table_ptr, file_descriptor_t* file, process_t* process)
+{
+    process_template_t* template = processTemplate_lookup(file->inode_num);
+    if (template)
+    {
+        PROCESS_TEMPLATES->hits++;
+    }
+    else
+    {
+        PROCESS_TEMPLATES->misses++;
+        template = processTemplate_create(file, process);
+        if (!template)
+            return 1;
+    }
+    template->last_used = ++PROCESS_TEMPLATES->execs;
+
+    /* Every page of the clone is copy on write, the template stays pristine */
+    *page_table_ptr = pageTable_fork(&template->page_table);
+    if (!*page_table_ptr)
+        return 1;
+    pageTable_addKernel(page_table_ptr);
+    vma_copy(&process->vmas, &template->vmas);
+
+    process->entry = template->entry;
+    process->regs->rip = template->rip;
+    process->program_headers = template->program_headers;
+    process->program_header_count = template->program_header_count;
+    process->interp_base = template->interp_base;
+    return 0;
+}
+
+void processTemplate_invalidate(uint32_t inode_num)
+{
+    for (uint64_t i = 0; i < PROCESS_TEMPLATE_MAX; i++)
+    {
+        process_template_t* template = &PROCESS_TEMPLATES->templates[i];
+        if (!template->inode_num)
+            continue;
+
+        /* The dynamic loader is mapped from its own file */
+        for (vma_t* vma = vma_find_next(&template->vmas, 0); vma; vma = vma_find_next(&template->vmas, vma->end))
+        {
+            if (vma->backing == VMA_FILE && vma->file->inode_num == inode_num)
+            {
+                processTemplate_release(template);
+                break;
+            }
+        }
+    }
+}
+
+uint64_t processTemplate_count()
+{
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < PROCESS_TEMPLATE_MAX; i++)
+    {
+        if (PROCESS_TEMPLATES->templates[i].inode_num)
+            count++;
+    }
+    return count;
+}
+
+uint64_t processTemplate_shrink(uint64_t target)
+{
+    uint64_t freed = 0;
+    while (freed < target)
+    {
+        process_template_t* oldest = 0;
+        for (uint64_t i = 0; i < PROCESS_TEMPLATE_MAX; i++)
+        {
+            process_template_t* template = &PROCESS_TEMPLATES->templates[i];
+            if (template->inode_num && (!oldest || template->last_used < oldest->last_used))
+                oldest = template;
+        }
+        if (!oldest)
+            break;
+
+        processTemplate_release(oldest);
+        freed++;
+    }
+    return freed;
+}
@@ -5,28 +5,517 @@
  * Implements process scheduling, context switching, and process state management
  * for the kernel's multitasking system.
  */
+#include <arch/io.h>
+#include <arch/smp.h>
 #include <kernel/scheduler.h>
+#include <kernel/tick.h>
 #include <memory/kglobals.h>
+#include <memory/kmemory.h>
 #include <misc/debug.h>
 
+/* Common exit of the interrupt stubs, returns through the frame at the stack pointer */
+extern void interrupt_return();
+
+/**
+ * @brief Saves the kernel context on the current stack and resumes another one
+ * @param save_rsp where the stack pointer of the current context is stored
+ * @param next_rsp stack pointer saved by the switch that stopped the next context
+ *
+ * Pushes and pops a scheduler_context_t.
+ */
+__attribute__((naked, ms_abi)) static void scheduler_context_switch(uint64_t* save_rsp, uint64_t next_rsp)
+{
+    __asm__ volatile("push %rbp\n\t"
+                     "push %rbx\n\t"
+                     "push %rdi\n\t"
+                     "push %rsi\n\t"
+                     "push %r12\n\t"
+                     "push %r13\n\t"
+                     "push %r14\n\t"
+                     "push %r15\n\t"
+                     "sub $160, %rsp\n\t"
+                     "movdqu %xmm6, 0(%rsp)\n\t"
+                     "movdqu %xmm7, 16(%rsp)\n\t"
+                     "movdqu %xmm8, 32(%rsp)\n\t"
+                     "movdqu %xmm9, 48(%rsp)\n\t"
+                     "movdqu %xmm10, 64(%rsp)\n\t"
+                     "movdqu %xmm11, 80(%rsp)\n\t"
+                     "movdqu %xmm12, 96(%rsp)\n\t"
+                     "movdqu %xmm13, 112(%rsp)\n\t"
+                     "movdqu %xmm14, 128(%rsp)\n\t"
+                     "movdqu %xmm15, 144(%rsp)\n\t"
+                     "mov %cr3, %rax\n\t"
+                     "push %rax\n\t"
+                     "mov %rsp, (%rcx)\n\t"
+                     "mov %rdx, %rsp\n\t"
+                     "pop %rax\n\t"
+                     "mov %cr3, %rbx\n\t"
+                     "cmp %rax, %rbx\n\t"
+                     "je 1f\n\t"
+                     "mov %rax, %cr3\n\t" /* Reloading the same table would only flush the TLB */
+                     "1:\n\t"
+                     "movdqu 0(%rsp), %xmm6\n\t"
+                     "movdqu 16(%rsp), %xmm7\n\t"
+                     "movdqu 32(%rsp), %xmm8\n\t"
+                     "movdqu 48(%rsp), %xmm9\n\t"
+                     "movdqu 64(%rsp), %xmm10\n\t"
+                     "movdqu 80(%rsp), %xmm11\n\t"
+                     "movdqu 96(%rsp), %xmm12\n\t"
+                     "movdqu 112(%rsp), %xmm13\n\t"
+                     "movdqu 128(%rsp), %xmm14\n\t"
+                     "movdqu 144(%rsp), %xmm15\n\t"
+                     "add $160, %rsp\n\t"
+                     "pop %r15\n\t"
+                     "pop %r14\n\t"
+                     "pop %r13\n\t"
+                     "pop %r12\n\t"
+                     "pop %rsi\n\t"
+                     "pop %rdi\n\t"
+                     "pop %rbx\n\t"
+                     "pop %rbp\n\t"
+                     "ret\n\t");
+}
+
+/**
+ * @brief First kernel code of a new process, the stack pointer is at its interrupt frame
+ */
+__attribute__((naked)) static void scheduler_start()
+{
+    __asm__ volatile("jmp interrupt_return\n\t");
+}
+
 process_t* scheduler_currentProcess()
 {
-    return *PROCESSES;
+    return smp_cpu()->current;
+}
+
+/* Weight of each nice level from -20 to 19, every level is about 10% of CPU time from the next */
+static const uint32_t scheduler_nice_weights[SCHEDULER_NICE_MAX - SCHEDULER_NICE_MIN + 1] = {
+    88761, 71755, 56483, 46273, 36291, /* -20 */
+    29154, 23254, 18705, 14949, 11916, /* -15 */
+    9548,  7620,  6100,  4904,  3906,  /* -10 */
+    3121,  2501,  1991,  1586,  1277,  /* -5 */
+    1024,  820,   655,   526,   423,   /* 0 */
+    335,   272,   215,   172,   137,   /* 5 */
+    110,   87,    70,    56,    45,    /* 10 */
+    36,    29,    23,    18,    15,    /* 15 */
+};
+
+/**
+ * @brief Converts milliseconds to TSC cycles
+ */
+static uint64_t scheduler_cycles(uint64_t ms)
+{
+    return USAGE->tsc_hz * ms / 1000;
+}
+
+/**
+ * @brief Checks whether a process is further behind in its share than another
+ *
+ * Compares the difference so the order holds when vruntime wraps.
+ */
+static bool scheduler_before(process_t* a, process_t* b)
+{
+    return (int64_t)(a->vruntime - b->vruntime) < 0;
+}
+
+/**
+ * @brief Checks whether a process is in one of the real time classes
+ */
+static bool scheduler_rt(process_t* process)
+{
+    return process->policy != SCHEDULER_NORMAL;
+}
+
+/**
+ * @brief Checks whether a process keeps its place on a CPU when switched away from
+ *
+ * Blocked processes leave the run queue, ended ones lost their CPU.
+ */
+static bool scheduler_runnable(cpu_t* cpu, process_t* process)
+{
+    return process != &cpu->idle && process->cpu == cpu && !(process->flags & PROCESS_BLOCKING);
+}
+
+/**
+ * @brief Puts a real time process in the list of its priority
+ * @param front 1 to run it before the others of its priority, when it was preempted
+ */
+static void scheduler_rt_enqueue(cpu_t* cpu, process_t* process, bool front)
+{
+    uint64_t priority = process->rt_priority;
+    process_t* head = cpu->rt_queue[priority];
+    if (!head)
+    {
+        process->rt_next = process;
+        process->rt_last = process;
+        cpu->rt_queue[priority] = process;
+        cpu->rt_bitmap[priority / 64] |= 1ULL << (priority % 64);
+    }
+    else
+    {
+        process->rt_next = head;
+        process->rt_last = head->rt_last;
+        head->rt_last->rt_next = process;
+        head->rt_last = process;
+        if (front)
+            cpu->rt_queue[priority] = process;
+    }
+    cpu->rt_queued++;
+}
+
+/**
+ * @brief Takes a real time process out of the list of its priority
+ */
+static void scheduler_rt_dequeue(cpu_t* cpu, process_t* process)
+{
+    uint64_t priority = process->rt_priority;
+    cpu->rt_queued--;
+    if (process->rt_next == process)
+    {
+        cpu->rt_queue[priority] = 0;
+        cpu->rt_bitmap[priority / 64] &= ~(1ULL << (priority % 64));
+        return;
+    }
+
+    if (cpu->rt_queue[priority] == process)
+        cpu->rt_queue[priority] = process->rt_next;
+    process->rt_next->rt_last = process->rt_last;
+    process->rt_last->rt_next = process->rt_next;
+}
+
+/**
+ * @brief Puts a process in the run queue of a CPU
+ * @param front 1 to run a real time process before the others of its priority
+ *
+ * Normal processes are ordered by vruntime, equal ones go right of each other
+ * and run in the order they came.
+ */
+static void scheduler_enqueue(cpu_t* cpu, process_t* process, bool front)
+{
+    process->cpu = cpu;
+    process->queued = 1;
+    if (scheduler_rt(process))
+    {
+        scheduler_rt_enqueue(cpu, process, front);
+        return;
+    }
+
+    krbtree_node_t* parent = 0;
+    krbtree_node_t** link = &cpu->run_queue.root;
+    while (*link)
+    {
+        parent = *link;
+        if (scheduler_before(process, krbtree_entry(parent, process_t, run_node)))
+            link = &parent->left;
+        else
+            link = &parent->right;
+    }
+    krbtree_insert(&cpu->run_queue, &process->run_node, parent, link);
+    cpu->queued++;
+    cpu->queued_weight += process->weight;
+}
+
+/**
+ * @brief Takes a process out of the run queue of its CPU
+ */
+static void scheduler_dequeue(process_t* process)
+{
+    cpu_t* cpu = process->cpu;
+    process->queued = 0;
+    if (scheduler_rt(process))
+    {
+        scheduler_rt_dequeue(cpu, process);
+        return;
+    }
+
+    krbtree_remove(&cpu->run_queue, &process->run_node);
+    cpu->queued--;
+    cpu->queued_weight -= process->weight;
+}
+
+/**
+ * @brief Gets the queued real time process of a CPU that runs next
+ * @return the first of the highest priority, 0 if none is queued
+ */
+static process_t* scheduler_rt_first(cpu_t* cpu)
+{
+    if (cpu->rt_bitmap[1])
+        return cpu->rt_queue[64 + 63 - __builtin_clzll(cpu->rt_bitmap[1])];
+    if (cpu->rt_bitmap[0])
+        return cpu->rt_queue[63 - __builtin_clzll(cpu->rt_bitmap[0])];
+    return 0;
+}
+
+/**
+ * @brief Checks whether the real time processes of a CPU may run
+ *
+ * Once they used their runtime of the period, normal processes that are
+ * runnable get the rest of it.
+ */
+static bool scheduler_rt_allowed(cpu_t* cpu)
+{
+    if (cpu->rt_runtime < scheduler_cycles(SCHEDULER_RT_RUNTIME_MS))
+        return 1;
+    return !cpu->queued && !(scheduler_runnable(cpu, cpu->current) && !scheduler_rt(cpu->current));
+}
+
+/**
+ * @brief Gets the queued process of a CPU with the smallest vruntime
+ * @return the process, 0 if the run queue is empty
+ */
+static process_t* scheduler_first(cpu_t* cpu)
+{
+    krbtree_node_t* node = krbtree_first(&cpu->run_queue);
+    return node ? krbtree_entry(node, process_t, run_node) : 0;
+}
+
+/**
+ * @brief Charges the current process of a CPU for the time it ran and moves min_vruntime up
+ *
+ * The vruntime of a process grows slower the heavier it is, so a process
+ * with twice the weight runs twice as long for the same vruntime.
+ */
+static void scheduler_update(cpu_t* cpu)
+{
+    uint64_t now = rdtsc();
+    if (now - cpu->rt_period_start >= scheduler_cycles(SCHEDULER_RT_PERIOD_MS))
+    {
+        cpu->rt_period_start = now;
+        cpu->rt_runtime = 0;
+    }
+
+    /* Real time processes are charged against the throttle instead */
+    process_t* current = cpu->current;
+    if (current != &cpu->idle)
+    {
+        if (scheduler_rt(current))
+            cpu->rt_runtime += now - current->exec_start;
+        else
+            current->vruntime += (now - current->exec_start) * SCHEDULER_NICE_0_WEIGHT / current->weight;
+        current->exec_start = now;
+    }
+
+    /* Follows the smallest vruntime of the CPU, it never goes back */
+    process_t* smallest = scheduler_runnable(cpu, current) && !scheduler_rt(current) ? current : 0;
+    process_t* first = scheduler_first(cpu);
+    if (first && (!smallest || scheduler_before(first, smallest)))
+        smallest = first;
+    if (smallest && (int64_t)(smallest->vruntime - cpu->min_vruntime) > 0)
+        cpu->min_vruntime = smallest->vruntime;
+}
+
+/**
+ * @brief Gets the run time a process is given before others of its CPU get their turn
+ *
+ * Every runnable process runs once within the scheduling latency, in shares
+ * of its weight. The period grows with the number of processes so no slice
+ * gets shorter than the minimum granularity.
+ * @return the slice in TSC cycles
+ */
+static uint64_t scheduler_slice(cpu_t* cpu, process_t* process)
+{
+    uint64_t running = cpu->queued + 1;
+    uint64_t granularity = scheduler_cycles(SCHEDULER_MIN_GRANULARITY_MS);
+    uint64_t period = scheduler_cycles(SCHEDULER_LATENCY_MS);
+    if (running * granularity > period)
+        period = running * granularity;
+
+    uint64_t slice = period * process->weight / (cpu->queued_weight + process->weight);
+    return slice < granularity ? granularity : slice;
+}
+
+/**
+ * @brief Counts the runnable processes of a CPU, the running one included
+ */
+static uint64_t scheduler_load(cpu_t* cpu)
+{
+    return cpu->queued + cpu->rt_queued + scheduler_runnable(cpu, cpu->current);
+}
+
+/**
+ * @brief Checks whether a process may move to another CPU
+ *
+ * Threads stay with their leader and vfork pairs together, an address space
+ * is only ever loaded on one CPU. Kernel threads keep the CPU they serve.
+ */
+static bool scheduler_can_move(process_t* process)
+{
+    return !(process->flags & (PROCESS_THREAD | PROCESS_VFORK | PROCESS_KTHREAD)) && !process->thread_count;
+}
+
+/**
+ * @brief Finds a queued process of a CPU that may move to another CPU
+ *
+ * Real time processes go first, highest priority first, then the normal one
+ * that waited longest.
+ */
+static process_t* scheduler_movable(cpu_t* cpu)
+{
+    for (uint64_t priority = SCHEDULER_RT_PRIORITY_MAX; priority > 0; priority--)
+    {
+        process_t* head = cpu->rt_queue[priority];
+        process_t* process = head;
+        while (process)
+        {
+            if (scheduler_can_move(process))
+                return process;
+            process = process->rt_next != head ? process->rt_next : 0;
+        }
+    }
+
+    for (krbtree_node_t* node = krbtree_first(&cpu->run_queue); node; node = krbtree_next(node))
+    {
+        process_t* process = krbtree_entry(node, process_t, run_node);
+        if (scheduler_can_move(process))
+            return process;
+    }
+    return 0;
+}
+
+/**
+ * @brief Moves a queued process into the run queue of another CPU
+ *
+ * Its vruntime keeps the same distance to min_vruntime, the clocks of the two
+ * CPUs are unrelated.
+ */
+static void scheduler_migrate(process_t* process, cpu_t* cpu)
+{
+    cpu_t* from = process->cpu;
+    scheduler_dequeue(process);
+    process->vruntime = process->vruntime - from->min_vruntime + cpu->min_vruntime;
+    scheduler_enqueue(cpu, process, 0);
+}
+
+/**
+ * @brief Finds the online CPU with the most runnable processes
+ */
+static cpu_t* scheduler_busiest(uint64_t* load)
+{
+    cpu_t* busiest = 0;
+    *load = 0;
+    for (uint64_t i = 0; i < SMP->cpu_count; i++)
+    {
+        cpu_t* cpu = &CPUS[i];
+        if (!cpu->online)
+            continue;
+        uint64_t cpu_load = scheduler_load(cpu);
+        if (!busiest || cpu_load > *load)
+        {
+            busiest = cpu;
+            *load = cpu_load;
+        }
+    }
+    return busiest;
+}
+
+/**
+ * @brief Finds the online CPU with the fewest runnable processes, the calling CPU on a tie
+ */
+static cpu_t* scheduler_idlest(uint64_t* load)
+{
+    cpu_t* idlest = smp_cpu();
+    *load = scheduler_load(idlest);
+    for (uint64_t i = 0; i < SMP->cpu_count; i++)
+    {
+        cpu_t* cpu = &CPUS[i];
+        if (!cpu->online)
+            continue;
+        uint64_t cpu_load = scheduler_load(cpu);
+        if (cpu_load < *load)
+        {
+            idlest = cpu;
+            *load = cpu_load;
+        }
+    }
+    return idlest;
+}
+
+/**
+ * @brief Picks the next process of a CPU from its own run queues, changing nothing
+ * @param need_resched whether a woken process asked to preempt the current one
+ * @return the process, 0 if nothing is runnable on the CPU
+ */
+static process_t* scheduler_pick(cpu_t* cpu, bool need_resched)
+{
+    process_t* current = cpu->current;
+    process_t* first = scheduler_first(cpu);
+    process_t* rt = scheduler_rt_allowed(cpu) ? scheduler_rt_first(cpu) : 0;
+    bool runnable = scheduler_runnable(cpu, current);
+
+    /* Real time processes run until they block or a higher priority comes, round robin ones share a priority in slices */
+    if (runnable && scheduler_rt(current))
+    {
+        if (!scheduler_rt_allowed(cpu))
+            return first ? first : current;
+        if (rt && rt->rt_priority > current->rt_priority)
+            return rt;
+        if (rt && rt->rt_priority == current->rt_priority && current->policy == SCHEDULER_RR &&
+            rdtsc() - current->slice_start >= scheduler_cycles(SCHEDULER_RR_SLICE_MS))
+            return rt;
+        return current;
+    }
+
+    /* Queued real time processes go before normal ones */
+    if (rt)
+        return rt;
+    if (runnable)
+    {
+        if (!first)
+            return current;
+
+        /* A woken process that is far enough behind takes over right away */
+        if (need_resched && scheduler_before(first, current))
+            return first;
+
+        /* Otherwise the current one finishes its slice, or runs at least the minimum and is not too far ahead */
+        uint64_t slice = scheduler_slice(cpu, current);
+        uint64_t ran = rdtsc() - current->slice_start;
+        if (ran >= slice)
+            return first;
+        if (ran >= scheduler_cycles(SCHEDULER_MIN_GRANULARITY_MS) && (int64_t)(current->vruntime - first->vruntime) > (int64_t)slice)
+            return first;
+        return current;
+    }
+    return first;
 }
 
 process_t* scheduler_nextProcess()
 {
-    if (!(*PROCESSES))
-        return 0;
+    cpu_t* cpu = smp_cpu();
+    scheduler_update(cpu);
+
+    bool need_resched = cpu->need_resched;
+    cpu->need_resched = 0;
 
-    process_t* current = *PROCESSES;
-    do
+    process_t* next = scheduler_pick(cpu, need_resched);
+    if (next)
+        return next;
+
+    /* Nothing to run here, take work from the busiest CPU */
+    uint64_t load;
+    cpu_t* busiest = scheduler_busiest(&load);
+    process_t* stolen = busiest && busiest != cpu ? scheduler_movable(busiest) : 0;
+    if (stolen)
     {
-        current = current->next;
-    } while (current->flags & PROCESS_BLOCKING);
+        scheduler_migrate(stolen, cpu);
+        return stolen;
+    }
+    return &cpu->idle;
+}
 
-    *PROCESSES = current;
-    return *PROCESSES;
+/**
+ * @brief Resets the scheduling state of a new process and queues it on a CPU, waking the CPU when it is idle
+ */
+static void scheduler_place(process_t* process, cpu_t* cpu)
+{
+    /* Copied processes keep their nice value only, they start one slice behind so forking cannot starve the others */
+    process->weight = scheduler_nice_weights[process->nice - SCHEDULER_NICE_MIN];
+    process->queued = 0;
+    process->vruntime = cpu->min_vruntime + scheduler_slice(cpu, process) * SCHEDULER_NICE_0_WEIGHT / process->weight;
+    scheduler_enqueue(cpu, process, 0);
+    if (cpu->current == &cpu->idle)
+        smp_kick(cpu);
 }
 
 process_t* scheduler_schedule(process_t* process)
@@ -34,55 +523,218 @@ process_t* scheduler_schedule(process_t* process)
     if (!process)
         return 0;
 
-    pid_hash_insert(PID_MAP, process->pid, (uint64_t)process);
+    pidMap_insert(PID_MAP, process->pid, process);
 
-    (*PROCESS_COUNT)++;
-    if (!(*PROCESSES))
-    {
-        process->next = process;
-        process->last = process;
-        *PROCESSES = process;
+    /* Threads share the address space of their leader, they run on its CPU */
+    uint64_t load;
+    cpu_t* cpu = process->thread_leader != process ? process->thread_leader->cpu : scheduler_idlest(&load);
+    scheduler_place(process, cpu);
+    return process;
+}
+
+void scheduler_schedule_on(process_t* process, cpu_t* cpu)
+{
+    scheduler_place(process, cpu);
+}
+
+process_t* schedule_end(process_t* process)
+{
+    if (!process)
+        return 0;
+
+    cpu_t* cpu = process->cpu;
+    if (process->queued)
+        scheduler_dequeue(process);
+    process->cpu = 0;
+    if (cpu != smp_cpu() || cpu->current != process)
         return 0;
+    return scheduler_nextProcess();
+}
+
+void schedule_block(process_t* process)
+{
+    process->flags |= PROCESS_BLOCKING;
+    if (process->queued)
+        scheduler_dequeue(process);
+}
+
+void schedule_unblock(process_t* process)
+{
+    process->flags &= ~PROCESS_BLOCKING;
+
+    /* Still queued or running, or it ended */
+    cpu_t* cpu = process->cpu;
+    if (!cpu || process->queued || cpu->current == process)
+        return;
+
+    /* Sleeping earns at most half a period of credit, a long sleeper cannot hold the CPU */
+    scheduler_update(cpu);
+    uint64_t floor = cpu->min_vruntime - scheduler_cycles(SCHEDULER_LATENCY_MS) / 2;
+    if ((int64_t)(process->vruntime - floor) < 0)
+        process->vruntime = floor;
+    scheduler_enqueue(cpu, process, 0);
+
+    if (cpu->current == &cpu->idle)
+    {
+        smp_kick(cpu);
+        return;
     }
+
+    /* Preempts the running process on the way back to user mode or by a kick, real time over normal, a
+     * normal one when far enough behind it */
+    process_t* current = cpu->current;
+    bool preempt;
+    if (scheduler_rt(process))
+        preempt = !scheduler_rt(current) || process->rt_priority > current->rt_priority;
     else
+        preempt = !scheduler_rt(current) &&
+                  (int64_t)(current->vruntime - process->vruntime) > (int64_t)scheduler_cycles(SCHEDULER_WAKEUP_GRANULARITY_MS);
+    if (preempt)
     {
-        (*PROCESSES)->next->last = process;
-        process->next = (*PROCESSES)->next;
-        (*PROCESSES)->next = process;
-        process->last = (*PROCESSES);
-        *PROCESSES = process;
-        return (*PROCESSES);
+        cpu->need_resched = 1;
+        smp_kick(cpu);
     }
 }
 
-process_t* schedule_end(process_t* process)
+void scheduler_set_nice(process_t* process, int64_t nice)
 {
-    if (!process)
-        return 0;
+    if (nice < SCHEDULER_NICE_MIN)
+        nice = SCHEDULER_NICE_MIN;
+    if (nice > SCHEDULER_NICE_MAX)
+        nice = SCHEDULER_NICE_MAX;
+
+    /* The queued weight of the CPU follows */
+    bool queued = process->queued;
+    if (queued)
+        scheduler_dequeue(process);
+    if (process->cpu && process->cpu->current == process)
+        scheduler_update(process->cpu);
+    process->nice = nice;
+    process->weight = scheduler_nice_weights[nice - SCHEDULER_NICE_MIN];
+    if (queued)
+        scheduler_enqueue(process->cpu, process, 0);
+}
+
+int scheduler_set_policy(process_t* process, uint64_t policy, uint64_t priority)
+{
+    if (policy == SCHEDULER_NORMAL && priority != 0)
+        return 1;
+    if ((policy == SCHEDULER_FIFO || policy == SCHEDULER_RR) && (priority < 1 || priority > SCHEDULER_RT_PRIORITY_MAX))
+        return 1;
+    if (policy != SCHEDULER_NORMAL && policy != SCHEDULER_FIFO && policy != SCHEDULER_RR)
+        return 1;
 
-    (*PROCESS_COUNT)--;
-    if (process == process->next == process->last)
+    cpu_t* cpu = process->cpu;
+    bool queued = process->queued;
+    if (queued)
+        scheduler_dequeue(process);
+    if (cpu && cpu->current == process)
+        scheduler_update(cpu);
+
+    /* A process back in the normal class starts level with the others */
+    if (scheduler_rt(process) && policy == SCHEDULER_NORMAL && cpu)
+        process->vruntime = cpu->min_vruntime;
+    process->policy = policy;
+    process->rt_priority = priority;
+    if (queued)
+        scheduler_enqueue(cpu, process, 0);
+
+    if (cpu)
     {
-        kfree(process);
-        *PROCESSES = 0;
-        return 0;
+        cpu->need_resched = 1;
+        smp_kick(cpu);
     }
-    else
+    return 0;
+}
+
+void scheduler_tick()
+{
+    /* Only charges the time that ran, the run queues stay as they are until the switch picks for real */
+    cpu_t* cpu = smp_cpu();
+    scheduler_update(cpu);
+    process_t* next = scheduler_pick(cpu, cpu->need_resched);
+    if ((next ? next : &cpu->idle) != cpu->current)
+        cpu->need_resched = 1;
+}
+
+void scheduler_balance()
+{
+    uint64_t busiest_load, idlest_load;
+    cpu_t* busiest = scheduler_busiest(&busiest_load);
+    cpu_t* idlest = scheduler_idlest(&idlest_load);
+    if (!busiest || busiest == idlest || busiest_load < idlest_load + 2)
+        return;
+
+    process_t* process = scheduler_movable(busiest);
+    if (!process)
+        return;
+    scheduler_migrate(process, idlest);
+    if (idlest->current == &idlest->idle)
+        smp_kick(idlest);
+}
+
+void scheduler_init_context(process_t* process)
+{
+    interrupt_frame_t* frame = (interrupt_frame_t*)process->kernel_stack - 1;
+    frame->irq_number = 0;
+    frame->cr3 = (uint64_t)*KERNEL_PAGE_TABLE; /* The way out loads the page table of the process */
+
+    scheduler_context_t* context = (scheduler_context_t*)frame - 1;
+    kmemset(context, 0, sizeof(scheduler_context_t));
+    context->cr3 = (uint64_t)*KERNEL_PAGE_TABLE;
+    context->rip = (uint64_t)scheduler_start;
+    process->kernel_rsp = (uint64_t)context;
+}
+
+void scheduler_switch(process_t* next)
+{
+    cpu_t* cpu = smp_cpu();
+    process_t* prev = cpu->current;
+    if (next == prev)
+        return;
+
+    /* A process picked from another run queue runs here from now on */
+    if (next->queued && next->cpu != cpu)
+        scheduler_migrate(next, cpu);
+
+    /* The running process is never queued, the one switched away from goes back unless it blocked or ended */
+    scheduler_update(cpu);
+    if (scheduler_runnable(cpu, prev))
     {
-        if (process == *PROCESSES)
-            scheduler_nextProcess();
-        process->next->last = process->last;
-        process->last->next = process->next;
-        return *PROCESSES;
+        /* A preempted real time process stays first of its priority, a round robin one that used its slice goes last */
+        bool expired = prev->policy == SCHEDULER_RR && rdtsc() - prev->slice_start >= scheduler_cycles(SCHEDULER_RR_SLICE_MS);
+        scheduler_enqueue(cpu, prev, scheduler_rt(prev) && !expired);
     }
+    if (next->queued)
+        scheduler_dequeue(next);
+    next->exec_start = rdtsc();
+    next->slice_start = next->exec_start;
+    cpu->need_resched = 0;
+
+    /* A CPU only ticks while it has something to run */
+    if (prev == &cpu->idle)
+        tick_start();
+
+    usage_switch(prev);
+    cpu->current = next;
+    cpu->tss.rsp0 = (uint64_t)next->kernel_stack;
+    scheduler_context_switch(&prev->kernel_rsp, next->kernel_rsp);
 }
 
-void schedule_block(process_t* process)
+void scheduler_yield()
 {
-    process->flags |= PROCESS_BLOCKING;
+    scheduler_switch(scheduler_nextProcess());
 }
 
-void schedule_unblock(process_t* process)
+void scheduler_preempt()
 {
-    process->flags &= ~PROCESS_BLOCKING;
-}
\ No newline at end of file
+    /* sti holds interrupts off for one more instruction */
+    __asm__ volatile("sti\n\t"
+                     "nop\n\t"
+                     "cli\n\t" ::
+                         : "memory");
+
+    /* The tick or a woken process asked for the CPU while interrupts were on */
+    if (smp_cpu()->need_resched)
+        scheduler_yield();
+}
@@ -0,0 +1,105 @@
+/**
+ * @file softirq.c
+ * @brief Softirq and Tasklet Implementation
+ *
+ * Implements the softirq threads, the softirq vectors and the tasklets.
+ */
+#include <arch/smp.h>
+#include <kernel/kthread.h>
+#include <kernel/softirq.h>
+#include <kernel/tick.h>
+#include <kernel/timer.h>
+#include <kernel/wait.h>
+#include <memory/kglobals.h>
+
+/**
+ * @brief Runs the timers that expired and arms the APIC timer for the next ones
+ */
+static void softirq_timer(cpu_t* cpu)
+{
+    timer_run();
+    tick_rearm();
+}
+
+/**
+ * @brief Runs the tasklets of a CPU, oldest first
+ *
+ * One scheduled again by its function is queued anew and runs on the next pass.
+ */
+static void softirq_tasklet(cpu_t* cpu)
+{
+    tasklet_t* tasklet = cpu->tasklets;
+    cpu->tasklets = 0;
+    cpu->tasklets_last = 0;
+    while (tasklet)
+    {
+        tasklet_t* next = tasklet->next;
+        tasklet->next = 0;
+        tasklet->scheduled = 0;
+        tasklet->function(tasklet);
+        tasklet = next;
+    }
+}
+
+/* Handler of each softirq vector */
+static void (*const softirq_handlers[SOFTIRQ_COUNT])(cpu_t*) = {
+    softirq_timer,   /* SOFTIRQ_TIMER */
+    softirq_tasklet, /* SOFTIRQ_TASKLET */
+};
+
+/**
+ * @brief Softirq thread of a CPU, runs pending softirqs and sleeps while there are none
+ *
+ * Interrupts stay off in the kernel, nothing is raised between the last check
+ * and the sleep.
+ */
+static void softirq_thread(uint64_t data)
+{
+    cpu_t* cpu = (cpu_t*)data;
+    while (1)
+    {
+        while (cpu->softirq_pending)
+        {
+            uint64_t nr = __builtin_ctzll(cpu->softirq_pending);
+            cpu->softirq_pending &= ~(1ULL << nr);
+            softirq_handlers[nr](cpu);
+        }
+        wait_sleep(&cpu->softirq_waiters);
+    }
+}
+
+void softirq_init()
+{
+    for (uint64_t i = 0; i < SMP->cpu_count; i++)
+        kthread_create(softirq_thread, (uint64_t)&CPUS[i], &CPUS[i], SOFTIRQ_PRIORITY);
+}
+
+void softirq_raise(uint64_t nr)
+{
+    cpu_t* cpu = smp_cpu();
+    if (cpu->softirq_pending & (1ULL << nr))
+        return;
+    cpu->softirq_pending |= 1ULL << nr;
+    wait_wake_one(&cpu->softirq_waiters);
+}
+
+bool softirq_pending(uint64_t nr)
+{
+    return (smp_cpu()->softirq_pending & (1ULL << nr)) != 0;
+}
+
+void tasklet_schedule(tasklet_t* tasklet)
+{
+    if (tasklet->scheduled)
+        return;
+
+    cpu_t* cpu = smp_cpu();
+    tasklet->scheduled = 1;
+    tasklet->next = 0;
+    if (cpu->tasklets_last)
+        cpu->tasklets_last->next = tasklet;
+    else
+        cpu->tasklets = tasklet;
+    cpu->tasklets_last = tasklet;
+    softirq_raise(SOFTIRQ_TASKLET);
+}
@@ -6,16 +6,21 @@
  * These functions execute in kernel mode with full privileges.
  */
 
+#include <arch/io.h>
 #include <boot/elfLoader.h>
 #include <fs/fdm.h>
 #include <fs/vfs.h>
+#include <kernel/futex.h>
 #include <kernel/process.h>
 #include <kernel/scheduler.h>
 #include <kernel/syscalls.h>
+#include <kernel/timer.h>
+#include <kernel/wait.h>
 #include <kmath.h>
 #include <kstring.h>
 #include <memory/kglobals.h>
 #include <memory/memoryMap.h>
+#include <memory/pageCache.h>
 #include <memory/paging.h>
 #include <misc/debug.h>
 #include <stdint.h>
@@ -28,23 +33,6 @@
 #define KERNEL_CS 0x08
 #define USER_CS 0x1B
 
-static uint64_t rdmsr(uint32_t msr)
-{
-    uint32_t low, high;
-    __asm__ volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
-    return ((uint64_t)high << 32) | low;
-}
-
-/**
- * @brief Inline asm helpers for MSR read/write
- */
-static inline void wrmsr(uint32_t msr, uint64_t value)
-{
-    uint32_t low = (uint32_t)(value & 0xFFFFFFFF);
-    uint32_t high = (uint32_t)(value >> 32);
-    __asm__ volatile("wrmsr" : : "c"(msr), "a"(low), "d"(high) : "memory");
-}
-
 /* Read CR4 register */
 static inline uint64_t read_cr4()
 {
@@ -97,27 +85,51 @@ void syscall_init()
     }
 
     size_t syscall_counter = 0;
-    syscall_def(exit);      /* SYSCALL 1 */
-    syscall_def(execve);    /* SYSCALL 2 */
-    syscall_def(input);     /* SYSCALL 3 */
-    syscall_def(write);     /* SYSCALL 4 */
-    syscall_def(chdir);     /* SYSCALL 5 */
-    syscall_def(getcwd);    /* SYSCALL 6 */
-    syscall_def(mmap);      /* SYSCALL 7 */
-    syscall_def(fork);      /* SYSCALL 8 */
-    syscall_def(execvp);    /* SYSCALL 9 */
-    syscall_def(getpgid);   /* SYSCALL 10 */
-    syscall_def(setpgid);   /* SYSCALL 11 */
-    syscall_def(open);      /* SYSCALL 12 */
-    syscall_def(dup2);      /* SYSCALL 13 */
-    syscall_def(close);     /* SYSCALL 14 */
-    syscall_def(tcsetpgrp); /* SYSCALL 15 */
-    syscall_def(tcgetpgrp); /* SYSCALL 16 */
-    syscall_def(waitpid);   /* SYSCALL 17 */
-    syscall_def(setsid);    /* SYSCALL 18 */
-    syscall_def(getsid);    /* SYSCALL 19 */
-    syscall_def(kill);      /* SYSCALL 20 */
-    syscall_def(seek);      /* SYSCALL 21 */
+    syscall_def(exit);               /* SYSCALL 1 */
+    syscall_def(execve);             /* SYSCALL 2 */
+    syscall_def(input);              /* SYSCALL 3 */
+    syscall_def(write);              /* SYSCALL 4 */
+    syscall_def(chdir);              /* SYSCALL 5 */
+    syscall_def(getcwd);             /* SYSCALL 6 */
+    syscall_def(mmap);               /* SYSCALL 7 */
+    syscall_def(fork);               /* SYSCALL 8 */
+    syscall_def(execvp);             /* SYSCALL 9 */
+    syscall_def(getpgid);            /* SYSCALL 10 */
+    syscall_def(setpgid);            /* SYSCALL 11 */
+    syscall_def(open);               /* SYSCALL 12 */
+    syscall_def(dup2);               /* SYSCALL 13 */
+    syscall_def(close);              /* SYSCALL 14 */
+    syscall_def(tcsetpgrp);          /* SYSCALL 15 */
+    syscall_def(tcgetpgrp);          /* SYSCALL 16 */
+    syscall_def(waitpid);            /* SYSCALL 17 */
+    syscall_def(setsid);             /* SYSCALL 18 */
+    syscall_def(getsid);             /* SYSCALL 19 */
+    syscall_def(kill);               /* SYSCALL 20 */
+    syscall_def(seek);               /* SYSCALL 21 */
+    syscall_def(munmap);             /* SYSCALL 22 */
+    syscall_def(mprotect);           /* SYSCALL 23 */
+    syscall_def(madvise);            /* SYSCALL 24 */
+    syscall_def(mremap);             /* SYSCALL 25 */
+    syscall_def(pagemerge);          /* SYSCALL 26 */
+    syscall_def(swapstats);          /* SYSCALL 27 */
+    syscall_def(vfork);              /* SYSCALL 28 */
+    syscall_def(spawn);              /* SYSCALL 29 */
+    syscall_def(clone);              /* SYSCALL 30 */
+    syscall_def(futex);              /* SYSCALL 31 */
+    syscall_def(arch_prctl);         /* SYSCALL 32 */
+    syscall_def(exit_thread);        /* SYSCALL 33 */
+    syscall_def(getrusage);          /* SYSCALL 34 */
+    syscall_def(times);              /* SYSCALL 35 */
+    syscall_def(setpriority);        /* SYSCALL 36 */
+    syscall_def(getpriority);        /* SYSCALL 37 */
+    syscall_def(sched_setscheduler); /* SYSCALL 38 */
+    syscall_def(sched_getparam);     /* SYSCALL 39 */
+    syscall_def(sched_getscheduler); /* SYSCALL 40 */
+    syscall_def(nanosleep);          /* SYSCALL 41 */
+    syscall_def(alarm);              /* SYSCALL 42 */
+    syscall_def(setitimer);          /* SYSCALL 43 */
+    syscall_def(getitimer);          /* SYSCALL 44 */
+    syscall_def(poll);               /* SYSCALL 45 */
 }
 
 /* ================================== SYSCALL API ===================================== */
@@ -158,11 +170,6 @@ void sys_exit()
     process_exit(*CURRENT_PROCESS, exit_code << 8);
 }
 
-#define PROT_NONE 0  /* Pages cannot be accessed */
-#define PROT_EXEC 1  /* Pages can be executed */
-#define PROT_WRITE 2 /* Pages can be written */
-#define PROT_READ 4  /* Pages can be read */
-
 #define MAP_PRIVATE 0         /* Changes are shared with other processes */
 #define MAP_SHARED 1          /* Changes are private to the process */
 #define MAP_ANONYMOUS 2       /* Memory is not blocked by any file (raw memory) */
@@ -174,6 +181,13 @@ void sys_exit()
 #define MAP_LOCKED 128        /* Lock the memory so it doesn't get swapped */
 #define MAP_HUGETLB 256       /* User huge pages */
 
+#define MADV_NORMAL 0    /* No special treatment */
+#define MADV_WILLNEED 3  /* Pages will be used soon, fault them in */
+#define MADV_DONTNEED 4  /* Pages are not needed, drop them (anonymous memory reads back as zero) */
+#define MADV_HUGEPAGE 14 /* Back the range with huge pages when possible */
+
+#define MREMAP_MAYMOVE 1 /* Mapping may be moved when it cannot grow in place */
+
 /**
  * @brief Allocates memory for user space
  *
@@ -186,29 +200,824 @@ void sys_exit()
  */
 void sys_mmap()
 {
-
-    // TODO: make syscall more robust with making sure registers dont get overwritten (along with
-    // interrupts)
     uint64_t addr = SYS_ARG_1(*CURRENT_PROCESS);
     uint64_t length = SYS_ARG_2(*CURRENT_PROCESS);
-    uint64_t prot, flags, fd, offset;
+    uint64_t prot = SYS_ARG_3(*CURRENT_PROCESS);
+    uint64_t flags = SYS_ARG_4(*CURRENT_PROCESS);
+    uint64_t fd = SYS_ARG_5(*CURRENT_PROCESS);
+    uint64_t offset = SYS_ARG_6(*CURRENT_PROCESS);
     /**
      * TODO: implement other flags
      *
      * Right now:
-     * prot = PROT_READ | PROT_WRITE
-     * flags = MAP_PRIVATE | MAP_ANONYMOUS
+     * flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_FIXED_NOREPLACE (| MAP_POPULATE | MAP_HUGETLB)
+     * MAP_SHARED file mappings are private, writes are not written back
      */
 
-    uint64_t page_count = length / 4096;
-    for (int i = 0; i < page_count; i++)
+    process_t* current = (*CURRENT_PROCESS);
+    current->regs->rax = (uint64_t)-1;
+
+    if (length == 0)
+        return;
+
+    /* Huge page mappings are 2mb aligned so every slot can take a huge page */
+    uint64_t alignment = (flags & MAP_HUGETLB) ? PAGE_SIZE_2MB : PAGE_SIZE_4KB;
+    uint64_t vma_flags = (flags & MAP_HUGETLB) ? VMA_HUGEPAGE : 0;
+    length = ALIGN_UP(length, alignment);
+
+    /* Files are read through the page cache, programs mapping the same file share its frames */
+    file_descriptor_t* file = 0;
+    if (!(flags & MAP_ANONYMOUS))
+    {
+        file = fdm_get((file_descriptor_entry_t*)current->file_descriptor_table, fd);
+        if (!file || file->type != EXT2_FT_REG_FILE || (offset & (PAGE_SIZE_4KB - 1)) || (flags & MAP_HUGETLB))
+            return;
+    }
+
+    uint64_t start = ALIGN_UP((uint64_t)current->thread_leader->heap_end, alignment);
+    if (flags & (MAP_FIXED | MAP_FIXED_NOREPLACE))
+    {
+        if ((addr & (alignment - 1)) || addr + length > PROCESS_STACK_TOP)
+            return;
+        start = addr;
+
+        /* Whatever was mapped there is replaced */
+        if (flags & MAP_FIXED)
+        {
+            uint64_t current_cr3;
+            __asm__ volatile("mov %%cr3, %0\n\t" : "=r"(current_cr3) : :);
+            __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(*KERNEL_PAGE_TABLE) :);
+
+            tlb_batch_t batch = {.count = 0};
+            pageTable_unmap(&current->page_table, start, start + length, &batch);
+            vma_remove_range(&current->thread_leader->vmas, start, start + length);
+
+            __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(current_cr3) :);
+            pageTable_tlb_flush(&batch);
+        }
+    }
+
+    /* Only reserve the range, pages are zero filled or read on first touch */
+    vma_t* vma = vma_create(&current->thread_leader->vmas, start, start + length, prot, file ? VMA_FILE : VMA_ANON, vma_flags);
+    if (!vma)
+        return;
+
+    if (file)
+    {
+        uint64_t size = file->inode->size > offset ? file->inode->size - offset : 0;
+        vma->file = pageCache_open(file)->file;
+        vma->offset = offset;
+        vma->file_end = start + MIN(size, length);
+    }
+
+    if (start >= PROCESS_HEAP_START && start + length > (uint64_t)current->thread_leader->heap_end)
+        current->thread_leader->heap_end = (void*)(start + length);
+
+    if (flags & MAP_POPULATE)
+    {
+        process_fault_in(start, length, 1);
+    }
+
+    current->regs->rax = start;
+}
+
+/**
+ * @brief Removes a mapping
+ *
+ * @param addr Start of the range (page aligned)
+ * @param length Size of the range
+ */
+void sys_munmap()
+{
+    uint64_t addr = SYS_ARG_1(*CURRENT_PROCESS);
+    uint64_t length = SYS_ARG_2(*CURRENT_PROCESS);
+
+    process_t* current = (*CURRENT_PROCESS);
+
+    if ((addr & (PAGE_SIZE_4KB - 1)) || length == 0)
+    {
+        current->regs->rax = (uint64_t)-1;
+        return;
+    }
+    uint64_t end = addr + ALIGN_UP(length, PAGE_SIZE_4KB);
+
+    uint64_t current_cr3;
+    __asm__ volatile("mov %%cr3, %0\n\t" : "=r"(current_cr3) : :);
+    __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(*KERNEL_PAGE_TABLE) :);
+
+    tlb_batch_t batch = {.count = 0};
+    pageTable_unmap(&current->page_table, addr, end, &batch);
+    vma_remove_range(&current->thread_leader->vmas, addr, end);
+
+    /* Unmapping the top of the mmap area gives the address space back */
+    if (addr >= PROCESS_HEAP_START && end >= (uint64_t)current->thread_leader->heap_end)
+    {
+        current->thread_leader->heap_end = (void*)addr;
+    }
+
+    __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(current_cr3) :);
+    pageTable_tlb_flush(&batch);
+
+    current->regs->rax = 0;
+}
+
+/**
+ * @brief Changes the protection of a mapped range
+ *
+ * @param addr Start of the range (page aligned)
+ * @param length Size of the range
+ * @param prot New protection flags
+ */
+void sys_mprotect()
+{
+    uint64_t addr = SYS_ARG_1(*CURRENT_PROCESS);
+    uint64_t length = SYS_ARG_2(*CURRENT_PROCESS);
+    uint64_t prot = SYS_ARG_3(*CURRENT_PROCESS);
+
+    process_t* current = (*CURRENT_PROCESS);
+
+    if ((addr & (PAGE_SIZE_4KB - 1)) || length == 0)
+    {
+        current->regs->rax = (uint64_t)-1;
+        return;
+    }
+    uint64_t end = addr + ALIGN_UP(length, PAGE_SIZE_4KB);
+
+    if (!vma_isolate_range(&current->thread_leader->vmas, addr, end))
     {
-        void* page = pages_allocatePage(PAGE_SIZE_4KB);
+        current->regs->rax = (uint64_t)-1;
+        return;
+    }
 
-        process_t* current = (*CURRENT_PROCESS);
-        pageTable_addPage(&current->page_table, current->heap_end, (uint64_t)page / PAGE_SIZE_4KB, 1, PAGE_SIZE_4KB, 4);
-        current->heap_end += PAGE_SIZE_4KB;
+    for (vma_t* vma = vma_find(&current->thread_leader->vmas, addr); vma && vma->start < end; vma = vma_find_next(&current->thread_leader->vmas, vma->end))
+    {
+        vma->prot = prot;
     }
+
+    uint64_t current_cr3;
+    __asm__ volatile("mov %%cr3, %0\n\t" : "=r"(current_cr3) : :);
+    __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(*KERNEL_PAGE_TABLE) :);
+
+    tlb_batch_t batch = {.count = 0};
+    pageTable_protect(&current->page_table, addr, end, (prot & PROT_WRITE) != 0, prot != PROT_NONE, &batch);
+
+    __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(current_cr3) :);
+    pageTable_tlb_flush(&batch);
+
+    current->regs->rax = 0;
+}
+
+/**
+ * @brief Gives the kernel advice about how a range is going to be used
+ *
+ * @param addr Start of the range (page aligned)
+ * @param length Size of the range
+ * @param advice MADV_ value
+ */
+void sys_madvise()
+{
+    uint64_t addr = SYS_ARG_1(*CURRENT_PROCESS);
+    uint64_t length = SYS_ARG_2(*CURRENT_PROCESS);
+    uint64_t advice = SYS_ARG_3(*CURRENT_PROCESS);
+
+    process_t* current = (*CURRENT_PROCESS);
+
+    if ((addr & (PAGE_SIZE_4KB - 1)) || length == 0)
+    {
+        current->regs->rax = (uint64_t)-1;
+        return;
+    }
+    uint64_t end = addr + ALIGN_UP(length, PAGE_SIZE_4KB);
+
+    if (!vma_check(&current->thread_leader->vmas, addr, end - addr, PROT_NONE))
+    {
+        current->regs->rax = (uint64_t)-1;
+        return;
+    }
+
+    switch (advice)
+    {
+    case MADV_WILLNEED:
+        process_fault_in(addr, end - addr, 0);
+        break;
+    case MADV_DONTNEED:
+    {
+        uint64_t current_cr3;
+        __asm__ volatile("mov %%cr3, %0\n\t" : "=r"(current_cr3) : :);
+        __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(*KERNEL_PAGE_TABLE) :);
+
+        tlb_batch_t batch = {.count = 0};
+        for (vma_t* vma = vma_find(&current->thread_leader->vmas, addr); vma && vma->start < end; vma = vma_find_next(&current->thread_leader->vmas, vma->end))
+        {
+            /* File pages are read back from the page cache, private changes are lost */
+            pageTable_unmap(&current->page_table, MAX(vma->start, addr), MIN(vma->end, end), &batch);
+        }
+
+        __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(current_cr3) :);
+        pageTable_tlb_flush(&batch);
+    }
+    break;
+    case MADV_NORMAL:
+    case MADV_HUGEPAGE:
+        vma_isolate_range(&current->thread_leader->vmas, addr, end);
+        for (vma_t* vma = vma_find(&current->thread_leader->vmas, addr); vma && vma->start < end; vma = vma_find_next(&current->thread_leader->vmas, vma->end))
+        {
+            if (advice == MADV_HUGEPAGE)
+                vma->flags |= VMA_HUGEPAGE;
+            else
+                vma->flags &= ~VMA_HUGEPAGE;
+        }
+        break;
+    default:
+        current->regs->rax = (uint64_t)-1;
+        return;
+    }
+
+    current->regs->rax = 0;
+}
+
+/**
+ * @brief Grows, shrinks or moves a mapping
+ *
+ * @param old_addr Start of the mapping (page aligned)
+ * @param old_size Current size of the mapping
+ * @param new_size Requested size of the mapping
+ * @param flags MREMAP_ flags
+ */
+void sys_mremap()
+{
+    uint64_t old_addr = SYS_ARG_1(*CURRENT_PROCESS);
+    uint64_t old_size = ALIGN_UP(SYS_ARG_2(*CURRENT_PROCESS), PAGE_SIZE_4KB);
+    uint64_t new_size = ALIGN_UP(SYS_ARG_3(*CURRENT_PROCESS), PAGE_SIZE_4KB);
+    uint64_t flags = SYS_ARG_4(*CURRENT_PROCESS);
+
+    process_t* current = (*CURRENT_PROCESS);
+    current->regs->rax = (uint64_t)-1;
+
+    if ((old_addr & (PAGE_SIZE_4KB - 1)) || old_size == 0 || new_size == 0)
+        return;
+
+    /* The mapping has to be a single area */
+    vma_t* vma = vma_find(&current->thread_leader->vmas, old_addr);
+    if (!vma || vma->end < old_addr + old_size)
+        return;
+
+    uint64_t current_cr3;
+    __asm__ volatile("mov %%cr3, %0\n\t" : "=r"(current_cr3) : :);
+    __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(*KERNEL_PAGE_TABLE) :);
+
+    tlb_batch_t batch = {.count = 0};
+
+    if (new_size <= old_size)
+    {
+        /* Shrink, drop the tail */
+        pageTable_unmap(&current->page_table, old_addr + new_size, old_addr + old_size, &batch);
+        vma_remove_range(&current->thread_leader->vmas, old_addr + new_size, old_addr + old_size);
+        current->regs->rax = old_addr;
+    }
+    else
+    {
+        vma_t* next = vma_find_next(&current->thread_leader->vmas, old_addr + old_size);
+        if (vma->end == old_addr + old_size && (!next || next->start >= old_addr + new_size))
+        {
+            /* Nothing above, grow in place */
+            vma->end = old_addr + new_size;
+            if (vma->end > (uint64_t)current->thread_leader->heap_end && old_addr >= PROCESS_HEAP_START)
+                current->thread_leader->heap_end = (void*)vma->end;
+            current->regs->rax = old_addr;
+        }
+        else if (flags & MREMAP_MAYMOVE)
+        {
+            /* Move to the top of the mmap area, keeping the offset into a 2mb page */
+            uint64_t new_addr = ALIGN_UP((uint64_t)current->thread_leader->heap_end, PAGE_SIZE_2MB) + (old_addr & (PAGE_SIZE_2MB - 1));
+            vma_t* moved = vma_create(&current->thread_leader->vmas, new_addr, new_addr + new_size, vma->prot, vma->backing, vma->flags);
+            if (moved)
+            {
+                moved->file = vma->file;
+                moved->offset = vma->offset + (old_addr - vma->start);
+                moved->file_end = vma->file_end + (new_addr - old_addr);
+
+                pageTable_move(&current->page_table, old_addr, new_addr, old_size, &batch);
+                vma_remove_range(&current->thread_leader->vmas, old_addr, old_addr + old_size);
+
+                current->thread_leader->heap_end = (void*)(new_addr + new_size);
+                current->regs->rax = new_addr;
+            }
+        }
+    }
+
+    __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(current_cr3) :);
+    pageTable_tlb_flush(&batch);
+}
+
+/**
+ * @brief Controls same page merging and reports the memory it saves
+ *
+ * @param mode PAGE_MERGE_QUERY, PAGE_MERGE_ENABLE or PAGE_MERGE_DISABLE
+ * @param stats Optional page_merge_stats_t filled in with the statistics
+ */
+void sys_pagemerge()
+{
+    uint64_t mode = SYS_ARG_1(*CURRENT_PROCESS);
+    uint64_t stats = SYS_ARG_2(*CURRENT_PROCESS);
+
+    if (mode == PAGE_MERGE_ENABLE)
+        PAGE_MERGE->enabled = 1;
+    else if (mode == PAGE_MERGE_DISABLE)
+        PAGE_MERGE->enabled = 0;
+
+    if (stats)
+    {
+        if (!process_validate_address((void*)stats, sizeof(page_merge_stats_t)))
+        {
+            (*CURRENT_PROCESS)->regs->rax = (uint64_t)-1;
+            return;
+        }
+        process_fault_in(stats, sizeof(page_merge_stats_t), 1);
+        pageMerge_stats((page_merge_stats_t*)stats);
+    }
+
+    (*CURRENT_PROCESS)->regs->rax = 0;
+}
+
+/**
+ * @brief Reports swap and compressed RAM device statistics
+ *
+ * @param swap Optional swap_stats_t filled in with the swap statistics
+ * @param zram Optional zram_stats_t filled in with the compression statistics
+ */
+void sys_swapstats()
+{
+    uint64_t swap = SYS_ARG_1(*CURRENT_PROCESS);
+    uint64_t zram = SYS_ARG_2(*CURRENT_PROCESS);
+
+    if ((swap && !process_validate_address((void*)swap, sizeof(swap_stats_t))) || (zram && !process_validate_address((void*)zram, sizeof(zram_stats_t))))
+    {
+        (*CURRENT_PROCESS)->regs->rax = (uint64_t)-1;
+        return;
+    }
+
+    if (swap)
+    {
+        process_fault_in(swap, sizeof(swap_stats_t), 1);
+        *(swap_stats_t*)swap = SWAP->stats;
+    }
+    if (zram)
+    {
+        process_fault_in(zram, sizeof(zram_stats_t), 1);
+        zram_stats((zram_stats_t*)zram);
+    }
+
+    (*CURRENT_PROCESS)->regs->rax = 0;
+}
+
+/**
+ * @brief Reports the resources used by the caller, its process or its reaped children
+ *
+ * @param who RUSAGE_SELF, RUSAGE_CHILDREN or RUSAGE_THREAD
+ * @param usage usage_rusage_t filled in with the totals
+ */
+void sys_getrusage()
+{
+    int64_t who = SYS_ARG_1(*CURRENT_PROCESS);
+    uint64_t usage = SYS_ARG_2(*CURRENT_PROCESS);
+
+    /* The resident size of the caller is sampled now, children left theirs on exit */
+    if (who != RUSAGE_CHILDREN)
+        usage_sample_rss(*CURRENT_PROCESS);
+
+    process_usage_t total;
+    if (!process_validate_address((void*)usage, sizeof(usage_rusage_t)) || usage_collect(*CURRENT_PROCESS, who, &total) != 0)
+    {
+        (*CURRENT_PROCESS)->regs->rax = (uint64_t)-1;
+        return;
+    }
+
+    process_fault_in(usage, sizeof(usage_rusage_t), 1);
+    usage_rusage_t* result = (usage_rusage_t*)usage;
+    kmemset(result, 0, sizeof(usage_rusage_t));
+    result->utime = usage_timeval(total.user_cycles);
+    result->stime = usage_timeval(total.system_cycles);
+    result->maxrss = total.rss_peak * (PAGE_SIZE_4KB / 1024);
+    result->minflt = total.minor_faults;
+    result->majflt = total.major_faults;
+    result->inblock = total.read_bytes / 512;
+    result->oublock = total.write_bytes / 512;
+    result->nvcsw = total.voluntary_switches;
+    result->nivcsw = total.involuntary_switches;
+
+    (*CURRENT_PROCESS)->regs->rax = 0;
+}
+
+/**
+ * @brief Reports the times of the calling process and its reaped children
+ *
+ * @param buffer Optional usage_tms_t filled in with clock ticks
+ * @return clock ticks since boot
+ */
+void sys_times()
+{
+    uint64_t buffer = SYS_ARG_1(*CURRENT_PROCESS);
+
+    if (buffer)
+    {
+        if (!process_validate_address((void*)buffer, sizeof(usage_tms_t)))
+        {
+            (*CURRENT_PROCESS)->regs->rax = (uint64_t)-1;
+            return;
+        }
+
+        process_usage_t self, children;
+        usage_collect(*CURRENT_PROCESS, RUSAGE_SELF, &self);
+        usage_collect(*CURRENT_PROCESS, RUSAGE_CHILDREN, &children);
+
+        process_fault_in(buffer, sizeof(usage_tms_t), 1);
+        usage_tms_t* result = (usage_tms_t*)buffer;
+        result->utime = usage_clock_ticks(self.user_cycles);
+        result->stime = usage_clock_ticks(self.system_cycles);
+        result->cutime = usage_clock_ticks(children.user_cycles);
+        result->cstime = usage_clock_ticks(children.system_cycles);
+    }
+
+    (*CURRENT_PROCESS)->regs->rax = usage_clock_ticks(rdtsc() - USAGE->boot_tsc);
+}
+
+/**
+ * @brief Finds the target of setpriority and getpriority
+ * @return the process, 0 if there is none
+ */
+static process_t* sys_priority_target(uint64_t which, uint64_t who)
+{
+    if (which != SCHEDULER_PRIO_PROCESS)
+        return 0;
+    if (who == 0)
+        return *CURRENT_PROCESS;
+    return (process_t*)pidMap_lookup(PID_MAP, who);
+}
+
+/**
+ * @brief Sets the nice value of a process
+ *
+ * @param which SCHEDULER_PRIO_PROCESS
+ * @param who pid, 0 for the caller
+ * @param prio nice value, clamped to -20 to 19
+ */
+void sys_setpriority()
+{
+    process_t* process = sys_priority_target(SYS_ARG_1(*CURRENT_PROCESS), SYS_ARG_2(*CURRENT_PROCESS));
+    if (!process || (process->flags & PROCESS_ZOMBIE))
+    {
+        (*CURRENT_PROCESS)->regs->rax = (uint64_t)-1;
+        return;
+    }
+
+    scheduler_set_nice(process, (int64_t)SYS_ARG_3(*CURRENT_PROCESS));
+    (*CURRENT_PROCESS)->regs->rax = 0;
+}
+
+/**
+ * @brief Gets the nice value of a process
+ *
+ * @param which SCHEDULER_PRIO_PROCESS
+ * @param who pid, 0 for the caller
+ * @return 20 - nice, from 1 to 40 so no value is mistaken for an error
+ */
+void sys_getpriority()
+{
+    process_t* process = sys_priority_target(SYS_ARG_1(*CURRENT_PROCESS), SYS_ARG_2(*CURRENT_PROCESS));
+    if (!process || (process->flags & PROCESS_ZOMBIE))
+    {
+        (*CURRENT_PROCESS)->regs->rax = (uint64_t)-1;
+        return;
+    }
+
+    (*CURRENT_PROCESS)->regs->rax = 20 - process->nice;
+}
+
+/**
+ * @brief Finds the target of the sched_ syscalls
+ * @return the process, 0 if there is none or it is a zombie
+ */
+static process_t* sys_sched_target(uint64_t pid)
+{
+    process_t* process = pid == 0 ? *CURRENT_PROCESS : (process_t*)pidMap_lookup(PID_MAP, pid);
+    if (!process || (process->flags & PROCESS_ZOMBIE))
+        return 0;
+    return process;
+}
+
+/**
+ * @brief Sets the scheduling class and real time priority of a process
+ *
+ * @param pid pid, 0 for the caller
+ * @param policy SCHEDULER_NORMAL, SCHEDULER_FIFO or SCHEDULER_RR
+ * @param param struct sched_param, an int priority, 1 to 99 for FIFO and RR, 0 for NORMAL
+ */
+void sys_sched_setscheduler()
+{
+    process_t* process = sys_sched_target(SYS_ARG_1(*CURRENT_PROCESS));
+    uint64_t policy = SYS_ARG_2(*CURRENT_PROCESS);
+    uint64_t param = SYS_ARG_3(*CURRENT_PROCESS);
+
+    (*CURRENT_PROCESS)->regs->rax = (uint64_t)-1;
+    if (!process || !process_validate_address((void*)param, sizeof(int32_t)))
+        return;
+
+    process_fault_in(param, sizeof(int32_t), 0);
+    int32_t priority = *(int32_t*)param;
+    if (priority < 0 || scheduler_set_policy(process, policy, priority) != 0)
+        return;
+    (*CURRENT_PROCESS)->regs->rax = 0;
+}
+
+/**
+ * @brief Gets the real time priority of a process
+ *
+ * @param pid pid, 0 for the caller
+ * @param param struct sched_param filled in, 0 in the normal class
+ */
+void sys_sched_getparam()
+{
+    process_t* process = sys_sched_target(SYS_ARG_1(*CURRENT_PROCESS));
+    uint64_t param = SYS_ARG_2(*CURRENT_PROCESS);
+
+    if (!process || !process_validate_address((void*)param, sizeof(int32_t)))
+    {
+        (*CURRENT_PROCESS)->regs->rax = (uint64_t)-1;
+        return;
+    }
+
+    process_fault_in(param, sizeof(int32_t), 1);
+    *(int32_t*)param = (int32_t)process->rt_priority;
+    (*CURRENT_PROCESS)->regs->rax = 0;
+}
+
+/**
+ * @brief Gets the scheduling class of a process
+ *
+ * @param pid pid, 0 for the caller
+ * @return SCHEDULER_NORMAL, SCHEDULER_FIFO or SCHEDULER_RR
+ */
+void sys_sched_getscheduler()
+{
+    process_t* process = sys_sched_target(SYS_ARG_1(*CURRENT_PROCESS));
+    (*CURRENT_PROCESS)->regs->rax = process ? process->policy : (uint64_t)-1;
+}
+
+/**
+ * @brief Sleeps for a time, unless a signal arrives first
+ *
+ * @param request timer_timespec_t to sleep for, rounded up to milliseconds
+ * @param remain optional timer_timespec_t filled in with the time left when a signal ended the sleep
+ * @return 0 once the time passed, -1 if interrupted or invalid
+ */
+void sys_nanosleep()
+{
+    uint64_t request = SYS_ARG_1(*CURRENT_PROCESS);
+    uint64_t remain = SYS_ARG_2(*CURRENT_PROCESS);
+
+    (*CURRENT_PROCESS)->regs->rax = (uint64_t)-1;
+    if (!process_validate_address((void*)request, sizeof(timer_timespec_t)) ||
+        (remain && !process_validate_address((void*)remain, sizeof(timer_timespec_t))))
+        return;
+
+    process_fault_in(request, sizeof(timer_timespec_t), 0);
+    timer_timespec_t* time = (timer_timespec_t*)request;
+    if (time->sec < 0 || time->nsec < 0 || time->nsec >= 1000000000)
+        return;
+
+    /* Woken early for something else it sleeps the rest */
+    uint64_t left = time->sec * 1000 + (time->nsec + 999999) / 1000000;
+    while (left && !wait_interrupted())
+        left = wait_schedule_timeout(left);
+
+    if (!left)
+    {
+        (*CURRENT_PROCESS)->regs->rax = 0;
+        return;
+    }
+    if (remain)
+    {
+        process_fault_in(remain, sizeof(timer_timespec_t), 1);
+        ((timer_timespec_t*)remain)->sec = left / 1000;
+        ((timer_timespec_t*)remain)->nsec = (left % 1000) * 1000000;
+    }
+}
+
+/**
+ * @brief Sends SIGALRM to the process of an alarm and starts the next period
+ */
+static void sys_alarm_expired(timer_event_t* timer)
+{
+    process_t* process = (process_t*)timer->data;
+    if (process->alarm_interval)
+        timer_add(timer, timer->expires + process->alarm_interval);
+    process_signal(process, SIGALRM);
+}
+
+/**
+ * @brief Gets the milliseconds until the alarm of a process, 0 if none is set
+ */
+static uint64_t sys_alarm_left(process_t* process)
+{
+    if (!timer_pending(&process->alarm_timer))
+        return 0;
+    uint64_t now = timer_now();
+    return process->alarm_timer.expires > now ? process->alarm_timer.expires - now : 1;
+}
+
+/**
+ * @brief Sets the alarm of a process, replacing the one set before
+ * @param value milliseconds until it expires, 0 stops it
+ * @param interval milliseconds it repeats at afterwards, 0 for once
+ */
+static void sys_alarm_set(process_t* process, uint64_t value, uint64_t interval)
+{
+    if (!value)
+    {
+        timer_cancel(&process->alarm_timer);
+        process->alarm_interval = 0;
+        return;
+    }
+
+    process->alarm_interval = interval;
+    process->alarm_timer.function = sys_alarm_expired;
+    process->alarm_timer.data = (uint64_t)process;
+    timer_add(&process->alarm_timer, timer_deadline(value));
+}
+
+/**
+ * @brief Milliseconds of a timeval, rounded up
+ */
+static uint64_t sys_timeval_ms(usage_timeval_t* time)
+{
+    return time->sec * 1000 + (time->usec + 999) / 1000;
+}
+
+/**
+ * @brief Timeval of a number of milliseconds
+ */
+static usage_timeval_t sys_ms_timeval(uint64_t ms)
+{
+    usage_timeval_t time = {.sec = ms / 1000, .usec = (ms % 1000) * 1000};
+    return time;
+}
+
+/**
+ * @brief Sends SIGALRM to the calling process after a number of seconds
+ *
+ * @param seconds delay, 0 cancels the alarm
+ * @return seconds left of the previous alarm, rounded up, 0 if none was set
+ */
+void sys_alarm()
+{
+    uint64_t seconds = SYS_ARG_1(*CURRENT_PROCESS);
+    process_t* process = (*CURRENT_PROCESS)->thread_leader;
+
+    uint64_t left = sys_alarm_left(process);
+    sys_alarm_set(process, seconds * 1000, 0);
+    (*CURRENT_PROCESS)->regs->rax = (left + 999) / 1000;
+}
+
+/**
+ * @brief Sets the interval timer of the calling process, shared with alarm
+ *
+ * @param which ITIMER_REAL
+ * @param value timer_itimerval_t to set
+ * @param old optional timer_itimerval_t filled in with the timer it replaced
+ * @return 0 on success, -1 for another timer or invalid memory
+ */
+void sys_setitimer()
+{
+    uint64_t which = SYS_ARG_1(*CURRENT_PROCESS);
+    uint64_t value = SYS_ARG_2(*CURRENT_PROCESS);
+    uint64_t old = SYS_ARG_3(*CURRENT_PROCESS);
+    process_t* process = (*CURRENT_PROCESS)->thread_leader;
+
+    (*CURRENT_PROCESS)->regs->rax = (uint64_t)-1;
+    if (which != ITIMER_REAL || !process_validate_address((void*)value, sizeof(timer_itimerval_t)) ||
+        (old && !process_validate_address((void*)old, sizeof(timer_itimerval_t))))
+        return;
+
+    process_fault_in(value, sizeof(timer_itimerval_t), 0);
+    timer_itimerval_t* timer = (timer_itimerval_t*)value;
+    if (timer->value.sec < 0 || timer->value.usec < 0 || timer->interval.sec < 0 || timer->interval.usec < 0)
+        return;
+    uint64_t ms = sys_timeval_ms(&timer->value);
+    uint64_t interval = sys_timeval_ms(&timer->interval);
+
+    if (old)
+    {
+        process_fault_in(old, sizeof(timer_itimerval_t), 1);
+        ((timer_itimerval_t*)old)->value = sys_ms_timeval(sys_alarm_left(process));
+        ((timer_itimerval_t*)old)->interval = sys_ms_timeval(process->alarm_interval);
+    }
+
+    sys_alarm_set(process, ms, interval);
+    (*CURRENT_PROCESS)->regs->rax = 0;
+}
+
+/**
+ * @brief Reads the interval timer of the calling process
+ *
+ * @param which ITIMER_REAL
+ * @param value timer_itimerval_t filled in
+ * @return 0 on success, -1 for another timer or invalid memory
+ */
+void sys_getitimer()
+{
+    uint64_t which = SYS_ARG_1(*CURRENT_PROCESS);
+    uint64_t value = SYS_ARG_2(*CURRENT_PROCESS);
+    process_t* process = (*CURRENT_PROCESS)->thread_leader;
+
+    (*CURRENT_PROCESS)->regs->rax = (uint64_t)-1;
+    if (which != ITIMER_REAL || !process_validate_address((void*)value, sizeof(timer_itimerval_t)))
+        return;
+
+    process_fault_in(value, sizeof(timer_itimerval_t), 1);
+    ((timer_itimerval_t*)value)->value = sys_ms_timeval(sys_alarm_left(process));
+    ((timer_itimerval_t*)value)->interval = sys_ms_timeval(timer_pending(&process->alarm_timer) ? process->alarm_interval : 0);
+    (*CURRENT_PROCESS)->regs->rax = 0;
+}
+
+/**
+ * @brief Checks the readiness of polled descriptors
+ *
+ * Devices with a CHRDEV_POLL operation queue the entry of a descriptor on
+ * what they wait for, everything else is always ready.
+ * @return number of descriptors with events
+ */
+static uint64_t sys_poll_scan(wait_pollfd_t* fds, uint64_t count, wait_entry_t* entries)
+{
+    uint64_t ready = 0;
+    for (uint64_t i = 0; i < count; i++)
+    {
+        fds[i].revents = 0;
+        if (fds[i].fd < 0)
+            continue;
+
+        file_descriptor_t* descriptor = fdm_get((file_descriptor_entry_t*)(*CURRENT_PROCESS)->file_descriptor_table, fds[i].fd);
+        if (!descriptor)
+        {
+            fds[i].revents = POLLNVAL;
+            ready++;
+            continue;
+        }
+
+        uint64_t events = POLLIN | POLLOUT;
+        if (descriptor->type == EXT2_FT_CHRDEV && descriptor->ops[CHRDEV_POLL])
+            events = descriptor->ops[CHRDEV_POLL]((uint64_t)descriptor, (uint64_t)&entries[i], 0);
+        fds[i].revents = events & fds[i].events;
+        if (fds[i].revents)
+            ready++;
+    }
+    return ready;
+}
+
+/**
+ * @brief Waits for events on file descriptors
+ *
+ * @param fds array of wait_pollfd_t, at most WAIT_POLL_MAX
+ * @param count entries in fds
+ * @param timeout milliseconds to wait at most, negative to wait until an event
+ * @return number of descriptors with events, 0 on timeout, -1 if interrupted or invalid
+ */
+void sys_poll()
+{
+    uint64_t fds = SYS_ARG_1(*CURRENT_PROCESS);
+    uint64_t count = SYS_ARG_2(*CURRENT_PROCESS);
+    int32_t timeout = (int32_t)SYS_ARG_3(*CURRENT_PROCESS);
+
+    (*CURRENT_PROCESS)->regs->rax = (uint64_t)-1;
+    if (count > WAIT_POLL_MAX || !process_validate_address((void*)fds, count * sizeof(wait_pollfd_t)))
+        return;
+    process_fault_in(fds, count * sizeof(wait_pollfd_t), 1);
+
+    wait_entry_t entries[WAIT_POLL_MAX];
+    uint64_t left = timeout < 0 ? WAIT_FOREVER : (uint64_t)timeout;
+    uint64_t ready;
+    while (1)
+    {
+        /* Every pass queues the entries again, a wake took them out of their queue */
+        kmemset(entries, 0, sizeof(entries));
+        ready = sys_poll_scan((wait_pollfd_t*)fds, count, entries);
+        bool sleep = !ready && left && !wait_interrupted();
+        if (sleep)
+            left = wait_schedule_timeout(left);
+        for (uint64_t i = 0; i < count; i++)
+        {
+            if (entries[i].process)
+                wait_remove(&entries[i]);
+        }
+
+        /* Scanned once more after a sleep, whatever ended it */
+        if (!sleep)
+            break;
+    }
+
+    if (!ready && wait_interrupted())
+        return;
+    (*CURRENT_PROCESS)->regs->rax = ready;
 }
 
 /**
@@ -249,8 +1058,10 @@ void sys_write()
         }
     }
 
+    process_fault_in(msg, len, 0);
+
     // TODO: add this to the queue instead so it can also run on user processes
-    descriptor->ops[DEV_WRITE]((uint64_t)descriptor, msg, len);
+    (*CURRENT_PROCESS)->usage.write_bytes += descriptor->ops[DEV_WRITE]((uint64_t)descriptor, msg, len);
 }
 
 /**
@@ -279,8 +1090,11 @@ void sys_input()
         }
     }
 
+    /* The line may be copied in later from the keyboard interrupt */
+    process_fault_in(msg, len, 1);
+
     // TODO: add this to the queue instead so it can also run on user processes
-    descriptor->ops[DEV_READ]((uint64_t)descriptor, msg, len);
+    (*CURRENT_PROCESS)->usage.read_bytes += descriptor->ops[DEV_READ]((uint64_t)descriptor, msg, len);
 
     /* TODO: Implement stderr (FD 2) and other file descriptors */
 }
@@ -290,26 +1104,267 @@ void sys_fork()
     process_fork();
 }
 
+/**
+ * @brief Creates a child sharing the address space until it execs or exits
+ */
+void sys_vfork()
+{
+    process_vfork();
+}
+
+/**
+ * @brief Copies a user array of string pointers
+ * @param vector user array
+ * @param count number of pointers
+ * @return kernel copy, NULL if the array is not mapped
+ */
+static char** sys_copy_vector(uint64_t vector, uint64_t count)
+{
+    if (!process_validate_address((void*)vector, sizeof(char*) * count))
+        return 0;
+    process_fault_in(vector, sizeof(char*) * count, 0);
+
+    char** kernel_vector = kmalloc(sizeof(char*) * (count + 1));
+    for (uint64_t i = 0; i < count; i++)
+    {
+        kernel_vector[i] = ((char**)vector)[i];
+    }
+    return kernel_vector;
+}
+
+/**
+ * @brief Counts the pointers of a NULL terminated user array
+ * @param vector user array, may be NULL
+ * @return number of pointers before the NULL, -1 if the array is not mapped
+ */
+static int64_t sys_vector_length(uint64_t vector)
+{
+    if (!vector)
+        return 0;
+
+    for (int64_t count = 0; count < PROCESS_ARG_MAX / sizeof(char*); count++)
+    {
+        uint64_t slot = vector + count * sizeof(char*);
+        if (!process_validate_address((void*)slot, sizeof(char*)))
+            return -1;
+        process_fault_in(slot, sizeof(char*), 0);
+        if (!*(char**)slot)
+            return count;
+    }
+    return -1;
+}
+
+/**
+ * @brief Finds an executable, names without a slash are looked up in /bin
+ * @param name user pointer to the name
+ * @return open executable, NULL if there is none
+ */
+static file_descriptor_t* sys_find_executable(uint64_t name)
+{
+    vfs_entry_t* directory;
+    vfs_entry_t* executable;
+    if (vfs_find_entry(ROOT, &directory, "bin") != 0 || vfs_find_entry(directory, &executable, (const char*)name) != 0 ||
+        executable->type != EXT2_FT_REG_FILE)
+        return 0;
+    return vfs_open_file(executable);
+}
+
 void sys_execvp() {}
 
 void sys_execve()
 {
+    /* Only the main thread can replace the program */
+    if ((*CURRENT_PROCESS)->flags & PROCESS_THREAD)
+    {
+        (*CURRENT_PROCESS)->regs->rax = (uint64_t)-1;
+        return;
+    }
+
     // SYSCALL_ARGS(name);
     uint64_t name = SYS_ARG_1(*CURRENT_PROCESS);
     uint64_t argc = SYS_ARG_2(*CURRENT_PROCESS);
     uint64_t argv = SYS_ARG_3(*CURRENT_PROCESS);
+    uint64_t envc = SYS_ARG_4(*CURRENT_PROCESS);
+    uint64_t envp = SYS_ARG_5(*CURRENT_PROCESS);
 
-    vfs_entry_t* directory;
-    vfs_find_entry(ROOT, &directory, "bin");
-    vfs_entry_t* executable;
-    vfs_find_entry(directory, &executable, (const char*)name);
-    char** kernel_argv = kmalloc(sizeof(char*) * argc);
-    for (int i = 0; i < argc; i++)
+    file_descriptor_t* executable = sys_find_executable(name);
+    if (!executable)
     {
-        kernel_argv[i] = ((char**)argv)[i];
+        (*CURRENT_PROCESS)->regs->rax = (uint64_t)-1;
+        return;
+    }
+
+    char** kernel_argv = sys_copy_vector(argv, argc);
+    char** kernel_env = sys_copy_vector(envp, envc);
+    if (!kernel_argv || !kernel_env)
+    {
+        kfree(kernel_argv);
+        kfree(kernel_env);
+        (*CURRENT_PROCESS)->regs->rax = (uint64_t)-1;
+        return;
     }
-    process_execvp(vfs_open_file(executable), argc, kernel_argv, 0, 0);
+
+    process_execvp(executable, argc, kernel_argv, envc, kernel_env);
     kfree(kernel_argv);
+    kfree(kernel_env);
+}
+
+/**
+ * @brief Starts a program in a new child process without copying the caller
+ *
+ * @param path Executable, looked up like execve
+ * @param argv NULL terminated arguments
+ * @param envp NULL terminated environment
+ * @param actions process_spawn_action_t file actions applied in order
+ * @param action_count Number of file actions
+ * @param attr Optional flags and process group, two 64 bit words
+ */
+void sys_spawn()
+{
+    uint64_t path = SYS_ARG_1(*CURRENT_PROCESS);
+    uint64_t argv = SYS_ARG_2(*CURRENT_PROCESS);
+    uint64_t envp = SYS_ARG_3(*CURRENT_PROCESS);
+    uint64_t actions = SYS_ARG_4(*CURRENT_PROCESS);
+    uint64_t action_count = SYS_ARG_5(*CURRENT_PROCESS);
+    uint64_t attr = SYS_ARG_6(*CURRENT_PROCESS);
+
+    (*CURRENT_PROCESS)->regs->rax = (uint64_t)-1;
+
+    int64_t argc = sys_vector_length(argv);
+    int64_t envc = sys_vector_length(envp);
+    if (argc < 0 || envc < 0 || action_count > PROCESS_SPAWN_MAX_ACTIONS)
+        return;
+    if (!process_validate_address((void*)actions, sizeof(process_spawn_action_t) * action_count) ||
+        (attr && !process_validate_address((void*)attr, sizeof(uint64_t) * 2)))
+        return;
+    process_fault_in(actions, sizeof(process_spawn_action_t) * action_count, 0);
+    if (attr)
+        process_fault_in(attr, sizeof(uint64_t) * 2, 0);
+
+    file_descriptor_t* executable = sys_find_executable(path);
+    if (!executable)
+        return;
+
+    char** kernel_argv = sys_copy_vector(argv, argc);
+    char** kernel_env = sys_copy_vector(envp, envc);
+    uint64_t flags = attr ? ((uint64_t*)attr)[0] : 0;
+    uint64_t pgroup = attr ? ((uint64_t*)attr)[1] : 0;
+
+    (*CURRENT_PROCESS)->regs->rax =
+        process_spawn(executable, argc, kernel_argv, envc, kernel_env, (process_spawn_action_t*)actions, action_count, flags, pgroup);
+    kfree(kernel_argv);
+    kfree(kernel_env);
+}
+
+/**
+ * @brief Creates a thread of the calling process
+ *
+ * @param flags CLONE_ flags, CLONE_VM, CLONE_FILES and CLONE_THREAD are required
+ * @param stack Stack pointer of the thread
+ * @param parent_tid Where the thread id is stored with CLONE_PARENT_SETTID
+ * @param child_tid Cleared and woken on exit with CLONE_CHILD_CLEARTID
+ * @param tls FS base of the thread with CLONE_SETTLS
+ */
+void sys_clone()
+{
+    uint64_t flags = SYS_ARG_1(*CURRENT_PROCESS);
+    uint64_t stack = SYS_ARG_2(*CURRENT_PROCESS);
+    uint64_t parent_tid = SYS_ARG_3(*CURRENT_PROCESS);
+    uint64_t child_tid = SYS_ARG_4(*CURRENT_PROCESS);
+    uint64_t tls = SYS_ARG_5(*CURRENT_PROCESS);
+
+    (*CURRENT_PROCESS)->regs->rax = process_clone(flags, stack, parent_tid, child_tid, tls);
+}
+
+/**
+ * @brief Waits on or wakes a user address shared by the threads of a process
+ *
+ * @param addr 32 bit aligned user address
+ * @param op FUTEX_WAIT or FUTEX_WAKE, FUTEX_PRIVATE_FLAG is ignored
+ * @param val FUTEX_WAIT sleeps only if addr still holds val, FUTEX_WAKE wakes up to val threads
+ * @param timeout Not supported, waits have no timeout
+ */
+void sys_futex()
+{
+    process_t* current = (*CURRENT_PROCESS);
+    uint64_t addr = SYS_ARG_1(current);
+    uint64_t op = SYS_ARG_2(current) & ~FUTEX_PRIVATE_FLAG;
+    uint64_t val = SYS_ARG_3(current);
+
+    current->regs->rax = (uint64_t)-1;
+    if ((addr & 3) || !process_validate_address((void*)addr, sizeof(uint32_t)))
+        return;
+
+    switch (op)
+    {
+    case FUTEX_WAIT:
+        process_fault_in(addr, sizeof(uint32_t), 0);
+
+        /* Nothing runs between the check and the sleep, a wake cannot be missed */
+        if (*(volatile uint32_t*)addr != (uint32_t)val)
+            return;
+        current->regs->rax = 0;
+        futex_wait(current, addr);
+        scheduler_yield();
+
+        /* Still queued if something else woke it up */
+        futex_cancel(current);
+        break;
+    case FUTEX_WAKE:
+        current->regs->rax = futex_wake(current->thread_leader, addr, val);
+        break;
+    default:
+        break;
+    }
+}
+
+#define ARCH_SET_FS 0x1002
+#define ARCH_GET_FS 0x1003
+
+/**
+ * @brief Sets or gets the FS base of the calling thread
+ *
+ * @param code ARCH_SET_FS or ARCH_GET_FS
+ * @param addr New FS base, or where the current one is stored
+ */
+void sys_arch_prctl()
+{
+    process_t* current = (*CURRENT_PROCESS);
+    uint64_t code = SYS_ARG_1(current);
+    uint64_t addr = SYS_ARG_2(current);
+
+    current->regs->rax = (uint64_t)-1;
+    switch (code)
+    {
+    case ARCH_SET_FS:
+        /* A non canonical base would fault when it is loaded */
+        if (addr >= PROCESS_STACK_TOP)
+            return;
+        current->fs_base = addr;
+        process_load_fs(current);
+        break;
+    case ARCH_GET_FS:
+        if (!process_validate_address((void*)addr, sizeof(uint64_t)))
+            return;
+        process_fault_in(addr, sizeof(uint64_t), 1);
+        *(uint64_t*)addr = current->fs_base;
+        break;
+    default:
+        return;
+    }
+    current->regs->rax = 0;
+}
+
+/**
+ * @brief Ends the calling thread, exit ends every thread
+ *
+ * @param status Exit status, used if the main thread calls it
+ */
+void sys_exit_thread()
+{
+    uint64_t exit_code = SYS_ARG_1(*CURRENT_PROCESS);
+
+    process_exit_thread(*CURRENT_PROCESS, exit_code << 8);
 }
 
 void sys_dup2()
@@ -332,16 +1387,15 @@ void sys_open()
     char* kernel_path = (char*)path;
     vfs_entry_t* entry;
     process_t* current = (*CURRENT_PROCESS);
-    uint64_t file_descriptor = 0;
+    uint64_t file_descriptor = (uint64_t)-1;
 
     if (vfs_find_entry(current->cwd, &entry, kernel_path) == 0)
     {
         file_descriptor_t* descriptor = fdm_open_file(entry);
         descriptor->mode = perms;
-        // TODO: Get a proper system for free table        \/
-        fdm_set((file_descriptor_entry_t*)(*CURRENT_PROCESS)->file_descriptor_table, 0, fdm_open_file(entry));
+        file_descriptor = fdm_alloc((file_descriptor_entry_t*)(*CURRENT_PROCESS)->file_descriptor_table, descriptor);
     }
-    current->process_stack_signature.rax = file_descriptor;
+    current->regs->rax = file_descriptor;
 }
 
 void sys_close()
@@ -487,6 +1541,8 @@ void sys_chdir()
     vfs_entry_t* out;
     if (vfs_find_entry((*CURRENT_PROCESS)->cwd, &out, (const char*)buffer) == 0)
     {
+        /* Working directories stay cached, processes hold on to them */
+        out->pinned = 1;
         (*CURRENT_PROCESS)->cwd = out;
     }
 }
@@ -499,6 +1555,8 @@ void sys_getcwd()
 
     // TODO: Generate path string
 
+    process_fault_in(buffer, size, 1);
+
     char* user_buffer = (char*)buffer;
     user_buffer[0] = 0;
     uint64_t offset = 0;
@@ -544,8 +1602,10 @@ void sys_setpgid()
     }
     else
     {
-        process = (process_t*)pid_hash_lookup(PID_MAP, pid);
+        process = (process_t*)pidMap_lookup(PID_MAP, pid);
     }
+    if (!process)
+        return;
 
     if (pgid == 0)
     {
@@ -569,12 +1629,12 @@ void sys_getpgid()
 
     if (pid == 0)
     {
-        (*CURRENT_PROCESS)->process_stack_signature.rax = (*CURRENT_PROCESS)->pgid;
+        (*CURRENT_PROCESS)->regs->rax = (*CURRENT_PROCESS)->pgid;
     }
     else
     {
-        process_t* process = (process_t*)pid_hash_lookup(PID_MAP, pid);
-        (*CURRENT_PROCESS)->process_stack_signature.rax = process->pid;
+        process_t* process = (process_t*)pidMap_lookup(PID_MAP, pid);
+        (*CURRENT_PROCESS)->regs->rax = process ? process->pgid : (uint64_t)-1;
     }
 }
 
@@ -598,8 +1658,10 @@ void sys_setpgrp()
     }
     else
     {
-        process = (process_t*)pid_hash_lookup(PID_MAP, pid);
+        process = (process_t*)pidMap_lookup(PID_MAP, pid);
     }
+    if (!process)
+        return;
 
     if (process->pid == process->pgid)
         return;
@@ -625,8 +1687,10 @@ void sys_setsid()
     }
     else
     {
-        process = (process_t*)pid_hash_lookup(PID_MAP, pid);
+        process = (process_t*)pidMap_lookup(PID_MAP, pid);
     }
+    if (!process)
+        return;
 
     if (sid == 0)
     {
@@ -635,10 +1699,10 @@ void sys_setsid()
 
     if (process->sid != 0)
     {
-        process_remove_from_group(process);
+        process_remove_from_session(process);
     }
 
-    process_add_to_group(process, sid);
+    process_add_to_session(process, sid);
 }
 
 /**
@@ -650,12 +1714,12 @@ void sys_getsid()
 
     if (pid == 0)
     {
-        (*CURRENT_PROCESS)->process_stack_signature.rax = (*CURRENT_PROCESS)->sid;
+        (*CURRENT_PROCESS)->regs->rax = (*CURRENT_PROCESS)->sid;
     }
     else
     {
-        process_t* process = (process_t*)pid_hash_lookup(PID_MAP, pid);
-        (*CURRENT_PROCESS)->process_stack_signature.rax = process->pid;
+        process_t* process = (process_t*)pidMap_lookup(PID_MAP, pid);
+        (*CURRENT_PROCESS)->regs->rax = process ? process->sid : (uint64_t)-1;
     }
 }
 
@@ -707,29 +1771,32 @@ void sys_tcsetpgrp()
 void sys_waitpid()
 {
     uint64_t pid = SYS_ARG_1(*CURRENT_PROCESS);
-    uint64_t options = SYS_ARG_2(*CURRENT_PROCESS);
-    uint64_t* status = (uint64_t*)SYS_ARG_3(*CURRENT_PROCESS);
+    int* status = (int*)SYS_ARG_2(*CURRENT_PROCESS); /* int like the std prototype, the word next to it is the caller's */
 
-    process_t* process = (process_t*)pid_hash_lookup(PID_MAP, pid);
-
-    if (process->flags & PROCESS_ZOMBIE)
-    {
-        *((uint64_t*)SYS_ARG_2(*CURRENT_PROCESS)) = process->status;
-        (*CURRENT_PROCESS)->process_stack_signature.rax = process->pid;
+    process_t* process = (process_t*)pidMap_lookup(PID_MAP, pid);
+    (*CURRENT_PROCESS)->regs->rax = (uint64_t)-1;
+    if (!process)
         return;
-    }
 
-    process->waiting_parent_pid = (*CURRENT_PROCESS)->pid;
+    if (status)
+        process_fault_in((uint64_t)status, sizeof(int), 1);
 
-    schedule_block((*CURRENT_PROCESS));
-    (*CURRENT_PROCESS) = scheduler_nextProcess();
+    /* Sleeps here until the child exits, then reaps it unless another waiter got to it first */
+    while (!(process->flags & PROCESS_ZOMBIE))
+    {
+        if (wait_interrupted())
+            return;
+        wait_sleep(&process->exit_waiters);
+        process = (process_t*)pidMap_lookup(PID_MAP, pid);
+        if (!process)
+            return;
+    }
 
-    /* Prepare for context switch:
-     * R12 = new process's page table root (CR3)
-     * R11 = new process's stack pointer */
-    INTERRUPT_INFO->cr3 = (uint64_t)(*CURRENT_PROCESS)->page_table;
-    INTERRUPT_INFO->rsp = (uint64_t)&(*CURRENT_PROCESS)->process_stack_signature;
-    TSS->ist1 = (uint64_t)(*CURRENT_PROCESS) + sizeof(process_stack_layout_t);
+    if (status)
+        *status = (int)process->status;
+    (*CURRENT_PROCESS)->regs->rax = process->pid;
+    usage_reap(*CURRENT_PROCESS, process);
+    process_cleanup(process);
 }
 
 void sys_kill()
@@ -743,13 +1810,14 @@ void sys_kill()
     }
     else if (pid < 0)
     {
-        process_group_t* group = (process_group_t*)pid_hash_lookup(PGID_MAP, -pid);
+        process_group_t* group = (process_group_t*)pidMap_lookup(PGID_MAP, -pid);
         process_group_signal(group, signal);
     }
     else
     {
-        process_t* process = (process_t*)pid_hash_lookup(PID_MAP, pid);
-        process_signal(process, signal);
+        process_t* process = (process_t*)pidMap_lookup(PID_MAP, pid);
+        if (process)
+            process_signal(process, signal);
     }
 }
 
@@ -0,0 +1,130 @@
+/**
+ * @file tick.c
+ * @brief Scheduler Tick Implementation
+ *
+ * Implements the one shot tick of every CPU and the housekeeping it paces.
+ */
+#include <arch/apic.h>
+#include <arch/io.h>
+#include <arch/pic.h>
+#include <arch/smp.h>
+#include <kernel/scheduler.h>
+#include <kernel/softirq.h>
+#include <kernel/tick.h>
+#include <kernel/timer.h>
+#include <kernel/usage.h>
+#include <kernel/workqueue.h>
+#include <memory/kglobals.h>
+#include <memory/pageMerge.h>
+#include <memory/pressure.h>
+
+/**
+ * @brief Merges pages and relieves memory pressure, in the worker thread
+ */
+static void tick_housekeeping(work_t* work)
+{
+    if (PAGE_MERGE->enabled)
+        pageMerge_scan(PAGE_MERGE_BUDGET);
+    pressure_tick();
+}
+
+void tick_init()
+{
+    TICK->period = USAGE->tsc_hz / TICK_HZ;
+    TICK->housekeeping_period = USAGE->tsc_hz / TICK_HOUSEKEEPING_HZ;
+    TICK->housekeeping_deadline = rdtsc() + TICK->housekeeping_period;
+    TICK->housekeeping.function = tick_housekeeping;
+    TICK->housekeeping.next = 0;
+    TICK->housekeeping.pending = 0;
+
+    /* The keyboard and mouse stay on the PIC, its timer line is not needed anymore */
+    outb(PIC1_DATA, inb(PIC1_DATA) | 0x01);
+}
+
+/**
+ * @brief Arms the APIC timer for the next tick, or the next timer of the wheel when it comes first
+ */
+static void tick_arm(cpu_t* cpu)
+{
+    /* Expired timers wait for the timer softirq, it arms for the next ones once they ran */
+    uint64_t deadline = cpu->tick_deadline;
+    if (cpu->id == TIMER_CPU && !softirq_pending(SOFTIRQ_TIMER))
+    {
+        uint64_t timer = timer_next();
+        if (timer && (!deadline || timer < deadline))
+            deadline = timer;
+    }
+
+    cpu->timer_deadline = deadline;
+    if (deadline)
+        apic_timer_arm(deadline);
+    else
+        apic_timer_stop();
+}
+
+void tick_start()
+{
+    cpu_t* cpu = smp_cpu();
+    if (cpu->tick_deadline)
+        return;
+
+    cpu->tick_deadline = rdtsc() + TICK->period;
+    tick_arm(cpu);
+}
+
+void tick_stop()
+{
+    cpu_t* cpu = smp_cpu();
+    cpu->tick_deadline = 0;
+    tick_arm(cpu);
+}
+
+void tick_handler()
+{
+    cpu_t* cpu = smp_cpu();
+    uint64_t now = rdtsc();
+    if (cpu->id == TIMER_CPU)
+    {
+        uint64_t timer = timer_next();
+        if (timer && timer <= now)
+            softirq_raise(SOFTIRQ_TIMER);
+    }
+
+    /* Only a timer was due, the tick is stopped or a count down could not reach the deadline */
+    if (!cpu->tick_deadline || now < cpu->tick_deadline)
+    {
+        tick_arm(cpu);
+        return;
+    }
+
+    cpu->tick_deadline = now + TICK->period;
+    tick_arm(cpu);
+
+    if (now >= TICK->housekeeping_deadline)
+    {
+        TICK->housekeeping_deadline = now + TICK->housekeeping_period;
+        work_queue(&TICK->housekeeping);
+        scheduler_balance();
+    }
+
+    usage_tick();
+    scheduler_tick();
+}
+
+void tick_rearm()
+{
+    tick_arm(smp_cpu());
+}
+
+void tick_timer_added()
+{
+    cpu_t* cpu = &CPUS[TIMER_CPU];
+    uint64_t deadline = timer_next();
+    if (cpu->timer_deadline && cpu->timer_deadline <= deadline)
+        return;
+
+    if (cpu == smp_cpu())
+        tick_arm(cpu);
+    else
+        apic_send_ipi(cpu->apic_id, SMP_VECTOR_TIMER);
+}
@@ -0,0 +1,185 @@
+/**
+ * @file timer.c
+ * @brief Kernel Timer Implementation
+ *
+ * Implements the hierarchical timer wheel.
+ */
+#include <arch/io.h>
+#include <kernel/tick.h>
+#include <kernel/timer.h>
+#include <kernel/usage.h>
+#include <memory/kglobals.h>
+#include <memory/kmemory.h>
+
+#define TIMER_MASK (TIMER_SLOTS - 1)
+#define TIMER_RANGE (1ULL << (TIMER_LEVELS * TIMER_LEVEL_BITS)) /* Milliseconds ahead the last level reaches */
+
+/**
+ * @brief Puts a timer into the slot of the lowest level reaching its expiry
+ */
+static void timer_place(timer_event_t* timer)
+{
+    /* Expired timers go into the slot processed next, ones out of range into the farthest slot */
+    uint64_t expires = timer->expires;
+    if (expires < TIMERS->now)
+        expires = TIMERS->now;
+    if (expires - TIMERS->now >= TIMER_RANGE)
+        expires = TIMERS->now + TIMER_RANGE - 1;
+
+    uint64_t level = 0;
+    while (level < TIMER_LEVELS - 1 && expires - TIMERS->now >= 1ULL << ((level + 1) * TIMER_LEVEL_BITS))
+        level++;
+    uint64_t index = (expires >> (level * TIMER_LEVEL_BITS)) & TIMER_MASK;
+
+    timer_event_t** slot = &TIMERS->slots[level][index];
+    timer->slot = slot;
+    timer->last = 0;
+    timer->next = *slot;
+    if (*slot)
+        (*slot)->last = timer;
+    *slot = timer;
+    TIMERS->bitmap[level] |= 1ULL << index;
+}
+
+/**
+ * @brief Takes a pending timer out of its slot
+ */
+static void timer_unlink(timer_event_t* timer)
+{
+    if (timer->next)
+        timer->next->last = timer->last;
+    if (timer->last)
+        timer->last->next = timer->next;
+    else
+        *timer->slot = timer->next;
+
+    if (!*timer->slot)
+    {
+        uint64_t position = timer->slot - &TIMERS->slots[0][0];
+        TIMERS->bitmap[position / TIMER_SLOTS] &= ~(1ULL << (position % TIMER_SLOTS));
+    }
+    timer->slot = 0;
+    timer->next = 0;
+    timer->last = 0;
+}
+
+/**
+ * @brief Moves the timers of a slot down the wheel, once the wheel reached its start
+ */
+static void timer_cascade(uint64_t level, uint64_t index)
+{
+    timer_event_t* timer = TIMERS->slots[level][index];
+    TIMERS->slots[level][index] = 0;
+    TIMERS->bitmap[level] &= ~(1ULL << index);
+
+    while (timer)
+    {
+        timer_event_t* next = timer->next;
+        timer_place(timer);
+        timer = next;
+    }
+}
+
+/**
+ * @brief Gets the next millisecond a slot of the wheel has to be processed at
+ *
+ * A level above the first is processed when the wheel reaches the start of a
+ * slot holding timers.
+ * @return millisecond from boot, UINT64_MAX if no timer is pending
+ */
+static uint64_t timer_next_event()
+{
+    uint64_t next = UINT64_MAX;
+    for (uint64_t level = 0; level < TIMER_LEVELS; level++)
+    {
+        uint64_t bitmap = TIMERS->bitmap[level];
+        if (!bitmap)
+            continue;
+
+        /* First slot of this level starting at or after now, then the first one holding timers from there */
+        uint64_t shift = level * TIMER_LEVEL_BITS;
+        uint64_t period = (TIMERS->now + (1ULL << shift) - 1) >> shift;
+        uint64_t index = period & TIMER_MASK;
+        uint64_t rotated = index ? (bitmap >> index) | (bitmap << (TIMER_SLOTS - index)) : bitmap;
+        uint64_t event = (period + __builtin_ctzll(rotated)) << shift;
+        if (event < next)
+            next = event;
+    }
+    return next;
+}
+
+void timer_init()
+{
+    kmemset(TIMERS, 0, sizeof(timer_state_t));
+    TIMERS->cycles_per_ms = USAGE->tsc_hz / 1000;
+    TIMERS->now = timer_now();
+}
+
+uint64_t timer_now()
+{
+    return (rdtsc() - USAGE->boot_tsc) / TIMERS->cycles_per_ms;
+}
+
+uint64_t timer_deadline(uint64_t ms)
+{
+    return timer_now() + ms + 1;
+}
+
+void timer_add(timer_event_t* timer, uint64_t expires)
+{
+    if (timer->slot)
+        timer_unlink(timer);
+    timer->expires = expires;
+    timer_place(timer);
+    tick_timer_added();
+}
+
+bool timer_cancel(timer_event_t* timer)
+{
+    if (!timer->slot)
+        return 0;
+    timer_unlink(timer);
+    return 1;
+}
+
+void timer_run()
+{
+    uint64_t target = timer_now();
+    while (TIMERS->now <= target)
+    {
+        /* Slots in between hold nothing, the wheel skips them */
+        uint64_t now = timer_next_event();
+        if (now > target)
+        {
+            TIMERS->now = target + 1;
+            break;
+        }
+        TIMERS->now = now;
+
+        for (uint64_t level = 1; level < TIMER_LEVELS; level++)
+        {
+            uint64_t shift = level * TIMER_LEVEL_BITS;
+            if (now & ((1ULL << shift) - 1))
+                break;
+            timer_cascade(level, (now >> shift) & TIMER_MASK);
+        }
+
+        /* A function may add timers, ones already expired land in this same slot */
+        timer_event_t** slot = &TIMERS->slots[0][now & TIMER_MASK];
+        while (*slot)
+        {
+            timer_event_t* timer = *slot;
+            timer_unlink(timer);
+            timer->function(timer);
+        }
+        TIMERS->now = now + 1;
+    }
+}
+
+uint64_t timer_next()
+{
+    uint64_t next = timer_next_event();
+    if (next == UINT64_MAX)
+        return 0;
+    return USAGE->boot_tsc + next * TIMERS->cycles_per_ms;
+}
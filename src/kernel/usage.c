@@ -0,0 +1,276 @@
+/**
+ * @file usage.c
+ * @brief Process Resource Accounting Implementation
+ *
+ * Implements TSC time charging, fault, switch and I/O counters, resident size
+ * sampling and the totals behind getrusage, times and /dev/procstat.
+ */
+#include <arch/idt.h>
+#include <arch/io.h>
+#include <arch/smp.h>
+#include <drivers/vcon.h>
+#include <fs/vfs.h>
+#include <kernel/process.h>
+#include <kernel/usage.h>
+#include <kmath.h>
+#include <memory/kglobals.h>
+#include <memory/kmemory.h>
+#include <memory/pageTable.h>
+
+#define USAGE_PIT_HZ 1193182
+
+/**
+ * @brief Charges the cycles since the last charge to the current process
+ * @param user 1 if they were spent in user mode
+ */
+static void usage_charge(bool user)
+{
+    uint64_t now = rdtsc();
+    cpu_t* cpu = smp_cpu();
+    process_t* process = cpu->current;
+    if (user)
+        process->usage.user_cycles += now - cpu->usage_stamp;
+    else
+        process->usage.system_cycles += now - cpu->usage_stamp;
+    cpu->usage_stamp = now;
+}
+
+/**
+ * @brief Adds counters to a total, resident sizes take the largest
+ */
+static void usage_add(process_usage_t* total, process_usage_t* usage)
+{
+    total->user_cycles += usage->user_cycles;
+    total->system_cycles += usage->system_cycles;
+    total->minor_faults += usage->minor_faults;
+    total->major_faults += usage->major_faults;
+    total->voluntary_switches += usage->voluntary_switches;
+    total->involuntary_switches += usage->involuntary_switches;
+    total->read_bytes += usage->read_bytes;
+    total->write_bytes += usage->write_bytes;
+    total->rss = MAX(total->rss, usage->rss);
+    total->rss_peak = MAX(total->rss_peak, usage->rss_peak);
+}
+
+/**
+ * @brief Reads the counters of every thread (DEV_READ of /dev/procstat)
+ * @return bytes of whole records written
+ */
+static uint64_t usage_read(uint64_t open_file, uint64_t buffer, uint64_t size)
+{
+    usage_record_t* records = (usage_record_t*)buffer;
+    uint64_t count = 0;
+
+    process_t* process;
+    for (uint32_t pid = 0; (count + 1) * sizeof(usage_record_t) <= size && (process = pidMap_next(PID_MAP, &pid)); pid++)
+    {
+        process_t* leader = process->thread_leader;
+        if (!(process->flags & PROCESS_ZOMBIE))
+            usage_sample_rss(process);
+
+        usage_record_t* record = &records[count++];
+        record->pid = process->pid;
+        record->tgid = leader->pid;
+        record->ppid = process->ppid;
+        record->pgid = process->pgid;
+        record->flags = process->flags;
+        record->tsc_hz = USAGE->tsc_hz;
+        record->usage = process->usage;
+        record->usage.rss = leader->usage.rss;
+        record->usage.rss_peak = leader->usage.rss_peak;
+    }
+
+    /* Idle time of every CPU, in CPU order */
+    for (uint64_t i = 0; i < SMP->cpu_count && (count + 1) * sizeof(usage_record_t) <= size; i++)
+    {
+        usage_record_t* record = &records[count++];
+        kmemset(record, 0, sizeof(usage_record_t));
+        record->tsc_hz = USAGE->tsc_hz;
+        record->usage = CPUS[i].idle.usage;
+    }
+    return count * sizeof(usage_record_t);
+}
+
+/**
+ * @brief Any process group may read the device
+ */
+static uint64_t usage_getgrp(uint64_t open_file, uint64_t arg1, uint64_t arg2)
+{
+    return (*CURRENT_PROCESS)->pgid;
+}
+
+void usage_init()
+{
+    kmemset(USAGE, 0, sizeof(usage_state_t));
+
+    /* PIT channel 2 counts down once with the speaker off, bit 5 of port 0x61 rises at 0 */
+    uint16_t count = USAGE_PIT_HZ * USAGE_CALIBRATE_MS / 1000;
+    outb(0x61, (inb(0x61) & ~0x02) | 0x01);
+    outb(0x43, 0xB0); /* Channel 2, mode 0 */
+    outb(0x42, count & 0xFF);
+    outb(0x42, count >> 8);
+
+    uint64_t start = rdtsc();
+    while (!(inb(0x61) & 0x20))
+        ;
+    uint64_t end = rdtsc();
+
+    USAGE->tsc_hz = MAX((end - start) * 1000 / USAGE_CALIBRATE_MS, 1);
+    USAGE->boot_tsc = end;
+    smp_cpu()->usage_stamp = end;
+}
+
+void usage_init_device()
+{
+    vfs_entry_t* device_file = vfs_create_entry(*DEV, USAGE_DEVICE, EXT2_FT_CHRDEV);
+    device_file->ops[DEV_READ] = usage_read;
+    device_file->ops[CHRDEV_GETGRP] = usage_getgrp;
+    device_file->private_data = USAGE;
+}
+
+void usage_start(process_t* process)
+{
+    kmemset(&process->usage, 0, sizeof(process_usage_t));
+    kmemset(&process->thread_usage, 0, sizeof(process_usage_t));
+    kmemset(&process->child_usage, 0, sizeof(process_usage_t));
+}
+
+void usage_enter(interrupt_frame_t* frame)
+{
+    usage_idle_leave();
+    if (frame->regs.cs & 3)
+        usage_charge(1);
+}
+
+void usage_leave()
+{
+    usage_charge(0);
+}
+
+void usage_idle_enter()
+{
+    usage_charge(0);
+    smp_cpu()->halted = 1;
+}
+
+void usage_idle_leave()
+{
+    cpu_t* cpu = smp_cpu();
+    if (!cpu->halted)
+        return;
+
+    uint64_t now = rdtsc();
+    cpu->halted = 0;
+    cpu->idle_wakeups++;
+    cpu->current->usage.idle_cycles += now - cpu->usage_stamp;
+    cpu->usage_stamp = now;
+}
+
+void usage_switch(process_t* prev)
+{
+    usage_charge(0);
+    if (prev->flags & (PROCESS_BLOCKING | PROCESS_ZOMBIE))
+        prev->usage.voluntary_switches++;
+    else
+        prev->usage.involuntary_switches++;
+}
+
+void usage_fault(process_t* process, bool major)
+{
+    if (major)
+        process->usage.major_faults++;
+    else
+        process->usage.minor_faults++;
+}
+
+void usage_tick()
+{
+    if (++smp_cpu()->ticks % USAGE_RSS_INTERVAL == 0)
+        usage_sample_rss(*CURRENT_PROCESS);
+}
+
+void usage_sample_rss(process_t* process)
+{
+    process_t* leader = process->thread_leader;
+    if (!leader->page_table)
+        return;
+
+    uint64_t current_cr3;
+    __asm__ volatile("mov %%cr3, %0\n\t" : "=r"(current_cr3) : :);
+    __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(*KERNEL_PAGE_TABLE) :);
+
+    uint64_t swapped;
+    leader->usage.rss = pageTable_count_user(&leader->page_table, &swapped);
+    leader->usage.rss_peak = MAX(leader->usage.rss_peak, leader->usage.rss);
+
+    __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(current_cr3) :);
+}
+
+void usage_exit(process_t* process)
+{
+    if (process == *CURRENT_PROCESS)
+        usage_charge(0);
+
+    if (process->flags & PROCESS_THREAD)
+    {
+        usage_add(&process->thread_leader->thread_usage, &process->usage);
+        return;
+    }
+    usage_sample_rss(process);
+}
+
+void usage_reap(process_t* parent, process_t* child)
+{
+    process_usage_t total;
+    usage_collect(child, RUSAGE_SELF, &total);
+    usage_add(&total, &child->child_usage);
+    usage_add(&parent->thread_leader->child_usage, &total);
+}
+
+int usage_collect(process_t* process, int64_t who, process_usage_t* total)
+{
+    process_t* leader = process->thread_leader;
+    kmemset(total, 0, sizeof(process_usage_t));
+
+    switch (who)
+    {
+    case RUSAGE_THREAD:
+        usage_add(total, &process->usage);
+        total->rss = leader->usage.rss;
+        total->rss_peak = leader->usage.rss_peak;
+        return 0;
+    case RUSAGE_CHILDREN:
+        usage_add(total, &leader->child_usage);
+        return 0;
+    case RUSAGE_SELF:
+        usage_add(total, &leader->usage);
+        usage_add(total, &leader->thread_usage);
+        break;
+    default:
+        return 1;
+    }
+
+    process_t* thread;
+    uint64_t threads = leader->thread_count;
+    for (uint32_t pid = 0; threads && (thread = pidMap_next(PID_MAP, &pid)); pid++)
+    {
+        if (thread == leader || thread->thread_leader != leader)
+            continue;
+        usage_add(total, &thread->usage);
+        threads--;
+    }
+    return 0;
+}
+
+usage_timeval_t usage_timeval(uint64_t cycles)
+{
+    usage_timeval_t time;
+    time.sec = cycles / USAGE->tsc_hz;
+    time.usec = (cycles % USAGE->tsc_hz) * 1000000 / USAGE->tsc_hz;
+    return time;
+}
+
+uint64_t usage_clock_ticks(uint64_t cycles)
+{
+    return cycles / USAGE->tsc_hz * USAGE_CLOCK_TICKS + (cycles % USAGE->tsc_hz) * USAGE_CLOCK_TICKS / USAGE->tsc_hz;
+}
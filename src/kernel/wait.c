@@ -0,0 +1,167 @@
+/**
+ * @file wait.c
+ * @brief Wait Queue Implementation
+ *
+ * Implements the wait queues and timed sleeps.
+ */
+#include <kernel/process.h>
+#include <kernel/scheduler.h>
+#include <kernel/timer.h>
+#include <kernel/wait.h>
+#include <memory/kglobals.h>
+
+/**
+ * @brief Takes an entry out of its queue
+ */
+static void wait_unlink(wait_entry_t* entry)
+{
+    wait_queue_t* queue = entry->queue;
+    if (entry->next)
+        entry->next->last = entry->last;
+    else
+        queue->last = entry->last;
+    if (entry->last)
+        entry->last->next = entry->next;
+    else
+        queue->first = entry->next;
+
+    entry->queue = 0;
+    entry->next = 0;
+    entry->last = 0;
+}
+
+/**
+ * @brief Wakes the process of a sleep whose timeout passed
+ */
+static void wait_timeout(timer_event_t* timer)
+{
+    schedule_unblock((process_t*)timer->data);
+}
+
+void wait_init(wait_queue_t* queue)
+{
+    queue->first = 0;
+    queue->last = 0;
+}
+
+void wait_start(process_t* process)
+{
+    process->wait_entries = 0;
+    process->sleep_timer.slot = 0;
+    process->sleep_timer.function = wait_timeout;
+    process->sleep_timer.data = (uint64_t)process;
+    process->alarm_timer.slot = 0;
+    process->alarm_interval = 0;
+    wait_init(&process->exit_waiters);
+}
+
+void wait_add(wait_queue_t* queue, wait_entry_t* entry)
+{
+    process_t* process = *CURRENT_PROCESS;
+    if (entry->process == process && entry->queue == queue)
+        return;
+
+    entry->process = process;
+    entry->queue = queue;
+    entry->next = 0;
+    entry->last = queue->last;
+    if (queue->last)
+        queue->last->next = entry;
+    else
+        queue->first = entry;
+    queue->last = entry;
+
+    entry->process_next = process->wait_entries;
+    process->wait_entries = entry;
+}
+
+void wait_remove(wait_entry_t* entry)
+{
+    if (entry->queue)
+        wait_unlink(entry);
+
+    wait_entry_t** link = &entry->process->wait_entries;
+    while (*link && *link != entry)
+        link = &(*link)->process_next;
+    if (*link)
+        *link = entry->process_next;
+    entry->process_next = 0;
+}
+
+bool wait_interrupted()
+{
+    process_t* process = *CURRENT_PROCESS;
+    return process->signal != SIGNONE || (process->flags & PROCESS_EXITING);
+}
+
+uint64_t wait_schedule_timeout(uint64_t ms)
+{
+    process_t* process = *CURRENT_PROCESS;
+    if (wait_interrupted())
+        return ms;
+
+    if (ms != WAIT_FOREVER)
+        timer_add(&process->sleep_timer, timer_deadline(ms));
+
+    process->flags |= PROCESS_SLEEPING;
+    schedule_block(process);
+    scheduler_yield();
+    process->flags &= ~PROCESS_SLEEPING;
+
+    if (ms == WAIT_FOREVER)
+        return WAIT_FOREVER;
+    timer_cancel(&process->sleep_timer);
+    uint64_t now = timer_now();
+    return process->sleep_timer.expires > now ? process->sleep_timer.expires - now : 0;
+}
+
+void wait_sleep(wait_queue_t* queue)
+{
+    wait_sleep_timeout(queue, WAIT_FOREVER);
+}
+
+uint64_t wait_sleep_timeout(wait_queue_t* queue, uint64_t ms)
+{
+    wait_entry_t entry = {0};
+    wait_add(queue, &entry);
+    ms = wait_schedule_timeout(ms);
+    wait_remove(&entry);
+    return ms;
+}
+
+bool wait_wake_one(wait_queue_t* queue)
+{
+    wait_entry_t* entry = queue->first;
+    if (!entry)
+        return 0;
+
+    wait_unlink(entry);
+    schedule_unblock(entry->process);
+    return 1;
+}
+
+uint64_t wait_wake_all(wait_queue_t* queue)
+{
+    uint64_t woken = 0;
+    while (wait_wake_one(queue))
+        woken++;
+    return woken;
+}
+
+void wait_interrupt(process_t* process)
+{
+    if (process->flags & PROCESS_SLEEPING)
+        schedule_unblock(process);
+}
+
+void wait_cancel(process_t* process)
+{
+    for (wait_entry_t* entry = process->wait_entries; entry; entry = entry->process_next)
+    {
+        if (entry->queue)
+            wait_unlink(entry);
+    }
+    process->wait_entries = 0;
+    process->flags &= ~PROCESS_SLEEPING;
+    timer_cancel(&process->sleep_timer);
+}
@@ -0,0 +1,57 @@
+/**
+ * @file workqueue.c
+ * @brief Work Queue Implementation
+ *
+ * Implements the system work queue and its worker thread.
+ */
+#include <arch/smp.h>
+#include <kernel/kthread.h>
+#include <kernel/wait.h>
+#include <kernel/workqueue.h>
+#include <memory/kglobals.h>
+
+/**
+ * @brief Worker thread, runs queued work oldest first and sleeps while there is none
+ */
+static void workqueue_worker(uint64_t data)
+{
+    workqueue_t* queue = (workqueue_t*)data;
+    while (1)
+    {
+        while (queue->first)
+        {
+            work_t* work = queue->first;
+            queue->first = work->next;
+            if (!queue->first)
+                queue->last = 0;
+            work->next = 0;
+            work->pending = 0;
+            work->function(work);
+        }
+        wait_sleep(&queue->waiters);
+    }
+}
+
+void workqueue_init()
+{
+    WORKQUEUE->first = 0;
+    WORKQUEUE->last = 0;
+    wait_init(&WORKQUEUE->waiters);
+    WORKQUEUE->worker = kthread_create(workqueue_worker, (uint64_t)WORKQUEUE, &CPUS[WORKQUEUE_CPU], 0);
+}
+
+bool work_queue(work_t* work)
+{
+    if (work->pending)
+        return 0;
+
+    work->pending = 1;
+    work->next = 0;
+    if (WORKQUEUE->last)
+        WORKQUEUE->last->next = work;
+    else
+        WORKQUEUE->first = work;
+    WORKQUEUE->last = work;
+    wait_wake_one(&WORKQUEUE->waiters);
+    return 1;
+}
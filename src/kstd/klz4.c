@@ -0,0 +1,198 @@
+/**
+ * @file klz4.c
+ * @brief Kernel LZ4 Block Compression Implementation
+ *
+ * Implements the LZ4 block format with a single entry hash table match finder.
+ * Blocks are independent, no dictionary or frame headers are used.
+ */
+#include <klz4.h>
+
+static inline uint32_t klz4_read32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint32_t klz4_hash(uint32_t sequence)
+{
+    return (sequence * 2654435761U) >> (32 - KLZ4_HASH_BITS);
+}
+
+/**
+ * @brief Writes the extra bytes of a length that did not fit in its token nibble
+ * @return position after the length, NULL if it does not fit
+ */
+static uint8_t* klz4_write_length(uint8_t* op, uint8_t* oend, size_t length)
+{
+    for (; length >= 255; length -= 255)
+    {
+        if (op >= oend)
+            return 0;
+        *op++ = 255;
+    }
+    if (op >= oend)
+        return 0;
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+/**
+ * @brief Emits one sequence, literals followed by an optional match
+ * @return position after the sequence, NULL if it does not fit
+ */
+static uint8_t* klz4_write_sequence(uint8_t* op, uint8_t* oend, const uint8_t* literals, size_t literal_length, uint64_t offset, size_t match_length)
+{
+    if (op >= oend)
+        return 0;
+    uint8_t* token = op++;
+
+    *token = (literal_length >= 15 ? 15 : literal_length) << 4;
+    if (literal_length >= 15 && !(op = klz4_write_length(op, oend, literal_length - 15)))
+        return 0;
+
+    if ((size_t)(oend - op) < literal_length)
+        return 0;
+    for (size_t i = 0; i < literal_length; i++)
+        op[i] = literals[i];
+    op += literal_length;
+
+    /* The last sequence ends after its literals */
+    if (!offset)
+        return op;
+
+    if (oend - op < 2)
+        return 0;
+    *op++ = offset & 0xFF;
+    *op++ = offset >> 8;
+
+    match_length -= KLZ4_MIN_MATCH;
+    *token |= match_length >= 15 ? 15 : match_length;
+    if (match_length >= 15 && !(op = klz4_write_length(op, oend, match_length - 15)))
+        return 0;
+
+    return op;
+}
+
+size_t klz4_compress(const void* source, size_t size, void* dest, size_t capacity)
+{
+    const uint8_t* src = source;
+    const uint8_t* ip = src;
+    const uint8_t* anchor = src;
+    const uint8_t* end = src + size;
+    uint8_t* op = dest;
+    uint8_t* oend = op + capacity;
+
+    /* Positions of the last 4 byte sequence seen per hash */
+    uint32_t table[1 << KLZ4_HASH_BITS];
+    for (uint64_t i = 0; i < (1 << KLZ4_HASH_BITS); i++)
+        table[i] = 0;
+
+    if (size >= KLZ4_MF_LIMIT)
+    {
+        const uint8_t* match_limit = end - KLZ4_LAST_LITERALS;
+        const uint8_t* search_limit = end - KLZ4_MF_LIMIT;
+
+        while (ip <= search_limit)
+        {
+            uint32_t sequence = klz4_read32(ip);
+            uint32_t hash = klz4_hash(sequence);
+            const uint8_t* ref = src + table[hash];
+            table[hash] = ip - src;
+
+            if (ref >= ip || ip - ref > KLZ4_MAX_OFFSET || klz4_read32(ref) != sequence)
+            {
+                ip++;
+                continue;
+            }
+
+            /* Extend the match as far as the format allows */
+            const uint8_t* match_end = ip + KLZ4_MIN_MATCH;
+            ref += KLZ4_MIN_MATCH;
+            while (match_end < match_limit && *match_end == *ref)
+            {
+                match_end++;
+                ref++;
+            }
+
+            op = klz4_write_sequence(op, oend, anchor, ip - anchor, match_end - ref, match_end - ip);
+            if (!op)
+                return 0;
+
+            ip = anchor = match_end;
+        }
+    }
+
+    op = klz4_write_sequence(op, oend, anchor, end - anchor, 0, 0);
+    if (!op)
+        return 0;
+
+    return op - (uint8_t*)dest;
+}
+
+int64_t klz4_decompress(const void* source, size_t size, void* dest, size_t capacity)
+{
+    const uint8_t* ip = source;
+    const uint8_t* iend = ip + size;
+    uint8_t* op = dest;
+    uint8_t* oend = op + capacity;
+
+    while (ip < iend)
+    {
+        uint8_t token = *ip++;
+
+        size_t literal_length = token >> 4;
+        if (literal_length == 15)
+        {
+            uint8_t byte;
+            do
+            {
+                if (ip >= iend)
+                    return -1;
+                byte = *ip++;
+                literal_length += byte;
+            } while (byte == 255);
+        }
+
+        if ((size_t)(iend - ip) < literal_length || (size_t)(oend - op) < literal_length)
+            return -1;
+        for (size_t i = 0; i < literal_length; i++)
+            op[i] = ip[i];
+        ip += literal_length;
+        op += literal_length;
+
+        /* Last sequence has no match */
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -1;
+        uint64_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (!offset || offset > (uint64_t)(op - (uint8_t*)dest))
+            return -1;
+
+        size_t match_length = token & 15;
+        if (match_length == 15)
+        {
+            uint8_t byte;
+            do
+            {
+                if (ip >= iend)
+                    return -1;
+                byte = *ip++;
+                match_length += byte;
+            } while (byte == 255);
+        }
+        match_length += KLZ4_MIN_MATCH;
+
+        if ((size_t)(oend - op) < match_length)
+            return -1;
+
+        /* Byte by byte, the match may overlap the bytes it produces */
+        const uint8_t* match = op - offset;
+        for (size_t i = 0; i < match_length; i++)
+            op[i] = match[i];
+        op += match_length;
+    }
+
+    return op - (uint8_t*)dest;
+}
@@ -0,0 +1,305 @@
+/**
+ * @file krbtree.c
+ * @brief Kernel Red-Black Tree Implementation
+ *
+ * Implements balancing, removal and in order traversal for the intrusive
+ * red-black tree used by kernel subsystems that need ordered lookups.
+ */
+#include <krbtree.h>
+
+/**
+ * @brief Replaces the child pointer of a parent (or the root) that points to old
+ */
+static void krbtree_replace_child(krbtree_t* tree, krbtree_node_t* parent, krbtree_node_t* old, krbtree_node_t* new)
+{
+    if (!parent)
+        tree->root = new;
+    else if (parent->left == old)
+        parent->left = new;
+    else
+        parent->right = new;
+}
+
+/**
+ * @brief Rotates a subtree left around node
+ */
+static void krbtree_rotate_left(krbtree_t* tree, krbtree_node_t* node)
+{
+    krbtree_node_t* pivot = node->right;
+
+    node->right = pivot->left;
+    if (pivot->left)
+        pivot->left->parent = node;
+
+    pivot->parent = node->parent;
+    krbtree_replace_child(tree, node->parent, node, pivot);
+
+    pivot->left = node;
+    node->parent = pivot;
+}
+
+/**
+ * @brief Rotates a subtree right around node
+ */
+static void krbtree_rotate_right(krbtree_t* tree, krbtree_node_t* node)
+{
+    krbtree_node_t* pivot = node->left;
+
+    node->left = pivot->right;
+    if (pivot->right)
+        pivot->right->parent = node;
+
+    pivot->parent = node->parent;
+    krbtree_replace_child(tree, node->parent, node, pivot);
+
+    pivot->right = node;
+    node->parent = pivot;
+}
+
+static inline bool krbtree_is_red(krbtree_node_t* node)
+{
+    return node && node->color == KRBTREE_RED;
+}
+
+void krbtree_insert(krbtree_t* tree, krbtree_node_t* node, krbtree_node_t* parent, krbtree_node_t** link)
+{
+    node->parent = parent;
+    node->left = 0;
+    node->right = 0;
+    node->color = KRBTREE_RED;
+    *link = node;
+
+    /* Fix red node with red parent */
+    while (krbtree_is_red(node->parent))
+    {
+        krbtree_node_t* parent = node->parent;
+        krbtree_node_t* grandparent = parent->parent;
+
+        if (parent == grandparent->left)
+        {
+            krbtree_node_t* uncle = grandparent->right;
+            if (krbtree_is_red(uncle))
+            {
+                /* Recolor and continue from the grandparent */
+                parent->color = KRBTREE_BLACK;
+                uncle->color = KRBTREE_BLACK;
+                grandparent->color = KRBTREE_RED;
+                node = grandparent;
+                continue;
+            }
+
+            if (node == parent->right)
+            {
+                krbtree_rotate_left(tree, parent);
+                node = parent;
+                parent = node->parent;
+            }
+
+            parent->color = KRBTREE_BLACK;
+            grandparent->color = KRBTREE_RED;
+            krbtree_rotate_right(tree, grandparent);
+        }
+        else
+        {
+            krbtree_node_t* uncle = grandparent->left;
+            if (krbtree_is_red(uncle))
+            {
+                /* Recolor and continue from the grandparent */
+                parent->color = KRBTREE_BLACK;
+                uncle->color = KRBTREE_BLACK;
+                grandparent->color = KRBTREE_RED;
+                node = grandparent;
+                continue;
+            }
+
+            if (node == parent->left)
+            {
+                krbtree_rotate_right(tree, parent);
+                node = parent;
+                parent = node->parent;
+            }
+
+            parent->color = KRBTREE_BLACK;
+            grandparent->color = KRBTREE_RED;
+            krbtree_rotate_left(tree, grandparent);
+        }
+    }
+
+    tree->root->color = KRBTREE_BLACK;
+}
+
+/**
+ * @brief Restores the black height after a black node was removed
+ * @param tree tree being fixed
+ * @param node node that took the removed nodes place (may be NULL)
+ * @param parent parent of node
+ */
+static void krbtree_remove_fixup(krbtree_t* tree, krbtree_node_t* node, krbtree_node_t* parent)
+{
+    while (node != tree->root && !krbtree_is_red(node))
+    {
+        if (node == parent->left)
+        {
+            krbtree_node_t* sibling = parent->right;
+            if (krbtree_is_red(sibling))
+            {
+                sibling->color = KRBTREE_BLACK;
+                parent->color = KRBTREE_RED;
+                krbtree_rotate_left(tree, parent);
+                sibling = parent->right;
+            }
+
+            if (!krbtree_is_red(sibling->left) && !krbtree_is_red(sibling->right))
+            {
+                sibling->color = KRBTREE_RED;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+
+            if (!krbtree_is_red(sibling->right))
+            {
+                sibling->left->color = KRBTREE_BLACK;
+                sibling->color = KRBTREE_RED;
+                krbtree_rotate_right(tree, sibling);
+                sibling = parent->right;
+            }
+
+            sibling->color = parent->color;
+            parent->color = KRBTREE_BLACK;
+            sibling->right->color = KRBTREE_BLACK;
+            krbtree_rotate_left(tree, parent);
+            node = tree->root;
+        }
+        else
+        {
+            krbtree_node_t* sibling = parent->left;
+            if (krbtree_is_red(sibling))
+            {
+                sibling->color = KRBTREE_BLACK;
+                parent->color = KRBTREE_RED;
+                krbtree_rotate_right(tree, parent);
+                sibling = parent->left;
+            }
+
+            if (!krbtree_is_red(sibling->left) && !krbtree_is_red(sibling->right))
+            {
+                sibling->color = KRBTREE_RED;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+
+            if (!krbtree_is_red(sibling->left))
+            {
+                sibling->right->color = KRBTREE_BLACK;
+                sibling->color = KRBTREE_RED;
+                krbtree_rotate_left(tree, sibling);
+                sibling = parent->left;
+            }
+
+            sibling->color = parent->color;
+            parent->color = KRBTREE_BLACK;
+            sibling->left->color = KRBTREE_BLACK;
+            krbtree_rotate_right(tree, parent);
+            node = tree->root;
+        }
+    }
+
+    if (node)
+        node->color = KRBTREE_BLACK;
+}
+
+void krbtree_remove(krbtree_t* tree, krbtree_node_t* node)
+{
+    krbtree_node_t* child;
+    krbtree_node_t* parent;
+    uint64_t removed_color;
+
+    if (!node->left || !node->right)
+    {
+        /* At most one child, splice the node out */
+        child = node->left ? node->left : node->right;
+        parent = node->parent;
+        removed_color = node->color;
+
+        if (child)
+            child->parent = parent;
+        krbtree_replace_child(tree, parent, node, child);
+    }
+    else
+    {
+        /* Two children, the in order successor takes the nodes place */
+        krbtree_node_t* successor = node->right;
+        while (successor->left)
+            successor = successor->left;
+
+        child = successor->right;
+        removed_color = successor->color;
+
+        if (successor->parent == node)
+        {
+            parent = successor;
+        }
+        else
+        {
+            parent = successor->parent;
+            parent->left = child;
+            if (child)
+                child->parent = parent;
+
+            successor->right = node->right;
+            node->right->parent = successor;
+        }
+
+        successor->left = node->left;
+        node->left->parent = successor;
+        successor->parent = node->parent;
+        successor->color = node->color;
+        krbtree_replace_child(tree, node->parent, node, successor);
+    }
+
+    if (removed_color == KRBTREE_BLACK)
+        krbtree_remove_fixup(tree, child, parent);
+}
+
+krbtree_node_t* krbtree_first(krbtree_t* tree)
+{
+    krbtree_node_t* node = tree->root;
+    if (!node)
+        return 0;
+
+    while (node->left)
+        node = node->left;
+    return node;
+}
+
+krbtree_node_t* krbtree_next(krbtree_node_t* node)
+{
+    if (node->right)
+    {
+        node = node->right;
+        while (node->left)
+            node = node->left;
+        return node;
+    }
+
+    while (node->parent && node == node->parent->right)
+        node = node->parent;
+    return node->parent;
+}
+
+krbtree_node_t* krbtree_prev(krbtree_node_t* node)
+{
+    if (node->left)
+    {
+        node = node->left;
+        while (node->right)
+            node = node->right;
+        return node;
+    }
+
+    while (node->parent && node == node->parent->left)
+        node = node->parent;
+    return node->parent;
+}
@@ -0,0 +1,120 @@
+/**
+ * @file kernelStack.c
+ * @brief Process Kernel Stack Implementation
+ *
+ * Implements mapping kernel stacks into their slots, caching freed stacks and
+ * unmapping them under memory pressure.
+ */
+#include <arch/smp.h>
+#include <memory/kernelStack.h>
+#include <memory/kglobals.h>
+#include <memory/kmemory.h>
+#include <memory/memoryMap.h>
+#include <memory/pageTable.h>
+#include <memory/paging.h>
+#include <memory/pressure.h>
+
+/**
+ * @brief Lowest mapped address of the stack in a slot
+ */
+static uint64_t kernelStack_base(uint64_t slot)
+{
+    return PROCESS_KERNEL_STACKS_START + slot * PROCESS_KERNEL_STACK_SLOT + (PROCESS_KERNEL_STACK_SLOT - PROCESS_KERNEL_STACK_SIZE);
+}
+
+/**
+ * @brief Unmaps and frees the pages of a stack
+ * @param base lowest address of the stack
+ * @param size bytes mapped from base
+ */
+static void kernelStack_unmap(uint64_t base, uint64_t size)
+{
+    uint64_t current_cr3;
+    __asm__ volatile("mov %%cr3, %0\n\t" : "=r"(current_cr3) : :);
+    __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(*KERNEL_PAGE_TABLE) :);
+
+    tlb_batch_t batch = {.count = 0};
+    pageTable_unmap(KERNEL_PAGE_TABLE, base, base + size, &batch);
+    pageTable_tlb_flush(&batch);
+    smp_tlb_shootdown(); /* The kernel half is in every address space on every CPU */
+
+    __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(current_cr3) :);
+}
+
+void kernelStack_init()
+{
+    kmemset(KERNEL_STACKS, 0, sizeof(kernel_stacks_t));
+    KERNEL_STACKS->mapped = kmalloc(PROCESS_KERNEL_STACKS_MAX);
+    kmemset(KERNEL_STACKS->mapped, 0, PROCESS_KERNEL_STACKS_MAX);
+    pressure_register_shrinker("kernel stacks", kernelStack_count, kernelStack_shrink);
+}
+
+void* kernelStack_allocate()
+{
+    if (KERNEL_STACKS->cached)
+    {
+        void** base = KERNEL_STACKS->cached;
+        KERNEL_STACKS->cached = *base;
+        KERNEL_STACKS->cached_count--;
+        KERNEL_STACKS->used++;
+        return (char*)base + PROCESS_KERNEL_STACK_SIZE;
+    }
+
+    for (uint64_t n = 0; n < PROCESS_KERNEL_STACKS_MAX; n++)
+    {
+        uint64_t slot = (KERNEL_STACKS->next_slot + n) % PROCESS_KERNEL_STACKS_MAX;
+        if (KERNEL_STACKS->mapped[slot])
+            continue;
+
+        /* The kernel half is shared, the pages show up in every address space */
+        uint64_t base = kernelStack_base(slot);
+        for (uint64_t offset = 0; offset < PROCESS_KERNEL_STACK_SIZE; offset += PAGE_SIZE_4KB)
+        {
+            void* frame = pages_allocatePage(PAGE_SIZE_4KB);
+            if (!frame || pageTable_addPage(KERNEL_PAGE_TABLE, (void*)(base + offset), (uint64_t)frame / PAGE_SIZE_4KB, 1, PAGE_SIZE_4KB, 0) != 0)
+            {
+                if (frame)
+                    pages_release(frame, PAGE_SIZE_4KB);
+                kernelStack_unmap(base, offset);
+                return 0;
+            }
+        }
+
+        KERNEL_STACKS->mapped[slot] = 1;
+        KERNEL_STACKS->next_slot = slot + 1;
+        KERNEL_STACKS->used++;
+        return (void*)(base + PROCESS_KERNEL_STACK_SIZE);
+    }
+    return 0;
+}
+
+void kernelStack_free(void* top)
+{
+    void** base = (void**)((char*)top - PROCESS_KERNEL_STACK_SIZE);
+    *base = KERNEL_STACKS->cached;
+    KERNEL_STACKS->cached = base;
+    KERNEL_STACKS->cached_count++;
+    KERNEL_STACKS->used--;
+}
+
+uint64_t kernelStack_count()
+{
+    return KERNEL_STACKS->cached_count;
+}
+
+uint64_t kernelStack_shrink(uint64_t target)
+{
+    uint64_t freed = 0;
+    while (freed < target && KERNEL_STACKS->cached)
+    {
+        void** base = KERNEL_STACKS->cached;
+        KERNEL_STACKS->cached = *base;
+        KERNEL_STACKS->cached_count--;
+
+        uint64_t slot = ((uint64_t)base - PROCESS_KERNEL_STACKS_START) / PROCESS_KERNEL_STACK_SLOT;
+        kernelStack_unmap((uint64_t)base, PROCESS_KERNEL_STACK_SIZE);
+        KERNEL_STACKS->mapped[slot] = 0;
+        freed++;
+    }
+    return freed;
+}
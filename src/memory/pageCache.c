@@ -0,0 +1,157 @@
+/**
+ * @file pageCache.c
+ * @brief File Page Cache Implementation
+ *
+ * Implements the per file frame cache backing file mappings and its shrinker.
+ */
+#include <fs/fdm.h>
+#include <kstd/kmath.h>
+#include <memory/kglobals.h>
+#include <memory/kmemory.h>
+#include <memory/kpool.h>
+#include <memory/pageCache.h>
+#include <memory/paging.h>
+#include <memory/pressure.h>
+
+/**
+ * @brief Finds the cache entry of an inode
+ * @return cache entry, NULL if the file was never cached
+ */
+static page_cache_file_t* pageCache_lookup(uint32_t inode_num)
+{
+    page_cache_file_t* cache = PAGE_CACHE->buckets[inode_num % PAGE_CACHE_BUCKETS];
+    while (cache && cache->file->inode_num != inode_num)
+        cache = cache->next;
+    return cache;
+}
+
+/**
+ * @brief Drops the cache reference of a frame
+ * @return 1 if the frame was freed
+ */
+static bool pageCache_drop(page_cache_file_t* cache, uint64_t index)
+{
+    bool freed = pages_release(cache->frames[index], PAGE_SIZE_4KB);
+    cache->frames[index] = 0;
+    PAGE_CACHE->pages--;
+    return freed;
+}
+
+void pageCache_init()
+{
+    kmemset(PAGE_CACHE, 0, sizeof(page_cache_t));
+    PAGE_CACHE->pool = pool_create(sizeof(page_cache_file_t), 8);
+    pressure_register_shrinker("page cache", pageCache_count, pageCache_shrink);
+}
+
+page_cache_file_t* pageCache_open(file_descriptor_t* file)
+{
+    page_cache_file_t* cache = pageCache_lookup(file->inode_num);
+    if (cache)
+        return cache;
+
+    cache = pool_allocate(PAGE_CACHE->pool);
+    cache->page_count = 0;
+    cache->frames = 0;
+
+    /* Own descriptor so reads do not move the position of the caller */
+    cache->file = pool_allocate(*OPEN_FILE_POOL);
+    kmemcpy(cache->file, file, sizeof(file_descriptor_t));
+    cache->file->pos = 0;
+
+    page_cache_file_t** bucket = &PAGE_CACHE->buckets[file->inode_num % PAGE_CACHE_BUCKETS];
+    cache->next = *bucket;
+    *bucket = cache;
+    return cache;
+}
+
+void* pageCache_get(file_descriptor_t* file, uint64_t index)
+{
+    page_cache_file_t* cache = pageCache_lookup(file->inode_num);
+    if (!cache)
+        return 0;
+
+    if (!cache->frames)
+    {
+        cache->page_count = ALIGN_UP((uint64_t)cache->file->inode->size, PAGE_SIZE_4KB) / PAGE_SIZE_4KB;
+        cache->frames = kmalloc(sizeof(void*) * cache->page_count);
+        kmemset(cache->frames, 0, sizeof(void*) * cache->page_count);
+    }
+
+    if (index >= cache->page_count)
+        return 0;
+    if (cache->frames[index])
+        return cache->frames[index];
+
+    void* frame = pages_allocatePage(PAGE_SIZE_4KB);
+    if (!frame)
+        return 0;
+    kmemset(frame, 0, PAGE_SIZE_4KB);
+
+    ext2_file_seek(cache->file, index * PAGE_SIZE_4KB, SEEK_SET);
+    ext2_file_read(FILESYSTEM, cache->file, frame, PAGE_SIZE_4KB);
+
+    cache->frames[index] = frame;
+    PAGE_CACHE->pages++;
+    PAGE_CACHE->reads++;
+    return frame;
+}
+
+void pageCache_invalidate(uint32_t inode_num)
+{
+    page_cache_file_t* cache = pageCache_lookup(inode_num);
+    if (!cache || !cache->frames)
+        return;
+
+    for (uint64_t i = 0; i < cache->page_count; i++)
+    {
+        if (cache->frames[i])
+            pageCache_drop(cache, i);
+    }
+
+    /* The size may have changed, the table is sized again on the next read */
+    kfree(cache->frames);
+    cache->frames = 0;
+    cache->page_count = 0;
+}
+
+uint64_t pageCache_count()
+{
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < PAGE_CACHE_BUCKETS; i++)
+    {
+        for (page_cache_file_t* cache = PAGE_CACHE->buckets[i]; cache; cache = cache->next)
+        {
+            for (uint64_t j = 0; j < cache->page_count; j++)
+            {
+                if (cache->frames[j] && !pages_shareCount(cache->frames[j], PAGE_SIZE_4KB))
+                    count++;
+            }
+        }
+    }
+    return count;
+}
+
+uint64_t pageCache_shrink(uint64_t target)
+{
+    uint64_t freed = 0;
+
+    /* Start where the last pass stopped so every file loses pages in turn */
+    for (uint64_t n = 0; n < PAGE_CACHE_BUCKETS && freed < target; n++)
+    {
+        uint64_t bucket = PAGE_CACHE->shrink_bucket;
+        PAGE_CACHE->shrink_bucket = (bucket + 1) % PAGE_CACHE_BUCKETS;
+
+        for (page_cache_file_t* cache = PAGE_CACHE->buckets[bucket]; cache && freed < target; cache = cache->next)
+        {
+            for (uint64_t i = 0; i < cache->page_count && freed < target; i++)
+            {
+                /* Mapped frames would stay allocated anyway */
+                if (cache->frames[i] && !pages_shareCount(cache->frames[i], PAGE_SIZE_4KB))
+                    freed += pageCache_drop(cache, i);
+            }
+        }
+    }
+
+    return freed;
+}
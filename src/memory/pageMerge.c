@@ -0,0 +1,210 @@
+/**
+ * @file pageMerge.c
+ * @brief Same Page Merging Implementation
+ *
+ * Implements the incremental scanner that merges identical private anonymous
+ * pages into copy on write frames shared between their mappings.
+ */
+#include <arch/smp.h>
+#include <kernel/process.h>
+#include <memory/kglobals.h>
+#include <memory/kmemory.h>
+#include <memory/pageCache.h>
+#include <memory/pageMerge.h>
+#include <memory/pageTable.h>
+#include <memory/paging.h>
+
+/**
+ * @brief Hashes the content of a 4kb frame (FNV-1a over 64 bit words)
+ */
+static uint64_t pageMerge_hash(const uint64_t* frame)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (uint64_t i = 0; i < PAGE_SIZE_4KB / sizeof(uint64_t); i++)
+    {
+        hash ^= frame[i];
+        hash *= 0x100000001B3ULL;
+    }
+
+    /* 0 marks an empty candidate slot */
+    return hash ? hash : 1;
+}
+
+/**
+ * @brief Points a mapping at another frame with equal content
+ * @param entry mapping being changed
+ * @param vaddr address of the mapping
+ * @param frame frame the mapping is moved to
+ * @param batch collects the pages that need invalidating
+ */
+static void pageMerge_replace(page_lookup_result_t entry, uint64_t vaddr, uint64_t frame, tlb_batch_t* batch)
+{
+    *entry.entry_ptr = frame | ((entry.entry & ~PAGE_MASK & ~PAGE_WRITABLE) | PAGE_COW);
+    pages_share((void*)frame, PAGE_SIZE_4KB);
+    pages_release((void*)(entry.entry & PAGE_MASK), PAGE_SIZE_4KB);
+    pageTable_tlb_add(batch, vaddr);
+}
+
+/**
+ * @brief Tries to merge a single page
+ * @param process process the page belongs to
+ * @param vaddr address of the page
+ * @param entry 4kb mapping of the page
+ * @param batch collects the pages that need invalidating
+ */
+static void pageMerge_page(process_t* process, uint64_t vaddr, page_lookup_result_t entry, tlb_batch_t* batch)
+{
+    uint64_t frame = entry.entry & PAGE_MASK;
+
+    /* Only private writable pages, shared ones are already saving memory */
+    if (!(entry.entry & PAGE_WRITABLE) || !(entry.entry & PAGE_USER) || (entry.entry & PAGE_COW) || pages_shareCount((void*)frame, PAGE_SIZE_4KB))
+        return;
+
+    uint64_t hash = pageMerge_hash((uint64_t*)frame);
+
+    /* Zero filled pages go to the zero frame */
+    if (hash == PAGE_MERGE->zero_hash && kmemcmp((void*)frame, *ZERO_PAGE, PAGE_SIZE_4KB) == 0)
+    {
+        pageMerge_replace(entry, vaddr, (uint64_t)*ZERO_PAGE, batch);
+        PAGE_MERGE->stats.zero_merged++;
+        return;
+    }
+
+    page_merge_candidate_t* candidate = &PAGE_MERGE->candidates[hash % PAGE_MERGE_TABLE_SIZE];
+    if (candidate->hash == hash && candidate->frame != frame)
+    {
+        /* Candidate may be stale, make sure the owner still maps the same frame */
+        process_t* owner = (process_t*)pidMap_lookup(PID_MAP, candidate->pid);
+        if (owner && !(owner->flags & PROCESS_ZOMBIE) && !smp_running_elsewhere(owner))
+        {
+            page_lookup_result_t owner_entry = pageTable_find_entry(&owner->page_table, candidate->vaddr);
+            if (owner_entry.size == PAGE_SIZE_4KB && (owner_entry.entry & PAGE_MASK) == candidate->frame && (owner_entry.entry & PAGE_USER) &&
+                pages_shareCount((void*)candidate->frame, PAGE_SIZE_4KB) < PAGE_MERGE_MAX_SHARES && kmemcmp((void*)frame, (void*)candidate->frame, PAGE_SIZE_4KB) == 0)
+            {
+                /* Owner keeps the frame, but it becomes copy on write, even while read only so mprotect cannot make it writable */
+                if (!(owner_entry.entry & PAGE_COW))
+                {
+                    *owner_entry.entry_ptr = (owner_entry.entry & ~PAGE_WRITABLE) | PAGE_COW;
+                    if (owner_entry.entry & PAGE_WRITABLE)
+                        pageTable_tlb_add(batch, candidate->vaddr);
+                }
+
+                pageMerge_replace(entry, vaddr, candidate->frame, batch);
+                PAGE_MERGE->stats.merged++;
+                return;
+            }
+        }
+    }
+
+    candidate->hash = hash;
+    candidate->frame = frame;
+    candidate->pid = process->pid;
+    candidate->vaddr = vaddr;
+}
+
+void pageMerge_init()
+{
+    PAGE_MERGE->enabled = 0;
+    PAGE_MERGE->zero_hash = pageMerge_hash(*ZERO_PAGE);
+    PAGE_MERGE->cursor_pid = 0;
+    PAGE_MERGE->cursor_vaddr = 0;
+    PAGE_MERGE->candidates = kmalloc(sizeof(page_merge_candidate_t) * PAGE_MERGE_TABLE_SIZE);
+    kmemset(PAGE_MERGE->candidates, 0, sizeof(page_merge_candidate_t) * PAGE_MERGE_TABLE_SIZE);
+    kmemset(&PAGE_MERGE->stats, 0, sizeof(page_merge_stats_t));
+}
+
+/**
+ * @brief Finds the next process the scanner may change, wrapping around the ids
+ * @param pid id to start from, set to the id of the process found
+ *
+ * Skips zombies and processes running on another CPU, their page tables are
+ * only changed by that CPU.
+ */
+static process_t* pageMerge_next_process(uint32_t* pid)
+{
+    for (uint64_t i = 0; i <= PID_MAP->count; i++)
+    {
+        process_t* process = (process_t*)pidMap_next(PID_MAP, pid);
+        if (!process)
+        {
+            *pid = 0;
+            process = (process_t*)pidMap_next(PID_MAP, pid);
+            if (!process)
+                return 0;
+        }
+        (*pid)++;
+        if (!(process->flags & PROCESS_ZOMBIE) && !smp_running_elsewhere(process))
+            return process;
+    }
+    return 0;
+}
+
+void pageMerge_scan(uint64_t budget)
+{
+    uint32_t pid = PAGE_MERGE->cursor_pid;
+    uint64_t vaddr = PAGE_MERGE->cursor_vaddr;
+    process_t* process = pageMerge_next_process(&pid);
+    if (!process)
+        return;
+    if (process->pid != PAGE_MERGE->cursor_pid)
+        vaddr = 0;
+
+    uint64_t current_cr3;
+    __asm__ volatile("mov %%cr3, %0\n\t" : "=r"(current_cr3) : :);
+    __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(*KERNEL_PAGE_TABLE) :);
+
+    /* Bounds the work spent skipping reserved but untouched memory */
+    uint64_t steps = budget * 64;
+    uint64_t processes_left = PID_MAP->count;
+    tlb_batch_t batch = {.count = 0};
+
+    while (budget && steps)
+    {
+        /* File and shared memory is not merged */
+        vma_t* vma = vma_find_next(&process->vmas, vaddr);
+        while (vma && (vma->backing == VMA_FILE || vma->backing == VMA_SHARED))
+            vma = vma_find_next(&process->vmas, vma->end);
+
+        if (!vma)
+        {
+            /* Done with this process */
+            process_t* next = processes_left-- ? pageMerge_next_process(&pid) : 0;
+            if (!next)
+                break;
+            process = next;
+            vaddr = 0;
+            continue;
+        }
+
+        if (vaddr < vma->start)
+            vaddr = vma->start;
+
+        page_lookup_result_t entry = pageTable_find_entry(&process->page_table, vaddr);
+        if (entry.size == PAGE_SIZE_4KB)
+        {
+            pageMerge_page(process, vaddr, entry, &batch);
+            PAGE_MERGE->stats.scanned++;
+            budget--;
+        }
+
+        uint64_t step = entry.size ? entry.size : PAGE_SIZE_4KB;
+        vaddr = ALIGN_DOWN(vaddr, step) + step;
+        steps--;
+    }
+
+    PAGE_MERGE->cursor_pid = process->pid;
+    PAGE_MERGE->cursor_vaddr = vaddr;
+
+    __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(current_cr3) :);
+    pageTable_tlb_flush(&batch);
+}
+
+void pageMerge_stats(page_merge_stats_t* stats)
+{
+    *stats = PAGE_MERGE->stats;
+    stats->zero_mapped = *ZERO_PAGE_REFS;
+
+    /* The reference of the page cache is no mapping, a file page mapped once is still its only copy */
+    uint64_t cache_mapped = PAGE_CACHE->pages - pageCache_count();
+    stats->saved = (stats->zero_mapped + pages_sharedPages() - cache_mapped) * PAGE_SIZE_4KB;
+}
@@ -62,14 +62,18 @@ static void copy_table_level(void* new_table, void* old_table, int level, uint64
         return;
     }
 
-    for (int i = 0; i < 512; i++)
+    int count = level == 4 ? 256 : 512;
+    for (int i = 0; i < count; i++)
     {
         uint64_t entry = old_entries[i];
         uint64_t virtual_address = base_virtual_address + (i * entry_size);
 
         if (!(entry & PAGE_PRESENT)) // Not present
         {
-            new_entries[i] = 0;
+            /* Swapped out pages are shared through their swap slot */
+            new_entries[i] = level == 1 && SWAP_IS_ENTRY(entry) ? entry : 0;
+            if (new_entries[i])
+                swap_dup(entry);
             continue;
         }
 
@@ -77,15 +81,18 @@ static void copy_table_level(void* new_table, void* old_table, int level, uint64
 
         if ((level == 3 && ps_bit_set) || (level == 2 && ps_bit_set) || level == 1)
         {
-            // Leaf entry: copy it and optionally mark COW
+            // Leaf entry: copy it and mark COW, read only frames too so a later mprotect cannot make the shared frame writable
             uint64_t entry_copy = entry;
-            if ((entry & PAGE_WRITABLE) && (entry & PAGE_MASK))
+            if (entry & PAGE_MASK)
             {
                 entry_copy |= PAGE_COW;
                 entry_copy &= ~PAGE_WRITABLE;
             }
 
+            /* Parent keeps the same protection as the child */
+            old_entries[i] = entry_copy;
             new_entries[i] = entry_copy;
+            pages_share((void*)(entry & PAGE_MASK), entry_size);
         }
         else
         {
@@ -116,9 +123,10 @@ page_table_t pageTable_fork(page_table_t* ref)
         kfree(table);
         return NULL;
     }
-    kmemcpy(table, *ref, PAGE_SIZE_4KB);
+    kmemset(table, 0, PAGE_SIZE_4KB);
 
-    // Recursively copy page tables starting from PML4 (level 4)
+    // Recursively copy the user half starting from PML4 (level 4), the kernel
+    // half is shared and added by pageTable_addKernel
     copy_table_level(table, *ref, 4, 0);
     __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(current_cr3) :);
     return table;
@@ -334,6 +342,7 @@ page_lookup_result_t pageTable_find_entry(page_table_t* pageTable, uint64_t cr2)
     {
         result.entry = pdpt[indices.pdpt_index];
         result.size = PAGE_SIZE_1GB;
+        result.entry_ptr = &pdpt[indices.pdpt_index];
         return result;
     }
 
@@ -347,15 +356,321 @@ page_lookup_result_t pageTable_find_entry(page_table_t* pageTable, uint64_t cr2)
     {
         result.entry = pd[indices.pd_index];
         result.size = PAGE_SIZE_2MB;
+        result.entry_ptr = &pd[indices.pd_index];
         return result;
     }
 
     uint64_t* pt = (uint64_t*)(pde & PAGE_MASK);
     uint64_t pte = pt[indices.pt_index];
+
+    /* Not present 4kb entries are still reported so swap entries can be found */
+    result.entry_ptr = &pt[indices.pt_index];
     if (!(pte & PAGE_PRESENT))
+    {
+        result.entry = pte;
         return result;
+    }
 
     result.entry = pt[indices.pt_index];
     result.size = PAGE_SIZE_4KB;
+    result.entry_ptr = &pt[indices.pt_index];
     return result;
-}
\ No newline at end of file
+}
+
+void pageTable_tlb_add(tlb_batch_t* batch, uint64_t vaddr)
+{
+    if (batch->count < TLB_BATCH_SIZE)
+    {
+        batch->addresses[batch->count] = vaddr;
+    }
+    batch->count++;
+}
+
+void pageTable_tlb_flush(tlb_batch_t* batch)
+{
+    if (batch->count > TLB_BATCH_SIZE)
+    {
+        /* Too many pages, reloading cr3 drops every non global entry */
+        uint64_t cr3;
+        __asm__ volatile("mov %%cr3, %0\n\t" : "=r"(cr3) : :);
+        __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(cr3) : "memory");
+    }
+    else
+    {
+        for (uint64_t i = 0; i < batch->count; i++)
+        {
+            __asm__ volatile("invlpg (%0)" : : "r"(batch->addresses[i]) : "memory");
+        }
+    }
+    batch->count = 0;
+}
+
+bool pageTable_huge_slot_free(page_table_t* pageTable, uint64_t vaddr)
+{
+    if (!*pageTable)
+        return 1;
+
+    page_table_indices_t indices = extract_indices(vaddr);
+
+    uint64_t pml4e = (*pageTable)[indices.pml4_index];
+    if (!(pml4e & PAGE_PRESENT))
+        return 1;
+
+    uint64_t pdpte = ((uint64_t*)(pml4e & PAGE_MASK))[indices.pdpt_index];
+    if (!(pdpte & PAGE_PRESENT))
+        return 1;
+    if (pdpte & PAGE_PS)
+        return 0;
+
+    uint64_t pde = ((uint64_t*)(pdpte & PAGE_MASK))[indices.pd_index];
+    return !(pde & PAGE_PRESENT);
+}
+
+int pageTable_split(page_table_t* pageTable, uint64_t vaddr)
+{
+    page_lookup_result_t result = pageTable_find_entry(pageTable, vaddr);
+    if (result.size != PAGE_SIZE_2MB)
+        return result.size == PAGE_SIZE_4KB ? 0 : -1;
+
+    uint64_t frame = result.entry & PAGE_MASK;
+    uint64_t flags = result.entry & ~PAGE_MASK & ~PAGE_PS;
+
+    uint64_t* pt = pages_allocatePage(PAGE_SIZE_4KB);
+    if (!pt)
+        return -1;
+
+    for (uint64_t i = 0; i < PAGE_TABLE_ENTRIES; i++)
+    {
+        pt[i] = (frame + i * PAGE_SIZE_4KB) | flags;
+    }
+    pages_split((void*)frame);
+
+    *result.entry_ptr = (uint64_t)pt | PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER;
+    return 0;
+}
+
+void pageTable_unmap(page_table_t* pageTable, uint64_t start, uint64_t end, tlb_batch_t* batch)
+{
+    uint64_t vaddr = start;
+    while (vaddr < end)
+    {
+        page_lookup_result_t result = pageTable_find_entry(pageTable, vaddr);
+        if (!result.size)
+        {
+            if (SWAP_IS_ENTRY(result.entry))
+            {
+                swap_free(result.entry);
+                *result.entry_ptr = 0;
+            }
+            vaddr += PAGE_SIZE_4KB;
+            continue;
+        }
+
+        uint64_t page_start = ALIGN_DOWN(vaddr, result.size);
+        if (page_start < start || page_start + result.size > end)
+        {
+            /* Partially covered huge page, unmap the covered 4kb pieces */
+            if (pageTable_split(pageTable, vaddr) == 0)
+            {
+                pageTable_tlb_add(batch, page_start);
+                continue;
+            }
+            vaddr = page_start + result.size;
+            continue;
+        }
+
+        *result.entry_ptr = 0;
+        pages_release((void*)(result.entry & PAGE_MASK), result.size);
+        pageTable_tlb_add(batch, page_start);
+        vaddr = page_start + result.size;
+    }
+}
+
+void pageTable_protect(page_table_t* pageTable, uint64_t start, uint64_t end, bool writable, bool user, tlb_batch_t* batch)
+{
+    uint64_t vaddr = start;
+    while (vaddr < end)
+    {
+        page_lookup_result_t result = pageTable_find_entry(pageTable, vaddr);
+        if (!result.size)
+        {
+            vaddr += PAGE_SIZE_4KB;
+            continue;
+        }
+
+        uint64_t page_start = ALIGN_DOWN(vaddr, result.size);
+        if ((page_start < start || page_start + result.size > end) && pageTable_split(pageTable, vaddr) == 0)
+        {
+            /* Only part of the huge page changes */
+            pageTable_tlb_add(batch, page_start);
+            continue;
+        }
+
+        uint64_t entry = result.entry & ~(PAGE_WRITABLE | PAGE_USER);
+        if (writable && !(entry & PAGE_COW))
+            entry |= PAGE_WRITABLE;
+        if (user)
+            entry |= PAGE_USER;
+
+        if (entry != result.entry)
+        {
+            *result.entry_ptr = entry;
+            pageTable_tlb_add(batch, ALIGN_DOWN(vaddr, result.size));
+        }
+        vaddr = ALIGN_DOWN(vaddr, result.size) + result.size;
+    }
+}
+
+void pageTable_move(page_table_t* pageTable, uint64_t old_start, uint64_t new_start, uint64_t size, tlb_batch_t* batch)
+{
+    uint64_t offset = 0;
+    while (offset < size)
+    {
+        page_lookup_result_t result = pageTable_find_entry(pageTable, old_start + offset);
+        if (!result.size)
+        {
+            if (SWAP_IS_ENTRY(result.entry))
+            {
+                /* Swap entries move with their slot */
+                pageTable_addPage(pageTable, (void*)(new_start + offset), 0, 1, PAGE_SIZE_4KB, PAGE_USER);
+                *pageTable_find_entry(pageTable, new_start + offset).entry_ptr = result.entry;
+                *result.entry_ptr = 0;
+            }
+            offset += PAGE_SIZE_4KB;
+            continue;
+        }
+
+        uint64_t page_offset = ALIGN_DOWN(old_start + offset, result.size) - old_start;
+        if (ALIGN_DOWN(old_start + offset, result.size) < old_start || page_offset + result.size > size)
+        {
+            /* Huge page sticking out of the range, only move the covered part */
+            if (pageTable_split(pageTable, old_start + offset) == 0)
+            {
+                pageTable_tlb_add(batch, ALIGN_DOWN(old_start + offset, result.size));
+                continue;
+            }
+            offset = page_offset + result.size;
+            continue;
+        }
+
+        /* Build the tables for the destination, then move the raw entry over */
+        pageTable_addPage(pageTable, (void*)(new_start + page_offset), (result.entry & PAGE_MASK) / result.size, 1, result.size, PAGE_USER);
+        *pageTable_find_entry(pageTable, new_start + page_offset).entry_ptr = result.entry;
+        *result.entry_ptr = 0;
+
+        pageTable_tlb_add(batch, old_start + page_offset);
+        offset = page_offset + result.size;
+    }
+}
+/**
+ * @brief Releases every leaf below a table and frees the table
+ * @param table table being released
+ * @param level level of the table (3 for a PDPT, 1 for a PT)
+ */
+static void pageTable_release_level(uint64_t* table, int level)
+{
+    for (uint64_t i = 0; i < PAGE_TABLE_ENTRIES; i++)
+    {
+        uint64_t entry = table[i];
+        if (!(entry & PAGE_PRESENT))
+        {
+            if (level == 1 && SWAP_IS_ENTRY(entry))
+                swap_free(entry);
+            continue;
+        }
+
+        if (level == 1 || (entry & PAGE_PS))
+        {
+            uint64_t size = level == 1 ? PAGE_SIZE_4KB : level == 2 ? PAGE_SIZE_2MB : PAGE_SIZE_1GB;
+            pages_release((void*)(entry & PAGE_MASK), size);
+        }
+        else
+        {
+            pageTable_release_level((uint64_t*)(entry & PAGE_MASK), level - 1);
+        }
+    }
+
+    pages_free(table, PAGE_SIZE_4KB);
+}
+
+void pageTable_clear_user(page_table_t* pageTable)
+{
+    if (!*pageTable)
+        return;
+
+    /* Only the user half, the kernel half is shared by every page table */
+    for (uint64_t i = 0; i < PAGE_TABLE_ENTRIES / 2; i++)
+    {
+        if ((*pageTable)[i] & PAGE_PRESENT)
+            pageTable_release_level((uint64_t*)((*pageTable)[i] & PAGE_MASK), 3);
+        (*pageTable)[i] = 0;
+    }
+}
+
+void pageTable_release_user(page_table_t* pageTable)
+{
+    if (!*pageTable)
+        return;
+
+    pageTable_clear_user(pageTable);
+    pages_free(*pageTable, PAGE_SIZE_4KB);
+    *pageTable = 0;
+}
+
+/**
+ * @brief Counts the pages below one table of the user half
+ * @param table table being counted
+ * @param level level of the table, 3 for a PDPT down to 1 for a PT
+ * @param swapped incremented for every swap entry
+ * @return number of resident 4kb pages
+ */
+static uint64_t pageTable_count_level(uint64_t* table, int level, uint64_t* swapped)
+{
+    uint64_t resident = 0;
+
+    for (uint64_t i = 0; i < PAGE_TABLE_ENTRIES; i++)
+    {
+        uint64_t entry = table[i];
+        if (!(entry & PAGE_PRESENT))
+        {
+            if (level == 1 && SWAP_IS_ENTRY(entry))
+                (*swapped)++;
+            continue;
+        }
+
+        if (level == 1)
+        {
+            if ((void*)(entry & PAGE_MASK) != *ZERO_PAGE)
+                resident++;
+        }
+        else if (entry & PAGE_PS)
+        {
+            resident += level == 2 ? PAGE_SIZE_2MB / PAGE_SIZE_4KB : PAGE_SIZE_1GB / PAGE_SIZE_4KB;
+        }
+        else
+        {
+            resident += pageTable_count_level((uint64_t*)(entry & PAGE_MASK), level - 1, swapped);
+        }
+    }
+
+    return resident;
+}
+
+uint64_t pageTable_count_user(page_table_t* pageTable, uint64_t* swapped)
+{
+    uint64_t resident = 0;
+    uint64_t swap_entries = 0;
+
+    if (*pageTable)
+    {
+        for (uint64_t i = 0; i < PAGE_TABLE_ENTRIES / 2; i++)
+        {
+            if ((*pageTable)[i] & PAGE_PRESENT)
+                resident += pageTable_count_level((uint64_t*)((*pageTable)[i] & PAGE_MASK), 3, &swap_entries);
+        }
+    }
+
+    if (swapped)
+        *swapped = swap_entries;
+    return resident;
+}
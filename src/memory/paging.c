@@ -7,6 +7,7 @@
  */
 
 #include <boot/bootServices.h>
+#include <kmath.h>
 #include <memory/kglobals.h>
 #include <memory/kmemory.h>
 #include <memory/memoryMap.h>
@@ -216,9 +217,16 @@ void* pages_allocatePage(uint64_t page_size)
     }
     else if (page_size == PAGE_SIZE_4KB)
     {
+        /* Start reclaim early, writing to compressed swap needs frames too */
+        if (*FREE_STACK_4KB_TOP < SWAP_LOW_WATERMARK)
+            swap_reclaim(SWAP_CLUSTER);
+
         if (*FREE_STACK_4KB_TOP == 0)
         {
-            return NULL; /* No free pages */
+            /* A kill does not always put frames back, they may be swapped out or shared */
+            pressure_oom();
+            if (*FREE_STACK_4KB_TOP == 0)
+                return NULL; /* No free pages, nothing could be swapped out or killed */
         }
 
         /* Pop from 4KB free stack */
@@ -303,4 +311,153 @@ void pages_free(void* address, uint64_t page_size)
         /* Push back onto free stack */
         (*FREE_STACK_4KB)[(*FREE_STACK_4KB_TOP)++] = (uint32_t)idx;
     }
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Turns an allocated 2mb frame into 512 allocated 4kb frames
+ * @param address physical address of the 2mb frame
+ */
+void pages_split(void* address)
+{
+    uint64_t idx = (uint64_t)address / PAGE_SIZE_2MB;
+    if (!bitmap_test(*BITMAP_2MB, idx))
+    {
+        return; /* Not a 2mb allocation */
+    }
+
+    /* The 4kb bits are already set, the 2mb frame just stops being one unit */
+    bitmap_clear(*BITMAP_2MB, idx);
+
+    uint64_t start_4kb = idx * PAGES_PER_2MB;
+    for (uint64_t i = 1; i < PAGES_PER_2MB; i++)
+    {
+        (*PAGE_SHARE_COUNTS)[start_4kb + i] = (*PAGE_SHARE_COUNTS)[start_4kb];
+    }
+}
+
+/* ==================== Frame Sharing ==================== */
+
+/**
+ * @brief Allocates the frame share counts
+ */
+void pages_initShareCounts()
+{
+    *PAGE_SHARE_COUNTS = kmalloc(*NUM_4KB_PAGES * sizeof(uint16_t));
+    kmemset(*PAGE_SHARE_COUNTS, 0, *NUM_4KB_PAGES * sizeof(uint16_t));
+}
+
+/**
+ * @brief Allocates the shared zero frame
+ */
+void pages_initZeroPage()
+{
+    *ZERO_PAGE = pages_allocatePage(PAGE_SIZE_4KB);
+    kmemset(*ZERO_PAGE, 0, PAGE_SIZE_4KB);
+    *ZERO_PAGE_REFS = 0;
+}
+
+/**
+ * @brief Checks if a 2mb mapping refers to a frame that has been split
+ */
+static bool pages_isSplit(void* address, uint64_t page_size)
+{
+    return page_size == PAGE_SIZE_2MB && !bitmap_test(*BITMAP_2MB, (uint64_t)address / PAGE_SIZE_2MB);
+}
+
+/**
+ * @brief Records another mapping of a frame
+ * @param address physical address of the frame
+ * @param page_size size of the mapping
+ */
+void pages_share(void* address, uint64_t page_size)
+{
+    if (address == *ZERO_PAGE)
+    {
+        (*ZERO_PAGE_REFS)++;
+        return;
+    }
+
+    uint64_t idx = (uint64_t)address / PAGE_SIZE_4KB;
+    uint64_t count = pages_isSplit(address, page_size) ? PAGES_PER_2MB : 1;
+    for (uint64_t i = 0; i < count; i++)
+    {
+        (*PAGE_SHARE_COUNTS)[idx + i]++;
+    }
+}
+
+/**
+ * @brief Drops one mapping of a frame, freeing it when it was the last one
+ * @param address physical address of the frame
+ * @param page_size size of the mapping
+ * @return 1 if the frame was freed
+ */
+bool pages_release(void* address, uint64_t page_size)
+{
+    if (address == *ZERO_PAGE)
+    {
+        (*ZERO_PAGE_REFS)--;
+        return 0;
+    }
+
+    if (pages_isSplit(address, page_size))
+    {
+        /* Every 4kb frame of a split frame is released on its own */
+        bool freed = 1;
+        for (uint64_t i = 0; i < PAGES_PER_2MB; i++)
+        {
+            freed &= pages_release((uint8_t*)address + i * PAGE_SIZE_4KB, PAGE_SIZE_4KB);
+        }
+        return freed;
+    }
+
+    uint16_t* count = &(*PAGE_SHARE_COUNTS)[(uint64_t)address / PAGE_SIZE_4KB];
+    if (*count)
+    {
+        (*count)--;
+        return 0;
+    }
+
+    if (page_size == PAGE_SIZE_4KB)
+        swap_untrack(address);
+    pages_free(address, page_size);
+    return 1;
+}
+
+/**
+ * @brief Gets how many mappings of a frame exist besides the first one
+ * @param address physical address of the frame
+ * @param page_size size of the mapping
+ */
+uint64_t pages_shareCount(void* address, uint64_t page_size)
+{
+    if (address == *ZERO_PAGE)
+        return *ZERO_PAGE_REFS;
+
+    uint64_t idx = (uint64_t)address / PAGE_SIZE_4KB;
+    if (!pages_isSplit(address, page_size))
+        return (*PAGE_SHARE_COUNTS)[idx];
+
+    /* Shared if any part of the split frame is */
+    uint64_t shares = 0;
+    for (uint64_t i = 0; i < PAGES_PER_2MB; i++)
+    {
+        shares = MAX(shares, (*PAGE_SHARE_COUNTS)[idx + i]);
+    }
+    return shares;
+}
+
+uint64_t pages_sharedPages()
+{
+    uint64_t pages = 0;
+    for (uint64_t idx = 0; idx < *NUM_4KB_PAGES; idx++)
+    {
+        uint64_t shares = (*PAGE_SHARE_COUNTS)[idx];
+        if (!shares)
+            continue;
+
+        /* A 2mb frame that is not split keeps its count on its first 4kb frame */
+        bool whole = idx % PAGES_PER_2MB == 0 && bitmap_test(*BITMAP_2MB, idx / PAGES_PER_2MB);
+        pages += shares * (whole ? PAGES_PER_2MB : 1);
+    }
+    return pages;
+}
@@ -0,0 +1,241 @@
+/**
+ * @file pressure.c
+ * @brief Memory Pressure Implementation
+ *
+ * Implements pressure levels, the shrinker pass run from the timer interrupt,
+ * the out of memory killer and the /dev/pressure device.
+ */
+#include <arch/smp.h>
+#include <drivers/vcon.h>
+#include <fs/vfs.h>
+#include <kernel/process.h>
+#include <kernel/scheduler.h>
+#include <memory/kglobals.h>
+#include <memory/kmemory.h>
+#include <memory/pressure.h>
+
+/**
+ * @brief Gets the pressure level matching the free 4kb frames
+ */
+static pressure_level_t pressure_level()
+{
+    uint64_t free = *FREE_STACK_4KB_TOP;
+
+    if (free < PRESSURE_CRITICAL_PAGES)
+        return PRESSURE_CRITICAL;
+    if (free < PRESSURE_MEDIUM_PAGES)
+        return PRESSURE_MEDIUM;
+    if (free < PRESSURE_LOW_PAGES)
+        return PRESSURE_LOW;
+    return PRESSURE_NONE;
+}
+
+/**
+ * @brief Records the current level, counting changes for readers
+ */
+static void pressure_update()
+{
+    pressure_level_t level = pressure_level();
+
+    PRESSURE->stats.free_pages = *FREE_STACK_4KB_TOP;
+    if (level != PRESSURE->stats.level)
+    {
+        PRESSURE->stats.level = level;
+        PRESSURE->stats.sequence++;
+        PRESSURE->stats.events[level]++;
+    }
+}
+
+/**
+ * @brief Asks every shrinker for a share of its objects
+ * @param level current pressure level
+ */
+static void pressure_shrink(pressure_level_t level)
+{
+    for (uint64_t i = 0; i < PRESSURE->shrinker_count; i++)
+    {
+        pressure_shrinker_t* shrinker = &PRESSURE->shrinkers[i];
+
+        /* 1/16 when low, 1/4 when medium, everything when critical */
+        uint64_t target = shrinker->count() >> (2 * (PRESSURE_CRITICAL - level));
+        if (target)
+            PRESSURE->stats.shrunk += shrinker->scan(target);
+    }
+}
+
+/**
+ * @brief Releases all user memory of a process that is not running
+ */
+static void pressure_reap(process_t* process)
+{
+    vma_destroy_all(&process->vmas);
+
+    uint64_t current_cr3;
+    __asm__ volatile("mov %%cr3, %0\n\t" : "=r"(current_cr3) : :);
+    __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(*KERNEL_PAGE_TABLE) :);
+    pageTable_clear_user(&process->page_table);
+    __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(current_cr3) :);
+}
+
+/**
+ * @brief Sends SIGKILL to a process and every thread of it
+ * @return 1 if none of them runs on the calling CPU or another one, so its memory can be reaped now
+ */
+static bool pressure_kill(process_t* victim)
+{
+    victim->signal = SIGKILL;
+    schedule_unblock(victim);
+
+    /* Threads share the address space, each one dies on its own way back to user mode */
+    process_t* thread;
+    for (uint32_t pid = 0; victim->thread_count && (thread = pidMap_next(PID_MAP, &pid)); pid++)
+    {
+        if (thread == victim || thread->thread_leader != victim)
+            continue;
+        thread->signal = SIGKILL;
+        schedule_unblock(thread);
+    }
+
+    /* The current process may be in the middle of using the page table, another CPU is kicked to kill its own */
+    cpu_t* cpu = smp_running_elsewhere(victim);
+    if (cpu)
+    {
+        smp_kick(cpu);
+        return 0;
+    }
+    process_t* current = *CURRENT_PROCESS;
+    return current->thread_leader != victim && (!victim->page_table || current->page_table != victim->page_table);
+}
+
+/**
+ * @brief Scores a process for the killer, resident plus swapped out pages
+ */
+static uint64_t pressure_oom_score(process_t* process)
+{
+    uint64_t current_cr3;
+    __asm__ volatile("mov %%cr3, %0\n\t" : "=r"(current_cr3) : :);
+    __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(*KERNEL_PAGE_TABLE) :);
+
+    uint64_t swapped;
+    uint64_t score = pageTable_count_user(&process->page_table, &swapped) + swapped;
+
+    __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(current_cr3) :);
+    return score;
+}
+
+/**
+ * @brief Reads the pressure state (DEV_READ of /dev/pressure)
+ */
+static uint64_t pressure_read(uint64_t open_file, uint64_t buffer, uint64_t size)
+{
+    if (size < sizeof(pressure_stats_t))
+        return 0;
+
+    pressure_update();
+    PRESSURE->stats.total_pages = *NUM_4KB_PAGES;
+    kmemcpy((void*)buffer, &PRESSURE->stats, sizeof(pressure_stats_t));
+    return sizeof(pressure_stats_t);
+}
+
+/**
+ * @brief Any process group may read the device
+ */
+static uint64_t pressure_getgrp(uint64_t open_file, uint64_t arg1, uint64_t arg2)
+{
+    return (*CURRENT_PROCESS)->pgid;
+}
+
+void pressure_init()
+{
+    kmemset(PRESSURE, 0, sizeof(pressure_t));
+}
+
+void pressure_init_device()
+{
+    vfs_entry_t* device_file = vfs_create_entry(*DEV, PRESSURE_DEVICE, EXT2_FT_CHRDEV);
+    device_file->ops[DEV_READ] = pressure_read;
+    device_file->ops[CHRDEV_GETGRP] = pressure_getgrp;
+    device_file->private_data = PRESSURE;
+}
+
+void pressure_register_shrinker(const char* name, uint64_t (*count)(), uint64_t (*scan)(uint64_t))
+{
+    if (PRESSURE->shrinker_count == PRESSURE_MAX_SHRINKERS)
+        return;
+
+    pressure_shrinker_t* shrinker = &PRESSURE->shrinkers[PRESSURE->shrinker_count++];
+    shrinker->name = name;
+    shrinker->count = count;
+    shrinker->scan = scan;
+}
+
+void pressure_tick()
+{
+    pressure_update();
+
+    if (PRESSURE->stats.level == PRESSURE_NONE)
+    {
+        PRESSURE->ticks = 0;
+        return;
+    }
+
+    /* First pass as soon as pressure shows up, then every few ticks */
+    if (PRESSURE->ticks++ % PRESSURE_SHRINK_INTERVAL == 0)
+        pressure_shrink(PRESSURE->stats.level);
+}
+
+bool pressure_oom()
+{
+    /* Reclaim holds pointers into page tables of other processes */
+    if (PRESSURE->killing || SWAP->reclaiming)
+        return 0;
+    PRESSURE->killing = 1;
+
+    process_t* victim = 0;
+    uint64_t victim_score = 0;
+    bool freed = 0;
+
+    process_t* process;
+    for (uint32_t pid = 0; (process = pidMap_next(PID_MAP, &pid)); pid++)
+    {
+        if (process->flags & PROCESS_ZOMBIE)
+        {
+            if (pressure_oom_score(process))
+            {
+                pressure_reap(process);
+                freed = 1;
+            }
+            continue;
+        }
+
+        /* Init is never picked, a process already killed has nothing left, vfork pairs share one address space and threads are
+         * scored through their leader */
+        if ((process->flags & (PROCESS_OOM_EXEMPT | PROCESS_VFORK | PROCESS_THREAD)) || process->signal == SIGKILL)
+            continue;
+
+        uint64_t score = pressure_oom_score(process);
+        if (score > victim_score || (score && score == victim_score && process->pid > victim->pid))
+        {
+            victim = process;
+            victim_score = score;
+        }
+    }
+
+    if (!freed && victim)
+    {
+        PRESSURE->stats.oom_kills++;
+        PRESSURE->stats.oom_last_pid = victim->pid;
+        PRESSURE->stats.oom_last_score = victim_score;
+
+        /* Dies the next time it is scheduled, its memory goes right away unless it is in use */
+        if (pressure_kill(victim))
+        {
+            pressure_reap(victim);
+            freed = 1;
+        }
+    }
+
+    pressure_update();
+    PRESSURE->killing = 0;
+    return freed;
+}
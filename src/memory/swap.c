@@ -0,0 +1,444 @@
+/**
+ * @file swap.c
+ * @brief Swap Implementation
+ *
+ * Implements the LRU lists of anonymous pages, reclaim with clustered
+ * writeback to the swap devices, the swap file device and swap faults with
+ * readahead.
+ */
+#include <arch/smp.h>
+#include <fs/vfs.h>
+#include <kernel/process.h>
+#include <memory/kglobals.h>
+#include <memory/kmemory.h>
+#include <memory/kpool.h>
+#include <memory/pageTable.h>
+#include <memory/paging.h>
+#include <memory/swap.h>
+#include <memory/vma.h>
+#include <memory/zram.h>
+
+/**
+ * @struct Page picked by reclaim, waiting to be written out
+ */
+typedef struct swap_victim_t
+{
+    swap_lru_page_t* page;
+    uint64_t* entry_ptr; /* Entry mapping the page */
+} swap_victim_t;
+
+/**
+ * @brief Adds a page at the head of a list
+ */
+static void swap_lru_push(swap_lru_t* list, swap_lru_page_t* page)
+{
+    page->prev = 0;
+    page->next = list->head;
+    if (list->head)
+        list->head->prev = page;
+    else
+        list->tail = page;
+    list->head = page;
+    list->count++;
+    page->active = list == &SWAP->active;
+}
+
+/**
+ * @brief Takes a page off the list it is on
+ */
+static void swap_lru_remove(swap_lru_page_t* page)
+{
+    swap_lru_t* list = page->active ? &SWAP->active : &SWAP->inactive;
+
+    if (page->prev)
+        page->prev->next = page->next;
+    else
+        list->head = page->next;
+    if (page->next)
+        page->next->prev = page->prev;
+    else
+        list->tail = page->prev;
+    list->count--;
+}
+
+/**
+ * @brief Moves pages from the tail of the active list to the inactive list
+ * @param count number of pages to move
+ *
+ * Pages used since they were last looked at go back to the head of the active
+ * list instead.
+ */
+static void swap_age_active(uint64_t count)
+{
+    for (uint64_t i = 0; i < count && SWAP->active.tail; i++)
+    {
+        swap_lru_page_t* page = SWAP->active.tail;
+        swap_lru_remove(page);
+
+        process_t* owner = (process_t*)pidMap_lookup(PID_MAP, page->pid);
+        page_lookup_result_t entry = owner ? pageTable_find_entry(&owner->page_table, page->vaddr) : (page_lookup_result_t){0};
+        if (entry.size == PAGE_SIZE_4KB && (entry.entry & PAGE_ACCESSED))
+        {
+            *entry.entry_ptr &= ~PAGE_ACCESSED;
+            __asm__ volatile("invlpg (%0)" ::"r"(page->vaddr) : "memory");
+            swap_lru_push(&SWAP->active, page);
+        }
+        else
+        {
+            swap_lru_push(&SWAP->inactive, page);
+        }
+    }
+}
+
+/**
+ * @brief Gets the device holding a slot
+ */
+static swap_device_t* swap_device(uint64_t slot)
+{
+    for (uint64_t i = 0; i < SWAP->device_count; i++)
+    {
+        if (slot - SWAP->devices[i].base < SWAP->devices[i].slots)
+            return &SWAP->devices[i];
+    }
+    return 0;
+}
+
+/**
+ * @brief Finds a run of free slots, filling devices in order
+ * @param count number of slots wanted, lowered to the run found
+ * @return first slot of the run
+ */
+static uint64_t swap_alloc_slots(uint64_t* count)
+{
+    for (uint64_t d = 0; d < SWAP->device_count; d++)
+    {
+        swap_device_t* device = &SWAP->devices[d];
+        uint64_t best = 0;
+        uint64_t best_length = 0;
+
+        for (uint64_t i = 0; i < device->slots && best_length < *count;)
+        {
+            uint64_t slot = device->base + (device->next_slot + i) % device->slots;
+            if (SWAP->slot_counts[slot])
+            {
+                i++;
+                continue;
+            }
+
+            /* Runs do not wrap around the end of the device */
+            uint64_t length = 0;
+            while (length < *count && slot + length < device->base + device->slots && !SWAP->slot_counts[slot + length])
+                length++;
+
+            if (length > best_length)
+            {
+                best = slot;
+                best_length = length;
+            }
+            i += length;
+        }
+
+        if (best_length)
+        {
+            *count = best_length;
+            device->next_slot = best + best_length - device->base;
+            return best;
+        }
+    }
+
+    *count = 0;
+    return 0;
+}
+
+/**
+ * @brief Writes a cluster of pages to swap and frees their frames
+ * @param victims pages picked by reclaim
+ * @param count number of pages
+ * @return number of frames freed
+ */
+static uint64_t swap_writeback(swap_victim_t* victims, uint64_t count)
+{
+    uint64_t freed = 0;
+
+    while (freed < count)
+    {
+        uint64_t run = count - freed;
+        uint64_t slot = swap_alloc_slots(&run);
+        if (!run)
+            break; /* Swap is full */
+
+        /* A run stays on one device, consecutive slots are one sequential write on the file */
+        swap_device_t* device = swap_device(slot);
+        for (uint64_t i = 0; i < run; i++)
+        {
+            swap_victim_t* victim = &victims[freed + i];
+            if (!device->write(slot + i - device->base, (void*)victim->page->frame))
+            {
+                /* Keep the rest mapped */
+                for (uint64_t j = freed + i; j < count; j++)
+                    swap_lru_push(&SWAP->active, victims[j].page);
+                return freed + i;
+            }
+
+            void* frame = (void*)victim->page->frame;
+            *victim->entry_ptr = SWAP_ENTRY(slot + i);
+            __asm__ volatile("invlpg (%0)" ::"r"(victim->page->vaddr) : "memory");
+            SWAP->slot_counts[slot + i] = 1;
+            SWAP->stats.free_slots--;
+            SWAP->stats.swapped_out++;
+
+            SWAP->frame_pages[(uint64_t)frame / PAGE_SIZE_4KB] = 0;
+            pool_free(victim->page);
+            pages_free(frame, PAGE_SIZE_4KB);
+        }
+        freed += run;
+    }
+
+    /* Pages that found no slot stay resident */
+    for (uint64_t i = freed; i < count; i++)
+        swap_lru_push(&SWAP->active, victims[i].page);
+
+    return freed;
+}
+
+/**
+ * @brief Reads a slot into a new frame and maps it
+ * @param process process the page belongs to
+ * @param vma area containing the page
+ * @param vaddr address of the page
+ * @param entry_ptr swap entry of the page
+ * @return 1 if the page is mapped
+ */
+static bool swap_read_page(process_t* process, vma_t* vma, uint64_t vaddr, uint64_t* entry_ptr)
+{
+    uint64_t entry = *entry_ptr;
+    void* frame = pages_allocatePage(PAGE_SIZE_4KB);
+    if (!frame)
+        return 0;
+
+    swap_device_t* device = swap_device(SWAP_SLOT(entry));
+    if (!device || !device->read(SWAP_SLOT(entry) - device->base, frame))
+    {
+        pages_free(frame, PAGE_SIZE_4KB);
+        return 0;
+    }
+
+    pageTable_addPage(&process->page_table, (void*)vaddr, (uint64_t)frame / PAGE_SIZE_4KB, 1, PAGE_SIZE_4KB, 4);
+    if (!(vma->prot & PROT_WRITE))
+    {
+        /* pageTable_addPage always maps writable */
+        *pageTable_find_entry(&process->page_table, vaddr).entry_ptr &= ~PAGE_WRITABLE;
+    }
+    swap_free(entry);
+    swap_track(process, vaddr, frame);
+    return 1;
+}
+
+/**
+ * @brief Stores a frame in the swap file
+ */
+static bool swap_file_write(uint64_t slot, const void* frame)
+{
+    ext2_file_seek(SWAP->file, slot * PAGE_SIZE_4KB, SEEK_SET);
+    return ext2_file_write(FILESYSTEM, SWAP->file, frame, PAGE_SIZE_4KB) == PAGE_SIZE_4KB;
+}
+
+/**
+ * @brief Loads a frame from the swap file
+ */
+static bool swap_file_read(uint64_t slot, void* frame)
+{
+    ext2_file_seek(SWAP->file, slot * PAGE_SIZE_4KB, SEEK_SET);
+    return ext2_file_read(FILESYSTEM, SWAP->file, frame, PAGE_SIZE_4KB) == PAGE_SIZE_4KB;
+}
+
+void swap_add_device(uint64_t slots, bool (*write)(uint64_t, const void*), bool (*read)(uint64_t, void*), void (*discard)(uint64_t))
+{
+    if (!slots || SWAP->device_count == SWAP_MAX_DEVICES)
+        return;
+
+    swap_device_t* device = &SWAP->devices[SWAP->device_count++];
+    device->base = SWAP->slots;
+    device->slots = slots;
+    device->next_slot = 0;
+    device->write = write;
+    device->read = read;
+    device->discard = discard;
+    SWAP->slots += slots;
+}
+
+void swap_init()
+{
+    kmemset(SWAP, 0, sizeof(swap_t));
+
+    /* Compressed memory first, it is much faster than the disk */
+    zram_init();
+
+    vfs_entry_t* entry;
+    if (vfs_find_entry(ROOT, &entry, SWAP_FILE) == 0)
+    {
+        SWAP->file = vfs_open_file(entry);
+        swap_add_device(SWAP->file->inode->size / PAGE_SIZE_4KB, swap_file_write, swap_file_read, 0);
+    }
+
+    if (!SWAP->slots)
+        return; /* No device, swap stays off */
+
+    SWAP->slot_counts = kmalloc(sizeof(uint16_t) * SWAP->slots);
+    kmemset(SWAP->slot_counts, 0, sizeof(uint16_t) * SWAP->slots);
+    SWAP->frame_pages = kmalloc(sizeof(swap_lru_page_t*) * *NUM_4KB_PAGES);
+    kmemset(SWAP->frame_pages, 0, sizeof(swap_lru_page_t*) * *NUM_4KB_PAGES);
+    SWAP->lru_pool = pool_create(sizeof(swap_lru_page_t), 8);
+    SWAP->stats.free_slots = SWAP->slots;
+}
+
+void swap_track(process_t* process, uint64_t vaddr, void* frame)
+{
+    if (!SWAP->slots)
+        return;
+
+    swap_lru_page_t** slot = &SWAP->frame_pages[(uint64_t)frame / PAGE_SIZE_4KB];
+    if (*slot)
+        return;
+
+    swap_lru_page_t* page = pool_allocate(SWAP->lru_pool);
+    page->pid = process->pid;
+    page->vaddr = ALIGN_DOWN(vaddr, PAGE_SIZE_4KB);
+    page->frame = (uint64_t)frame;
+    swap_lru_push(&SWAP->inactive, page);
+    *slot = page;
+}
+
+void swap_untrack(void* frame)
+{
+    if (!SWAP->slots)
+        return;
+
+    swap_lru_page_t** slot = &SWAP->frame_pages[(uint64_t)frame / PAGE_SIZE_4KB];
+    if (!*slot)
+        return;
+
+    swap_lru_remove(*slot);
+    pool_free(*slot);
+    *slot = 0;
+}
+
+uint64_t swap_reclaim(uint64_t target)
+{
+    if (!SWAP->slots || SWAP->reclaiming)
+        return 0;
+    SWAP->reclaiming = 1;
+
+    uint64_t current_cr3;
+    __asm__ volatile("mov %%cr3, %0\n\t" : "=r"(current_cr3) : :);
+    __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(*KERNEL_PAGE_TABLE) :);
+
+    swap_victim_t victims[SWAP_CLUSTER];
+    uint64_t victim_count = 0;
+    uint64_t freed = 0;
+    uint64_t scan = target * SWAP_SCAN_RATIO;
+
+    while (freed + victim_count < target && scan--)
+    {
+        /* Keep the inactive list at least as long as the active one */
+        if (SWAP->inactive.count < SWAP->active.count)
+            swap_age_active(SWAP->active.count - SWAP->inactive.count);
+
+        swap_lru_page_t* page = SWAP->inactive.tail;
+        if (!page)
+            break;
+        swap_lru_remove(page);
+
+        /* Only pages still privately mapped by their owner can go */
+        process_t* owner = (process_t*)pidMap_lookup(PID_MAP, page->pid);
+
+        /* Another CPU may hold the mapping in its TLB, the page waits for the next pass */
+        if (owner && smp_running_elsewhere(owner))
+        {
+            swap_lru_push(&SWAP->active, page);
+            continue;
+        }
+
+        page_lookup_result_t entry = {0};
+        if (owner && !(owner->flags & PROCESS_ZOMBIE))
+            entry = pageTable_find_entry(&owner->page_table, page->vaddr);
+
+        if (entry.size != PAGE_SIZE_4KB || (entry.entry & PAGE_MASK) != page->frame || !(entry.entry & PAGE_USER) || (entry.entry & PAGE_COW) ||
+            pages_shareCount((void*)page->frame, PAGE_SIZE_4KB))
+        {
+            /* Mapping changed under the list, forget the page */
+            SWAP->frame_pages[page->frame / PAGE_SIZE_4KB] = 0;
+            pool_free(page);
+            continue;
+        }
+
+        if (entry.entry & PAGE_ACCESSED)
+        {
+            /* Used since it was last looked at, second chance */
+            *entry.entry_ptr &= ~PAGE_ACCESSED;
+            __asm__ volatile("invlpg (%0)" ::"r"(page->vaddr) : "memory");
+            swap_lru_push(&SWAP->active, page);
+            continue;
+        }
+
+        victims[victim_count].page = page;
+        victims[victim_count].entry_ptr = entry.entry_ptr;
+        if (++victim_count == SWAP_CLUSTER)
+        {
+            freed += swap_writeback(victims, victim_count);
+            victim_count = 0;
+        }
+    }
+
+    if (victim_count)
+        freed += swap_writeback(victims, victim_count);
+
+    __asm__ volatile("mov %0, %%cr3\n\t" ::"r"(current_cr3) :);
+    SWAP->reclaiming = 0;
+    return freed;
+}
+
+bool swap_fault(process_t* process, vma_t* vma, uint64_t vaddr)
+{
+    uint64_t page = ALIGN_DOWN(vaddr, PAGE_SIZE_4KB);
+
+    page_lookup_result_t entry = pageTable_find_entry(&process->page_table, page);
+    if (entry.size || !entry.entry_ptr || !SWAP_IS_ENTRY(entry.entry))
+        return 0;
+
+    if (!swap_read_page(process, vma, page, entry.entry_ptr))
+        return 0;
+    SWAP->stats.swapped_in++;
+
+    /* Pages next to each other were likely written out together */
+    for (uint64_t i = 1; i < SWAP_READAHEAD && page + i * PAGE_SIZE_4KB < vma->end; i++)
+    {
+        uint64_t next = page + i * PAGE_SIZE_4KB;
+        page_lookup_result_t ahead = pageTable_find_entry(&process->page_table, next);
+        if (ahead.size || !ahead.entry_ptr || !SWAP_IS_ENTRY(ahead.entry))
+            break;
+        if (!swap_read_page(process, vma, next, ahead.entry_ptr))
+            break;
+        SWAP->stats.readahead++;
+    }
+
+    return 1;
+}
+
+void swap_dup(uint64_t entry)
+{
+    SWAP->slot_counts[SWAP_SLOT(entry)]++;
+}
+
+void swap_free(uint64_t entry)
+{
+    uint64_t slot = SWAP_SLOT(entry);
+    uint16_t* count = &SWAP->slot_counts[slot];
+    if (!*count || --(*count))
+        return;
+
+    SWAP->stats.free_slots++;
+    swap_device_t* device = swap_device(slot);
+    if (device->discard)
+        device->discard(slot - device->base);
+}
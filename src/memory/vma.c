@@ -0,0 +1,218 @@
+/**
+ * @file vma.c
+ * @brief Virtual Memory Area Implementation
+ *
+ * Implements lookup, creation, copying and validation of the per-process
+ * virtual memory area tree.
+ */
+#include <kmath.h>
+#include <memory/kglobals.h>
+#include <memory/kpool.h>
+#include <memory/vma.h>
+
+vma_t* vma_find(krbtree_t* tree, uint64_t addr)
+{
+    krbtree_node_t* node = tree->root;
+
+    while (node)
+    {
+        vma_t* vma = krbtree_entry(node, vma_t, node);
+
+        if (addr < vma->start)
+            node = node->left;
+        else if (addr >= vma->end)
+            node = node->right;
+        else
+            return vma;
+    }
+
+    return 0;
+}
+
+vma_t* vma_find_next(krbtree_t* tree, uint64_t addr)
+{
+    krbtree_node_t* node = tree->root;
+    vma_t* result = 0;
+
+    while (node)
+    {
+        vma_t* vma = krbtree_entry(node, vma_t, node);
+
+        if (addr < vma->end)
+        {
+            result = vma;
+            node = node->left;
+        }
+        else
+        {
+            node = node->right;
+        }
+    }
+
+    return result;
+}
+
+vma_t* vma_create(krbtree_t* tree, uint64_t start, uint64_t end, uint64_t prot, vma_backing_t backing, uint64_t flags)
+{
+    start = ALIGN_DOWN(start, PAGE_SIZE_4KB);
+    end = ALIGN_UP(end, PAGE_SIZE_4KB);
+
+    if (start >= end)
+        return 0;
+
+    /* Find insertion point, fail on overlap */
+    krbtree_node_t** link = &tree->root;
+    krbtree_node_t* parent = 0;
+    while (*link)
+    {
+        vma_t* vma = krbtree_entry(*link, vma_t, node);
+        parent = *link;
+
+        if (end <= vma->start)
+            link = &parent->left;
+        else if (start >= vma->end)
+            link = &parent->right;
+        else
+            return 0;
+    }
+
+    /* Extend the previous area when it can absorb the new range */
+    if (backing == VMA_ANON && start)
+    {
+        vma_t* prev = vma_find(tree, start - 1);
+        if (prev && prev->backing == VMA_ANON && prev->prot == prot && prev->flags == flags)
+        {
+            prev->end = end;
+            return prev;
+        }
+    }
+
+    vma_t* vma = pool_allocate(*VMA_POOL);
+    vma->start = start;
+    vma->end = end;
+    vma->prot = prot;
+    vma->backing = backing;
+    vma->flags = flags;
+    vma->file = 0;
+    vma->offset = 0;
+    vma->file_end = 0;
+
+    krbtree_insert(tree, &vma->node, parent, link);
+
+    return vma;
+}
+
+void vma_destroy(krbtree_t* tree, vma_t* vma)
+{
+    krbtree_remove(tree, &vma->node);
+    pool_free(vma);
+}
+
+vma_t* vma_split(krbtree_t* tree, vma_t* vma, uint64_t addr)
+{
+    vma_t* upper = pool_allocate(*VMA_POOL);
+    *upper = *vma;
+    upper->start = addr;
+    upper->offset = vma->offset + (addr - vma->start);
+    vma->end = addr;
+
+    /* Upper half goes right after the area, left most spot of its right subtree */
+    krbtree_node_t* parent = &vma->node;
+    krbtree_node_t** link = &parent->right;
+    while (*link)
+    {
+        parent = *link;
+        link = &parent->left;
+    }
+    krbtree_insert(tree, &upper->node, parent, link);
+
+    return upper;
+}
+
+void vma_remove_range(krbtree_t* tree, uint64_t start, uint64_t end)
+{
+    vma_t* vma = vma_find_next(tree, start);
+    while (vma && vma->start < end)
+    {
+        if (vma->start < start)
+        {
+            /* Keep the part below the range */
+            vma = vma_split(tree, vma, start);
+            continue;
+        }
+        if (vma->end > end)
+        {
+            /* Keep the part above the range */
+            vma_split(tree, vma, end);
+        }
+
+        krbtree_node_t* next = krbtree_next(&vma->node);
+        vma_destroy(tree, vma);
+        vma = next ? krbtree_entry(next, vma_t, node) : 0;
+    }
+}
+
+bool vma_isolate_range(krbtree_t* tree, uint64_t start, uint64_t end)
+{
+    if (!vma_check(tree, start, end - start, PROT_NONE))
+        return 0;
+
+    vma_t* first = vma_find(tree, start);
+    if (first->start < start)
+        vma_split(tree, first, start);
+
+    vma_t* last = vma_find(tree, end - 1);
+    if (last->end > end)
+        vma_split(tree, last, end);
+
+    return 1;
+}
+
+void vma_destroy_all(krbtree_t* tree)
+{
+    while (tree->root)
+    {
+        vma_destroy(tree, krbtree_entry(tree->root, vma_t, node));
+    }
+}
+
+void vma_copy(krbtree_t* dest, krbtree_t* src)
+{
+    dest->root = 0;
+
+    /* Areas come in order, so every insert goes to the right most link */
+    for (krbtree_node_t* node = krbtree_first(src); node; node = krbtree_next(node))
+    {
+        vma_t* vma = krbtree_entry(node, vma_t, node);
+        vma_t* copy = pool_allocate(*VMA_POOL);
+        *copy = *vma;
+
+        krbtree_node_t** link = &dest->root;
+        krbtree_node_t* parent = 0;
+        while (*link)
+        {
+            parent = *link;
+            link = &parent->right;
+        }
+        krbtree_insert(dest, &copy->node, parent, link);
+    }
+}
+
+bool vma_check(krbtree_t* tree, uint64_t start, uint64_t size, uint64_t prot)
+{
+    uint64_t end = start + size;
+
+    /* Reject ranges wrapping around the address space */
+    if (end < start)
+        return 0;
+
+    while (start < end)
+    {
+        vma_t* vma = vma_find(tree, start);
+        if (!vma || (vma->prot & prot) != prot)
+            return 0;
+        start = vma->end;
+    }
+
+    return 1;
+}
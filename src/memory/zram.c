@@ -0,0 +1,241 @@
+/**
+ * @file zram.c
+ * @brief Compressed RAM Swap Device Implementation
+ *
+ * Implements the in-memory swap device: same filled page detection, LZ4
+ * compression and the size class allocator packing objects into frames.
+ */
+#include <arch/io.h>
+#include <klz4.h>
+#include <kmath.h>
+#include <memory/kglobals.h>
+#include <memory/kmemory.h>
+#include <memory/paging.h>
+#include <memory/swap.h>
+#include <memory/zram.h>
+
+/**
+ * @brief Unlinks a pool frame from the free list of its class
+ */
+static void zram_unlink(zram_page_t* page)
+{
+    if (page->prev)
+        page->prev->next = page->next;
+    else
+        ZRAM->classes[page->size / ZRAM_CLASS_SIZE - 1] = page->next;
+    if (page->next)
+        page->next->prev = page->prev;
+}
+
+/**
+ * @brief Links a pool frame at the front of the free list of its class
+ */
+static void zram_link(zram_page_t* page)
+{
+    zram_page_t** head = &ZRAM->classes[page->size / ZRAM_CLASS_SIZE - 1];
+    page->prev = 0;
+    page->next = *head;
+    if (*head)
+        (*head)->prev = page;
+    *head = page;
+}
+
+/**
+ * @brief Allocates an object
+ * @param size size of the object (at most ZRAM_MAX_COMPRESSED)
+ * @return physical address of the object, NULL if out of memory
+ */
+static void* zram_alloc(uint64_t size)
+{
+    size = ALIGN_UP(size, ZRAM_CLASS_SIZE);
+    zram_page_t* page = ZRAM->classes[size / ZRAM_CLASS_SIZE - 1];
+
+    if (!page)
+    {
+        page = pages_allocatePage(PAGE_SIZE_4KB);
+        if (!page)
+            return 0;
+        ZRAM->stats.memory_used += PAGE_SIZE_4KB;
+
+        /* Thread every object onto the free list */
+        page->size = size;
+        page->used = 0;
+        page->free = ZRAM_HEADER_SIZE;
+        uint64_t offset = ZRAM_HEADER_SIZE;
+        for (; offset + 2 * size <= PAGE_SIZE_4KB; offset += size)
+            *(uint32_t*)((uint8_t*)page + offset) = offset + size;
+        *(uint32_t*)((uint8_t*)page + offset) = 0;
+        zram_link(page);
+    }
+
+    uint8_t* object = (uint8_t*)page + page->free;
+    page->free = *(uint32_t*)object;
+    page->used++;
+    if (!page->free)
+        zram_unlink(page); /* Full */
+
+    return object;
+}
+
+/**
+ * @brief Frees an object, and its pool frame once it is empty
+ * @param object physical address of the object
+ */
+static void zram_object_free(void* object)
+{
+    zram_page_t* page = (zram_page_t*)ALIGN_DOWN((uint64_t)object, PAGE_SIZE_4KB);
+
+    if (!page->free)
+        zram_link(page); /* Was full */
+
+    *(uint32_t*)object = page->free;
+    page->free = (uint8_t*)object - (uint8_t*)page;
+
+    if (--page->used == 0)
+    {
+        zram_unlink(page);
+        pages_free(page, PAGE_SIZE_4KB);
+        ZRAM->stats.memory_used -= PAGE_SIZE_4KB;
+    }
+}
+
+/**
+ * @brief Checks if a frame is one word repeated
+ * @param frame frame being checked
+ * @param word set to the repeated word
+ */
+static bool zram_same_filled(const uint64_t* frame, uint64_t* word)
+{
+    for (uint64_t i = 1; i < PAGE_SIZE_4KB / sizeof(uint64_t); i++)
+    {
+        if (frame[i] != frame[0])
+            return 0;
+    }
+    *word = frame[0];
+    return 1;
+}
+
+/**
+ * @brief Stores a frame in a slot
+ */
+static bool zram_write(uint64_t slot, const void* frame)
+{
+    uint64_t word;
+    if (zram_same_filled(frame, &word))
+    {
+        ZRAM->handles[slot] = word;
+        ZRAM->sizes[slot] = ZRAM_SAME;
+        ZRAM->stats.same_pages++;
+        ZRAM->stats.stored_pages++;
+        ZRAM->stats.original_size += PAGE_SIZE_4KB;
+        return 1;
+    }
+
+    uint64_t start = rdtsc();
+    uint64_t size = klz4_compress(frame, PAGE_SIZE_4KB, ZRAM->buffer, ZRAM_MAX_COMPRESSED);
+    ZRAM->stats.compress_cycles += rdtsc() - start;
+    ZRAM->stats.compress_count++;
+
+    void* object;
+    if (size)
+    {
+        object = zram_alloc(size);
+        if (!object)
+            return 0;
+        kmemcpy(object, ZRAM->buffer, size);
+    }
+    else
+    {
+        /* Does not compress, keep the page as it is */
+        object = pages_allocatePage(PAGE_SIZE_4KB);
+        if (!object)
+            return 0;
+        kmemcpy(object, frame, PAGE_SIZE_4KB);
+        size = ZRAM_RAW;
+        ZRAM->stats.raw_pages++;
+        ZRAM->stats.memory_used += PAGE_SIZE_4KB;
+    }
+
+    ZRAM->handles[slot] = (uint64_t)object;
+    ZRAM->sizes[slot] = size;
+    ZRAM->stats.stored_pages++;
+    ZRAM->stats.original_size += PAGE_SIZE_4KB;
+    ZRAM->stats.compressed_size += size;
+    return 1;
+}
+
+/**
+ * @brief Loads a frame from a slot
+ */
+static bool zram_read(uint64_t slot, void* frame)
+{
+    uint64_t size = ZRAM->sizes[slot];
+
+    if (size == ZRAM_SAME)
+    {
+        uint64_t* words = frame;
+        for (uint64_t i = 0; i < PAGE_SIZE_4KB / sizeof(uint64_t); i++)
+            words[i] = ZRAM->handles[slot];
+        return 1;
+    }
+
+    if (size == ZRAM_RAW)
+    {
+        kmemcpy(frame, (void*)ZRAM->handles[slot], PAGE_SIZE_4KB);
+        return 1;
+    }
+
+    uint64_t start = rdtsc();
+    int64_t length = klz4_decompress((void*)ZRAM->handles[slot], size, frame, PAGE_SIZE_4KB);
+    ZRAM->stats.decompress_cycles += rdtsc() - start;
+    ZRAM->stats.decompress_count++;
+
+    return length == PAGE_SIZE_4KB;
+}
+
+/**
+ * @brief Frees whatever a slot holds
+ */
+static void zram_discard(uint64_t slot)
+{
+    uint64_t size = ZRAM->sizes[slot];
+
+    if (size == ZRAM_RAW)
+    {
+        pages_free((void*)ZRAM->handles[slot], PAGE_SIZE_4KB);
+        ZRAM->stats.raw_pages--;
+        ZRAM->stats.memory_used -= PAGE_SIZE_4KB;
+    }
+    else if (size == ZRAM_SAME)
+    {
+        ZRAM->stats.same_pages--;
+    }
+    else
+    {
+        zram_object_free((void*)ZRAM->handles[slot]);
+    }
+
+    ZRAM->stats.stored_pages--;
+    ZRAM->stats.original_size -= PAGE_SIZE_4KB;
+    if (size != ZRAM_SAME)
+        ZRAM->stats.compressed_size -= size;
+}
+
+void zram_init()
+{
+    kmemset(ZRAM, 0, sizeof(zram_t));
+    if (!ZRAM_ENABLED)
+        return;
+
+    ZRAM->slots = *NUM_4KB_PAGES / ZRAM_SIZE_RATIO;
+    ZRAM->handles = kmalloc(sizeof(uint64_t) * ZRAM->slots);
+    ZRAM->sizes = kmalloc(sizeof(uint16_t) * ZRAM->slots);
+    ZRAM->buffer = kmalloc(ZRAM_MAX_COMPRESSED);
+
+    swap_add_device(ZRAM->slots, zram_write, zram_read, zram_discard);
+}
+
+void zram_stats(zram_stats_t* stats)
+{
+    *stats = ZRAM->stats;
+}
@@ -0,0 +1,8 @@
+#ifndef __LOCK_H
+#define __LOCK_H
+
+/* Futex based lock guarding state shared by threads inside std, 0 when unlocked */
+void __std_lock(volatile int* lock);
+void __std_unlock(volatile int* lock);
+
+#endif
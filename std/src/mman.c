@@ -0,0 +1,86 @@
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <syscall.h>
+
+/* Kernel side protection and mapping flags */
+#define K_PROT_EXEC 1
+#define K_PROT_WRITE 2
+#define K_PROT_READ 4
+
+#define K_MAP_SHARED 1
+#define K_MAP_ANONYMOUS 2
+#define K_MAP_FIXED 4
+#define K_MAP_FIXED_NOREPLACE 8
+#define K_MAP_GROWSDOWN 16
+#define K_MAP_NORESERVE 32
+#define K_MAP_POPULATE 64
+#define K_MAP_LOCKED 128
+#define K_MAP_HUGETLB 256
+
+static long mman_prot(int __prot)
+{
+    long prot = 0;
+    if (__prot & PROT_EXEC)
+        prot |= K_PROT_EXEC;
+    if (__prot & PROT_WRITE)
+        prot |= K_PROT_WRITE;
+    if (__prot & PROT_READ)
+        prot |= K_PROT_READ;
+    return prot;
+}
+
+static long mman_flags(int __flags)
+{
+    long flags = 0;
+    if (__flags & MAP_SHARED)
+        flags |= K_MAP_SHARED;
+    if (__flags & MAP_ANONYMOUS)
+        flags |= K_MAP_ANONYMOUS;
+    if (__flags & MAP_FIXED)
+        flags |= K_MAP_FIXED;
+    if (__flags & MAP_FIXED_NOREPLACE)
+        flags |= K_MAP_FIXED_NOREPLACE;
+    if (__flags & MAP_GROWSDOWN)
+        flags |= K_MAP_GROWSDOWN;
+    if (__flags & MAP_NORESERVE)
+        flags |= K_MAP_NORESERVE;
+    if (__flags & MAP_POPULATE)
+        flags |= K_MAP_POPULATE;
+    if (__flags & MAP_LOCKED)
+        flags |= K_MAP_LOCKED;
+    if (__flags & MAP_HUGETLB)
+        flags |= K_MAP_HUGETLB;
+    return flags;
+}
+
+void* mmap(void* __addr, size_t __len, int __prot, int __flags, int __fd, __off_t __offset)
+{
+    long ret = syscall(7, __addr, __len, mman_prot(__prot), mman_flags(__flags), __fd, __offset);
+    if (ret == -1)
+        return MAP_FAILED;
+    return (void*)ret;
+}
+
+int munmap(void* __addr, size_t __len)
+{
+    return syscall(22, __addr, __len);
+}
+
+int mprotect(void* __addr, size_t __len, int __prot)
+{
+    return syscall(23, __addr, __len, mman_prot(__prot));
+}
+
+int madvise(void* __addr, size_t __len, int __advice)
+{
+    /* MADV_ values are shared with the kernel */
+    return syscall(24, __addr, __len, __advice);
+}
+
+void* mremap(void* __addr, size_t __old_len, size_t __new_len, int __flags, ...)
+{
+    long ret = syscall(25, __addr, __old_len, __new_len, __flags & MREMAP_MAYMOVE);
+    if (ret == -1)
+        return MAP_FAILED;
+    return (void*)ret;
+}
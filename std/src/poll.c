@@ -0,0 +1,7 @@
+#include <poll.h>
+#include <syscall.h>
+
+int poll(struct pollfd* __fds, nfds_t __nfds, int __timeout)
+{
+    return syscall(45, __fds, __nfds, __timeout);
+}
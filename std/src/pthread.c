@@ -0,0 +1,280 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <lock.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+
+/* Kernel syscalls */
+#define K_SYS_CLONE 30
+#define K_SYS_FUTEX 31
+#define K_SYS_ARCH_PRCTL 32
+#define K_SYS_EXIT_THREAD 33
+
+#define K_FUTEX_WAIT 0
+#define K_FUTEX_WAKE 1
+#define K_FUTEX_PRIVATE 128
+#define K_ARCH_SET_FS 0x1002
+
+#define THREAD_STACK_SIZE (64 * 1024)
+#define THREAD_KEYS 32
+
+#define THREAD_CLONE_FLAGS                                                                                                                                     \
+    (CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SIGHAND | CLONE_THREAD | CLONE_SYSVSEM | CLONE_SETTLS | CLONE_PARENT_SETTID | CLONE_CHILD_CLEARTID)
+
+/* Thread control block, FS points at it and its first word points at itself */
+struct __std_thread
+{
+    struct __std_thread* self;
+    void* (*start)(void*);
+    void* arg;
+    void* result;
+    volatile int tid; /* Cleared and woken by the kernel when the thread exits */
+    void* specific[THREAD_KEYS];
+};
+
+static struct __std_thread main_thread;
+static int threads_ready;
+
+static volatile int key_lock;
+static unsigned int key_count;
+static void (*key_destructors[THREAD_KEYS])(void*);
+
+static long futex(volatile int* addr, int op, int val)
+{
+    return syscall(K_SYS_FUTEX, addr, op | K_FUTEX_PRIVATE, val, 0);
+}
+
+void __std_lock(volatile int* lock)
+{
+    /* 0 unlocked, 1 locked, 2 locked with threads sleeping on it */
+    int state = __sync_val_compare_and_swap(lock, 0, 1);
+    if (!state)
+        return;
+
+    if (state != 2)
+        state = __atomic_exchange_n(lock, 2, __ATOMIC_ACQUIRE);
+    while (state)
+    {
+        futex(lock, K_FUTEX_WAIT, 2);
+        state = __atomic_exchange_n(lock, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+void __std_unlock(volatile int* lock)
+{
+    if (__atomic_exchange_n(lock, 0, __ATOMIC_RELEASE) == 2)
+        futex(lock, K_FUTEX_WAKE, 1);
+}
+
+/* Runs the start routine on the new stack, entered by thread_clone in the child */
+__attribute__((used, noreturn)) static void thread_start()
+{
+    struct __std_thread* self = (struct __std_thread*)pthread_self();
+    pthread_exit(self->start(self->arg));
+}
+
+/* Both threads return from the syscall, only the parent returns from here */
+__attribute__((naked)) static long thread_clone(unsigned long flags, void* stack, volatile int* parent_tid, volatile int* child_tid, void* tls)
+{
+    __asm__ volatile("mov %rcx, %r10\n\t"
+                     "mov $30, %eax\n\t"
+                     "int $0x80\n\t"
+                     "test %rax, %rax\n\t"
+                     "jnz 1f\n\t"
+                     "xor %ebp, %ebp\n\t"
+                     "call thread_start\n\t"
+                     "1:\n\t"
+                     "ret\n\t");
+}
+
+/* The main thread gets its control block on first use */
+static void thread_init()
+{
+    if (threads_ready)
+        return;
+    main_thread.self = &main_thread;
+    syscall(K_SYS_ARCH_PRCTL, K_ARCH_SET_FS, &main_thread);
+    threads_ready = 1;
+}
+
+pthread_t pthread_self(void)
+{
+    thread_init();
+
+    struct __std_thread* self;
+    __asm__ volatile("mov %%fs:0, %0" : "=r"(self));
+    return (pthread_t)self;
+}
+
+int pthread_equal(pthread_t __thread1, pthread_t __thread2)
+{
+    return __thread1 == __thread2;
+}
+
+int pthread_create(pthread_t* __restrict __newthread, const pthread_attr_t* __restrict __attr, void* (*__start_routine)(void*), void* __restrict __arg)
+{
+    thread_init();
+
+    /* Control block first, stack above it, freed together by pthread_join */
+    char* block = malloc(sizeof(struct __std_thread) + THREAD_STACK_SIZE);
+    if (!block)
+        return EAGAIN;
+
+    struct __std_thread* thread = (struct __std_thread*)block;
+    memset(thread, 0, sizeof(struct __std_thread));
+    thread->self = thread;
+    thread->start = __start_routine;
+    thread->arg = __arg;
+
+    void* stack = (void*)((unsigned long)(block + sizeof(struct __std_thread) + THREAD_STACK_SIZE) & ~15UL);
+    if (thread_clone(THREAD_CLONE_FLAGS, stack, &thread->tid, &thread->tid, thread) < 0)
+    {
+        free(block);
+        return EAGAIN;
+    }
+
+    *__newthread = (pthread_t)thread;
+    return 0;
+}
+
+void pthread_exit(void* __retval)
+{
+    struct __std_thread* self = (struct __std_thread*)pthread_self();
+    self->result = __retval;
+
+    for (unsigned int i = 0; i < key_count; i++)
+    {
+        void* value = self->specific[i];
+        self->specific[i] = 0;
+        if (value && key_destructors[i])
+            key_destructors[i](value);
+    }
+
+    /* Ends the process when called by the main thread */
+    syscall(K_SYS_EXIT_THREAD, 0);
+    for (;;)
+        ;
+}
+
+int pthread_join(pthread_t __th, void** __thread_return)
+{
+    struct __std_thread* thread = (struct __std_thread*)__th;
+
+    int tid;
+    while ((tid = thread->tid) != 0)
+        futex(&thread->tid, K_FUTEX_WAIT, tid);
+
+    if (__thread_return)
+        *__thread_return = thread->result;
+    free(thread);
+    return 0;
+}
+
+int pthread_mutex_init(pthread_mutex_t* __mutex, const pthread_mutexattr_t* __mutexattr)
+{
+    memset(__mutex, 0, sizeof(pthread_mutex_t));
+    return 0;
+}
+
+int pthread_mutex_destroy(pthread_mutex_t* __mutex)
+{
+    return 0;
+}
+
+int pthread_mutex_lock(pthread_mutex_t* __mutex)
+{
+    __std_lock((volatile int*)__mutex);
+    return 0;
+}
+
+int pthread_mutex_trylock(pthread_mutex_t* __mutex)
+{
+    return __sync_val_compare_and_swap((volatile int*)__mutex, 0, 1) ? EBUSY : 0;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t* __mutex)
+{
+    __std_unlock((volatile int*)__mutex);
+    return 0;
+}
+
+int pthread_cond_init(pthread_cond_t* __restrict __cond, const pthread_condattr_t* __restrict __cond_attr)
+{
+    memset(__cond, 0, sizeof(pthread_cond_t));
+    return 0;
+}
+
+int pthread_cond_destroy(pthread_cond_t* __cond)
+{
+    return 0;
+}
+
+int pthread_cond_wait(pthread_cond_t* __restrict __cond, pthread_mutex_t* __restrict __mutex)
+{
+    /* A signal between the unlock and the sleep changes the sequence, the wait then returns right away */
+    volatile int* sequence = (volatile int*)__cond;
+    int value = *sequence;
+
+    pthread_mutex_unlock(__mutex);
+    futex(sequence, K_FUTEX_WAIT, value);
+
+    /* Taken as contended, other woken waiters may sleep on the mutex */
+    volatile int* lock = (volatile int*)__mutex;
+    while (__atomic_exchange_n(lock, 2, __ATOMIC_ACQUIRE))
+        futex(lock, K_FUTEX_WAIT, 2);
+    return 0;
+}
+
+int pthread_cond_signal(pthread_cond_t* __cond)
+{
+    __atomic_add_fetch((volatile int*)__cond, 1, __ATOMIC_RELEASE);
+    futex((volatile int*)__cond, K_FUTEX_WAKE, 1);
+    return 0;
+}
+
+int pthread_cond_broadcast(pthread_cond_t* __cond)
+{
+    __atomic_add_fetch((volatile int*)__cond, 1, __ATOMIC_RELEASE);
+    futex((volatile int*)__cond, K_FUTEX_WAKE, 0x7FFFFFFF);
+    return 0;
+}
+
+int pthread_key_create(pthread_key_t* __key, void (*__destr_function)(void*))
+{
+    __std_lock(&key_lock);
+    if (key_count == THREAD_KEYS)
+    {
+        __std_unlock(&key_lock);
+        return EAGAIN;
+    }
+    key_destructors[key_count] = __destr_function;
+    *__key = key_count++;
+    __std_unlock(&key_lock);
+    return 0;
+}
+
+int pthread_key_delete(pthread_key_t __key)
+{
+    if (__key >= key_count)
+        return EINVAL;
+    key_destructors[__key] = 0;
+    return 0;
+}
+
+void* pthread_getspecific(pthread_key_t __key)
+{
+    if (__key >= THREAD_KEYS)
+        return 0;
+    return ((struct __std_thread*)pthread_self())->specific[__key];
+}
+
+int pthread_setspecific(pthread_key_t __key, const void* __pointer)
+{
+    if (__key >= THREAD_KEYS)
+        return EINVAL;
+    ((struct __std_thread*)pthread_self())->specific[__key] = (void*)__pointer;
+    return 0;
+}
@@ -0,0 +1,27 @@
+#include <sys/resource.h>
+#include <sys/times.h>
+#include <syscall.h>
+
+int getrusage(__rusage_who_t __who, struct rusage* __usage)
+{
+    return syscall(34, __who, __usage);
+}
+
+clock_t times(struct tms* __buffer)
+{
+    return syscall(35, __buffer);
+}
+
+int setpriority(__priority_which_t __which, id_t __who, int __prio)
+{
+    return syscall(36, __which, __who, __prio);
+}
+
+int getpriority(__priority_which_t __which, id_t __who)
+{
+    /* The kernel returns 20 - nice, nice itself can be -1 */
+    long result = syscall(37, __which, __who);
+    if (result == -1)
+        return -1;
+    return 20 - (int)result;
+}
@@ -0,0 +1,17 @@
+#include <sched.h>
+#include <syscall.h>
+
+int sched_setscheduler(__pid_t __pid, int __policy, const struct sched_param* __param)
+{
+    return syscall(38, __pid, __policy, __param);
+}
+
+int sched_getparam(__pid_t __pid, struct sched_param* __param)
+{
+    return syscall(39, __pid, __param);
+}
+
+int sched_getscheduler(__pid_t __pid)
+{
+    return syscall(40, __pid);
+}
@@ -0,0 +1,7 @@
+#include <signal.h>
+#include <syscall.h>
+
+int kill(__pid_t __pid, int __sig)
+{
+    return syscall(20, __pid, __sig);
+}
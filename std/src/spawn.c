@@ -0,0 +1,148 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <syscall.h>
+
+/* Kernel side file actions and attribute flags */
+#define K_SPAWN_OPEN 0
+#define K_SPAWN_CLOSE 1
+#define K_SPAWN_DUP2 2
+#define K_SPAWN_TCSETPGRP 3
+
+#define K_SPAWN_SETPGROUP 1
+
+/* Laid out like the kernel's process_spawn_action_t */
+struct __spawn_action
+{
+    long type;
+    long fd;
+    long newfd;
+    const char* path;
+    long oflag;
+    long mode;
+};
+
+static int spawn_add_action(posix_spawn_file_actions_t* __file_actions, long type, long fd, long newfd, const char* path, long oflag,
+                            long mode)
+{
+    if (__file_actions->__used == __file_actions->__allocated)
+    {
+        int allocated = __file_actions->__allocated ? __file_actions->__allocated * 2 : 4;
+        struct __spawn_action* actions = realloc(__file_actions->__actions, allocated * sizeof(struct __spawn_action));
+        if (!actions)
+            return ENOMEM;
+        __file_actions->__actions = actions;
+        __file_actions->__allocated = allocated;
+    }
+
+    struct __spawn_action* action = &__file_actions->__actions[__file_actions->__used++];
+    action->type = type;
+    action->fd = fd;
+    action->newfd = newfd;
+    action->path = path;
+    action->oflag = oflag;
+    action->mode = mode;
+    return 0;
+}
+
+int posix_spawn_file_actions_init(posix_spawn_file_actions_t* __file_actions)
+{
+    __file_actions->__allocated = 0;
+    __file_actions->__used = 0;
+    __file_actions->__actions = 0;
+    return 0;
+}
+
+int posix_spawn_file_actions_destroy(posix_spawn_file_actions_t* __file_actions)
+{
+    free(__file_actions->__actions);
+    return posix_spawn_file_actions_init(__file_actions);
+}
+
+int posix_spawn_file_actions_addopen(posix_spawn_file_actions_t* __restrict __file_actions, int __fd, const char* __restrict __path, int __oflag,
+                                     mode_t __mode)
+{
+    /* The kernel only opens existing files, creating or truncating one is not supported */
+    if (__oflag & ~O_ACCMODE)
+        return EINVAL;
+    return spawn_add_action(__file_actions, K_SPAWN_OPEN, __fd, 0, __path, __oflag, __mode);
+}
+
+int posix_spawn_file_actions_addclose(posix_spawn_file_actions_t* __file_actions, int __fd)
+{
+    return spawn_add_action(__file_actions, K_SPAWN_CLOSE, __fd, 0, 0, 0, 0);
+}
+
+int posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t* __file_actions, int __fd, int __newfd)
+{
+    return spawn_add_action(__file_actions, K_SPAWN_DUP2, __fd, __newfd, 0, 0, 0);
+}
+
+int posix_spawn_file_actions_addtcsetpgrp_np(posix_spawn_file_actions_t* __file_actions, int __tcfd)
+{
+    return spawn_add_action(__file_actions, K_SPAWN_TCSETPGRP, __tcfd, 0, 0, 0, 0);
+}
+
+int posix_spawnattr_init(posix_spawnattr_t* __attr)
+{
+    __attr->__flags = 0;
+    __attr->__pgrp = 0;
+    return 0;
+}
+
+int posix_spawnattr_destroy(posix_spawnattr_t* __attr)
+{
+    return 0;
+}
+
+int posix_spawnattr_getflags(const posix_spawnattr_t* __restrict __attr, short int* __restrict __flags)
+{
+    *__flags = __attr->__flags;
+    return 0;
+}
+
+int posix_spawnattr_setflags(posix_spawnattr_t* __attr, short int __flags)
+{
+    __attr->__flags = __flags;
+    return 0;
+}
+
+int posix_spawnattr_getpgroup(const posix_spawnattr_t* __restrict __attr, pid_t* __restrict __pgroup)
+{
+    *__pgroup = __attr->__pgrp;
+    return 0;
+}
+
+int posix_spawnattr_setpgroup(posix_spawnattr_t* __attr, pid_t __pgroup)
+{
+    __attr->__pgrp = __pgroup;
+    return 0;
+}
+
+int posix_spawn(pid_t* __restrict __pid, const char* __restrict __path, const posix_spawn_file_actions_t* __restrict __file_actions,
+                const posix_spawnattr_t* __restrict __attrp, char* const __argv[__restrict_arr], char* const __envp[__restrict_arr])
+{
+    long attr[2] = {0, 0};
+    if (__attrp && (__attrp->__flags & POSIX_SPAWN_SETPGROUP))
+    {
+        attr[0] = K_SPAWN_SETPGROUP;
+        attr[1] = __attrp->__pgrp;
+    }
+
+    long pid = syscall(29, __path, __argv, __envp, __file_actions ? __file_actions->__actions : 0, __file_actions ? __file_actions->__used : 0, attr);
+    if (pid == -1)
+        return ENOENT;
+
+    if (__pid)
+        *__pid = pid;
+    return 0;
+}
+
+int posix_spawnp(pid_t* __pid, const char* __file, const posix_spawn_file_actions_t* __file_actions, const posix_spawnattr_t* __attrp,
+                 char* const __argv[], char* const __envp[])
+{
+    /* Names without a slash are already looked up in /bin */
+    return posix_spawn(__pid, __file, __file_actions, __attrp, __argv, __envp);
+}
@@ -1,4 +1,6 @@
+#include <lock.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 
 typedef struct BlockHeader
 {
@@ -10,10 +12,12 @@ typedef struct BlockHeader
 #define ALIGN4(x) (((x) + 3) & ~3)
 #define BLOCK_SIZE sizeof(BlockHeader)
 #define PAGE_SIZE 4096
+#define HEAP_TRIM_THRESHOLD (64 * 1024) /* Free space at the end of the heap given back to the kernel */
 
 static char* heap_start = (char*)0x40000000;
 static char* heap_end = (char*)0x40000000;
 static BlockHeader* heap_head = NULL;
+static volatile int heap_lock; /* Threads share the heap */
 
 void exit(int __status)
 {
@@ -42,17 +46,38 @@ int atoi(const char* __nptr)
     return result * sign;
 }
 
-static void heap_extend(unsigned long page_count)
+/* Grows the heap in place, returns 0 when something else is mapped right after it */
+static int heap_extend(unsigned long page_count)
 {
-    // TODO: Extend this after the syscall has been extended
-    __asm__ volatile("mov $7, %%rax\n\t"
-                     "mov $0, %%rdi\n\t"
-                     "mov %0, %%rsi\n\t"
-                     "int $0x80\n\t"
-                     :
-                     : "r"(page_count * 4096)
-                     : "rax", "rdi", "rsi");
+    /* Pages are only backed by the kernel once they are touched */
+    char* pages = mmap(heap_end, page_count * PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (pages == MAP_FAILED)
+        return 0;
+    if (pages != heap_end)
+    {
+        munmap(pages, page_count * PAGE_SIZE);
+        return 0;
+    }
     heap_end += page_count * PAGE_SIZE;
+    return 1;
+}
+
+/* Bytes mapped for a block outside the heap */
+static size_t heap_mapped_length(size_t size)
+{
+    return (size + BLOCK_SIZE + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+}
+
+/* Gives a block a mapping of its own when the heap cannot grow, free unmaps it again */
+static void* heap_alloc_mapped(size_t size)
+{
+    BlockHeader* block = mmap(0, heap_mapped_length(size), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (block == MAP_FAILED)
+        return NULL;
+    block->size = size;
+    block->next = NULL;
+    block->free = 0;
+    return (void*)(block + 1);
 }
 
 static BlockHeader* find_free_block(size_t size)
@@ -97,7 +122,7 @@ static void split_block(BlockHeader* block, size_t size)
     }
 }
 
-void* malloc(size_t __size)
+static void* heap_alloc(size_t __size)
 {
     if (__size == 0)
         return NULL;
@@ -124,7 +149,8 @@ void* malloc(size_t __size)
         // Need to extend heap
         size_t needed = (free_start + total_size) - heap_end;
         size_t pages = (needed + PAGE_SIZE - 1) / PAGE_SIZE;
-        heap_extend(pages);
+        if (!heap_extend(pages))
+            return heap_alloc_mapped(__size);
     }
 
     // Allocate new block at free_start
@@ -151,6 +177,14 @@ void* malloc(size_t __size)
     return (void*)(block + 1);
 }
 
+void* malloc(size_t __size)
+{
+    __std_lock(&heap_lock);
+    void* __ptr = heap_alloc(__size);
+    __std_unlock(&heap_lock);
+    return __ptr;
+}
+
 void* realloc(void* __ptr, size_t __size)
 {
     if (!__ptr)
@@ -204,12 +238,17 @@ void* calloc(size_t __nmemb, size_t __size)
     return __ptr;
 }
 
-void free(void* __ptr)
+static void heap_free(void* __ptr)
 {
     if (!__ptr)
         return;
 
     BlockHeader* block = (BlockHeader*)__ptr - 1;
+    if ((char*)block < heap_start || (char*)block >= heap_end)
+    {
+        munmap(block, heap_mapped_length(block->size));
+        return;
+    }
     block->free = 1;
 
     // Optional: coalesce adjacent free blocks
@@ -226,4 +265,24 @@ void free(void* __ptr)
             curr = curr->next;
         }
     }
-}
\ No newline at end of file
+
+    // Give whole free pages at the end of the heap back
+    if (curr && curr->free)
+    {
+        char* data_start = (char*)(curr + 1);
+        char* trim_start = (char*)(((unsigned long)data_start + PAGE_SIZE - 1) & ~(unsigned long)(PAGE_SIZE - 1));
+        if (trim_start + HEAP_TRIM_THRESHOLD <= heap_end)
+        {
+            munmap(trim_start, heap_end - trim_start);
+            curr->size = trim_start - data_start;
+            heap_end = trim_start;
+        }
+    }
+}
+
+void free(void* __ptr)
+{
+    __std_lock(&heap_lock);
+    heap_free(__ptr);
+    __std_unlock(&heap_lock);
+}
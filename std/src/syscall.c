@@ -24,7 +24,12 @@ long syscall(long number, ...)
     long f = va_arg(ap, long);
     va_end(ap);
 
+    /* Arguments 4-6 are passed in r10, r8 and r9 */
+    register long r10 __asm__("r10") = d;
+    register long r8 __asm__("r8") = e;
+    register long r9 __asm__("r9") = f;
+
     long ret;
-    __asm__ volatile("int $0x80" : "=a"(ret) : "a"(number), "D"(a), "S"(b), "d"(c), "r"(d), "r"(e), "r"(f) : "rcx", "r11", "memory");
+    __asm__ volatile("int $0x80" : "=a"(ret) : "a"(number), "D"(a), "S"(b), "d"(c), "r"(r10), "r"(r8), "r"(r9) : "rcx", "r11", "memory");
     return __syscall_ret(ret);
 }
\ No newline at end of file
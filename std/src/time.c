@@ -0,0 +1,18 @@
+#include <sys/time.h>
+#include <syscall.h>
+#include <time.h>
+
+int nanosleep(const struct timespec* __requested_time, struct timespec* __remaining)
+{
+    return syscall(41, __requested_time, __remaining);
+}
+
+int setitimer(__itimer_which_t __which, const struct itimerval* __restrict __new, struct itimerval* __restrict __old)
+{
+    return syscall(43, __which, __new, __old);
+}
+
+int getitimer(__itimer_which_t __which, struct itimerval* __value)
+{
+    return syscall(44, __which, __value);
+}
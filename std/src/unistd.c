@@ -1,4 +1,5 @@
 #include <syscall.h>
+#include <time.h>
 #include <unistd.h>
 
 int dup2(int __fd, int __fd2)
@@ -29,6 +30,17 @@ __pid_t fork(void)
     return syscall(8);
 }
 
+/* The child runs on this stack until it execs or exits, so the return address
+ * is kept in a register instead of a stack frame it would overwrite */
+__attribute__((naked)) __pid_t vfork(void)
+{
+    __asm__ volatile("pop %rdx\n\t"
+                     "mov $28, %eax\n\t"
+                     "int $0x80\n\t"
+                     "push %rdx\n\t"
+                     "ret\n\t");
+}
+
 __pid_t getpid(void) {}
 
 int setpgid(__pid_t __pid, __pid_t __pgid)
@@ -41,14 +53,38 @@ __pid_t getsid(__pid_t __pid)
     return syscall(19, __pid);
 }
 
+static long vector_length(char* const __vector[])
+{
+    long count = 0;
+    while (__vector && __vector[count])
+        count++;
+    return count;
+}
+
 int execve(const char* __path, char* const __argv[], char* const __envp[])
 {
-    return syscall(2, __path, __argv, sizeof(__argv));
+    return syscall(2, __path, vector_length(__argv), __argv, vector_length(__envp), __envp);
 }
 
 unsigned int sleep(unsigned int __seconds)
 {
-    return 0;
+    /* Cut short by a signal it reports the seconds left, rounded up */
+    struct timespec request = {.tv_sec = __seconds, .tv_nsec = 0};
+    struct timespec remain = {0, 0};
+    if (nanosleep(&request, &remain) == 0)
+        return 0;
+    return remain.tv_sec + (remain.tv_nsec > 0);
+}
+
+int usleep(__useconds_t __useconds)
+{
+    struct timespec request = {.tv_sec = __useconds / 1000000, .tv_nsec = (__useconds % 1000000) * 1000};
+    return nanosleep(&request, 0);
+}
+
+unsigned int alarm(unsigned int __seconds)
+{
+    return syscall(42, __seconds);
 }
 
 int pipe(int __pipedes[2])
@@ -74,4 +110,11 @@ char* getcwd(char* __buf, size_t __size)
 int chdir(const char* __path)
 {
     return syscall(5, __path);
-}
\ No newline at end of file
+}
+int nice(int __inc)
+{
+    long result = syscall(37, 0, 0);
+    if (result == -1 || syscall(36, 0, 0, 20 - result + __inc) == -1)
+        return -1;
+    return 20 - (int)syscall(37, 0, 0);
+}
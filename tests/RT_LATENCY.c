@@ -0,0 +1,136 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/times.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define HOGS 8            /* CPU bound processes, more than there are CPUs */
+#define ROUNDS 200        /* Wakeups measured per class */
+#define BOUND_US 1000     /* Worst wakeup delay allowed for the real time class */
+#define RT_PRIORITY 50
+#define CLOCK_TICKS 100   /* Ticks per second of times */
+
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+
+static volatile int ready;           /* Set once the waiter runs in its class */
+static volatile int sequence;        /* Round the waker woke the waiter for */
+static volatile int acknowledged;    /* Last round the waiter saw */
+static volatile unsigned long stamp; /* TSC when the waker woke the waiter */
+
+/* Never returns, killed once the measurement is done */
+static void hog()
+{
+    volatile unsigned long sum = 0;
+    while (1)
+        sum++;
+}
+
+/* TSC cycles per microsecond, measured against the clock ticks of times */
+static unsigned long calibrate()
+{
+    struct tms buffer;
+    clock_t start = times(&buffer);
+    while (times(&buffer) == start)
+        ;
+    start = times(&buffer);
+    unsigned long tsc = __builtin_ia32_rdtsc();
+    while (times(&buffer) < start + 10)
+        ;
+    unsigned long cycles = (__builtin_ia32_rdtsc() - tsc) / (10 * 1000000 / CLOCK_TICKS);
+    return cycles ? cycles : 1;
+}
+
+/* Normal thread competing with the hogs, wakes the waiter once per round */
+static void* waker(void* arg)
+{
+    (void)arg;
+    while (!ready)
+        ;
+    for (int round = 1; round <= ROUNDS; round++)
+    {
+        /* Busy for a while so the waiter is asleep again */
+        for (volatile int i = 0; i < 100000; i++)
+            ;
+        stamp = __builtin_ia32_rdtsc();
+        sequence = round;
+        syscall(31, &sequence, FUTEX_WAKE, 1);
+        while (acknowledged != round)
+            ;
+    }
+    return 0;
+}
+
+/* Measures the delay from every wakeup to the waiter running, in the given class */
+static unsigned long run(int policy, int priority, unsigned long* average)
+{
+    ready = 0;
+    sequence = 0;
+    acknowledged = 0;
+
+    /* The waker is created first, it stays in the normal class */
+    pthread_t thread;
+    pthread_create(&thread, 0, waker, 0);
+    struct sched_param param = {.sched_priority = priority};
+    sched_setscheduler(0, policy, &param);
+    ready = 1;
+
+    unsigned long worst = 0;
+    unsigned long total = 0;
+    for (int round = 1; round <= ROUNDS; round++)
+    {
+        while (sequence != round)
+            syscall(31, &sequence, FUTEX_WAIT, round - 1);
+        unsigned long delay = __builtin_ia32_rdtsc() - stamp;
+        acknowledged = round;
+        total += delay;
+        if (delay > worst)
+            worst = delay;
+    }
+
+    param.sched_priority = 0;
+    sched_setscheduler(0, SCHED_OTHER, &param);
+    pthread_join(thread, 0);
+    *average = total / ROUNDS;
+    return worst;
+}
+
+int main()
+{
+    printf("RUNNING REAL TIME LATENCY TEST\n");
+
+    unsigned long cycles_per_us = calibrate();
+
+    /* Every CPU busy with normal work */
+    pid_t pids[HOGS];
+    for (int i = 0; i < HOGS; i++)
+    {
+        pids[i] = fork();
+        if (pids[i] == 0)
+            hog();
+    }
+
+    unsigned long average;
+    unsigned long worst = run(SCHED_OTHER, 0, &average);
+    printf("normal: average %u us, worst %u us\n", (unsigned)(average / cycles_per_us), (unsigned)(worst / cycles_per_us));
+    worst = run(SCHED_FIFO, RT_PRIORITY, &average);
+    printf("fifo: average %u us, worst %u us\n", (unsigned)(average / cycles_per_us), (unsigned)(worst / cycles_per_us));
+
+    for (int i = 0; i < HOGS; i++)
+    {
+        int status;
+        kill(pids[i], SIGKILL);
+        waitpid(pids[i], &status, 0);
+    }
+
+    if (worst / cycles_per_us > BOUND_US)
+    {
+        printf("FAILED: worst wakeup delay above %u us\n", BOUND_US);
+        return 1;
+    }
+    printf("PASSED\n");
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/times.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define ROUNDS 10       /* Sleeps measured */
+#define SLEEP_US 20000  /* Length of each sleep */
+#define POLL_MS 50      /* Timeout of the poll on no descriptors */
+#define SLACK_MS 10     /* Oversleep allowed, past the timer resolution and the tick */
+#define CLOCK_TICKS 100 /* Ticks per second of times */
+
+/* TSC cycles per millisecond, measured against the clock ticks of times */
+static unsigned long calibrate()
+{
+    struct tms buffer;
+    clock_t start = times(&buffer);
+    while (times(&buffer) == start)
+        ;
+    start = times(&buffer);
+    unsigned long tsc = __builtin_ia32_rdtsc();
+    while (times(&buffer) < start + 10)
+        ;
+    unsigned long cycles = (__builtin_ia32_rdtsc() - tsc) / (10 * 1000 / CLOCK_TICKS);
+    return cycles ? cycles : 1;
+}
+
+/* Fails unless ms lies between low and low + SLACK_MS */
+static int check(const char* what, unsigned long ms, unsigned long low)
+{
+    printf("%s: %u ms, expected %u ms\n", what, (unsigned)ms, (unsigned)low);
+    if (ms < low || ms > low + SLACK_MS)
+    {
+        printf("FAILED: %s\n", what);
+        return 1;
+    }
+    return 0;
+}
+
+int main()
+{
+    printf("RUNNING SLEEP TEST\n");
+
+    unsigned long cycles_per_ms = calibrate();
+    int failed = 0;
+
+    /* Each sleep lasts at least as long as asked, and not much longer */
+    unsigned long worst = 0;
+    unsigned long shortest = (unsigned long)-1;
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        unsigned long start = __builtin_ia32_rdtsc();
+        usleep(SLEEP_US);
+        unsigned long ms = (__builtin_ia32_rdtsc() - start) / cycles_per_ms;
+        if (ms > worst)
+            worst = ms;
+        if (ms < shortest)
+            shortest = ms;
+    }
+    failed |= check("usleep shortest", shortest, SLEEP_US / 1000);
+    failed |= check("usleep longest", worst, SLEEP_US / 1000);
+
+    /* Nothing to wait for, poll only times out */
+    unsigned long start = __builtin_ia32_rdtsc();
+    int ready = poll(0, 0, POLL_MS);
+    failed |= check("poll timeout", (__builtin_ia32_rdtsc() - start) / cycles_per_ms, POLL_MS);
+    if (ready != 0)
+    {
+        printf("FAILED: poll returned %d\n", ready);
+        failed = 1;
+    }
+
+    /* The alarm ends a longer sleep, SIGALRM terminates the child */
+    start = __builtin_ia32_rdtsc();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        alarm(1);
+        sleep(10);
+        return 0;
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    failed |= check("alarm", (__builtin_ia32_rdtsc() - start) / cycles_per_ms, 1000);
+    if (status != SIGALRM)
+    {
+        printf("FAILED: child exited with %d\n", status);
+        failed = 1;
+    }
+
+    if (failed)
+        return 1;
+    printf("PASSED\n");
+    return 0;
+}
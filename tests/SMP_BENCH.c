@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/times.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define MAX_WORKERS 8
+#define WORK 200000000UL
+
+/* Same CPU bound loop in every worker, the result keeps it from being optimized out */
+static unsigned long work()
+{
+    volatile unsigned long sum = 0;
+    for (unsigned long i = 0; i < WORK; i++)
+        sum += i ^ (sum >> 3);
+    return sum;
+}
+
+/* Runs count workers at once, returns the wall clock ticks until all of them exit */
+static clock_t run(int count)
+{
+    struct tms buffer;
+    pid_t pids[MAX_WORKERS];
+    clock_t start = times(&buffer);
+    for (int i = 0; i < count; i++)
+    {
+        pids[i] = fork();
+        if (pids[i] == 0)
+            exit(work() == 1);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        int status;
+        waitpid(pids[i], &status, 0);
+    }
+    return times(&buffer) - start;
+}
+
+int main()
+{
+    printf("RUNNING SMP BENCHMARK\n");
+
+    /* Throughput of n workers against one, in percent; n CPUs should give n * 100 */
+    clock_t single = run(1);
+    if (single == 0)
+        single = 1;
+    printf("workers 1: %u ticks\n", (unsigned)single);
+    for (int count = 2; count <= MAX_WORKERS; count *= 2)
+    {
+        clock_t elapsed = run(count);
+        if (elapsed == 0)
+            elapsed = 1;
+        printf("workers %d: %u ticks, speedup %u%%\n", count, (unsigned)elapsed, (unsigned)(count * single * 100 / elapsed));
+    }
+
+    return 0;
+}